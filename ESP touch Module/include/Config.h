@@ -10,6 +10,11 @@
   #define MY_ROLE                 ESP_NOW_ROLE_IDLE  // This is reduntant for ESP32 and only applicable for ESP8266
   #define STATUS_LED              IN_USE // If Status LED is used or not, affects battery
   #define OTA                     IN_USE // If Status LED is used or not, affects battery
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (APP_ACK in the gateway), no need to listen for commands if it says none are waiting
+  #define CHANNEL_HUNT            IN_USE // find the gateway's channel by probing it instead of a ~2 sec WiFi scan, see espnowSender::hunt()
+  #define KNOWN_CHANNELS          {1, 6, 11} // channels the router (or the nodes of a mesh router) use, probed after the last known channel and its neighbours
+  #define RETRY_POLICY            RETRY_POLICY_BATTERY // few tries per wake, a touch not delivered goes out first on the next wake, see retryPolicy.h
+  #define PHASE_PROFILER          NOT_IN_USE // time the phases of the wake and send them to the gateway, see phaseProfiler.h
   #define DEVICE_NAME             "touch_sensor1" //max 15 characters without spaces
   uint8_t gatewayAddress[] =      GATEWAY_FF_AP_MAC; //comes from secrets.h
   #define WiFi_SSID               primary_ssid //from secrets.h
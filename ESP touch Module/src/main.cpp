@@ -1,11 +1,20 @@
 /*
- *
+ * Touch module, wakes up on a touch, sends the touched gpio to the gateway via espnow and goes back to deep sleep
+ * After sending it listens for a moment for commands from the gateway (see MAILBOX in the gateway), which sends them right after our frame :
+ * - OTA : restarts in OTA mode
+ * - CONFIG : "listen_ms" sets the time to listen for commands, kept in the EEPROM
+ * - TIME_SYNC : sets the clock
+ * Listening stops as soon as the gateway says no more commands are waiting (intvalue4 is 0), with APP_ACK it is skipped altogether
+ * if the gateway's ack says no command is waiting, the ack also sets the clock
+ * With PHASE_PROFILER the time spent in each phase of the wake is sent with the message, the send, ack and sleep phases with the next wake's
 */
 //Specify the sensor this is being compiled for in platform.ini, see Config.h for list of all devices this can be compiled for
 
 // ************ HASH DEFINES *******************
 #define EEPROM_SIZE 16 // number of bytes to be allocated to EEPROM
-#define MSG_WAIT_TIMEOUT 30 // time in ms to wait for receiving any incoming messages to this ESP , typically 10-40 ms
+#define MSG_WAIT_TIMEOUT 30 // default time in ms to wait for receiving any incoming messages to this ESP , typically 10-40 ms, the gateway can change it
+#define LISTEN_WINDOW_ADDR (sizeof(int) + 1) // EEPROM address of the listen window set by the gateway, after the OTA flag
+#define INBOX_SIZE 4 // max commands received in one wake up
 #define OTA_TIMEOUT 60 // time in seconds beyond which to come out of OTA mode
 #define VERSION "1.1.0"
 // ************ HASH DEFINES *******************
@@ -20,6 +29,7 @@
 #include "myutils.h"
 #include <EEPROM.h> // to store WiFi channel number to EEPROM
 #include <ArduinoOTA.h> 
+#include <sys/time.h> // settimeofday() for the time sync command
 #include "version.h" // this defines a variable compile_version which gives the complete version of the program
 
 // ************ GLOBAL OBJECTS/VARIABLES *******************
@@ -32,40 +42,45 @@ int gpio_pin = 100;
 volatile bool msgReceived = false; //flag to indicate if the ESP has received any message during its wake up cycle
 volatile bool ota_msg = false; // indicates if the esp has received a OTA message
 volatile bool ota_mode = false; // determines if the ESP should start in the OTA mode or ESPNOW mode
+espnow_message inbox[INBOX_SIZE]; // commands received from the gateway, written by OnDataRecv
+volatile uint8_t inbox_count = 0; // no of commands in the inbox
+uint8_t inbox_read = 0; // no of commands in the inbox already processed
+uint8_t listen_window = MSG_WAIT_TIMEOUT; // time in ms to listen for commands after sending, read from EEPROM
 unsigned long start_time = millis(); // keeps track of the time ESP started, can be changed in between though
 // ************ GLOBAL OBJECTS/VARIABLES *******************
 // need to include this file after ssid variable as I am using ssid inside espcontroller, not a good design but will sort this out later
 #include "espnowController.h" //defines all utility functions for sending espnow messages from a controller
+espnowSender sender; // sends myData and waits for its delivery, fed by the callbacks below
 
 // MAC Address , This should be the address of the softAP (and NOT WiFi MAC addr obtained by WiFi.macAddress()) if the Receiver uses both, WiFi & ESPNow
 // You can get the address via the command WiFi.softAPmacAddress() , usually it is one decimal no after WiFi MAC address
 
 /*
- * Callback when data is sent , It sets the bResultReady flag to true on successful delivery of message
- * The flag is set to false in the main loop where data is sent and then the code waits to see if it gets set to true, if not it retires to send
+ * Callback when data is sent , it hands the delivery status to the sender which is waiting for it in send(), if it failed it retries to send
  */
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
-  deliverySuccess = status;
   DPRINT("OnDataSent:Last Packet delivery status:\t");
   DPRINTLN(status == 0 ? "Success" : "Fail");
-  bResultReady = true;
+  sender.onSent(status);
 }
 
 /*
- * Callback called when a message is received , nothing to do here for now , just log message
+ * Callback called when a message is received , the command is kept in the inbox and processed in scan_for_messages()
  */
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  espnow_message msg;
-  memcpy(&msg, incomingData, sizeof(msg));
-  if(!ota_msg && !ota_mode) // dont receive any more messages if we are already in OTA mode
+  #if USING(APP_ACK)
+  if(sender.onReceive(incomingData,len))
+    return;
+  #endif
+  if(ota_msg || ota_mode || len < (int)ESPNOW_MESSAGE_MIN_LEN || inbox_count >= INBOX_SIZE) // dont receive any more messages if we are already in OTA mode
   {
-    msgReceived = true;
-    if(msg.msg_type == ESP_NOW_OTA)
-      ota_msg = true;
-    DPRINTF("Processing msg:%lu,%u,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.msg_type,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
+    DPRINTFLN("Ignoring msg of len:%d",len);
+    return;
   }
-  else
-    DPRINTF("Ignoring msg:%lu,%u,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
+  inbox[inbox_count] = espnow_message(); // a frame from an older gateway has no seq
+  memcpy(&inbox[inbox_count], incomingData, len < (int)sizeof(espnow_message) ? len : sizeof(espnow_message));
+  inbox_count = inbox_count + 1;
+  msgReceived = true;
 };
 
 void print_init_info()
@@ -141,6 +156,7 @@ void setup_OTA()
 }
 
 void setup() {
+  PROFILE_START();
   //Init Serial Monitor
   DBEGIN(115200);
   DPRINTLN();
@@ -150,8 +166,13 @@ void setup() {
   #endif
   
   print_init_info();
+  PROFILE_MARK(PHASE_HOLD);
   EEPROM.begin(EEPROM_SIZE);
   ota_mode = EEPROM.get(sizeof(int),ota_mode);
+  uint8_t window = EEPROM.read(LISTEN_WINDOW_ADDR);
+  if(window != 0 && window != 0xFF) // 0xFF is an erased EEPROM
+    listen_window = window;
+  PROFILE_MARK(PHASE_EEPROM);
   DPRINTFLN("Starting up in %s mode",ota_mode?"OTA":"ESPNOW");
   if(ota_mode)
   {
@@ -178,6 +199,7 @@ void setup() {
       peerInfo.encrypt = false;
     #endif
     refreshPeer(&peerInfo);
+    PROFILE_MARK(PHASE_PEER);
     
     touch_pad_t touchPin;
     touchPin = esp_sleep_get_touchpad_wakeup_status();
@@ -197,6 +219,7 @@ void setup() {
       default : {    DPRINTLN("Not a pin wakeup, probably starting up"); break;  }
     }
     DPRINTFLN("gpio_pin %u",gpio_pin);
+    PROFILE_MARK(PHASE_BOUNCE);
   }
 }
 
@@ -264,9 +287,10 @@ void send_message()
     strcpy(myData.chardata1,"");
     strcpy(myData.chardata2,"");
     myData.message_id = millis();//there is no use of message_id so using it to send the uptime
+    myData.seq = 0; // a new message, sender.send() gives it the next sequence no
       
     //int result = esp_now_send(gatewayAddress, (uint8_t *) &myData, sizeof(myData));
-    int result = sendESPnowMessage(&myData,gatewayAddress);
+    int result = sender.send(&myData,gatewayAddress);
     if (result == 0) {
       DPRINTLN("Delivered with success");}
     else {DPRINTFLN("Error sending/receipting the message, error code:%d",result);}
@@ -296,11 +320,45 @@ void set_led_off()
 }
 
 /*
-* Processes incoming messages, for now its only OTA msg type, In future can code for more events
-* For future events I will have to collect incoming messages in a queue and then process them
+* Processes the commands in the inbox, OTA is handled last as it restarts the ESP
+* Returns true if the gateway has no more commands waiting for us
 */
-void process_messages()
+bool process_messages()
 {
+  bool done = false;
+  msgReceived = false;
+  while(inbox_read < inbox_count)
+  {
+    espnow_message &msg = inbox[inbox_read++];
+    DPRINTF("Processing msg:%lu,%u,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.msg_type,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
+    if(strncmp(msg.device_name, DEVICE_NAME, sizeof(msg.device_name)) != 0)
+      continue; // not for us
+    done = msg.intvalue4 == 0;
+    switch(msg.msg_type)
+    {
+      case ESP_NOW_OTA:
+        ota_msg = true;
+        break;
+      case ESP_NOW_CONFIG:
+        if(strcmp(msg.chardata1, "listen_ms") == 0 && msg.intvalue1 > 0 && msg.intvalue1 < 0xFF)
+        {
+          listen_window = msg.intvalue1;
+          EEPROM.write(LISTEN_WINDOW_ADDR, listen_window);
+          EEPROM.commit();
+          DPRINTFLN("Listen window set to %u ms",listen_window);
+        }
+        else
+          DPRINTFLN("Invalid setting %s:%d",msg.chardata1,msg.intvalue1);
+        break;
+      case ESP_NOW_TIME_SYNC:
+      {
+        timeval now = {(time_t)msg.intvalue1, 0};
+        settimeofday(&now, NULL); // the RTC keeps it across deep sleep
+        DPRINTFLN("Time set to %d",msg.intvalue1);
+        break;
+      }
+    }
+  }
   if(ota_msg)
   {
     // write true in EEPROM and restart the ESP
@@ -311,8 +369,7 @@ void process_messages()
     DFLUSH();
     ESP.restart();
   }
-  msgReceived = false; //now that we've processed the message , clear the flag
-  // You can code for future events here
+  return done;
 }
 
 /*
@@ -320,15 +377,12 @@ void process_messages()
 */
 void scan_for_messages()
 {
-  // Wait for some time to see if we haev any service message for this ESP
-  for(byte i=0;i<MSG_WAIT_TIMEOUT;i++)
+  // Wait for some time to see if we haev any service message for this ESP, the gateway sends them right after our message
+  for(byte i=0;i<listen_window;i++)
   {
     delay(1);
-    if(msgReceived)
-    {
-      process_messages();
+    if(msgReceived && process_messages())
       break;
-    }
     yield();
   }
 }
@@ -349,13 +403,18 @@ void loop() {
   else 
   {
     send_message();
-    scan_for_messages();
-    if(!msgReceived) //no messages are received to process, turn off led and go to sleep
+    #if USING(APP_ACK)
+    if(sender.ackReceived() && sender.lastAck().time != 0)
     {
-      set_led_off();
-      go_to_sleep();
+      timeval now = {(time_t)sender.lastAck().time, 0};
+      settimeofday(&now, NULL);
     }
-    //else it will go back to the loop() and process OTA or other messages
+    if(!sender.ackReceived() || (sender.lastAck().flags & ESPNOW_ACK_PENDING)) // the gateway said if a command follows, dont listen if none does
+    #endif
+    scan_for_messages(); // restarts the ESP if an OTA message is received
+    set_led_off();
+    PROFILE_END(); // the listen window and the LED count as PHASE_SLEEP
+    go_to_sleep();
   }
 
 }
@@ -6,6 +6,7 @@
 
 // Define all your devices here and then pass the DEVICE in the build flags in platform.ini file
 #define GATEWAY_FF 2
+#define GATEWAY_GF 3
 
 #define RX
 
@@ -14,6 +15,13 @@
   #define SERIAL_DEBUG            IN_USE // Debug statements in use or not
   #define SECURITY                NOT_IN_USE // encryption of messages
   #define MOTION_SENSOR           IN_USE // if a motion sensor is connected to the ESP as an optional sensor
+  #define BINARY_PAYLOAD          NOT_IN_USE // publish frames in the compact binary format of espnowBinary.h on MQTT_BASE_TOPIC/<device>/bin instead of JSON on /state
+  #define COALESCE                NOT_IN_USE // when the gateway falls behind, keep only the latest queued frame of each device, see COALESCE_EXEMPT_DEVICES
+  #define SPOOL                   IN_USE // park frames on LittleFS while MQTT is down and replay them once it is back, needs a filesystem in the flash layout
+  #define GATEWAY_PAIR            NOT_IN_USE // run active-active with PEER_GATEWAY, each publishes the frames of its own senders and takes over the peer's if it doesnt
+  #define MAILBOX                 IN_USE // keep commands posted on MQTT_TOPIC/cmd/<device> and send them to the sensor right after its next frame
+  #define APP_ACK                 IN_USE // answer every frame with an ack carrying the channel, time, command pending flag and backoff, see espnowAck.h
+  #define PHASE_STATS             IN_USE // keep histograms of the wake phases the sensors with PHASE_PROFILER send, published on MQTT_TOPIC/phases
   //Turn features ON and OFF below end
 
   #define MY_ROLE                 ESP_NOW_ROLE_SLAVE              // set the role of this device: CONTROLLER, SLAVE, COMBO
@@ -28,7 +36,43 @@
   #define DEVICE_MAC              GATEWAY_FF_AP_MAC // from secrets.h . You should preferably define a custom MAC instead of actual device MAC so that the MAC doesnt change with device
   #define PIR_PIN                 3 // GPIO pin no where PIR sensor is connected
   #define MOTION_SENSOR_NAME      "family_room_motion"
+  // devices whose frames are time critical (door/motion events) and are published ahead of other telemetry
+  #define PRIORITY_DEVICES        {"main_door", "terrace_door", "balcony_door", "test_door"}
+  // devices whose every frame matters (events, counters), never coalesced. Door and touch sensors send state so they can be coalesced
+  #define COALESCE_EXEMPT_DEVICES {""} // none yet (empty names are ignored), add names eg. {"doorbell", "water_meter"}
   #define MOTION_ON_DURATION      15 // time in seconds for which motion value should remain ON after detecting motion
+  #define GATEWAY_INDEX           0 // 0 or 1, the peer must have the other one. Decides which senders this gateway owns
+  #define PEER_GATEWAY            "gateway_gf" // DEVICE_NAME of the other gateway of the pair
+#elif (DEVICE == GATEWAY_GF)
+  //Turn features ON and OFF below start
+  #define SERIAL_DEBUG            IN_USE // Debug statements in use or not
+  #define SECURITY                NOT_IN_USE // encryption of messages
+  #define MOTION_SENSOR           NOT_IN_USE // if a motion sensor is connected to the ESP as an optional sensor
+  #define BINARY_PAYLOAD          NOT_IN_USE // publish frames in the compact binary format of espnowBinary.h on MQTT_BASE_TOPIC/<device>/bin instead of JSON on /state
+  #define COALESCE                NOT_IN_USE // when the gateway falls behind, keep only the latest queued frame of each device, see COALESCE_EXEMPT_DEVICES
+  #define SPOOL                   IN_USE // park frames on LittleFS while MQTT is down and replay them once it is back, needs a filesystem in the flash layout
+  #define GATEWAY_PAIR            NOT_IN_USE // run active-active with PEER_GATEWAY, each publishes the frames of its own senders and takes over the peer's if it doesnt
+  #define MAILBOX                 IN_USE // keep commands posted on MQTT_TOPIC/cmd/<device> and send them to the sensor right after its next frame
+  #define APP_ACK                 IN_USE // answer every frame with an ack carrying the channel, time, command pending flag and backoff, see espnowAck.h
+  #define PHASE_STATS             IN_USE // keep histograms of the wake phases the sensors with PHASE_PROFILER send, published on MQTT_TOPIC/phases
+  //Turn features ON and OFF below end
+
+  #define MY_ROLE                 ESP_NOW_ROLE_SLAVE              // set the role of this device: CONTROLLER, SLAVE, COMBO
+  #define RECEIVER_ROLE           ESP_NOW_ROLE_CONTROLLER              // set the role of the receiver
+  #define DEVICE_NAME             "gateway_gf" //no spaces as this is used in topic names too
+  #define MQTT_TOPIC              "home/espnow/" DEVICE_NAME
+  #define MQTT_BASE_TOPIC          "home/espnow"
+  #define ESP_IP_ADDRESS          IP_gateway_gf //from secrets.h\static_ipaddress.h
+  #define WiFi_SSID               primary_ssid //from secrets.h. Same AP as gateway_ff, the senders reach both gateways only if they are on the same channel
+  #define WiFi_SSID_PSWD          primary_ssid_pswd //from secrets.h
+  #define STATUS_LED              2 //GPIO on which the status led is connected
+  #define DEVICE_MAC              GATEWAY_GF_AP_MAC // from secrets.h . You should preferably define a custom MAC instead of actual device MAC so that the MAC doesnt change with device
+  // devices whose frames are time critical (door/motion events) and are published ahead of other telemetry
+  #define PRIORITY_DEVICES        {"main_door", "terrace_door", "balcony_door", "test_door"}
+  // devices whose every frame matters (events, counters), never coalesced. Door and touch sensors send state so they can be coalesced
+  #define COALESCE_EXEMPT_DEVICES {""} // none yet (empty names are ignored), add names eg. {"doorbell", "water_meter"}
+  #define GATEWAY_INDEX           1 // 0 or 1, the peer must have the other one. Decides which senders this gateway owns
+  #define PEER_GATEWAY            "gateway_ff" // DEVICE_NAME of the other gateway of the pair
 #else
   #error "Device type not found. Have you passed DEVICE id in platform.ini as build flag. See Config.h for all DEVICES"
 #endif
@@ -0,0 +1,106 @@
+/*
+ * frameRing.h - single producer / single consumer ring of preallocated frame slots
+ * Used by the gateway to hand over espnow frames from the receive callback (producer) to loop() (consumer) without copying them around
+ * - The producer calls reserve() to get a free slot, writes the frame straight into it and then calls commit() to make it visible to the consumer
+ * - The consumer calls front() to get the oldest committed slot, uses it by reference and calls release() only once it is done with it
+ *   (eg. after a successful publish), until then front() keeps returning the same slot so a failed publish is simply retried
+ * - If reserve() finds the ring full the frame is counted as lost, nothing is overwritten
+ * - No locks and no heap, the head is only written by the producer and the tail only by the consumer. The slot count N must be a power of 2
+ *   so that the free running 32 bit indices wrap correctly
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+
+template <typename T, uint16_t N>
+class frameRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "frameRing size must be a power of 2");
+
+    public:
+    // ************ producer side *******************
+    /*
+     * returns a pointer to the next free slot or nullptr if the ring is full, the slot is not visible to the consumer until commit() is called
+     */
+    T* reserve()
+    {
+        if(_head - _tail >= N)
+        {
+            _lost++;
+            return nullptr;
+        }
+        return &_slots[_head & (N - 1)];
+    }
+
+    /*
+     * publishes the slot returned by the last reserve() to the consumer
+     */
+    void commit()
+    {
+        __sync_synchronize(); // the slot contents must be written out before the consumer can see the new head
+        _head = _head + 1;
+        uint32_t used = _head - _tail;
+        if(used > _high_water)
+            _high_water = used;
+    }
+
+    /*
+     * returns the position of the slot returned by the last reserve(), after commit() it is a handle to pass to pending()
+     */
+    uint32_t position() const { return _head; }
+
+    /*
+     * returns the committed slot at pos if it is still queued and is not the front slot, else nullptr. Lets the producer overwrite a queued frame
+     * with a newer one. The front slot is never returned as the consumer may be using it, for the other slots this relies on the consumer
+     * not being interrupted by the producer between release() and the next front(), which holds for the receive callback and loop() on the ESP8266
+     */
+    T* pending(uint32_t pos)
+    {
+        uint32_t tail = _tail;
+        if(pos == tail || (uint32_t)(pos - tail) >= (uint32_t)(_head - tail))
+            return nullptr;
+        return &_slots[pos & (N - 1)];
+    }
+
+    // ************ consumer side *******************
+    /*
+     * returns the oldest committed slot or nullptr if the ring is empty. The slot stays owned by the consumer until release() is called
+     */
+    T* front()
+    {
+        if(_tail == _head)
+            return nullptr;
+        __sync_synchronize(); // do not read the slot before seeing the head that covers it
+        return &_slots[_tail & (N - 1)];
+    }
+
+    /*
+     * hands the slot returned by front() back to the producer
+     */
+    void release()
+    {
+        if(_tail == _head)
+            return;
+        __sync_synchronize(); // finish using the slot before the producer can reuse it
+        _tail = _tail + 1;
+    }
+
+    // ************ stats *******************
+    uint16_t count() const { return _head - _tail; }
+    bool isEmpty() const { return _head == _tail; }
+    bool isFull() const { return (_head - _tail) >= N; }
+    uint16_t capacity() const { return N; }
+    uint32_t lost() const { return _lost; }
+    uint16_t highWater() const { return _high_water; }
+
+    private:
+    T _slots[N];
+    volatile uint32_t _head = 0; // written by the producer only
+    volatile uint32_t _tail = 0; // written by the consumer only
+    volatile uint32_t _lost = 0; // frames dropped because the ring was full, written by the producer only
+    volatile uint16_t _high_water = 0; // max no of slots ever in use, written by the producer only
+};
+
+#endif
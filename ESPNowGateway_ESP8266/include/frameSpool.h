@@ -0,0 +1,344 @@
+/*
+ * frameSpool.h - log structured store and forward spool of frames on flash, used by the gateway while MQTT is down
+ * Instead of dropping frames once the ingest ring is full, loop() moves them into the spool and replays them in order once MQTT is back
+ * - frames are buffered in RAM and appended to flash in batches of SPOOL_BATCH_BYTES (one flash sector) to limit flash wear.
+ *   A partial batch is written out after SPOOL_FLUSH_INTERVAL so little is lost if the ESP restarts. The batch buffer is on the heap only
+ *   while frames are being spooled, update() frees it once it is empty. If it cant be allocated frames are written to flash one at a time
+ * - the log is a set of segment files SPOOL_DIR/<n> written in increasing n, each up to SPOOL_SEGMENT_BYTES long
+ * - retention is capped at SPOOL_MAX_SEGMENTS segments, when a new segment is needed beyond that the oldest one is deleted and its frames counted as discarded
+ * - replay reads the oldest segment front to back and then the RAM batch, so frames come out in the order they went in.
+ *   A segment is deleted once fully replayed, if the ESP restarts in between, that segment is replayed again from the start
+ * - a power cut in the middle of a write leaves a partial frame at the end of the tail segment, it is skipped on replay. After a restart
+ *   new frames go to a new segment so they are never written after such a partial frame
+ * - front()/release() work like frameRing so the same drain code publishes from either
+ * - the frame size is kept in SPOOL_DIR/layout, segments left by a firmware with another frame layout cant be read back and are deleted by begin()
+ * The flash is reached through the storage class S, so the spool has no Arduino dependencies. S provides :
+ *   S::file open(const char *path, const char *mode) - mode "r", "w" or "a", the file has read(), write(), seek(), size(), close() and converts to bool as fs::File does
+ *   bool remove(const char *path), bool mkdir(const char *path)
+ *   list(const char *dir, f) - calls f(const char *name, size_t size) for each file in dir
+ * fsStorage.h adapts a fs::FS (LittleFS on the gateway) to it, the native tests use a file backed stand-in (test/shim/fileStorage.h)
+ */
+
+#ifndef FRAME_SPOOL_H
+#define FRAME_SPOOL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#ifndef SPOOL_DIR
+  #define SPOOL_DIR "/spool"
+#endif
+#ifndef SPOOL_BATCH_BYTES
+  #define SPOOL_BATCH_BYTES 4096 // RAM buffer appended to flash in one go, one flash sector
+#endif
+#ifndef SPOOL_SEGMENT_BYTES
+  #define SPOOL_SEGMENT_BYTES 8192 // max size of one segment file
+#endif
+#ifndef SPOOL_MAX_SEGMENTS
+  #define SPOOL_MAX_SEGMENTS 5 // retention cap, 5 x 8KB fits in the 64KB filesystem of an ESP01 1M with room for LittleFS metadata
+#endif
+#ifndef SPOOL_FLUSH_INTERVAL
+  #define SPOOL_FLUSH_INTERVAL 5000 // time in millisecs after which a partial batch is written to flash
+#endif
+#define SPOOL_PATH_LEN 24 // SPOOL_DIR "/" and a segment no
+
+template <typename T, typename S>
+class frameSpool
+{
+    static const uint16_t BATCH_FRAMES = SPOOL_BATCH_BYTES / sizeof(T);
+    static const uint16_t SEGMENT_FRAMES = SPOOL_SEGMENT_BYTES / sizeof(T);
+    static_assert(BATCH_FRAMES > 0 && SEGMENT_FRAMES >= BATCH_FRAMES, "spool batch/segment too small for a frame");
+
+    public:
+    frameSpool(S &storage) : _storage(storage) {}
+
+    ~frameSpool()
+    {
+        delete[] _batch;
+    }
+
+    /*
+     * finds the segments left over from before a restart so that they get replayed, call after the filesystem is mounted
+     * Returns false if the spool directory cant be written, the spool then discards what is appended to it
+     */
+    bool begin()
+    {
+        _storage.mkdir(SPOOL_DIR); // fails if it is already there
+        if(!checkLayout())
+            return false;
+        bool found = false;
+        _storage.list(SPOOL_DIR, [&](const char *name, size_t size)
+        {
+            if(name[0] < '0' || name[0] > '9') // the layout file
+                return;
+            uint32_t n = strtoul(name, nullptr, 10);
+            if(!found || n < _head_segment) _head_segment = n;
+            if(!found || n > _tail_segment) _tail_segment = n;
+            _stored += size / sizeof(T); // a partial frame at the end is not counted
+            found = true;
+        });
+        if(!found)
+            _head_segment = _tail_segment = 0;
+        // the tail may end in a partial frame if the power went during a write, it is not appended to
+        _tail_frames = found ? SEGMENT_FRAMES : 0;
+        _ready = true;
+        return true;
+    }
+
+    /*
+     * adds a frame at the end of the spool, it goes to flash when the batch is full. now is millis()
+     */
+    void append(const T &frame, uint32_t now)
+    {
+        if(!_ready)
+        {
+            _discarded++;
+            return;
+        }
+        _spooled++;
+        if(_batch == nullptr)
+            _batch = new (std::nothrow) T[BATCH_FRAMES];
+        if(_batch == nullptr)
+        {
+            write(&frame, 1); // no RAM to spare for the batch, more flash wear but the frame is kept
+            return;
+        }
+        if(_batch_count == BATCH_FRAMES)
+            flush();
+        if(_batch_count == 0)
+            _batch_started = now;
+        _batch[_batch_count++] = frame;
+    }
+
+    /*
+     * writes out a partial batch once it is older than SPOOL_FLUSH_INTERVAL and frees the batch buffer once it is empty, to be called from loop()
+     */
+    void update(uint32_t now)
+    {
+        if(_batch_count > _batch_read && (now - _batch_started) > SPOOL_FLUSH_INTERVAL)
+            flush();
+        if(_batch != nullptr && _batch_count == 0)
+        {
+            delete[] _batch;
+            _batch = nullptr;
+        }
+    }
+
+    /*
+     * returns the oldest spooled frame or nullptr if the spool is empty, it stays the same until release() is called
+     */
+    T* front()
+    {
+        if(_have_front)
+            return &_front;
+        if(_stored > 0)
+        {
+            if(!_reader)
+            {
+                char path[SPOOL_PATH_LEN];
+                _reader = _storage.open(segmentPath(_head_segment, path), "r");
+                if(_reader) _reader.seek(_read_offset * sizeof(T));
+            }
+            if(_reader && _reader.read((uint8_t*)&_front, sizeof(T)) == sizeof(T))
+            {
+                _have_front = true;
+                return &_front;
+            }
+            // unreadable or truncated segment, skip what is left of it
+            discardHeadSegment();
+            return front();
+        }
+        if(_batch_read < _batch_count)
+        {
+            _front = _batch[_batch_read];
+            _have_front = true;
+            return &_front;
+        }
+        return nullptr;
+    }
+
+    /*
+     * drops the frame returned by front(), deleting its segment once the whole segment has been replayed
+     */
+    void release()
+    {
+        if(!_have_front)
+            return;
+        _have_front = false;
+        _replayed++;
+        if(_stored > 0)
+        {
+            _stored--;
+            _read_offset++;
+            if(_reader && _read_offset >= _reader.size() / sizeof(T)) // a partial frame after the last whole one is dropped with the segment
+            {
+                _reader.close();
+                dropHeadSegment();
+            }
+            return;
+        }
+        _batch_read++;
+        if(_batch_read == _batch_count)
+            _batch_read = _batch_count = 0;
+    }
+
+    bool isEmpty() const { return _stored == 0 && _batch_read == _batch_count; }
+    uint32_t count() const { return _stored + _batch_count - _batch_read; }
+    uint32_t spooled() const { return _spooled; }
+    uint32_t replayed() const { return _replayed; }
+    uint32_t discarded() const { return _discarded; }
+    bool batchAllocated() const { return _batch != nullptr; }
+
+    private:
+    /*
+     * deletes the segments if they were written with a frame size other than sizeof(T), and records sizeof(T) for the next start
+     * Returns false if the layout cant be recorded
+     */
+    bool checkLayout()
+    {
+        uint32_t size = 0;
+        typename S::file f = _storage.open(SPOOL_DIR "/layout", "r");
+        if(f)
+        {
+            f.read((uint8_t*)&size, sizeof(size));
+            f.close();
+        }
+        if(size == sizeof(T))
+            return true;
+        for(uint8_t i = 0; i <= SPOOL_MAX_SEGMENTS + 1; i++) // bounded in case a file cant be removed
+        {
+            char path[SPOOL_PATH_LEN] = "";
+            _storage.list(SPOOL_DIR, [&](const char *name, size_t file_size)
+            {
+                if(path[0] != '\0' || name[0] < '0' || name[0] > '9')
+                    return;
+                snprintf(path, sizeof(path), SPOOL_DIR "/%s", name);
+                _discarded += file_size / (size > 0 ? size : sizeof(T));
+            });
+            if(path[0] == '\0')
+                break;
+            _storage.remove(path);
+        }
+        size = sizeof(T);
+        f = _storage.open(SPOOL_DIR "/layout", "w");
+        if(!f)
+            return false;
+        bool written = f.write((const uint8_t*)&size, sizeof(size)) == sizeof(size);
+        f.close();
+        return written;
+    }
+
+    /*
+     * appends the unreplayed part of the RAM batch to flash
+     */
+    void flush()
+    {
+        uint16_t n = _batch_count - _batch_read;
+        if(n == 0)
+            return;
+        write(&_batch[_batch_read], n);
+        _batch_read = _batch_count = 0;
+    }
+
+    /*
+     * appends n frames to the tail segment, starting a new segment (and enforcing retention) when it is full
+     */
+    void write(const T *frames, uint16_t n)
+    {
+        if(_stored == 0 && !_reader)
+        {
+            // spool on flash is empty, start afresh so segment numbers dont grow forever
+            _head_segment = _tail_segment = 0;
+            _tail_frames = 0;
+            _read_offset = 0;
+        }
+        // start a new segment when the tail is full, or when it is being replayed so the reader never sees it grow
+        if(_tail_frames > 0 && (_tail_frames + n > SEGMENT_FRAMES || (_reader && _tail_segment == _head_segment)))
+        {
+            _tail_segment++;
+            _tail_frames = 0;
+            if(_tail_segment - _head_segment >= SPOOL_MAX_SEGMENTS)
+                discardHeadSegment(); // over the retention cap, the oldest frames go
+        }
+        char path[SPOOL_PATH_LEN];
+        // a new segment is written afresh, a file of that name can only be left over from before a power cut and holds no whole frame
+        typename S::file f = _storage.open(segmentPath(_tail_segment, path), _tail_frames == 0 ? "w" : "a");
+        size_t written = f ? f.write((const uint8_t*)frames, n * sizeof(T)) : 0;
+        if(f) f.close();
+        uint16_t whole = written / sizeof(T);
+        _discarded += n - whole;
+        _stored += whole;
+        _tail_frames += whole;
+        if(written % sizeof(T) != 0)
+            _tail_frames = SEGMENT_FRAMES; // a partial frame was written, what follows must not be appended after it
+    }
+
+    /*
+     * deletes the head segment without replaying the rest of it, those frames are counted as discarded
+     */
+    void discardHeadSegment()
+    {
+        if(_reader) _reader.close();
+        uint32_t frames = segmentFrames(_head_segment);
+        uint32_t lost = frames > _read_offset ? frames - _read_offset : 0;
+        if(lost > _stored) lost = _stored;
+        _discarded += lost;
+        _stored -= lost;
+        _have_front = false; // a frame held in front() came from this segment
+        dropHeadSegment();
+    }
+
+    void dropHeadSegment()
+    {
+        char path[SPOOL_PATH_LEN];
+        _storage.remove(segmentPath(_head_segment, path));
+        _read_offset = 0;
+        if(_head_segment == _tail_segment)
+        {
+            _head_segment = _tail_segment = 0;
+            _tail_frames = 0;
+            _stored = 0;
+        }
+        else
+            _head_segment++;
+    }
+
+    uint32_t segmentFrames(uint32_t segment)
+    {
+        char path[SPOOL_PATH_LEN];
+        typename S::file f = _storage.open(segmentPath(segment, path), "r");
+        if(!f)
+            return 0;
+        uint32_t frames = f.size() / sizeof(T);
+        f.close();
+        return frames;
+    }
+
+    static const char* segmentPath(uint32_t segment, char (&path)[SPOOL_PATH_LEN])
+    {
+        snprintf(path, sizeof(path), SPOOL_DIR "/%lu", (unsigned long)segment);
+        return path;
+    }
+
+    S &_storage;
+    typename S::file _reader; // open on the head segment while replaying
+    bool _ready = false;
+    T *_batch = nullptr; // frames not yet on flash, BATCH_FRAMES of them, allocated while spooling
+    uint16_t _batch_count = 0;
+    uint16_t _batch_read = 0; // frames of the batch already replayed straight from RAM
+    uint32_t _batch_started = 0;
+    T _front; // copy of the frame being replayed
+    bool _have_front = false;
+    uint32_t _head_segment = 0; // oldest segment, being replayed
+    uint32_t _tail_segment = 0; // newest segment, being appended to
+    uint32_t _tail_frames = 0; // frames in the tail segment
+    uint32_t _read_offset = 0; // frames of the head segment already replayed
+    uint32_t _stored = 0; // frames on flash not yet replayed
+    uint32_t _spooled = 0;
+    uint32_t _replayed = 0;
+    uint32_t _discarded = 0;
+};
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * fsStorage.h - adapts a fs::FS (LittleFS, SPIFFS) to the storage interface frameSpool.h writes its segments through
+ */
+
+#ifndef FS_STORAGE_H
+#define FS_STORAGE_H
+
+#include <FS.h>
+
+class fsStorage
+{
+    public:
+    typedef fs::File file;
+
+    fsStorage(fs::FS &fs) : _fs(fs) {}
+
+    file open(const char *path, const char *mode) { return _fs.open(path, mode); }
+    bool remove(const char *path) { return _fs.remove(path); }
+    bool mkdir(const char *path) { return _fs.mkdir(path); }
+
+    /*
+     * calls f(name, size) for each file in the directory path
+     */
+    template <typename F>
+    void list(const char *path, F f)
+    {
+        fs::Dir dir = _fs.openDir(path);
+        while(dir.next())
+            f(dir.fileName().c_str(), dir.fileSize());
+    }
+
+    private:
+    fs::FS &_fs;
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * holdTable.h - fixed size table of frames held back for a while, used by a gateway of a pair for the frames its peer is expected to publish
+ * A held frame either gets removed (the peer confirmed it) or is released once it has been held longer than the hold time
+ * Not thread safe, it is used from loop() only
+ */
+
+#ifndef HOLD_TABLE_H
+#define HOLD_TABLE_H
+
+#include <stdint.h>
+
+template <typename T, uint8_t N>
+class holdTable
+{
+    public:
+    /*
+     * holds frame from now on, returns false if the table is full
+     */
+    bool add(const T &frame, uint32_t now)
+    {
+        for(uint8_t i = 0; i < N; i++)
+        {
+            if(!_used[i])
+            {
+                _frames[i] = frame;
+                _since[i] = now;
+                _used[i] = true;
+                _count++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * removes the first held frame for which match(frame) returns true, returns false if there was none
+     */
+    template <typename P>
+    bool remove(P match)
+    {
+        for(uint8_t i = 0; i < N; i++)
+        {
+            if(_used[i] && match(_frames[i]))
+            {
+                _used[i] = false;
+                _count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * calls release(frame) for the frames held longer than hold_time (all of them if hold_time is 0), oldest first
+     * a frame is dropped from the table only if release returns true, else it is offered again in the next call
+     * Returns the no of frames released
+     */
+    template <typename F>
+    uint8_t expire(uint32_t now, uint32_t hold_time, F release)
+    {
+        uint8_t released = 0;
+        while(_count > 0)
+        {
+            uint8_t oldest = N;
+            for(uint8_t i = 0; i < N; i++)
+                if(_used[i] && (oldest == N || (int32_t)(_since[i] - _since[oldest]) < 0))
+                    oldest = i;
+            if((hold_time != 0 && now - _since[oldest] < hold_time) || !release(_frames[oldest]))
+                break;
+            _used[oldest] = false;
+            _count--;
+            released++;
+        }
+        return released;
+    }
+
+    bool isFull() const { return _count == N; }
+    uint8_t count() const { return _count; }
+
+    private:
+    T _frames[N];
+    uint32_t _since[N] = {}; // millis() when each frame was added
+    bool _used[N] = {};
+    uint8_t _count = 0;
+};
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * jsonWriter.h - renders an espnow_message as JSON straight into a caller supplied buffer
+ * This replaces building a StaticJsonDocument and serializing it into an Arduino String for every frame. There is no heap use at all
+ * and the output is byte identical to what ArduinoJson 6 (with its default of storing floats as double) produces for the same document:
+ * - keys are written from precomputed fragments which also carry the separators, eg. ,"ival1":
+ * - integers are written with a small reverse digit loop
+ * - floats follow the ArduinoJson FloatParts algorithm (9 significant decimals, trailing zeros stripped, exponent beyond 1e7 / 1e-5)
+ *   with a fast path for whole numbers, which covers the zero fields most sensors send
+ * - strings escape the same characters as ArduinoJson ( " \ \b \f \n \r \t ). The char fields are bounded by their array size
+ *   so a sender which does not terminate them cannot make the gateway read past the frame
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "espnowMessage.h"
+
+// worst case length of a rendered espnow_message : 3 strings * (16 chars escaped to 32 + quotes) + 4 ints * 11 + 4 floats * 26 + keys ~ 330 bytes
+#define JSON_MSG_LEN 400
+
+class jsonWriter
+{
+    public:
+    jsonWriter(char *buffer, size_t size) : _buf(buffer), _size(size) {}
+
+    /*
+     * appends a string literal as is, the length is known at compile time
+     */
+    template <size_t L>
+    jsonWriter& raw(const char (&s)[L]) { return raw(s, L - 1); }
+
+    jsonWriter& raw(const char *s, size_t len)
+    {
+        if(_len + len >= _size)
+        {
+            _overflow = true;
+            return *this;
+        }
+        memcpy(_buf + _len, s, len);
+        _len += len;
+        return *this;
+    }
+
+    jsonWriter& raw(char c)
+    {
+        if(_len + 1 >= _size)
+        {
+            _overflow = true;
+            return *this;
+        }
+        _buf[_len++] = c;
+        return *this;
+    }
+
+    jsonWriter& uint(uint32_t value)
+    {
+        char digits[10];
+        char *p = digits + sizeof(digits);
+        do
+        {
+            *--p = char('0' + value % 10);
+            value /= 10;
+        } while(value);
+        return raw(p, digits + sizeof(digits) - p);
+    }
+
+    jsonWriter& integer(int32_t value)
+    {
+        if(value < 0)
+        {
+            raw('-');
+            return uint(uint32_t(0) - uint32_t(value));
+        }
+        return uint(uint32_t(value));
+    }
+
+    jsonWriter& number(float value)
+    {
+        // fast path : whole numbers print the same as an integer in ArduinoJson
+        if(value > -1e7f && value < 1e7f && value == (float)(int32_t)value)
+            return integer((int32_t)value);
+        return number((double)value);
+    }
+
+    jsonWriter& number(double value)
+    {
+        if(isnan(value) || isinf(value))
+            return raw("null");
+        if(value < 0.0)
+        {
+            raw('-');
+            value = -value;
+        }
+        // split into integral, decimal and exponent parts, same as ArduinoJson::FloatParts<double>
+        uint32_t max_decimal = 1000000000;
+        int8_t decimal_places = 9;
+        int16_t exponent = normalize(value);
+        uint32_t integral = uint32_t(value);
+        for(uint32_t tmp = integral; tmp >= 10; tmp /= 10)
+        {
+            max_decimal /= 10;
+            decimal_places--;
+        }
+        double remainder = (value - double(integral)) * double(max_decimal);
+        uint32_t decimal = uint32_t(remainder);
+        remainder = remainder - double(decimal);
+        decimal += uint32_t(remainder * 2); // round half up
+        if(decimal >= max_decimal)
+        {
+            decimal = 0;
+            integral++;
+            if(exponent && integral >= 10)
+            {
+                exponent++;
+                integral = 1;
+            }
+        }
+        while(decimal % 10 == 0 && decimal_places > 0)
+        {
+            decimal /= 10;
+            decimal_places--;
+        }
+
+        uint(integral);
+        if(decimal_places)
+        {
+            char digits[10];
+            char *p = digits + sizeof(digits);
+            while(decimal_places--)
+            {
+                *--p = char('0' + decimal % 10);
+                decimal /= 10;
+            }
+            raw('.');
+            raw(p, digits + sizeof(digits) - p);
+        }
+        if(exponent)
+        {
+            raw('e');
+            integer(exponent);
+        }
+        return *this;
+    }
+
+    /*
+     * appends a quoted and escaped string of at most max_len chars
+     */
+    jsonWriter& string(const char *s, size_t max_len)
+    {
+        raw('"');
+        for(size_t i = 0; i < max_len && s[i] != '\0'; i++)
+        {
+            char c = s[i];
+            switch(c)
+            {
+                case '"'  : raw("\\\""); break;
+                case '\\' : raw("\\\\"); break;
+                case '\b' : raw("\\b"); break;
+                case '\f' : raw("\\f"); break;
+                case '\n' : raw("\\n"); break;
+                case '\r' : raw("\\r"); break;
+                case '\t' : raw("\\t"); break;
+                default   : raw(c);
+            }
+        }
+        return raw('"');
+    }
+
+    /*
+     * terminates the output, returns its length or 0 if it did not fit in the buffer
+     */
+    size_t end()
+    {
+        if(_size == 0)
+            return 0;
+        _buf[_len < _size ? _len : _size - 1] = '\0';
+        return _overflow ? 0 : _len;
+    }
+
+    private:
+    /*
+     * brings value into [1,10) when it is outside [1e-5,1e7) and returns the power of 10 it was scaled by, same as ArduinoJson
+     */
+    static int16_t normalize(double &value)
+    {
+        static const double positive[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+        static const double negative[] = {1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256};
+        static const double negative_plus_one[] = {1e0, 1e-1, 1e-3, 1e-7, 1e-15, 1e-31, 1e-63, 1e-127, 1e-255};
+        int16_t powers_of_10 = 0;
+        int8_t index = 8;
+        int bit = 1 << index;
+        if(value >= 1e7)
+        {
+            for(; index >= 0; index--)
+            {
+                if(value >= positive[index])
+                {
+                    value *= negative[index];
+                    powers_of_10 = int16_t(powers_of_10 + bit);
+                }
+                bit >>= 1;
+            }
+        }
+        if(value > 0 && value <= 1e-5)
+        {
+            for(; index >= 0; index--)
+            {
+                if(value < negative_plus_one[index])
+                {
+                    value *= positive[index];
+                    powers_of_10 = int16_t(powers_of_10 - bit);
+                }
+                bit >>= 1;
+            }
+        }
+        return powers_of_10;
+    }
+
+    char *_buf;
+    size_t _size;
+    size_t _len = 0;
+    bool _overflow = false;
+};
+
+/*
+ * renders msg as JSON into buffer, same keys and order as the gateway has always published
+ * returns the length of the JSON or 0 if the buffer is too small
+ */
+inline size_t serializeMessage(const espnow_message &msg, char *buffer, size_t size)
+{
+    jsonWriter json(buffer, size);
+    json.raw("{\"id\":").uint(msg.message_id);
+    json.raw(",\"device\":").string(msg.device_name, sizeof(msg.device_name));
+    json.raw(",\"ival1\":").integer(msg.intvalue1);
+    json.raw(",\"ival2\":").integer(msg.intvalue2);
+    json.raw(",\"ival3\":").integer(msg.intvalue3);
+    json.raw(",\"ival4\":").integer(msg.intvalue4);
+    json.raw(",\"fval1\":").number(msg.floatvalue1);
+    json.raw(",\"fval2\":").number(msg.floatvalue2);
+    json.raw(",\"fval3\":").number(msg.floatvalue3);
+    json.raw(",\"fval4\":").number(msg.floatvalue4);
+    json.raw(",\"char1\":").string(msg.chardata1, sizeof(msg.chardata1));
+    json.raw(",\"char2\":").string(msg.chardata2, sizeof(msg.chardata2));
+    json.raw('}');
+    return json.end();
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * logHistogram.h - fixed memory histogram with one bucket per power of 2, used by the gateway for the latencies reported in the health message
+ * - bucket 0 counts the value 0, bucket b (1-32) counts values in [2^(b-1), 2^b - 1]
+ * - record() is a count leading zeros and an increment, no floats, no allocation, so it can be called per frame
+ * - percentile() returns the upper bound of the bucket holding the percentile (capped at the max seen), ie. it is accurate to within a factor of 2
+ */
+
+#ifndef LOG_HISTOGRAM_H
+#define LOG_HISTOGRAM_H
+
+#include <stdint.h>
+
+class logHistogram
+{
+    public:
+    static const uint8_t BUCKETS = 33;
+
+    void record(uint32_t value)
+    {
+        uint8_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+        _counts[bucket]++;
+        _total++;
+        if(value > _max)
+            _max = value;
+    }
+
+    /*
+     * returns the value below which pct percent of the recorded values fall, 0 if nothing was recorded
+     */
+    uint32_t percentile(uint8_t pct) const
+    {
+        if(_total == 0)
+            return 0;
+        uint32_t rank = (uint32_t)(((uint64_t)_total * pct + 99) / 100); // no of values at or below the percentile, rounded up
+        uint32_t seen = 0;
+        for(uint8_t b = 0; b < BUCKETS; b++)
+        {
+            seen += _counts[b];
+            if(seen >= rank)
+            {
+                uint32_t upper = b == 0 ? 0 : (b == 32 ? 0xFFFFFFFFu : (1u << b) - 1);
+                return upper < _max ? upper : _max;
+            }
+        }
+        return _max;
+    }
+
+    uint32_t max() const { return _max; }
+    uint32_t count() const { return _total; }
+
+    void reset()
+    {
+        for(uint8_t b = 0; b < BUCKETS; b++)
+            _counts[b] = 0;
+        _total = 0;
+        _max = 0;
+    }
+
+    private:
+    uint32_t _counts[BUCKETS] = {};
+    uint32_t _total = 0;
+    uint32_t _max = 0;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * mailbox.h - fixed size store of the commands waiting to be sent down to the sensors, keyed by device name
+ * A sleepy sensor only listens for a few millisecs after it sends a frame, so the gateway keeps its commands here and sends them
+ * right after it receives that sensor's next frame
+ * - post() queues a command, commands of a device are handed out oldest first by next()
+ * - a command stays in the mailbox until remove() (delivered or given up) or expire() (too old)
+ * Not thread safe. On the ESP8266 it is used from the MQTT and espnow callbacks and loop(), which do not preempt each other
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <string.h>
+#include "espnowMessage.h"
+
+typedef struct mail_entry
+{
+    espnow_message msg; // command as sent, msg.device_name is the device it is for
+    uint32_t posted = 0; // millis() when it was posted
+    uint32_t seq = 0; // order of posting, oldest first
+    uint8_t attempts = 0; // no of failed sends
+    bool used = false;
+}mail_entry;
+
+template <uint8_t N>
+class mailbox
+{
+    public:
+    /*
+     * queues a command for msg.device_name, returns nullptr if the mailbox is full
+     */
+    mail_entry* post(const espnow_message &msg, uint32_t now)
+    {
+        for(uint8_t i = 0; i < N; i++)
+        {
+            mail_entry &e = _entries[i];
+            if(!e.used)
+            {
+                e.msg = msg;
+                e.posted = now;
+                e.seq = _seq++;
+                e.attempts = 0;
+                e.used = true;
+                _count++;
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+     * returns the oldest command for the device or nullptr if it has none. device_name need not be null terminated
+     */
+    mail_entry* next(const char device_name[16])
+    {
+        mail_entry *oldest = nullptr;
+        for(uint8_t i = 0; i < N; i++)
+        {
+            mail_entry &e = _entries[i];
+            if(e.used && strncmp(e.msg.device_name, device_name, sizeof(e.msg.device_name)) == 0 &&
+                (oldest == nullptr || (int32_t)(e.seq - oldest->seq) < 0))
+                oldest = &e;
+        }
+        return oldest;
+    }
+
+    /*
+     * returns the no of commands waiting for the device
+     */
+    uint8_t pending(const char device_name[16]) const
+    {
+        uint8_t n = 0;
+        for(uint8_t i = 0; i < N; i++)
+            if(_entries[i].used && strncmp(_entries[i].msg.device_name, device_name, sizeof(_entries[i].msg.device_name)) == 0)
+                n++;
+        return n;
+    }
+
+    void remove(mail_entry *e)
+    {
+        if(e == nullptr || !e->used)
+            return;
+        e->used = false;
+        _count--;
+    }
+
+    /*
+     * removes the commands posted more than ttl millisecs ago, calling expired(entry) for each before it goes
+     * Returns the no of commands removed
+     */
+    template <typename F>
+    uint8_t expire(uint32_t now, uint32_t ttl, F expired)
+    {
+        uint8_t removed = 0;
+        for(uint8_t i = 0; i < N; i++)
+        {
+            mail_entry &e = _entries[i];
+            if(e.used && now - e.posted > ttl)
+            {
+                expired(e);
+                remove(&e);
+                removed++;
+            }
+        }
+        return removed;
+    }
+
+    uint8_t count() const { return _count; }
+    uint8_t capacity() const { return N; }
+
+    private:
+    mail_entry _entries[N];
+    uint32_t _seq = 0;
+    uint8_t _count = 0;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * phaseTable.h - per device histograms of the wake phases the battery sensors report (see ../include/phaseProfiler.h), shows where a
+ * sensor's awake time (and battery) goes : EEPROM, channel, send retries, waiting for the ack...
+ * - a table of PHASE_DEVICES devices keyed by MAC, when it is full the least recently heard one is replaced
+ * - per device and phase a histogram with one bucket per power of 2 of PHASE_UNIT_US units, like logHistogram.h but with 16 bit counts
+ *   so a device takes ~350 bytes. Bucket 0 counts 0 (under PHASE_UNIT_US), bucket b counts [2^(b-1), 2^b - 1] units, the last one all above
+ * - sensors wake a few times an hour, so the histograms are not reset per interval. Once a count would overflow all counts of the phase are halved,
+ *   older wakes then weigh less
+ * It is updated from the espnow receive callback and read from loop(), the same as senderTable.h
+ */
+
+#ifndef PHASE_TABLE_H
+#define PHASE_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "phaseProfiler.h"
+
+#ifndef PHASE_DEVICES
+  #define PHASE_DEVICES 8 // no of devices whose phases are kept
+#endif
+#define PHASE_BUCKETS 15 // the last bucket holds 2^13 units (~0.8 sec) and above
+
+typedef struct phase_histogram
+{
+    uint16_t counts[PHASE_BUCKETS];
+    uint16_t max; // in PHASE_UNIT_US
+}phase_histogram;
+
+typedef struct phase_device
+{
+    uint8_t mac[6];
+    char device_name[16]; // name from the last frame, not necessarily null terminated
+    uint32_t last_seen = 0; // millis() of the last record, 0 marks a free entry
+    uint32_t records = 0; // no of records received
+    phase_histogram phases[PHASE_COUNT];
+}phase_device;
+
+template <uint8_t N>
+class phaseTable
+{
+    public:
+    /*
+     * adds the phases of one wake of the device, phases not measured are left out
+     */
+    void record(const uint8_t mac[6], const char device_name[16], const phase_record &record, uint32_t now)
+    {
+        phase_device &d = lookup(mac, now);
+        memcpy(d.device_name, device_name, sizeof(d.device_name));
+        d.last_seen = now | 1;
+        d.records++;
+        for(uint8_t p = 0; p < PHASE_COUNT; p++)
+        {
+            uint16_t units = record.units[p];
+            if(units == PHASE_NOT_MEASURED)
+                continue;
+            phase_histogram &h = d.phases[p];
+            uint8_t bucket = units == 0 ? 0 : 32 - __builtin_clz(units);
+            if(bucket >= PHASE_BUCKETS)
+                bucket = PHASE_BUCKETS - 1;
+            if(h.counts[bucket] == 0xFFFF)
+                for(uint8_t b = 0; b < PHASE_BUCKETS; b++)
+                    h.counts[b] = (h.counts[b] + 1) / 2;
+            h.counts[bucket]++;
+            if(units > h.max)
+                h.max = units;
+        }
+    }
+
+    /*
+     * returns the no of samples of the phase, as weighed after halving
+     */
+    static uint32_t count(const phase_histogram &h)
+    {
+        uint32_t total = 0;
+        for(uint8_t b = 0; b < PHASE_BUCKETS; b++)
+            total += h.counts[b];
+        return total;
+    }
+
+    /*
+     * returns the value in PHASE_UNIT_US below which pct percent of the samples fall : the upper bound of its bucket capped at the max, 0 if none
+     */
+    static uint16_t percentile(const phase_histogram &h, uint8_t pct)
+    {
+        uint32_t total = count(h);
+        if(total == 0)
+            return 0;
+        uint32_t rank = (total * pct + 99) / 100;
+        uint32_t seen = 0;
+        for(uint8_t b = 0; b < PHASE_BUCKETS - 1; b++)
+        {
+            seen += h.counts[b];
+            if(seen >= rank)
+            {
+                uint16_t upper = b == 0 ? 0 : (uint16_t)((1u << b) - 1);
+                return upper < h.max ? upper : h.max;
+            }
+        }
+        return h.max;
+    }
+
+    bool isUsed(uint8_t i) const { return _devices[i].last_seen != 0; }
+    const phase_device& at(uint8_t i) const { return _devices[i]; }
+    uint8_t capacity() const { return N; }
+
+    private:
+    phase_device& lookup(const uint8_t mac[6], uint32_t now)
+    {
+        uint8_t victim = 0;
+        for(uint8_t i = 0; i < N; i++)
+        {
+            phase_device &d = _devices[i];
+            if(d.last_seen != 0 && memcmp(d.mac, mac, sizeof(d.mac)) == 0)
+                return d;
+            if(d.last_seen == 0 || (_devices[victim].last_seen != 0 && now - d.last_seen > now - _devices[victim].last_seen))
+                victim = i;
+        }
+        phase_device &d = _devices[victim];
+        memset(d.phases, 0, sizeof(d.phases));
+        memcpy(d.mac, mac, sizeof(d.mac));
+        d.records = 0;
+        return d;
+    }
+
+    phase_device _devices[N];
+};
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * priorityShare.h - picks the ring the gateway publishes its next frame from, the priority one or the normal one
+ * Priority frames go first, but after share priority frames in a row a normal frame waiting goes next, so normal traffic gets at least one
+ * publish in every share+1 while both rings have frames
+ * Not thread safe, it is used from loop() only
+ */
+
+#ifndef PRIORITY_SHARE_H
+#define PRIORITY_SHARE_H
+
+#include <stdint.h>
+
+class priorityShare
+{
+    public:
+    priorityShare(uint8_t share) : _share(share) {}
+
+    /*
+     * true if the next frame should come from the priority ring, given which rings have frames waiting
+     */
+    bool pickPriority(bool priority_waiting, bool normal_waiting) const
+    {
+        return priority_waiting && (!normal_waiting || _streak < _share);
+    }
+
+    /*
+     * counts a frame published from the priority ring if priority, else from the normal one
+     */
+    void published(bool priority)
+    {
+        if(!priority)
+            _streak = 0;
+        else if(_streak < _share) // stays there while the normal ring is empty
+            _streak++;
+    }
+
+    uint8_t streak() const { return _streak; }
+
+    private:
+    uint8_t _share;
+    uint8_t _streak = 0; // priority frames published since the last normal one
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * publishWindow.h - window of QoS1 publishes waiting for their PUBACK, lets the gateway keep several frames in flight instead of waiting a round trip per frame
+ * - frames are copied in from the ingest rings/spool and held in a window slot until the broker acknowledges them, only then is the slot released
+ * - slots form a ring in the order the frames came in, frames are sent oldest first and the window moves on past the oldest frame only once it is acknowledged
+ * - a frame not acknowledged within MQTT_ACK_TIMEOUT, or sent on a connection which has since dropped, is sent again with the dup flag and its original packet id
+ * acked() is called from the MQTT client's publish callback, which on the ESP8266 runs between passes of loop() and never in the middle of update()
+ */
+
+#ifndef PUBLISH_WINDOW_H
+#define PUBLISH_WINDOW_H
+
+#include <stdint.h>
+
+#ifndef MQTT_ACK_TIMEOUT
+  #define MQTT_ACK_TIMEOUT 5000 // time in millisecs to wait for a PUBACK before the frame is sent again
+#endif
+
+template <typename T, uint8_t N>
+class publishWindow
+{
+    static_assert(N > 0, "publishWindow needs at least one slot");
+
+    public:
+    /*
+     * copies the frame into the window, it goes out in the next update(). Returns false if the window is full
+     */
+    bool add(const T &frame)
+    {
+        if(isFull())
+            return false;
+        slot &s = _slots[(_tail + _count) % N];
+        s.frame = frame;
+        s.packet_id = 0;
+        s.state = SLOT_PENDING;
+        _count++;
+        if(_count > _high_water)
+            _high_water = _count;
+        return true;
+    }
+
+    /*
+     * marks the frame sent with packet_id as acknowledged
+     */
+    void acked(uint16_t packet_id)
+    {
+        for(uint8_t i = 0; i < N; i++)
+        {
+            if(_slots[i].state == SLOT_SENT && _slots[i].packet_id == packet_id)
+            {
+                _slots[i].state = SLOT_ACKED;
+                return;
+            }
+        }
+    }
+
+    /*
+     * releases acknowledged frames and sends the pending and timed out ones
+     * send(frame, dup, packet_id) publishes a frame and returns its packet id, 0 if it can't be sent now (not connected, TCP buffer full)
+     * or -1 if the frame can never be published, it is then dropped
+     * done(frame) is called for each frame released as acknowledged, before its slot is reused
+     * Returns the no of frames released as acknowledged
+     */
+    template <typename F, typename D>
+    uint8_t update(uint32_t now, F send, D done)
+    {
+        uint8_t released = 0;
+        while(_count > 0 && (_slots[_tail].state == SLOT_ACKED || _slots[_tail].state == SLOT_DROPPED))
+        {
+            if(_slots[_tail].state == SLOT_ACKED)
+            {
+                done(_slots[_tail].frame);
+                released++;
+            }
+            _slots[_tail].state = SLOT_FREE;
+            _tail = (_tail + 1) % N;
+            _count--;
+        }
+        _acked += released;
+
+        for(uint8_t i = 0; i < _count; i++)
+        {
+            slot &s = _slots[(_tail + i) % N];
+            bool timed_out = s.state == SLOT_SENT && (now - s.sent_at) > MQTT_ACK_TIMEOUT;
+            if(s.state != SLOT_PENDING && !timed_out)
+                continue;
+            bool dup = s.packet_id != 0;
+            int32_t packet_id = send(s.frame, dup, s.packet_id);
+            if(packet_id == 0)
+                break; // try again in the next call, keeping the order
+            if(packet_id < 0)
+            {
+                s.state = SLOT_DROPPED; // released along with the acknowledged ones so the window keeps moving
+                _dropped++;
+                continue;
+            }
+            if(dup)
+                _retransmits++;
+            s.packet_id = packet_id;
+            s.sent_at = now;
+            s.state = SLOT_SENT;
+        }
+        return released;
+    }
+
+    /*
+     * to be called when a new connection is up, frames sent on the previous one and not acknowledged are sent again
+     */
+    void requeue()
+    {
+        for(uint8_t i = 0; i < N; i++)
+            if(_slots[i].state == SLOT_SENT)
+                _slots[i].state = SLOT_PENDING;
+    }
+
+    bool isEmpty() const { return _count == 0; }
+    bool isFull() const { return _count == N; }
+    uint8_t count() const { return _count; }
+    uint8_t capacity() const { return N; }
+    uint8_t highWater() const { return _high_water; }
+    uint32_t acknowledged() const { return _acked; }
+    uint32_t retransmits() const { return _retransmits; }
+    uint32_t dropped() const { return _dropped; }
+
+    private:
+    enum slot_state : uint8_t
+    {
+        SLOT_FREE = 0,
+        SLOT_PENDING, // waiting to be sent, again if packet_id is set
+        SLOT_SENT, // waiting for the PUBACK
+        SLOT_ACKED,
+        SLOT_DROPPED // could not be published
+    };
+
+    struct slot
+    {
+        T frame;
+        uint16_t packet_id = 0;
+        uint32_t sent_at = 0; // millis() of the last send
+        volatile slot_state state = SLOT_FREE;
+    };
+
+    slot _slots[N];
+    uint8_t _tail = 0; // oldest frame
+    uint8_t _count = 0;
+    uint8_t _high_water = 0;
+    uint32_t _acked = 0;
+    uint32_t _retransmits = 0;
+    uint32_t _dropped = 0;
+};
+
+#endif
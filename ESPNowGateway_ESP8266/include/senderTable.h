@@ -0,0 +1,212 @@
+/*
+ * senderTable.h - fixed size table of the controllers (sensors) sending espnow messages to the gateway, keyed by their MAC address
+ * It is updated from the espnow receive callback so every operation is bounded : the MAC is hashed to a slot and at most
+ * SENDER_TABLE_PROBES slots are probed, when all of them belong to other senders the least recently heard one is replaced
+ * Duplicate suppression :
+ * - espnowSender::send() on a controller resends the same frame (same message_id) if the MAC layer ack is lost, even though the gateway may have received it
+ * - each sender keeps the last DEDUP_DEPTH message ids it sent, a frame whose id is among them and was seen within DEDUP_WINDOW millisecs is a duplicate
+ * Link statistics : recordFrame() keeps per sender counts of frames and bytes and an average interval between frames, so a sensor on a marginal link
+ * (frames missing, many retransmissions) shows up. The ESP8266 receive callback does not give the RSSI of a frame so it is not tracked
+ * Loss accounting : acceptSeq() follows the sequence no (espnow_message.seq) of each sender, a gap counts the frames skipped as lost and a frame
+ * arriving late within the last SEQ_WINDOW nos takes one back off. A frame whose no was already received or is older than that is a stale replay
+ * and is rejected. A sender whose nos restart (eg. its EEPROM was erased) would have everything rejected, so after SEQ_RESYNC stale frames in a row
+ * its numbering is taken afresh
+ */
+
+#ifndef SENDER_TABLE_H
+#define SENDER_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef SENDER_TABLE_PROBES
+  #define SENDER_TABLE_PROBES 4
+#endif
+#ifndef DEDUP_DEPTH
+  #define DEDUP_DEPTH 4 // no of recent message ids remembered per sender
+#endif
+#ifndef SEQ_RESYNC
+  #define SEQ_RESYNC 3 // no of stale frames in a row after which a sender's sequence nos are taken afresh
+#endif
+#define SEQ_WINDOW 32 // late frames are accepted within this many nos of the newest, one bit each in seq_window
+#ifndef DEDUP_WINDOW
+  #define DEDUP_WINDOW 5000 // time in millisecs within which a repeated message id is treated as a retransmission
+#endif
+
+typedef struct sender_entry
+{
+  uint8_t mac[6];
+  char device_name[16]; // name from the last frame, not necessarily null terminated
+  uint32_t last_seen = 0; // millis() when the last frame was received, 0 marks a free entry
+  uint32_t frames = 0; // no of frames received, duplicates excluded
+  uint32_t bytes = 0; // bytes in those frames
+  uint32_t last_frame = 0; // millis() of the last frame which was not a duplicate
+  uint32_t interval = 0; // moving average of the time between frames in millisecs, 0 until 2 frames are received
+  uint32_t duplicates = 0; // no of retransmitted frames dropped
+  uint32_t last_seq = 0; // highest sequence no received, 0 until a frame with one is received
+  uint32_t seq_window = 0; // bit i set if last_seq - i was received
+  uint32_t seq_frames = 0; // frames received with a sequence no
+  uint32_t lost = 0; // sequence nos never received
+  uint32_t replays = 0; // stale frames rejected
+  uint8_t stale_run = 0; // stale frames in a row
+  bool priority = false; // frames go to the priority ring, looked up from the device name
+  bool coalesce = true; // a newer frame may replace a queued one when the gateway is behind, looked up from the device name
+  bool queued = false; // queued_pos is set
+  uint32_t queued_pos = 0; // ring position of the last frame queued from this sender, see frameRing::pending()
+  uint32_t recent_ids[DEDUP_DEPTH]; // ring of the last message ids
+  uint32_t recent_time[DEDUP_DEPTH]; // millis() when each of the above was received
+  uint8_t recent_next = 0; // next position to write in the ring above
+  uint8_t recent_count = 0;
+}sender_entry;
+
+template <uint8_t N>
+class senderTable
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "senderTable size must be a power of 2");
+
+    public:
+    /*
+     * returns the entry for the mac, creating it (and evicting the least recently heard sender if needed) when it isnt in the table
+     */
+    sender_entry* lookup(const uint8_t mac[6], uint32_t now)
+    {
+        uint32_t hash = hashMac(mac);
+        uint8_t victim = hash & (N - 1);
+        for(uint8_t i = 0; i < SENDER_TABLE_PROBES && i < N; i++)
+        {
+            uint8_t slot = (hash + i) & (N - 1);
+            sender_entry &e = _entries[slot];
+            if(e.last_seen == 0)
+            {
+                victim = slot;
+                break;
+            }
+            if(memcmp(e.mac, mac, 6) == 0)
+            {
+                e.last_seen = now | 1;
+                return &e;
+            }
+            if((int32_t)(e.last_seen - _entries[victim].last_seen) < 0)
+                victim = slot;
+        }
+        sender_entry &e = _entries[victim];
+        e = sender_entry();
+        memcpy(e.mac, mac, 6);
+        e.last_seen = now | 1; // never 0 so the entry is not taken as free
+        return &e;
+    }
+
+    /*
+     * returns true if message_id was already received from this sender within DEDUP_WINDOW, else remembers it and returns false
+     */
+    bool isDuplicate(sender_entry *e, uint32_t message_id, uint32_t now)
+    {
+        for(uint8_t i = 0; i < e->recent_count; i++)
+        {
+            if(e->recent_ids[i] == message_id && (now - e->recent_time[i]) < DEDUP_WINDOW)
+            {
+                e->duplicates++;
+                _duplicates++;
+                return true;
+            }
+        }
+        e->recent_ids[e->recent_next] = message_id;
+        e->recent_time[e->recent_next] = now;
+        e->recent_next = (e->recent_next + 1) % DEDUP_DEPTH;
+        if(e->recent_count < DEDUP_DEPTH)
+            e->recent_count++;
+        return false;
+    }
+
+    /*
+     * returns false if the frame with sequence no seq is a stale replay, else accounts for it in the sender's loss counts
+     * seq 0 comes from a sender without sequence nos and is always accepted
+     */
+    bool acceptSeq(sender_entry *e, uint32_t seq)
+    {
+        if(seq == 0)
+            return true;
+        if(e->seq_frames == 0 || e->stale_run >= SEQ_RESYNC)
+        {
+            e->last_seq = seq;
+            e->seq_window = 0xFFFFFFFF; // nos before the first one are not ours to count, late ones among them are stale
+            e->stale_run = 0;
+            e->seq_frames++;
+            return true;
+        }
+        if((int32_t)(seq - e->last_seq) > 0)
+        {
+            uint32_t gap = seq - e->last_seq;
+            e->lost += gap - 1;
+            e->seq_window = gap < SEQ_WINDOW ? (e->seq_window << gap) | 1 : 1;
+            e->last_seq = seq;
+        }
+        else
+        {
+            uint32_t age = e->last_seq - seq;
+            if(age >= SEQ_WINDOW || (e->seq_window & (1UL << age)))
+            {
+                e->replays++;
+                e->stale_run++;
+                _replays++;
+                return false;
+            }
+            e->seq_window |= 1UL << age; // late, it was counted lost when the gap opened
+            if(e->lost > 0)
+                e->lost--;
+        }
+        e->stale_run = 0;
+        e->seq_frames++;
+        return true;
+    }
+
+    /*
+     * returns the share of the sender's frames which were lost on the way, in tenths of a percent
+     */
+    uint16_t lossPermille(const sender_entry &e) const
+    {
+        uint32_t total = e.seq_frames + e.lost;
+        return total == 0 ? 0 : (uint16_t)((uint64_t)e.lost * 1000 / total);
+    }
+
+    /*
+     * counts a frame (which isnt a duplicate) of len bytes received from this sender at now
+     * the interval average is an exponential moving average with weight 1/8 for the latest interval, integer only
+     */
+    void recordFrame(sender_entry *e, uint8_t len, uint32_t now)
+    {
+        if(e->frames > 0)
+        {
+            uint32_t interval = now - e->last_frame;
+            if(e->interval == 0)
+                e->interval = interval;
+            else
+                e->interval = e->interval - (e->interval >> 3) + (interval >> 3);
+        }
+        e->last_frame = now;
+        e->frames++;
+        e->bytes += len;
+    }
+
+    uint8_t capacity() const { return N; }
+    sender_entry& at(uint8_t i) { return _entries[i]; }
+    bool isUsed(uint8_t i) const { return _entries[i].last_seen != 0; }
+    uint32_t duplicates() const { return _duplicates; }
+    uint32_t replays() const { return _replays; }
+
+    private:
+    static uint32_t hashMac(const uint8_t mac[6])
+    {
+        // the last 3 bytes are device specific, the first 3 are the vendor and mostly the same across the fleet
+        uint32_t hash = ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+        hash ^= hash >> 7;
+        hash *= 0x9E3779B1u;
+        return hash >> 16;
+    }
+
+    sender_entry _entries[N];
+    uint32_t _duplicates = 0;
+    uint32_t _replays = 0;
+};
+
+#endif
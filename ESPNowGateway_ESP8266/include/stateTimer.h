@@ -0,0 +1,45 @@
+/*
+ * stateTimer.h - keeps the current state of a state machine with N states along with the total time spent and the no of entries into each state
+ * Used by the gateway for its WiFi/MQTT connection so the time spent waiting on each can be reported in the health message
+ * Times are in millisecs and wrap after ~49 days like millis()
+ */
+
+#ifndef STATE_TIMER_H
+#define STATE_TIMER_H
+
+#include <stdint.h>
+
+template <uint8_t N>
+class stateTimer
+{
+    public:
+    stateTimer(uint8_t initial) : _state(initial) {}
+
+    /*
+     * moves to state at time now, does nothing if already in it
+     */
+    void set(uint8_t state, uint32_t now)
+    {
+        if(state == _state || state >= N)
+            return;
+        _total[_state] += now - _since;
+        _state = state;
+        _since = now;
+        _entries[state]++;
+    }
+
+    uint8_t get() const { return _state; }
+    // time spent in the current state since it was entered
+    uint32_t elapsed(uint32_t now) const { return now - _since; }
+    // total time spent in state including the ongoing stay
+    uint32_t timeIn(uint8_t state, uint32_t now) const { return _total[state] + (state == _state ? now - _since : 0); }
+    uint32_t entries(uint8_t state) const { return _entries[state]; }
+
+    private:
+    uint8_t _state;
+    uint32_t _since = 0; // millis() when the current state was entered
+    uint32_t _total[N] = {};
+    uint32_t _entries[N] = {};
+};
+
+#endif
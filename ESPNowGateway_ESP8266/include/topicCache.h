@@ -0,0 +1,118 @@
+/*
+ * topicCache.h - fixed capacity cache of MQTT topics per device, keyed by the device_name carried in espnow_message
+ * The topic of a device is built once, the first time the device is seen, and after that publishing only needs a lookup
+ * - open addressing on a FNV-1a hash of the name, probing at most TOPIC_CACHE_PROBES slots so a lookup is bounded
+ * - if all probed slots are taken by other devices the least recently used of them is evicted
+ * - hit, miss and eviction counts are kept so the capacity can be sized for the fleet from the health message
+ */
+
+#ifndef TOPIC_CACHE_H
+#define TOPIC_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TOPIC_NAME_LEN 16 // same as espnow_message::device_name, the name is not necessarily null terminated
+#define TOPIC_LEN 65 // accomodates 50 characters of main topic + 15 char of sub topic
+#ifndef TOPIC_CACHE_PROBES
+  #define TOPIC_CACHE_PROBES 4
+#endif
+
+template <uint8_t N>
+class topicCache
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "topicCache size must be a power of 2");
+
+    public:
+    /*
+     * base - topic under which all devices publish eg. home/espnow
+     * suffix - sub topic appended after the device name eg. /state
+     */
+    topicCache(const char *base, const char *suffix) : _base(base), _suffix(suffix) {}
+
+    /*
+     * returns the topic for the device, building and caching it on a miss. Returns nullptr only if the topic does not fit in TOPIC_LEN
+     */
+    const char* get(const char name[TOPIC_NAME_LEN])
+    {
+        uint8_t name_len = 0;
+        while(name_len < TOPIC_NAME_LEN && name[name_len] != '\0')
+            name_len++;
+        size_t base_len = strlen(_base);
+        size_t suffix_len = strlen(_suffix);
+        if(base_len + 1 + name_len + suffix_len >= TOPIC_LEN)
+            return nullptr; // before any slot is touched, freeing one would cut the probe sequence of the names after it
+        uint32_t hash = fnv1a(name, name_len);
+        _tick++;
+
+        uint8_t victim = hash & (N - 1);
+        for(uint8_t i = 0; i < TOPIC_CACHE_PROBES && i < N; i++)
+        {
+            uint8_t slot = (hash + i) & (N - 1);
+            entry &e = _entries[slot];
+            if(e.last_used == 0) // free slot, nothing further along the probe sequence can match
+            {
+                victim = slot;
+                break;
+            }
+            if(e.hash == hash && e.name_len == name_len && memcmp(e.name, name, name_len) == 0)
+            {
+                _hits++;
+                e.last_used = _tick;
+                return e.topic;
+            }
+            if(e.last_used < _entries[victim].last_used)
+                victim = slot;
+        }
+
+        _misses++;
+        entry &e = _entries[victim];
+        if(e.last_used != 0)
+            _evictions++;
+        char *p = e.topic;
+        memcpy(p, _base, base_len); p += base_len;
+        *p++ = '/';
+        memcpy(p, name, name_len); p += name_len;
+        memcpy(p, _suffix, suffix_len + 1);
+        memcpy(e.name, name, name_len);
+        e.name_len = name_len;
+        e.hash = hash;
+        e.last_used = _tick;
+        return e.topic;
+    }
+
+    uint32_t hits() const { return _hits; }
+    uint32_t misses() const { return _misses; }
+    uint32_t evictions() const { return _evictions; }
+
+    private:
+    struct entry
+    {
+        uint32_t hash = 0;
+        uint32_t last_used = 0; // 0 marks a free slot
+        uint8_t name_len = 0;
+        char name[TOPIC_NAME_LEN];
+        char topic[TOPIC_LEN];
+    };
+
+    static uint32_t fnv1a(const char *s, uint8_t len)
+    {
+        uint32_t hash = 2166136261u;
+        for(uint8_t i = 0; i < len; i++)
+        {
+            hash ^= (uint8_t)s[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    entry _entries[N];
+    const char *_base;
+    const char *_suffix;
+    uint32_t _tick = 0;
+    uint32_t _hits = 0;
+    uint32_t _misses = 0;
+    uint32_t _evictions = 0;
+};
+
+#endif
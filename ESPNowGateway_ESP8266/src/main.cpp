@@ -9,16 +9,42 @@
  * - Publishes initial health message on startup and then a health message at a set interval, stats like msg count, msg rate, queue length, free memory, uptime etc are posted
  * - Supports OTA
  * - DONE - Do not pop out the message form the queue in case posting to MQTT isnt successful
+ * - Frames are received straight into a lock free ring of preallocated slots and published from there by reference, a slot is released only after a successful publish
+ * - Renders frames to JSON with a dedicated writer into a preallocated buffer, no ArduinoJson document or String per frame
+ * - Optionally (BINARY_PAYLOAD) publishes frames in a compact versioned binary format on a parallel /bin topic, see espnowBinary.h for the layout
+ * - Caches the state topic of each device the first time it is seen, the gateway's own topics are built at compile time
+ * - Drops retransmitted frames (same sender MAC and message_id within DEDUP_WINDOW) before they are queued, counts are reported per device in the health message
+ * - Drains the queue in batches, each loop() publishes as many frames as fit in a budget of DRAIN_BUDGET_MSGS frames / DRAIN_BUDGET_US microsecs
+ * - Two priority classes : frames from the devices in PRIORITY_DEVICES (door/motion events) go to their own ring and are published first,
+ *   normal frames are still guaranteed one in every LOW_PRIORITY_SHARE+1 publishes
+ * - Optionally (COALESCE) once a ring is over COALESCE_THRESHOLD percent full, a new frame from a device replaces its frame still waiting in the ring
+ *   (same msg_type), so a backlog holds the latest state of each device instead of every intermediate one. Devices in COALESCE_EXEMPT_DEVICES are never coalesced
+ * - Optionally (GATEWAY_PAIR) runs as one of an active-active pair of gateways which both receive the frames of sensors sending to both.
+ *   Each sender MAC is owned by one gateway (a hash of the MAC), frames of the peer's senders are held back for PEER_HOLD_TIME and dropped once the peer
+ *   confirms it published them, else published here. Gateways confirm what they published with 10 byte keys (MAC + message_id) on MQTT_TOPIC/published,
+ *   while the peer is offline (its LWT) all frames are published here
+ * - Optionally (MAILBOX) keeps commands for the sensors posted on MQTT_TOPIC/cmd/<device> ({"id":..,"cmd":"ota"|"config"|"time","key":..,"value":..})
+ *   and sends them down with espnow (COMBO role) right after that sensor's next frame, while it listens. Delivery is reported on MQTT_TOPIC/cmd/<device>/status
+ * - Optionally (APP_ACK) answers every frame with a 12 byte ack carrying the channel, the time, a command pending flag and a backoff, see espnowAck.h
+ * - Drops the channel probe frames of the senders (see espnowSender::hunt() in espnowController.h), counted in the health message
+ * - Optionally (SPOOL) moves frames into a store and forward spool on LittleFS while MQTT is down and replays them in order once it is back
+ * - Publishes frames with QoS1 over an asynchronous MQTT client, up to MQTT_INFLIGHT frames are in flight at a time and a frame is released only on its PUBACK,
+ *   unacknowledged frames are retransmitted after MQTT_ACK_TIMEOUT or on reconnect (at least once delivery), see publishWindow.h
+ * - Never blocks on WiFi or MQTT : ESP-NOW receive starts at boot before WiFi is up, the connection is a state machine driven from loop() and WiFi events,
+ *   the time spent in each state is reported in the health message
+ * - Publishes a per sender table (frames, bytes, average interval, duplicates, last seen) as one JSON document on MQTT_TOPIC/senders every HEALTH_INTERVAL
+ * - Follows the sequence no of each sender to count the frames lost on the way (loss_pct per device in the health message) and drop stale replays
+ * - Optionally (PHASE_STATS) keeps per device histograms of the wake phases (EEPROM, channel, send, ack...) the battery sensors send with PHASE_PROFILER,
+ *   published as p50/p90/max per phase on MQTT_TOPIC/phases every HEALTH_INTERVAL, see phaseTable.h
+ * - Keeps log2 histograms of queue wait (receive to PUBACK), publish call time and loop() time, reported as p50/p90/p99/max per HEALTH_INTERVAL
  * 
  * TO DO :
  * - encryption isnt working. Even if I change the keys on the master to random values, the slave is able to receieve the messages, so have to debug later
  *  if you can solve the encryption issue, remove it as with excryption , an eSP8266 can only connect to 6 other peers, ESP32 can connect to 10 other
  *  while without encryption they can connect to 20 peers, encryption eg from :https://github.com/espressif/ESP8266_NONOS_SDK/issues/114#issuecomment-383521100
- * - Change the role to COMBO for both slave and Controller so that Slave can also pass on administration messages to the controller.
  * - construct the controller topic from its mac address instead of picking it up from the message id. Instead use message id as a string to identify the device name
  * - Introduce a status LED for MQTT connection status
  * - Implement a restart of ESP after configurable interval if the connection to MQTT is not restored
- * - To Support COMBO role where it can receive and send messages
  */
 
 // IMPORTANT : Compile it for the device you want, details of which are in Config.h
@@ -37,10 +63,26 @@
 #include <espnow.h>
 #include "secrets.h"
 #include <ArduinoJson.h>
-#include <ArduinoQueue.h>
+#include "frameRing.h"
+#include "jsonWriter.h"
+#include "espnowBinary.h"
+#include "espnowAck.h"
+#include "topicCache.h"
+#include "senderTable.h"
+#include "frameSpool.h"
+#include "fsStorage.h"
+#include "publishWindow.h"
+#include "stateTimer.h"
+#include "logHistogram.h"
+#include "holdTable.h"
+#include "priorityShare.h"
+#include "mailbox.h"
+#include "phaseTable.h"
+#include <LittleFS.h>
 #include <ArduinoOTA.h>
+#include <time.h>
 #include "espnowMessage.h" // for struct of espnow message
-#include <PubSubClient.h>
+#include <AsyncMqttClient.h>
 #include <Pinger.h>
 #include "myutils.h"
 #include "espwatchdog.h"
@@ -54,21 +96,67 @@
 const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3 strings adjacent to each other become pasted together as one long string
 #define KEY_LEN  16 // lenght of PMK & LMK key (fixed at 16 for ESP)
 #define MQTT_RETRY_INTERVAL 5000 //MQTT server connection retry interval in milliseconds
-#define QUEUE_LENGTH 50
+#define QUEUE_LENGTH 64 // no of frame slots in the ingest ring for normal frames, must be a power of 2
+#define PRIORITY_QUEUE_LENGTH 16 // no of frame slots in the ingest ring for priority frames, must be a power of 2
+#ifndef LOW_PRIORITY_SHARE
+  #define LOW_PRIORITY_SHARE 4 // after these many priority frames in a row one normal frame is published, if there is one waiting
+#endif
 #define MAX_MESSAGE_LEN 251 // defnies max message length, as the max espnow allows is 250, cant exceed it
+#define HEALTH_MSG_LEN 1536 // size of the json document for the health message, it carries a few per device stats. The document is static, too big for the stack
+#define SENDERS_MSG_LEN (SENDER_TABLE_SIZE * 160) // size of the sender table message, ~155 chars per sender
+#define PHASES_MSG_LEN (PHASE_DEVICES * 360) // size of the phase table message, ~340 chars per device
+#define TOPIC_CACHE_SIZE 16 // no of devices whose topics are cached, must be a power of 2
+#define SENDER_TABLE_SIZE 16 // no of controllers tracked for duplicate suppression, must be a power of 2
+#ifndef MQTT_INFLIGHT
+  #define MQTT_INFLIGHT 8 // max no of QoS1 publishes waiting for their PUBACK
+#endif
 #define ESP_OK 0 // This is defined for ESP32 but not for ESP8266 , so define it
 #define HEALTH_INTERVAL 30e3 // interval is millisecs to publish health message for the gateway
+// Budget for publishing queued frames in one pass of loop() before going back to MQTT/OTA/LED housekeeping, whichever limit is hit first
+#ifndef DRAIN_BUDGET_MSGS
+  #define DRAIN_BUDGET_MSGS 16 // max frames published per loop()
+#endif
+#ifndef DRAIN_BUDGET_US
+  #define DRAIN_BUDGET_US 20000 // max time in microsecs spent publishing per loop()
+#endif
+#ifndef COALESCE_THRESHOLD
+  #define COALESCE_THRESHOLD 25 // percent of a ring's slots in use beyond which frames are coalesced
+#endif
+// a gateway of a pair holds the frames of its peer's senders for PEER_HOLD_TIME millisecs waiting for the peer to confirm it published them
+// it has to cover the peer's publish round trip and CONFIRM_INTERVAL, and be shorter than the time the broker takes to post the peer's LWT
+#ifndef PEER_HOLD_TIME
+  #define PEER_HOLD_TIME 2000
+#endif
+#define PEER_HOLD_SIZE 16 // max frames held for the peer
+#define CONFIRM_INTERVAL 200 // millisecs after which a partial batch of confirmations is published
+#define CONFIRM_BATCH 24 // max confirmations per message, 10 bytes each
+#define ACK_PEERS 8 // no of senders kept registered as espnow peers for the acks, the least recently added one makes way for a new one
+#define ACK_BACKOFF 10 // backoff in secs suggested to the senders while the ingest ring is more than half full
+#define ACK_CALLBACK_TIMEOUT 50 // millisecs after which acks still waiting for their send callback are given up
+#define NTP_SERVER "pool.ntp.org" // for the time in the acks
+#define TIME_VALID 1600000000 // time() below this means the time isnt synced yet
+#define MAILBOX_SIZE 8 // max commands waiting for the sensors, all devices together
+#define MAILBOX_ATTEMPTS 5 // a command is given up after failing to reach the sensor after these many of its frames
+#define MAILBOX_TTL (24 * 3600 * 1000UL) // millisecs after which a command not yet delivered is given up
+#define DOWNLINK_WINDOW 20 // millisecs after a sensor's frame within which its command must go out, the sensor listens for ~30ms
+// Frames are moved from the ring into the flash spool once MQTT has been down for SPOOL_AFTER millisecs or the ring holds more than SPOOL_WATERMARK frames
+#ifndef SPOOL_AFTER
+  #define SPOOL_AFTER 10000
+#endif
+#ifndef SPOOL_WATERMARK
+  #define SPOOL_WATERMARK (QUEUE_LENGTH / 2)
+#endif
 // API_TIMEOUT is used to determine how long to wait for MQTT connection before restarting the ESP
 #ifndef API_TIMEOUT
   #define API_TIMEOUT 600 // define default timeout of monitoring for MQTT connection if not defined.
 #endif
-const char* ssid = WiFi_SSID;
-const char* password = WiFi_SSID_PSWD;
+static const char* ssid = WiFi_SSID; // static, the native tests link main.cpp next to sensor code with its own ssid
+static const char* password = WiFi_SSID_PSWD;
 long last_time = 0;
-bool retry_message = false;
 long last_message_count = 0;//stores the last count with which message rate was calculated
 long message_count = 0;//keeps track of total no of messages publshed since uptime
 long lastReconnectAttempt = 0; // Keeps track of the last time an attempt was made to connect to MQTT
+unsigned long mqtt_down_since = 0; // millis() when the MQTT connection was found down, 0 while connected
 bool initilised = false; // flag to track if initialisation of the ESP has finished. At present it only handles tracking of the "init" message published on startup
 String strIP_address = "";//stores the IP address of the ESP
 
@@ -89,14 +177,124 @@ uint8_t controller_mac[][6] = CONTROLLERS; //from secrets.h
 //    {0xC, 0xDD, 0xC2, 0x33, 0x11, 0x98}
 // };
 
+// The gateway's own topics, the adjacent strings are pasted together at compile time
+const char lwt_topic[] = MQTT_TOPIC "/LWT";
+const char state_topic[] = MQTT_TOPIC "/state";
+const char wifi_topic[] = MQTT_TOPIC "/wifi";
+const char init_topic[] = MQTT_TOPIC "/init";
+const char senders_topic[] = MQTT_TOPIC "/senders";
+#if USING(PHASE_STATS)
+const char phases_topic[] = MQTT_TOPIC "/phases";
+#endif
+#if USING(MOTION_SENSOR)
+const char motion_topic[] = MQTT_TOPIC "/" MOTION_SENSOR_NAME "/state";
+#endif
+// topics of the devices sending espnow messages, of the form MQTT_BASE_TOPIC/<device_name>/state , or /bin for binary payloads
+#if USING(BINARY_PAYLOAD)
+topicCache<TOPIC_CACHE_SIZE> deviceTopics(MQTT_BASE_TOPIC,"/bin");
+#else
+topicCache<TOPIC_CACHE_SIZE> deviceTopics(MQTT_BASE_TOPIC,"/state");
+#endif
+senderTable<SENDER_TABLE_SIZE> senders; // controllers heard from, updated in OnDataRecv
+#if USING(PHASE_STATS)
+phaseTable<PHASE_DEVICES> phases; // wake phases of the sensors with PHASE_PROFILER, updated in OnDataRecv
+#endif
+#if USING(SPOOL)
+fsStorage spoolStorage(LittleFS);
+frameSpool<espnow_message, fsStorage> spool(spoolStorage); // frames parked on flash while MQTT is down, written and read by loop() only
+#endif
+
 uint8_t kok[KEY_LEN]= PMK_KEY_STR;//comes from secrets.h
 uint8_t key[KEY_LEN] = LMK_KEY_STR;// comes from secrets.h
 
-ArduinoQueue<espnow_message> structQueue(QUEUE_LENGTH);
-WiFiClient espClient;
-PubSubClient client(espClient);
-static espnow_message emptyMessage;
-espnow_message currentMessage = emptyMessage;
+// a frame as held in the rings and the publish window, the message along with the time it was received
+typedef struct gateway_frame
+{
+  espnow_message msg;
+  uint32_t rx_time; // micros() in OnDataRecv, 0 if not known (frames replayed from the spool)
+  uint8_t mac[6]; // MAC of the sender, all 0 if not known (frames replayed from the spool)
+}gateway_frame;
+
+frameRing<gateway_frame,QUEUE_LENGTH> frameQueue; // normal frames, written by OnDataRecv, read by loop()
+frameRing<gateway_frame,PRIORITY_QUEUE_LENGTH> priorityQueue; // frames from PRIORITY_DEVICES, written by OnDataRecv, read by loop()
+const char* const priority_devices[] = PRIORITY_DEVICES; // from Config.h
+#if USING(GATEWAY_PAIR)
+const char pair_topic[] = MQTT_TOPIC "/published"; // confirmations of the frames published by this gateway
+const char peer_pair_topic[] = MQTT_BASE_TOPIC "/" PEER_GATEWAY "/published";
+const char peer_lwt_topic[] = MQTT_BASE_TOPIC "/" PEER_GATEWAY "/LWT";
+// a confirmation, on the wire it is the 6 MAC bytes followed by the message_id little endian
+typedef struct pair_key
+{
+  uint8_t mac[6];
+  uint32_t message_id;
+}pair_key;
+#define PAIR_KEY_LEN 10
+frameRing<gateway_frame,PEER_HOLD_SIZE> peerQueue; // frames of the peer's senders, written by OnDataRecv, read by loop()
+frameRing<pair_key,32> confirmQueue; // confirmations from the peer, written by the MQTT message callback, read by loop()
+holdTable<gateway_frame,PEER_HOLD_SIZE> peerHold; // frames of the peer's senders waiting for the peer's confirmation
+uint8_t confirm_batch[CONFIRM_BATCH * PAIR_KEY_LEN]; // confirmations of frames published here, not yet sent
+uint8_t confirm_count = 0;
+unsigned long confirm_started = 0;
+volatile bool peer_online = false; // from the peer's LWT, false while we are not connected ourselves
+uint32_t peer_confirmed = 0; // held frames dropped as the peer published them
+uint32_t peer_takeover = 0; // held frames published here as the peer did not
+#endif
+#if USING(MAILBOX)
+const char cmd_topic[] = MQTT_TOPIC "/cmd/+"; // commands, MQTT_TOPIC/cmd/<device>
+#define CMD_TOPIC_PREFIX MQTT_TOPIC "/cmd/" // no parentheses, it is pasted in front of a format string
+// delivery report of a command, published on MQTT_TOPIC/cmd/<device>/status
+typedef struct cmd_status
+{
+  char device_name[16];
+  uint32_t id;
+  const char *status; // "queued", "rejected", "delivered", "failed" or "expired"
+  uint8_t attempts;
+}cmd_status;
+// the command being sent to a sensor which just sent a frame
+typedef struct downlink
+{
+  uint8_t mac[6];
+  mail_entry *mail; // nullptr if none
+  bool sent; // esp_now_send() done, waiting for OnDataSent()
+  bool added_peer; // the sensor was added as a peer for this and is removed after
+  uint32_t started; // millis() when the sensor's frame came in
+}downlink;
+mailbox<MAILBOX_SIZE> commands;
+frameRing<cmd_status,16> statusQueue; // written by the callbacks, published from loop()
+downlink current_downlink = {{0}, nullptr, false, false, 0};
+uint32_t cmd_delivered = 0;
+uint32_t cmd_failed = 0;
+#endif
+#if USING(APP_ACK)
+// ack to be sent to a sender, queued by OnDataRecv and sent from loop()
+typedef struct ack_job
+{
+  uint8_t mac[6];
+  uint32_t message_id;
+  bool pending; // a command follows
+}ack_job;
+frameRing<ack_job,8> ackQueue;
+uint8_t ack_peers[ACK_PEERS][6]; // senders added as peers for the acks, in the order added
+uint8_t ack_peer_count = 0;
+uint8_t ack_peer_next = 0; // next entry of ack_peers to be replaced once it is full
+volatile uint8_t acks_in_flight = 0; // acks sent and waiting for OnDataSent
+unsigned long acks_sent_at = 0;
+uint32_t acks_sent = 0;
+uint32_t acks_failed = 0;
+#endif
+#if USING(COALESCE)
+const char* const coalesce_exempt_devices[] = COALESCE_EXEMPT_DEVICES; // from Config.h
+volatile uint32_t coalesced = 0; // frames which replaced an older queued frame of the same device, written by OnDataRecv only
+#endif
+publishWindow<gateway_frame,MQTT_INFLIGHT> inflight; // frames published and waiting for their PUBACK
+uint16_t drain_budget_msgs = DRAIN_BUDGET_MSGS; // the drain budget in use, variables so that the native tests can sweep them
+unsigned long drain_budget_us = DRAIN_BUDGET_US;
+AsyncMqttClient mqttClient;
+volatile uint32_t probes = 0; // channel probes received from the senders, see espnowSender::hunt() in espnowController.h
+// latencies in microsecs, reset after every health message
+logHistogram queueWait; // OnDataRecv to PUBACK
+logHistogram publishTime; // time taken by a publish call
+logHistogram loopTime; // time between the start of successive loop() passes
 
 #if USING(MOTION_SENSOR)
 pir_sensor motion_sensor(PIR_PIN,MOTION_ON_DURATION);
@@ -108,46 +306,80 @@ typedef enum
   UNDEFINED = 1
 }msgType;
 
+// states of the WiFi/MQTT connection, see updateConnection()
+typedef enum
+{
+  LINK_WIFI_DOWN = 0, // waiting for the station to connect and get an IP
+  LINK_MQTT_DOWN = 1, // WiFi is up, connecting to the broker
+  LINK_UP = 2, // connected to the broker
+  LINK_STATES = 3
+}linkState;
+stateTimer<LINK_STATES> connection(LINK_WIFI_DOWN); // also keeps the time spent in each state for the health message
+volatile bool wifi_up = false; // set from the WiFi events
+WiFiEventHandler wifiGotIPHandler, wifiDisconnectedHandler; // the handlers stay registered only as long as these are alive
+
 /*
- * connects to MQTT server , publishes LWT message as "online" every time it connects
- * waits for a time defined by MQTT_RETRY_INTERVAL before reconnecting again
+ * Runs the WiFi/MQTT connection state machine, called on every loop() and never waits
+ * WiFi reconnects by itself (auto reconnect) and is tracked through the WiFi events, MQTT is connected in the background and retried every MQTT_RETRY_INTERVAL
+ * ESP-NOW receive keeps running in every state, frames wait in the rings/spool until the link is up again
+ * publishes LWT message as "online" every time it connects
  * I had issues with MQTT nto able to connect at times and so I included pinger to ping the gateway but then the issue hasnt happened for a long time now
+ * Returns true if connected to MQTT
  */
-bool reconnectMQTT()
+bool updateConnection()
 {
-  if (!client.connected())
+  unsigned long now = millis();
+  switch(connection.get())
   {
-    long now = millis();
-    if ((now - lastReconnectAttempt > MQTT_RETRY_INTERVAL) || lastReconnectAttempt == 0) 
-    {
-      lastReconnectAttempt = now;
-      DPRINTLN("Attempting MQTT connection...");
-      // publishes the LWT message ("online") to the topic,If the this device disconnects from the broker ungracefully then the broker automatically posts the "offline" message on the LWT topic
-      // so that all connected clients know that this device has gone offline
-      char publish_topic[65] = ""; //variable accomodates 50 characters of main topic + 15 char of sub topic
-      strcpy(publish_topic,MQTT_TOPIC);
-      strcat(publish_topic,"/LWT"); 
-      if (client.connect(DEVICE_NAME,mqtt_uname,mqtt_pswd,publish_topic,0,true,"offline")) {//credentials come from secrets.h
+    case LINK_WIFI_DOWN:
+      if(wifi_up)
+      {
+        DPRINT("Station IP Address: ");DPRINTLN(WiFi.localIP());
+        DPRINT("Wi-Fi Channel: ");DPRINTLN(WiFi.channel());
+        lastReconnectAttempt = 0; // try MQTT straight away
+        connection.set(LINK_MQTT_DOWN,now);
+      }
+      break;
+    case LINK_MQTT_DOWN:
+      if(!wifi_up)
+        connection.set(LINK_WIFI_DOWN,now);
+      else if(mqttClient.connected())
+      {
         DPRINTLN("MQTT connected");
-        client.publish(publish_topic,"online",true);
-        if(statusLED.getState() == LED_BLINKING)
-          statusLED.cancel();
-        return true;
+        // publishes the LWT message ("online") to the topic,If the this device disconnects from the broker ungracefully then the broker automatically posts the "offline" message on the LWT topic
+        // so that all connected clients know that this device has gone offline
+        mqttClient.publish(lwt_topic,0,true,"online");
+        inflight.requeue(); // frames sent on the previous connection and not acknowledged go out again
+        #if USING(GATEWAY_PAIR)
+        mqttClient.subscribe(peer_lwt_topic,0); // retained, tells straight away if the peer is online
+        mqttClient.subscribe(peer_pair_topic,0);
+        #endif
+        #if USING(MAILBOX)
+        mqttClient.subscribe(cmd_topic,1); // clean session, commands posted while we were offline are not delivered, only retained ones
+        #endif
+        connection.set(LINK_UP,now);
       }
-    //   else 
-    //   {
-    //     DPRINT("failed, rc=");
-    //     DPRINT(client.state());
-    //     if(pinger.Ping(WiFi.gatewayIP()))
-    //     {
-    //       DPRINTLN("ping to gateway success");
-    //     }
-    //     else
-    //     {
-    //       DPRINTLN("ping to gateway failed");
-    //     }
-    //   }
-    }
+      else if ((now - lastReconnectAttempt > MQTT_RETRY_INTERVAL) || lastReconnectAttempt == 0)
+      {
+        lastReconnectAttempt = now;
+        DPRINTLN("Attempting MQTT connection...");
+        mqttClient.connect(); // credentials and the LWT ("offline") are set in setup(), OnMqttConnect/OnMqttDisconnect are called when it completes
+      }
+      break;
+    case LINK_UP:
+      if(!wifi_up || !mqttClient.connected())
+      {
+        if(mqttClient.connected())
+          mqttClient.disconnect(true); // WiFi is gone, dont wait for the TCP timeout to find out
+        #if USING(GATEWAY_PAIR)
+        peer_online = false; // we cant hear the peer anymore, take all frames till we are back
+        #endif
+        connection.set(wifi_up ? LINK_MQTT_DOWN : LINK_WIFI_DOWN,now);
+      }
+      break;
+  }
+  if(connection.get() != LINK_UP)
+  {
     if(statusLED.getState() == LED_IDLE)
       statusLED.blink(1000, 500);
     return false;
@@ -158,13 +390,13 @@ bool reconnectMQTT()
 }
 
 /*
- * publishes a string to MQTT
+ * publishes a string to MQTT with QoS0
  */
 bool publishToMQTT(const char msg[],const char topic[], bool retain)
 {
-  if(client.connected())
+  if(mqttClient.connected())
   {
-    if(client.publish(topic,msg,retain))
+    if(mqttClient.publish(topic,0,retain,msg) != 0)
     {
       DPRINT("publishToMQTT-Published:");DPRINTLN(msg);
       return true;
@@ -179,54 +411,301 @@ bool publishToMQTT(const char msg[],const char topic[], bool retain)
 }
 
 /*
- * Creates a json string from the espnow message and publishes it to a MQTT queue
- * Returns true if message was published successfully else false
+ * Creates a json string (or binary payload if BINARY_PAYLOAD is in use) from the espnow message and publishes it to a MQTT queue with QoS1
+ * The JSON is rendered by serializeMessage() into a static buffer, so nothing is allocated per frame
+ * dup and packet_id are set when the frame is sent again after a missing PUBACK
+ * Returns the packet id, 0 if it can't be published now (not connected, TCP buffer full) or -1 if the frame can't be published at all
  */
-bool publishToMQTT(espnow_message msg) {
-  char final_publish_topic[65] = "";
-  char publish_topic[65] = "";
-  // create a path for this specific device which is of the form MQTT_BASE_TOPIC/<master_id> , master_id is usually the mac address stripped off the colon eg. MQTT_BASE_TOPIC/2CF43220842D
-  strcpy(publish_topic,MQTT_BASE_TOPIC);
-  strcat(publish_topic,"/");
-  //DPRINT("master_id:");DPRINTLN(msg.master_id);
-  strcat(publish_topic,msg.device_name); // from here on all messages would be published within this topic specific for this device
-  strcpy(final_publish_topic,publish_topic);
-  strcat(final_publish_topic,"/state");// create a topic to publish the state of the device
-  //DPRINT("Final topic:");DPRINTLN(final_publish_topic);
+int32_t publishToMQTT(const espnow_message &msg, bool dup, uint16_t packet_id) {
+  if(!mqttClient.connected())
+    return 0;
+  // the topic for this specific device is of the form MQTT_BASE_TOPIC/<device_name>/state (or /bin), it is built only the first time the device is seen
+  const char *final_publish_topic = deviceTopics.get(msg.device_name);
+  if(final_publish_topic == nullptr)
+  {
+    DPRINTLN("publishToMQTT-Topic too long");
+    return -1;
+  }
   DPRINTF("publishToMQTT:%lu,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
-  
-  StaticJsonDocument<MAX_MESSAGE_LEN> msg_json;
-  msg_json["id"] = msg.message_id;
-  msg_json["device"] = msg.device_name;
-  msg_json["ival1"] = msg.intvalue1;
-  msg_json["ival2"] = msg.intvalue2;
-  msg_json["ival3"] = msg.intvalue3;
-  msg_json["ival4"] = msg.intvalue4;
-  msg_json["fval1"] = msg.floatvalue1;
-  msg_json["fval2"] = msg.floatvalue2;
-  msg_json["fval3"] = msg.floatvalue3;
-  msg_json["fval4"] = msg.floatvalue4;
-  msg_json["char1"] = msg.chardata1;
-  msg_json["char2"] = msg.chardata2;
-  
-  String str_msg="";
-  serializeJson(msg_json,str_msg);
-  return publishToMQTT(str_msg.c_str(),final_publish_topic,false);
-  //DPRINTF("published message with len:%u\n",measureJson(msg_json));
+
+  #if USING(BINARY_PAYLOAD)
+  static uint8_t bin_msg[ESPNOW_BINARY_MAX_LEN];
+  size_t len = encodeMessage(msg,bin_msg,sizeof(bin_msg));
+  return mqttClient.publish(final_publish_topic,1,false,(const char*)bin_msg,len,dup,packet_id);
+  #else
+  static char json_msg[JSON_MSG_LEN];
+  size_t len = serializeMessage(msg,json_msg,sizeof(json_msg));
+  if(len == 0)
+  {
+    DPRINTLN("publishToMQTT-Failed to serialize message");
+    return -1;
+  }
+  return mqttClient.publish(final_publish_topic,1,false,json_msg,len,dup,packet_id);
+  #endif
 }
 
+#if USING(MOTION_SENSOR)
 /*
- * Creates a message string for motion ON message and publishes it to a MQTT queue
+ * Publishes the motion state ("on"/"off") to the motion sensor topic MQTT_TOPIC/MOTION_SENSOR_NAME/state
  * Returns true if message was published successfully else false
  */
-bool publishMotionMsgToMQTT(const char topic_name[],const char state[4]) {
-  char publish_topic[65] = "";
-  // create a path for this specific device which is of the form MQTT_BASE_TOPIC/<master_id> , master_id is usually the mac address stripped off the colon eg. MQTT_BASE_TOPIC/2CF43220842D
-  strcpy(publish_topic,MQTT_TOPIC);
-  strcat(publish_topic,"/");
-  strcat(publish_topic,topic_name);
-  strcat(publish_topic,"/state");
-  return publishToMQTT(state,publish_topic,false);
+bool publishMotionMsgToMQTT(const char state[4]) {
+  return publishToMQTT(state,motion_topic,false);
+}
+#endif
+
+#if USING(MAILBOX)
+/*
+ * queues a delivery report of the command for publishing from loop()
+ */
+void reportCommand(const espnow_message &cmd, const char *status, uint8_t attempts)
+{
+  cmd_status *report = statusQueue.reserve();
+  if(report == nullptr)
+    return;
+  memcpy(report->device_name, cmd.device_name, sizeof(report->device_name));
+  report->id = cmd.message_id;
+  report->status = status;
+  report->attempts = attempts;
+  statusQueue.commit();
+}
+
+/*
+ * parses a command posted on MQTT_TOPIC/cmd/<device> and keeps it in the mailbox till the device sends its next frame
+ */
+void postCommand(const char *device, const char *payload, size_t len)
+{
+  espnow_message cmd = espnow_message(); // zeroed, a rejected command is still reported with its fields and the sensor gets no stray bytes
+  strncpy(cmd.device_name, device, sizeof(cmd.device_name) - 1);
+  const char *status = "rejected";
+  StaticJsonDocument<192> doc;
+  if(strlen(device) < sizeof(cmd.device_name) && deserializeJson(doc, payload, len) == DeserializationError::Ok)
+  {
+    const char *type = doc["cmd"] | "";
+    cmd.message_id = doc["id"] | 0UL;
+    cmd.intvalue1 = doc["value"] | 0;
+    strlcpy(cmd.chardata1, doc["key"] | "", sizeof(cmd.chardata1));
+    bool known = true;
+    if(strcmp(type, "ota") == 0)
+      cmd.msg_type = ESP_NOW_OTA;
+    else if(strcmp(type, "config") == 0)
+      cmd.msg_type = ESP_NOW_CONFIG;
+    else if(strcmp(type, "time") == 0)
+      cmd.msg_type = ESP_NOW_TIME_SYNC;
+    else
+      known = false;
+    if(known && commands.post(cmd, millis()) != nullptr)
+      status = "queued";
+  }
+  DPRINTF("Command %lu for %s %s\n", (unsigned long)cmd.message_id, cmd.device_name, status);
+  reportCommand(cmd, status, 0);
+}
+
+/*
+ * called for every frame received, the sensor listens for a moment after it sends so its oldest command goes out now (from loop())
+ */
+void checkMailbox(const uint8_t *mac, const uint8_t *data, uint8_t len)
+{
+  if(current_downlink.mail != nullptr || commands.count() == 0 || len < sizeof(espnow_message::device_name))
+    return;
+  mail_entry *mail = commands.next((const char*)data + offsetof(espnow_message,device_name));
+  if(mail == nullptr)
+    return;
+  memcpy(current_downlink.mac, mac, sizeof(current_downlink.mac));
+  current_downlink.sent = false;
+  current_downlink.started = millis();
+  current_downlink.mail = mail;
+}
+
+/*
+ * ends the current downlink, the sensor is removed as a peer if it was added for it
+ */
+void endDownlink()
+{
+  if(current_downlink.added_peer)
+    esp_now_del_peer(current_downlink.mac);
+  current_downlink.added_peer = false;
+  current_downlink.sent = false;
+  current_downlink.mail = nullptr;
+}
+
+/*
+ * the command could not be sent this time, it is tried again on the sensor's next frame till MAILBOX_ATTEMPTS
+ */
+void commandFailed()
+{
+  mail_entry *mail = current_downlink.mail;
+  if(++mail->attempts >= MAILBOX_ATTEMPTS)
+  {
+    reportCommand(mail->msg, "failed", mail->attempts);
+    cmd_failed++;
+    commands.remove(mail);
+  }
+  endDownlink();
+}
+
+/*
+ * sends the command picked by checkMailbox(), the outcome comes in commandSent()
+ */
+void sendCommand()
+{
+  downlink &dl = current_downlink;
+  if(dl.mail == nullptr || dl.sent)
+    return;
+  #if USING(APP_ACK)
+  if(acks_in_flight > 0)
+    return; // the ack goes first, OnDataSent() cannot tell the two apart
+  #endif
+  if(millis() - dl.started > DOWNLINK_WINDOW)
+  {
+    commandFailed(); // the sensor has stopped listening by now
+    return;
+  }
+  espnow_message cmd = dl.mail->msg;
+  cmd.intvalue4 = commands.pending(cmd.device_name) - 1; // the sensor keeps listening while this is not 0
+  if(cmd.msg_type == ESP_NOW_TIME_SYNC)
+    cmd.intvalue1 += (millis() - dl.mail->posted) / 1000; // the time was posted a while ago
+  if(!dl.added_peer && !esp_now_is_peer_exist(dl.mac))
+    dl.added_peer = esp_now_add_peer(dl.mac, ESP_NOW_ROLE_COMBO, wifi_get_channel(), NULL, 0) == 0;
+  if(esp_now_send(dl.mac, (uint8_t *) &cmd, sizeof(cmd)) != 0)
+  {
+    commandFailed();
+    return;
+  }
+  dl.sent = true;
+}
+
+/*
+ * called from OnDataSent(), a command which reached the sensor is removed and the sensor's next command (if any) goes out straight away
+ */
+void commandSent(const uint8_t *mac, uint8_t status)
+{
+  downlink &dl = current_downlink;
+  if(dl.mail == nullptr || !dl.sent || memcmp(mac, dl.mac, sizeof(dl.mac)) != 0)
+    return;
+  dl.sent = false;
+  if(status != 0)
+  {
+    commandFailed();
+    return;
+  }
+  char device_name[16];
+  memcpy(device_name, dl.mail->msg.device_name, sizeof(device_name));
+  reportCommand(dl.mail->msg, "delivered", dl.mail->attempts + 1);
+  cmd_delivered++;
+  commands.remove(dl.mail);
+  dl.mail = commands.next(device_name);
+  if(dl.mail == nullptr)
+    endDownlink();
+}
+
+/*
+ * publishes the delivery reports, gives up the commands older than MAILBOX_TTL
+ */
+void publishCommandStatus()
+{
+  if(current_downlink.mail == nullptr)
+    commands.expire(millis(), MAILBOX_TTL, [](const mail_entry &e) { reportCommand(e.msg, "expired", e.attempts); });
+  cmd_status *report;
+  while((report = statusQueue.front()) != nullptr)
+  {
+    char topic[sizeof(CMD_TOPIC_PREFIX) + sizeof(report->device_name) + 7];
+    char msg[80];
+    snprintf(topic, sizeof(topic), CMD_TOPIC_PREFIX "%.16s/status", report->device_name);
+    snprintf(msg, sizeof(msg), "{\"id\":%lu,\"status\":\"%s\",\"attempts\":%u}", (unsigned long)report->id, report->status, report->attempts);
+    if(!publishToMQTT(msg, topic, false))
+      break; // tried again on the next loop()
+    statusQueue.release();
+  }
+}
+#endif
+
+#if USING(APP_ACK)
+/*
+ * registers the sender as a peer if it isnt one, the one registered longest ago is removed if ACK_PEERS are registered already
+ */
+void ensurePeer(const uint8_t mac[6])
+{
+  if(esp_now_is_peer_exist((uint8_t*)mac))
+    return;
+  if(ack_peer_count == ACK_PEERS)
+    esp_now_del_peer(ack_peers[ack_peer_next]);
+  else
+    ack_peer_count++;
+  if(esp_now_add_peer((uint8_t*)mac, ESP_NOW_ROLE_COMBO, wifi_get_channel(), NULL, 0) != 0)
+  {
+    ack_peer_count--;
+    return;
+  }
+  memcpy(ack_peers[ack_peer_next], mac, 6);
+  ack_peer_next = (ack_peer_next + 1) % ACK_PEERS;
+}
+
+/*
+ * called for every frame received, including retransmissions as the sender missed the last ack. The ack goes out from loop()
+ */
+void queueAck(const uint8_t *mac, const uint8_t *data, uint8_t len)
+{
+  if(len < offsetof(espnow_message,message_id) + sizeof(espnow_message::message_id))
+    return;
+  ack_job *job = ackQueue.reserve();
+  if(job == nullptr)
+    return; // no ack, the sender takes the MAC layer ack once its wait for this one runs out
+  memcpy(job->mac, mac, sizeof(job->mac));
+  memcpy(&job->message_id, data + offsetof(espnow_message,message_id), sizeof(job->message_id));
+  job->pending = false;
+  #if USING(MAILBOX)
+  job->pending = current_downlink.mail != nullptr && memcmp(current_downlink.mac, mac, 6) == 0; // checkMailbox() has run before
+  #endif
+  ackQueue.commit();
+}
+
+/*
+ * sends the queued acks, not while a command is waiting for its send callback as OnDataSent() cannot tell the two apart
+ */
+void sendAcks()
+{
+  if(acks_in_flight > 0 && millis() - acks_sent_at > ACK_CALLBACK_TIMEOUT)
+    acks_in_flight = 0; // should not happen, dont let it block the commands
+  #if USING(MAILBOX)
+  if(current_downlink.sent)
+    return;
+  #endif
+  ack_job *job;
+  while((job = ackQueue.front()) != nullptr)
+  {
+    espnow_ack ack;
+    ack.channel = wifi_get_channel();
+    ack.flags = job->pending ? ESPNOW_ACK_PENDING : 0;
+    ack.backoff = frameQueue.count() * 2 > frameQueue.capacity() ? ACK_BACKOFF : 0;
+    ack.message_id = job->message_id;
+    time_t now = time(nullptr);
+    ack.time = now > TIME_VALID ? (uint32_t)now : 0;
+    uint8_t frame[ESPNOW_ACK_LEN];
+    encodeAck(ack, frame);
+    ensurePeer(job->mac);
+    if(esp_now_send(job->mac, frame, sizeof(frame)) == 0)
+    {
+      acks_in_flight++;
+      acks_sent_at = millis();
+      acks_sent++;
+    }
+    else
+      acks_failed++; // not retried, the sender takes the MAC layer ack once its wait for this one runs out
+    ackQueue.release();
+  }
+}
+#endif
+
+/*
+ * sends the acks queued since the last call. Called at the top of loop() and after each step of it that can take a while (publishing, the spool's
+ * flash writes, the health messages) so that a slow loop() pass does not hold an ack past the sender's ACK_WAIT_TIMEOUT
+ */
+inline void pollAcks()
+{
+  #if USING(APP_ACK)
+  sendAcks();
+  #endif
 }
 
 /*
@@ -238,76 +717,610 @@ void OnDataSent(uint8_t *receiver_mac, uint8_t transmissionStatus) {
   } else {
     DPRINT("Error code: ");DPRINTLN(transmissionStatus);
   }
+  #if USING(APP_ACK)
+  if(acks_in_flight > 0) // sends complete in order and a command is never sent while acks are in flight
+  {
+    acks_in_flight--;
+    if(transmissionStatus != 0)
+      acks_failed++;
+    return;
+  }
+  #endif
+  #if USING(MAILBOX)
+  commandSent(receiver_mac, transmissionStatus);
+  #endif
 };
 
+/*
+ * Callbacks called when the MQTT connection completes or drops, the state machine in updateConnection() picks up the change
+ */
+void OnMqttConnect(bool session_present) {
+  DPRINTLN("MQTT session up");
+}
+
+void OnMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
+  DPRINTF("MQTT disconnected, reason:%d\n",(int)reason);
+}
+
+#if USING(GATEWAY_PAIR)
+/*
+ * returns true if the sender is owned by the peer gateway, both gateways compute the same from the MAC
+ */
+bool peerOwns(const uint8_t mac[6])
+{
+  return ((mac[3] ^ mac[4] ^ mac[5]) & 1) != GATEWAY_INDEX;
+}
+
+/*
+ * handles the messages from the peer, its LWT and its confirmations. Returns false if the topic isnt one of them
+ */
+bool pairMessage(const char *topic, const char *payload, size_t len)
+{
+  if(strcmp(topic, peer_lwt_topic) == 0)
+  {
+    peer_online = len == 6 && memcmp(payload, "online", 6) == 0;
+    DPRINTF("Peer gateway %s\n", peer_online ? "online" : "offline");
+  }
+  else if(strcmp(topic, peer_pair_topic) == 0)
+  {
+    for(size_t i = 0; i + PAIR_KEY_LEN <= len; i += PAIR_KEY_LEN)
+    {
+      pair_key *key = confirmQueue.reserve();
+      if(key == nullptr)
+        break; // the frames are published by both then, better than losing them
+      memcpy(key->mac, payload + i, 6);
+      const uint8_t *id = (const uint8_t*)payload + i + 6;
+      key->message_id = (uint32_t)id[0] | ((uint32_t)id[1] << 8) | ((uint32_t)id[2] << 16) | ((uint32_t)id[3] << 24);
+      confirmQueue.commit();
+    }
+  }
+  else
+    return false;
+  return true;
+}
+
+/*
+ * publishes the batch of confirmations collected so far
+ */
+void publishConfirmations()
+{
+  if(confirm_count > 0 && mqttClient.connected())
+    mqttClient.publish(pair_topic,0,false,(const char*)confirm_batch,confirm_count * PAIR_KEY_LEN);
+  confirm_count = 0; // the peer publishes the frames itself if these dont reach it
+}
+
+/*
+ * adds a confirmation for a frame published here, the batch goes out when full or CONFIRM_INTERVAL old
+ */
+void confirmFrame(const gateway_frame &frame)
+{
+  static const uint8_t unknown[6] = {0};
+  if(memcmp(frame.mac, unknown, 6) == 0)
+    return;
+  if(confirm_count == 0)
+    confirm_started = millis();
+  uint8_t *p = confirm_batch + confirm_count * PAIR_KEY_LEN;
+  memcpy(p, frame.mac, 6);
+  uint32_t id = frame.msg.message_id;
+  p[6] = (uint8_t)id; p[7] = (uint8_t)(id >> 8); p[8] = (uint8_t)(id >> 16); p[9] = (uint8_t)(id >> 24);
+  if(++confirm_count == CONFIRM_BATCH)
+    publishConfirmations();
+}
+
+/*
+ * moves the peer's frames into the hold table, drops the ones the peer confirmed and publishes the ones held too long (or all if the peer is offline)
+ */
+void updatePair()
+{
+  gateway_frame *frame;
+  while(!peerHold.isFull() && (frame = peerQueue.front()) != nullptr)
+  {
+    peerHold.add(*frame, millis());
+    peerQueue.release();
+  }
+  pair_key *key;
+  while((key = confirmQueue.front()) != nullptr)
+  {
+    if(peerHold.remove([key](const gateway_frame &f) { return f.msg.message_id == key->message_id && memcmp(f.mac, key->mac, 6) == 0; }))
+      peer_confirmed++;
+    confirmQueue.release();
+  }
+  peerHold.expire(millis(), peer_online ? PEER_HOLD_TIME : 0, [](const gateway_frame &f) {
+    if(!inflight.add(f))
+      return false;
+    peer_takeover++;
+    return true;
+  });
+  if(confirm_count > 0 && millis() - confirm_started > CONFIRM_INTERVAL)
+    publishConfirmations();
+}
+#endif
+
+#if USING(GATEWAY_PAIR) || USING(MAILBOX)
+/*
+ * Callback called for the messages on the topics subscribed to
+ */
+void OnMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+  if(index != 0 || len != total)
+    return; // all of these fit in one piece, anything longer is not ours
+  #if USING(GATEWAY_PAIR)
+  if(pairMessage(topic, payload, len))
+    return;
+  #endif
+  #if USING(MAILBOX)
+  if(strncmp(topic, CMD_TOPIC_PREFIX, sizeof(CMD_TOPIC_PREFIX) - 1) == 0)
+    postCommand(topic + sizeof(CMD_TOPIC_PREFIX) - 1, payload, len);
+  #endif
+}
+#endif
+
+/*
+ * Callback called when the broker acknowledges a QoS1 publish
+ */
+void OnMqttPublish(uint16_t packet_id) {
+  inflight.acked(packet_id);
+}
+
+/*
+ * returns true if the device is in the list of names (PRIORITY_DEVICES, COALESCE_EXEMPT_DEVICES), name need not be null terminated
+ * Empty entries are skipped, {""} is how Config.h writes an empty list and must not match a frame with an empty device_name
+ */
+template <size_t L>
+bool isListed(const char* const (&list)[L], const char name[16])
+{
+  for(uint8_t i = 0; i < L; i++)
+    if(list[i][0] != '\0' && strncmp(list[i], name, 16) == 0)
+      return true;
+  return false;
+}
+
+/*
+ * copies a received frame into a ring slot, a shorter frame leaves the remaining fields zeroed
+ */
+void copyFrame(gateway_frame *frame, const uint8_t *mac, const uint8_t *data, uint8_t len)
+{
+  frame->rx_time = micros() | 1;
+  memcpy(frame->mac, mac, sizeof(frame->mac));
+  uint8_t copy_len = len < sizeof(espnow_message) ? len : sizeof(espnow_message);
+  memcpy(&frame->msg, data, copy_len);
+  memset((uint8_t*)&frame->msg + copy_len, 0, sizeof(espnow_message) - copy_len);
+}
+
+#if USING(COALESCE)
+/*
+ * Once ring is more than COALESCE_THRESHOLD percent full, overwrites the frame of this sender still waiting in the ring with the new one,
+ * provided both have the same msg_type and the device is not exempt. The backlog then holds at most one frame per device
+ * Returns true if the frame was coalesced, it is then not queued separately
+ */
+template <typename R>
+bool coalesceFrame(R &ring, sender_entry *sender, const uint8_t *mac, const uint8_t *data, uint8_t len)
+{
+  if(!sender->coalesce || !sender->queued || (uint32_t)ring.count() * 100 <= (uint32_t)ring.capacity() * COALESCE_THRESHOLD)
+    return false;
+  gateway_frame *frame = ring.pending(sender->queued_pos);
+  if(frame == nullptr)
+    return false;
+  msg_type_t msg_type = (msg_type_t)0;
+  if(len >= offsetof(espnow_message,msg_type) + sizeof(msg_type_t))
+    memcpy(&msg_type, data + offsetof(espnow_message,msg_type), sizeof(msg_type_t));
+  if(frame->msg.msg_type != msg_type)
+    return false;
+  copyFrame(frame,mac,data,len);
+  coalesced++;
+  return true;
+}
+#endif
+
+/*
+ * puts a received frame in ring, sender is nullptr if the frame was too short to identify it
+ */
+template <typename R>
+void enqueueFrame(R &ring, sender_entry *sender, const uint8_t *mac, const uint8_t *data, uint8_t len)
+{
+  #if USING(COALESCE)
+  if(sender != nullptr && coalesceFrame(ring,sender,mac,data,len))
+    return;
+  #endif
+  gateway_frame *frame = ring.reserve();
+  if(frame == nullptr)
+  {
+    DPRINTLN("Queue Full");
+    return;
+  }
+  copyFrame(frame,mac,data,len);
+  if(sender != nullptr)
+  {
+    sender->queued_pos = ring.position();
+    sender->queued = true;
+  }
+  ring.commit();
+  espnow_message *msg = &frame->msg;
+  DPRINTF("OnDataRecv:%lu,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg->message_id,msg->intvalue1,msg->intvalue2,msg->intvalue3,msg->intvalue4,msg->floatvalue1,msg->floatvalue2,msg->floatvalue3,msg->floatvalue4,msg->chardata1,msg->chardata2);
+}
+
 /*
  * Callback called on sending a message.
  */
 void OnDataRecv(uint8_t * mac, uint8_t *incomingData, uint8_t len) {
-  espnow_message msg;
-  memcpy(&msg, incomingData, sizeof(msg));
-  DPRINTF("OnDataRecv:%lu,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
-  
-    if(!structQueue.isFull())
-      structQueue.enqueue(msg);
-    else
-      DPRINTLN("Queue Full");
+  if(len == ESPNOW_PROBE_LEN && incomingData[0] == ESPNOW_PROBE_MAGIC)
+  {
+    probes++; // a sender looking for our channel, the MAC layer ack is all it needs
+    return;
+  }
+  #if USING(MAILBOX)
+  checkMailbox(mac,incomingData,len); // before the duplicate check, a sensor resending its frame is listening as well
+  #endif
+  #if USING(APP_ACK)
+  queueAck(mac,incomingData,len);
+  #endif
+  sender_entry *sender = nullptr;
+  // drop retransmissions of a frame we already have before they take up a slot
+  if(len >= offsetof(espnow_message,message_id) + sizeof(espnow_message::message_id))
+  {
+    uint32_t now = millis();
+    sender = senders.lookup(mac,now);
+    uint32_t message_id;
+    memcpy(&message_id, incomingData + offsetof(espnow_message,message_id), sizeof(message_id));
+    if(senders.isDuplicate(sender,message_id,now))
+    {
+      DPRINTF("Duplicate frame:%lu\n",(unsigned long)message_id);
+      return;
+    }
+    if(len >= offsetof(espnow_message,seq) + sizeof(espnow_message::seq))
+    {
+      uint32_t seq;
+      memcpy(&seq, incomingData + offsetof(espnow_message,seq), sizeof(seq));
+      if(!senders.acceptSeq(sender,seq))
+      {
+        DPRINTF("Stale frame, seq:%lu\n",(unsigned long)seq);
+        return;
+      }
+    }
+    // the priority class and coalescing policy are looked up only when the sender is new or changes its name
+    const char *name = (const char*)incomingData + offsetof(espnow_message,device_name);
+    if(memcmp(sender->device_name, name, sizeof(sender->device_name)) != 0 || sender->frames == 0)
+    {
+      memcpy(sender->device_name, name, sizeof(sender->device_name));
+      sender->priority = isListed(priority_devices,name);
+      #if USING(COALESCE)
+      sender->coalesce = !isListed(coalesce_exempt_devices,name);
+      #endif
+      sender->queued = false; // its queued frame may be in the other ring
+    }
+    senders.recordFrame(sender,len,now);
+    #if USING(PHASE_STATS)
+    phase_record record;
+    // the record follows the message, decodePhases() checks its length against the phase count it carries so a sensor with fewer phases is read too
+    if(len > sizeof(espnow_message) && decodePhases(incomingData + sizeof(espnow_message), len - sizeof(espnow_message), &record))
+      phases.record(mac,name,record,now);
+    #endif
+  }
+
+  #if USING(GATEWAY_PAIR)
+  if(peer_online && peerOwns(mac))
+  {
+    enqueueFrame(peerQueue,nullptr,mac,incomingData,len); // held in loop() till the peer confirms it
+    return;
+  }
+  #endif
+  if(sender != nullptr && sender->priority)
+    enqueueFrame(priorityQueue,sender,mac,incomingData,len);
+  else
+    enqueueFrame(frameQueue,sender,mac,incomingData,len);
 };
 
+// the rings hold gateway_frame while the spool holds only the message, its receive time is not kept across a restart
+inline const gateway_frame& toFrame(const gateway_frame &frame) { return frame; }
+inline gateway_frame toFrame(const espnow_message &msg) { return gateway_frame{msg, 0, {0}}; }
+
+/*
+ * Moves frames from queue (an ingest ring or the spool) oldest first into the publish window until it is empty, the window is full or the budget of
+ * max_msgs frames / drain_budget_us microsecs counted from start is used up. The window publishes them and holds them until they are acknowledged
+ * Returns the no of frames moved
+ */
+template <typename Q>
+uint16_t drainQueue(Q &queue, uint16_t max_msgs, unsigned long start)
+{
+  uint16_t published = 0;
+  while(published < max_msgs && (micros() - start) < drain_budget_us && !inflight.isFull())
+  {
+    auto *item = queue.front();
+    if(item == nullptr)
+      break;
+    inflight.add(toFrame(*item));
+    queue.release();
+    published++;
+    pollAcks(); // a frame from the spool may have been read from flash
+  }
+  return published;
+}
+
+/*
+ * Publishes from both ingest rings within the budget of max_msgs frames / drain_budget_us microsecs counted from start
+ * Priority frames go first, except that after LOW_PRIORITY_SHARE priority frames in a row one normal frame is published so normal traffic is never starved
+ * Returns the no of frames published
+ */
+uint16_t drainRings(uint16_t max_msgs, unsigned long start)
+{
+  static priorityShare share(LOW_PRIORITY_SHARE);
+  uint16_t published = 0;
+  while(published < max_msgs && (micros() - start) < drain_budget_us)
+  {
+    bool use_priority = share.pickPriority(!priorityQueue.isEmpty(), !frameQueue.isEmpty());
+    if((use_priority ? drainQueue(priorityQueue,1,start) : drainQueue(frameQueue,1,start)) == 0)
+      break;
+    share.published(use_priority);
+    published++;
+  }
+  return published;
+}
+
+/*
+ * adds the p50/p90/p99/max of the histogram as an array under key, the caller resets it once the health message is out
+ */
+void addPercentiles(JsonObject obj, const char *key, logHistogram &hist)
+{
+  JsonArray arr = obj.createNestedArray(key);
+  arr.add(hist.percentile(50));
+  arr.add(hist.percentile(90));
+  arr.add(hist.percentile(99));
+  arr.add(hist.max());
+}
+
+/*
+ * publishes the sender table as a single JSON document, an array with an entry per sender :
+ * {"mac":"4C:F2:32:F0:74:2D","device":"main_door","age_s":12,"frames":340,"bytes":29920,"interval_s":180,"dups":3,"seq":1207,"lost":5,"replays":0}
+ * age_s is the time since the sender was last heard, interval_s the average time between its frames, seq the last sequence no received (0 for
+ * a sender without them), lost the sequence nos never received and replays the stale frames rejected
+ */
+bool publishSenderTable()
+{
+  static char senders_msg[SENDERS_MSG_LEN];
+  jsonWriter json(senders_msg, sizeof(senders_msg));
+  uint32_t now = millis();
+  bool first = true;
+  json.raw('[');
+  for(uint8_t i = 0; i < senders.capacity(); i++)
+  {
+    if(!senders.isUsed(i))
+      continue;
+    sender_entry &sender = senders.at(i);
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X", sender.mac[0], sender.mac[1], sender.mac[2], sender.mac[3], sender.mac[4], sender.mac[5]);
+    if(!first)
+      json.raw(',');
+    json.raw("{\"mac\":").string(mac, sizeof(mac));
+    json.raw(",\"device\":").string(sender.device_name, sizeof(sender.device_name));
+    json.raw(",\"age_s\":").uint((now - sender.last_seen) / 1000);
+    json.raw(",\"frames\":").uint(sender.frames);
+    json.raw(",\"bytes\":").uint(sender.bytes);
+    json.raw(",\"interval_s\":").uint(sender.interval / 1000);
+    json.raw(",\"dups\":").uint(sender.duplicates);
+    json.raw(",\"seq\":").uint(sender.last_seq);
+    json.raw(",\"lost\":").uint(sender.lost);
+    json.raw(",\"replays\":").uint(sender.replays);
+    json.raw('}');
+    first = false;
+  }
+  json.raw(']');
+  if(json.end() == 0)
+  {
+    DPRINTLN("publishSenderTable-Message too long");
+    return false;
+  }
+  return publishToMQTT(senders_msg,senders_topic,false);
+}
+
+#if USING(PHASE_STATS)
+/*
+ * adds the values of one percentile of every phase as an array under key, in micro secs
+ */
+void addPhaseValues(jsonWriter &json, const char *key, const phase_device &device, uint8_t pct)
+{
+  json.raw(key, strlen(key));
+  for(uint8_t p = 0; p < PHASE_COUNT; p++)
+  {
+    const phase_histogram &h = device.phases[p];
+    json.raw(p == 0 ? '[' : ',');
+    json.uint((uint32_t)(pct == 100 ? h.max : phaseTable<PHASE_DEVICES>::percentile(h, pct)) * PHASE_UNIT_US);
+  }
+  json.raw(']');
+}
+
+/*
+ * publishes the phase histograms of the sensors as a single JSON document, an array with an entry per device :
+ * {"mac":"4C:F2:32:F0:74:2D","device":"touch_sensor1","wakes":52,"n":[52,..],"p50_us":[1500,..],"p90_us":[3100,..],"max_us":[4200,..]}
+ * the arrays have a value per phase in the order of "phases", n is the no of samples of the phase, 0 for a phase the device doesnt measure
+ * Nothing is published till a device sends its phases
+ */
+bool publishPhaseTable()
+{
+  static char phases_msg[PHASES_MSG_LEN];
+  jsonWriter json(phases_msg, sizeof(phases_msg));
+  bool first = true;
+  json.raw("{\"phases\":[");
+  for(uint8_t p = 0; p < PHASE_COUNT; p++)
+  {
+    if(p > 0)
+      json.raw(',');
+    json.string(phase_names[p], 16);
+  }
+  json.raw("],\"devices\":[");
+  for(uint8_t i = 0; i < phases.capacity(); i++)
+  {
+    if(!phases.isUsed(i))
+      continue;
+    const phase_device &device = phases.at(i);
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X", device.mac[0], device.mac[1], device.mac[2], device.mac[3], device.mac[4], device.mac[5]);
+    if(!first)
+      json.raw(',');
+    json.raw("{\"mac\":").string(mac, sizeof(mac));
+    json.raw(",\"device\":").string(device.device_name, sizeof(device.device_name));
+    json.raw(",\"wakes\":").uint(device.records);
+    json.raw(",\"n\":");
+    for(uint8_t p = 0; p < PHASE_COUNT; p++)
+    {
+      json.raw(p == 0 ? '[' : ',');
+      json.uint(phaseTable<PHASE_DEVICES>::count(device.phases[p]));
+    }
+    json.raw(']');
+    addPhaseValues(json, ",\"p50_us\":", device, 50);
+    addPhaseValues(json, ",\"p90_us\":", device, 90);
+    addPhaseValues(json, ",\"max_us\":", device, 100);
+    json.raw('}');
+    first = false;
+  }
+  json.raw("]}");
+  if(first)
+    return true;
+  if(json.end() == 0)
+  {
+    DPRINTLN("publishPhaseTable-Message too long");
+    return false;
+  }
+  return publishToMQTT(phases_msg,phases_topic,false);
+}
+#endif
+
+/*
+ * publishes the IP address and the RSSI, retained
+ */
+bool publishWiFiMessage()
+{
+  strIP_address = WiFi.localIP().toString();
+  StaticJsonDocument<JSON_OBJECT_SIZE(2) + 32> wifi_msg_json;//It is recommended to create a new obj than reuse the earlier one by ArduinoJson. The IP address string is copied in
+  wifi_msg_json["ip_address"] = strIP_address;
+  wifi_msg_json["rssi"] = WiFi.RSSI();
+  String str_msg="";
+  serializeJson(wifi_msg_json,str_msg);
+  return publishToMQTT(str_msg.c_str(),wifi_topic,true);
+}
+
 /*
  * creates data for health message and publishes it
  * takes bool param init , if true then publishes the startup message else publishes the health check message
  */
 bool publishHealthMessage(bool init=false)
 {
-  char publish_topic[65] = "";
   String str_msg="";
 
   if(init)
   {
      // publish the init message
-    StaticJsonDocument<MAX_MESSAGE_LEN> init_msg_json;//It is recommended to create a new obj than reuse the earlier one by ArduinoJson
+    StaticJsonDocument<JSON_OBJECT_SIZE(5) + 48> init_msg_json;//It is recommended to create a new obj than reuse the earlier one by ArduinoJson. The 2 MAC strings are copied in
     init_msg_json["version"] = compile_version;
     init_msg_json["tot_memKB"] = (float)ESP.getFlashChipSize() / 1024.0;
     init_msg_json["mac"] = WiFi.macAddress();
     init_msg_json["macAP"] = WiFi.softAPmacAddress();
     init_msg_json["wifiChannel"] = WiFi.channel();
-    strcpy(publish_topic,MQTT_TOPIC);
-    strcat(publish_topic,"/init");
     str_msg="";
     serializeJson(init_msg_json,str_msg);
-    return publishToMQTT(str_msg.c_str(),publish_topic,true);
+    return publishToMQTT(str_msg.c_str(),init_topic,true);
   }
   else
   {
-    StaticJsonDocument<MAX_MESSAGE_LEN> msg_json;
+    static StaticJsonDocument<HEALTH_MSG_LEN> msg_json; // static, the 4KB stack of loop() cant spare it
+    msg_json.clear();
     msg_json["uptime"] = millis()/1000; //publish uptime in seconds
     msg_json["mem_freeKB"] = serialized(String((float)ESP.getFreeHeap()/ 1024.0,0));//Ref:https://arduinojson.org/v6/how-to/configure-the-serialization-of-floats/
     msg_json["msg_count"] = message_count;
-    msg_json["queue_len"] = structQueue.itemCount();
+    msg_json["queue_len"] = frameQueue.count();
+    msg_json["queue_max"] = frameQueue.highWater();
+    msg_json["lost"] = frameQueue.lost();
+    msg_json["prio_len"] = priorityQueue.count();
+    msg_json["prio_max"] = priorityQueue.highWater();
+    msg_json["prio_lost"] = priorityQueue.lost();
+    msg_json["inflight"] = inflight.count();
+    msg_json["inflight_max"] = inflight.highWater();
+    msg_json["retx"] = inflight.retransmits();
+    // seconds spent in each connection state since boot and the no of times WiFi/MQTT went down
+    unsigned long now = millis();
+    msg_json["wifi_down_s"] = connection.timeIn(LINK_WIFI_DOWN,now) / 1000;
+    msg_json["mqtt_down_s"] = connection.timeIn(LINK_MQTT_DOWN,now) / 1000;
+    msg_json["up_s"] = connection.timeIn(LINK_UP,now) / 1000;
+    msg_json["wifi_drops"] = connection.entries(LINK_WIFI_DOWN);
+    msg_json["mqtt_drops"] = connection.entries(LINK_MQTT_DOWN);
+    msg_json["reconnects"] = connection.entries(LINK_UP) > 0 ? connection.entries(LINK_UP) - 1 : 0;
+    // frames lost anywhere in the pipeline : rings full, spool over its retention cap, unpublishable
+    uint32_t drops = frameQueue.lost() + priorityQueue.lost() + inflight.dropped();
+    #if USING(SPOOL)
+    drops += spool.discarded();
+    #endif
+    msg_json["drops"] = drops;
+    #if USING(COALESCE)
+    msg_json["coalesced"] = coalesced;
+    #endif
+    msg_json["probes"] = probes;
+    #if USING(APP_ACK)
+    msg_json["acks"] = acks_sent;
+    msg_json["ack_fails"] = acks_failed;
+    #endif
+    #if USING(MAILBOX)
+    msg_json["mailbox"] = commands.count();
+    msg_json["cmd_delivered"] = cmd_delivered;
+    msg_json["cmd_failed"] = cmd_failed;
+    #endif
+    #if USING(GATEWAY_PAIR)
+    msg_json["peer_online"] = (bool)peer_online;
+    msg_json["peer_held"] = peerHold.count() + peerQueue.count();
+    msg_json["peer_confirmed"] = peer_confirmed;
+    msg_json["peer_takeover"] = peer_takeover;
+    #endif
+    JsonObject lat = msg_json.createNestedObject("lat_us"); // [p50,p90,p99,max] over the last HEALTH_INTERVAL
+    addPercentiles(lat,"wait",queueWait);
+    addPercentiles(lat,"pub",publishTime);
+    addPercentiles(lat,"loop",loopTime);
+    msg_json["topic_hit"] = deviceTopics.hits();
+    msg_json["topic_miss"] = deviceTopics.misses();
+    msg_json["topic_evict"] = deviceTopics.evictions();
+    #if USING(SPOOL)
+    msg_json["spool_len"] = spool.count();
+    msg_json["spooled"] = spool.spooled();
+    msg_json["replayed"] = spool.replayed();
+    msg_json["spool_discarded"] = spool.discarded();
+    #endif
+    msg_json["dup_count"] = senders.duplicates();
+    JsonObject dups = msg_json.createNestedObject("dups"); // duplicates dropped per device, only devices with duplicates are listed
+    for(uint8_t i = 0; i < senders.capacity(); i++)
+    {
+      sender_entry &sender = senders.at(i);
+      if(senders.isUsed(i) && sender.duplicates > 0)
+      {
+        char name[sizeof(sender.device_name) + 1];
+        memcpy(name, sender.device_name, sizeof(sender.device_name));
+        name[sizeof(sender.device_name)] = '\0';
+        dups[name] = sender.duplicates; // JsonObject copies the key as name is a char[]
+      }
+    }
+    msg_json["replays"] = senders.replays();
+    JsonObject loss = msg_json.createNestedObject("loss_pct"); // end to end loss per device from the gaps in its sequence nos, only devices with losses are listed
+    for(uint8_t i = 0; i < senders.capacity(); i++)
+    {
+      sender_entry &sender = senders.at(i);
+      if(senders.isUsed(i) && sender.lost > 0)
+      {
+        char name[sizeof(sender.device_name) + 1];
+        memcpy(name, sender.device_name, sizeof(sender.device_name));
+        name[sizeof(sender.device_name)] = '\0';
+        loss[name] = serialized(String(senders.lossPermille(sender) / 10.0, 1));
+      }
+    }
     float message_rate = (message_count - last_message_count)/(float)(HEALTH_INTERVAL/(60*1000));//rate calculated over one minute
     last_message_count = message_count;//reset the count
     msg_json["msg_rate"] = serialized(String(message_rate,1));//format with 1 decimal places, Ref:https://arduinojson.org/v6/how-to/configure-the-serialization-of-floats/
 
-    // create a path for this specific device which is of the form MQTT_BASE_TOPIC/<master_id> , master_id is usually the mac address stripped off the colon eg. MQTT_BASE_TOPIC/2CF43220842D
-    strcpy(publish_topic,MQTT_TOPIC);
-    strcat(publish_topic,"/state");
     serializeJson(msg_json,str_msg);
-    if(publishToMQTT(str_msg.c_str(),publish_topic,false))
+    if(publishToMQTT(str_msg.c_str(),state_topic,false))
     {
-      // publish the wifi message , I am publishing this everytime because it also has rssi
-      strIP_address = WiFi.localIP().toString();
-      StaticJsonDocument<MAX_MESSAGE_LEN> wifi_msg_json;//It is recommended to create a new obj than reuse the earlier one by ArduinoJson
-      wifi_msg_json["ip_address"] = strIP_address;
-      wifi_msg_json["rssi"] = WiFi.RSSI();
-      strcpy(publish_topic,MQTT_TOPIC);
-      strcat(publish_topic,"/wifi");
-      str_msg="";
-      serializeJson(wifi_msg_json,str_msg);
-      return publishToMQTT(str_msg.c_str(),publish_topic,true);
-   }
+      // the latencies start over for the next interval only once they are out, a failed publish carries them into the next one
+      queueWait.reset();
+      publishTime.reset();
+      loopTime.reset();
+      return publishWiFiMessage(); // I am publishing this everytime because it also has rssi
+    }
   }
-  return false;//control will never come here
+  return false;
 }
 
 void printInitInfo()
@@ -365,30 +1378,39 @@ void setup() {
   // For Station Mode
   //wifi_set_macaddr(STATION_IF, &newMACAddress[0]);
 
-  // Set device as a Wi-Fi Station
+  // the connection is tracked from these events, see updateConnection()
+  wifiGotIPHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &event) { wifi_up = true; });
+  wifiDisconnectedHandler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected &event) { wifi_up = false; });
+  mqttClient.setServer(mqtt_broker, mqtt_port);// from secrets.h
+  mqttClient.setCredentials(mqtt_uname,mqtt_pswd);// from secrets.h
+  mqttClient.setClientId(DEVICE_NAME);
+  mqttClient.setWill(lwt_topic,0,true,"offline");
+  mqttClient.onConnect(OnMqttConnect);
+  mqttClient.onDisconnect(OnMqttDisconnect);
+  mqttClient.onPublish(OnMqttPublish);
+  #if USING(GATEWAY_PAIR) || USING(MAILBOX)
+  mqttClient.onMessage(OnMqttMessage);
+  #endif
+
+  // Set device as a Wi-Fi Station, the connection is made in the background. ESP-NOW is started right after so no frame is lost while WiFi comes up
+  // (frames are received once the radio is on the router's channel, which is where the controllers send)
+  WiFi.setAutoReconnect(true);
   WiFi.begin(ssid, password);
+  #if USING(APP_ACK)
+  configTime(0, 0, NTP_SERVER); // UTC, synced in the background once WiFi is up
+  #endif
   DPRINTLN("Setting as a Wi-Fi Station..");
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    DPRINT(".");
-  }
-  DPRINT("Station IP Address: ");
-  DPRINTLN(WiFi.localIP());
-  DPRINT("Wi-Fi Channel: ");
-  DPRINTLN(WiFi.channel());
-  WiFi.setAutoReconnect(true);
-
-  if((WiFi.status() == WL_CONNECTED))
-  {
-    client.setServer(mqtt_broker, mqtt_port);// from secrets.h
-  }
   // Init ESP-NOW
   if (esp_now_init() != ESP_OK) {
     DPRINTLN("Error initializing ESP-NOW");
     return;
   }
   
+  #if USING(MAILBOX) || USING(APP_ACK)
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO); // sends commands and acks to the sensors too
+  #else
   esp_now_set_self_role(MY_ROLE);
+  #endif
   #if USING(SECURITY)
   // Setting the PMK key
   esp_now_set_kok(kok, KEY_LEN);
@@ -401,6 +1423,16 @@ void setup() {
   }
    #endif
 
+  #if USING(SPOOL)
+  // mount the filesystem before frames start coming in, anything spooled before a restart is replayed once MQTT is up
+  if(!LittleFS.begin())
+    {DPRINTLN("Failed to mount LittleFS, spool not available");}
+  else if(!spool.begin())
+    {DPRINTLN("Failed to write the spool directory, spool not available");}
+  else
+    {DPRINTFLN("Spool ready with %u frames",spool.count());}
+  #endif
+
   esp_now_register_send_cb(OnDataSent);
   esp_now_register_recv_cb(OnDataRecv);
   DPRINT("WiFi address:");DPRINTLN(WiFi.macAddress());
@@ -437,10 +1469,7 @@ void setup() {
       DPRINTLN("End Failed");
     }
   });
-  ArduinoOTA.begin();
-  reconnectMQTT(); //connect to MQTT before publishing the startup message
-  if(publishHealthMessage(true)) //publish the startup message
-    initilised = true;
+  ArduinoOTA.begin(); // the startup message is published from loop() once MQTT is connected
   #if USING(MOTION_SENSOR)
   if(!motion_sensor.begin(MOTION_SENSOR_NAME)) //initialize the motion sensor
     DPRINTLN("Failed to initialize motion sensor");
@@ -453,64 +1482,110 @@ void setup() {
  * runs the loop to check for incoming messages in the queue, picks them up and posts them to MQTT
  */
 void loop() {
-  //check for MQTT connection
-  if (!client.connected()) 
-  {
-    reconnectMQTT(); // Attempt to reconnect
-  } else {
-    client.loop(); // Client connected
-  }
-  MQTT_wd.update(client.connected()); //feed the watchdog by calling update
+  static unsigned long last_loop = 0;
+  unsigned long loop_start = micros();
+  if(last_loop != 0)
+    loopTime.record(loop_start - last_loop);
+  last_loop = loop_start;
+  pollAcks(); // first thing, the senders wait for them
+  #if USING(MAILBOX)
+  sendCommand(); // first thing, the sensor is listening only for a few millisecs
+  #endif
+
+  //check for WiFi/MQTT connection, reconnects if needed
+  bool connected = updateConnection();
+  MQTT_wd.update(connected); //feed the watchdog by calling update
+  if(!initilised && connected && publishHealthMessage(true)) //publish the startup message once
+    initilised = true;
+  #if USING(MAILBOX)
+  if(connected)
+    publishCommandStatus();
+  #endif
   
   #if USING(MOTION_SENSOR)
   short motion_state = motion_sensor.update();
   if(motion_state == 1)
   {
     DPRINTLN("Motion detected as ON");
-    publishMotionMsgToMQTT(motion_sensor.getSensorName(),"on");
+    publishMotionMsgToMQTT("on");
   }
   else if(motion_state == 2)
   {
     DPRINTLN("Motion detected as OFF");
-    publishMotionMsgToMQTT(motion_sensor.getSensorName(),"off");
+    publishMotionMsgToMQTT("off");
   }
   #endif
 
   ArduinoOTA.handle();
   
-  if(client.connected())
-  {
-    if(!structQueue.isEmpty())
-      if(!retry_message)
-        currentMessage = structQueue.dequeue();
-      //else last message content is still there is currentMessage
-    
-    if(currentMessage != emptyMessage)
+  if(connected)
+  {
+    mqtt_down_since = 0;
+    unsigned long drain_start = micros();
+    uint16_t published = 0;
+    #if USING(SPOOL)
+    // spooled frames (of both classes) are older than the ones in the rings, the rings are drained only once the spool is empty
+    // so that the order within each class is kept
+    published = drainQueue(spool, drain_budget_msgs, drain_start);
+    if(spool.isEmpty())
+    #endif
+      drainRings(drain_budget_msgs - published, drain_start);
+  }
+  else if(mqtt_down_since == 0)
+    mqtt_down_since = millis() | 1;
+  // sends what was moved into the window, resends what timed out and counts what was acknowledged
+  message_count += inflight.update(millis(),
+    [](const gateway_frame &frame, bool dup, uint16_t packet_id) {
+      unsigned long start = micros();
+      int32_t result = publishToMQTT(frame.msg,dup,packet_id);
+      publishTime.record(micros() - start);
+      pollAcks();
+      return result;
+    },
+    [](const gateway_frame &frame) {
+      if(frame.rx_time != 0)
+        queueWait.record(micros() - frame.rx_time);
+      #if USING(GATEWAY_PAIR)
+      confirmFrame(frame);
+      #endif
+    });
+  #if USING(GATEWAY_PAIR)
+  updatePair();
+  #endif
+
+  #if USING(SPOOL)
+  // publishing is stalled, move frames out of the ring before it fills up or a watchdog restart loses them
+  if(mqtt_down_since != 0)
+  {
+    bool stalled = (millis() - mqtt_down_since) > SPOOL_AFTER;
+    gateway_frame *frame;
+    while((stalled || priorityQueue.count() > PRIORITY_QUEUE_LENGTH / 2) && (frame = priorityQueue.front()) != nullptr)
     {
-      if(publishToMQTT(currentMessage))
-      {
-        message_count++;
-        currentMessage = emptyMessage;
-      }
-      else
-      {
-        retry_message = true;
-      }//else the same message will be retried the next time
+      spool.append(frame->msg, millis());
+      priorityQueue.release();
+    }
+    while((stalled || frameQueue.count() > SPOOL_WATERMARK) && (frame = frameQueue.front()) != nullptr)
+    {
+      spool.append(frame->msg, millis());
+      frameQueue.release();
     }
   }
+  spool.update(millis());
+  pollAcks();
+  #endif
 
   // try to publish health message irrespective of the state of espnow messages
   if(millis() - last_time > HEALTH_INTERVAL)
   {
-    // It might be possible when the ESP comes up MQTT is down, in that case an init message will not get published in setup()
-    // The statement below will check and publish the same , only once
-    if(!initilised)
-    {
-      if(publishHealthMessage(true))
-        initilised = true;
-    }
     //Now publish the health message
     publishHealthMessage();
+    pollAcks();
+    publishSenderTable();
+    pollAcks();
+    #if USING(PHASE_STATS)
+    publishPhaseTable();
+    pollAcks();
+    #endif
     last_time = millis(); // This is reset irrespective of a successful publish else the main loop will continously try to publish this message
   }
   statusLED.loop();
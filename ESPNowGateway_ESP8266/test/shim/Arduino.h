@@ -0,0 +1,101 @@
+/*
+ * Arduino.h - stand-in for the ESP8266 Arduino core in the native tests, only what the headers under test and src/main.cpp use
+ * millis(), micros() and delay() run on the virtual clock (simClock.h). ARDUINO is not defined, so shared headers take their host paths
+ */
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "simClock.h"
+#include "WString.h"
+
+typedef uint8_t byte;
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define SERIAL_8N1 0x1c
+#define SERIAL_TX_ONLY 2
+
+// unsigned long is 64 bit on the host, the values are truncated to 32 bits so they wrap as on the ESP8266
+inline unsigned long millis() { return (uint32_t)(simTime().now_us / 1000); }
+inline unsigned long micros() { return (uint32_t)simTime().now_us; }
+inline void delay(unsigned long ms) { simAdvance((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { simAdvance(us); }
+inline void yield() {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+// newlib has it on the ESP8266, glibc only from 2.38
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if(size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+inline void configTime(int, int, const char*, const char* = nullptr, const char* = nullptr) {} // time() is the host's
+inline uint32_t system_get_rtc_time() { return (uint32_t)simTime().now_us; }
+inline uint32_t system_rtc_clock_cali_proc() { return 1 << 12; }
+
+class simSerial
+{
+    public:
+    void begin(unsigned long, uint8_t = SERIAL_8N1, uint8_t = 0) {}
+    template <typename... A> size_t print(A...) { return 0; }
+    template <typename... A> size_t println(A...) { return 0; }
+    template <typename... A> size_t printf(const char*, A...) { return 0; }
+    void flush() {}
+    void end() {}
+};
+
+inline simSerial Serial;
+
+/*
+ * RTC user memory (128 blocks of 4 bytes) survives restart(), as it survives deep sleep on the ESP8266. powerCut() garbles it
+ */
+class simEsp
+{
+    public:
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+    {
+        if(offset * 4 + size > sizeof(rtc))
+            return false;
+        memcpy(data, rtc + offset * 4, size);
+        return true;
+    }
+
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+    {
+        if(offset * 4 + size > sizeof(rtc))
+            return false;
+        memcpy(rtc + offset * 4, data, size);
+        return true;
+    }
+
+    void restart() { restarts++; }
+    void powerCut() { memset(rtc, 0x5A, sizeof(rtc)); }
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getFlashChipSize() { return 1048576; }
+
+    uint8_t rtc[512] = {};
+    uint32_t restarts = 0;
+};
+
+inline simEsp ESP;
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * ArduinoOTA.h - stand-in for the ESP8266 ArduinoOTA library in the native tests, nothing ever arrives over the air
+ */
+
+#ifndef SIM_ARDUINO_OTA_H
+#define SIM_ARDUINO_OTA_H
+
+#include <functional>
+
+#define U_FLASH 0
+#define U_FS 100
+
+typedef enum
+{
+    OTA_AUTH_ERROR,
+    OTA_BEGIN_ERROR,
+    OTA_CONNECT_ERROR,
+    OTA_RECEIVE_ERROR,
+    OTA_END_ERROR
+} ota_error_t;
+
+class simArduinoOTA
+{
+    public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    void onStart(THandlerFunction) {}
+    void onEnd(THandlerFunction) {}
+    void onProgress(std::function<void(unsigned int, unsigned int)>) {}
+    void onError(std::function<void(ota_error_t)>) {}
+    void begin(bool = true) {}
+    void handle() { handled++; }
+    int getCommand() { return U_FLASH; }
+
+    uint32_t handled = 0;
+};
+
+inline simArduinoOTA ArduinoOTA;
+
+#endif
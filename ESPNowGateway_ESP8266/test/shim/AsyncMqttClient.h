@@ -0,0 +1,119 @@
+/*
+ * AsyncMqttClient.h - stand-in for AsyncMqttClient in the native tests, connected to the simulated broker (mqttBroker() in simBroker.h)
+ * connect() completes connect_us later on the virtual clock if WiFi is up and the broker online, else it fails after connect_us.
+ * The callbacks run from the clock's events, between passes of loop() as on the ESP8266
+ */
+
+#ifndef SIM_ASYNC_MQTT_CLIENT_H
+#define SIM_ASYNC_MQTT_CLIENT_H
+
+#include <functional>
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "simBroker.h"
+
+enum class AsyncMqttClientDisconnectReason : int8_t
+{
+    TCP_DISCONNECTED = 0,
+    MQTT_UNACCEPTABLE_PROTOCOL_VERSION = 1,
+    MQTT_IDENTIFIER_REJECTED = 2,
+    MQTT_SERVER_UNAVAILABLE = 3,
+    MQTT_MALFORMED_CREDENTIALS = 4,
+    MQTT_NOT_AUTHORIZED = 5,
+    ESP8266_NOT_ENOUGH_SPACE = 6,
+    TLS_BAD_FINGERPRINT = 7
+};
+
+struct AsyncMqttClientMessageProperties
+{
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
+class AsyncMqttClient
+{
+    public:
+    typedef std::function<void(bool session_present)> OnConnectUserCallback;
+    typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+    typedef std::function<void(uint16_t packet_id)> OnPublishUserCallback;
+    typedef std::function<void(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)> OnMessageUserCallback;
+
+    AsyncMqttClient& setServer(IPAddress, uint16_t) { return *this; }
+    AsyncMqttClient& setCredentials(const char*, const char* = nullptr) { return *this; }
+    AsyncMqttClient& setClientId(const char*) { return *this; }
+    AsyncMqttClient& setWill(const char*, uint8_t, bool, const char* = nullptr, size_t = 0) { return *this; }
+    AsyncMqttClient& onConnect(OnConnectUserCallback cb) { _on_connect = cb; return *this; }
+    AsyncMqttClient& onDisconnect(OnDisconnectUserCallback cb) { _on_disconnect = cb; return *this; }
+
+    AsyncMqttClient& onPublish(OnPublishUserCallback cb)
+    {
+        mqttBroker().on_puback = cb;
+        return *this;
+    }
+
+    AsyncMqttClient& onMessage(OnMessageUserCallback cb)
+    {
+        mqttBroker().on_message = [cb](const char *topic, const char *payload, size_t len)
+        {
+            std::string t(topic), p(payload, len);
+            cb(&t[0], &p[0], AsyncMqttClientMessageProperties{1, false, false}, len, 0, len);
+        };
+        return *this;
+    }
+
+    bool connected() const { return mqttBroker().connected(); }
+
+    void connect()
+    {
+        if(_connecting || connected())
+            return;
+        _connecting = true;
+        simSchedule(connect_us, [this]()
+        {
+            _connecting = false;
+            simBroker &broker = mqttBroker();
+            if(WiFi.isConnected() && broker.online)
+            {
+                broker.connect();
+                broker.subscriptions.clear(); // clean session
+                if(_on_connect)
+                    _on_connect(false);
+            }
+            else if(_on_disconnect)
+                _on_disconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+        });
+    }
+
+    void disconnect(bool = false)
+    {
+        if(!connected())
+            return;
+        mqttBroker().disconnect();
+        if(_on_disconnect)
+            _on_disconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+
+    uint16_t subscribe(const char *topic, uint8_t)
+    {
+        if(!connected())
+            return 0;
+        mqttBroker().subscribe(topic);
+        return 1;
+    }
+
+    uint16_t publish(const char *topic, uint8_t qos, bool retain, const char *payload = nullptr, size_t length = 0, bool dup = false, uint16_t message_id = 0)
+    {
+        simBusy(mqttBroker().publish_us);
+        return mqttBroker().publish(topic, qos, retain, payload, length, dup, message_id);
+    }
+
+    uint32_t connect_us = 50000; // TCP and MQTT CONNECT/CONNACK
+
+    private:
+    bool _connecting = false;
+    OnConnectUserCallback _on_connect;
+    OnDisconnectUserCallback _on_disconnect;
+};
+
+#endif
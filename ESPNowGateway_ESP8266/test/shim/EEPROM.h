@@ -0,0 +1,52 @@
+/*
+ * EEPROM.h - stand-in for the ESP8266 EEPROM library in the native tests, the contents survive ESP.restart() and ESP.powerCut()
+ * A commit() takes commit_us of the virtual clock, the sector erase and write of the real one
+ */
+
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "simClock.h"
+
+class simEEPROM
+{
+    public:
+    simEEPROM() { erase(); }
+
+    void begin(size_t size) { _size = size < sizeof(_data) ? size : sizeof(_data); }
+    uint8_t read(int address) const { return _data[address]; }
+    void write(int address, uint8_t value) { _data[address] = value; }
+    bool commit()
+    {
+        commits++;
+        simBusy(commit_us);
+        return true;
+    }
+    void erase() { memset(_data, 0xFF, sizeof(_data)); }
+
+    template <typename T>
+    T& get(int address, T &t) const
+    {
+        memcpy(&t, _data + address, sizeof(T));
+        return t;
+    }
+
+    template <typename T>
+    const T& put(int address, const T &t)
+    {
+        memcpy(_data + address, &t, sizeof(T));
+        return t;
+    }
+
+    uint32_t commits = 0; // flash writes, to check the wear
+    uint32_t commit_us = 0;
+    private:
+    uint8_t _data[512];
+    size_t _size = 0;
+};
+
+inline simEEPROM EEPROM;
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * ESP8266WiFi.h - stand-in for the ESP8266 WiFi library in the native tests, the channel and the scan come from the simulated radio (simRadio.h)
+ * The station's link to the access point runs on the virtual clock : begin() connects connect_us later if the access point is up (apUp()),
+ * apDown() drops the link and with auto reconnect it comes back connect_us after apUp(). The got IP/disconnected events are raised as they happen
+ */
+
+#ifndef SIM_ESP8266WIFI_H
+#define SIM_ESP8266WIFI_H
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "simRadio.h"
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+#define STATION_IF 0
+#define SOFTAP_IF 1
+
+class IPAddress
+{
+    public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{a, b, c, d} {}
+    uint8_t operator[](int i) const { return _bytes[i]; }
+    String toString() const
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+        return String(buf);
+    }
+
+    private:
+    uint8_t _bytes[4] = {0, 0, 0, 0};
+};
+
+struct WiFiEventStationModeGotIP { IPAddress ip; };
+struct WiFiEventStationModeDisconnected { uint8_t reason; };
+struct WiFiEventHandlerOpaque { std::function<void()> on_event; };
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler; // the handler stays registered while the caller keeps this
+
+class simWiFi
+{
+    public:
+    bool mode(WiFiMode_t m) { _mode = m; return true; }
+    bool config(IPAddress ip, IPAddress, IPAddress) { _ip = ip; return true; }
+    bool hostname(const char*) { return true; }
+    bool setAutoReconnect(bool on) { _auto_reconnect = on; return true; }
+
+    void begin(const char*, const char* = nullptr)
+    {
+        _begun = true;
+        scheduleConnect();
+    }
+
+    bool disconnect(bool = false)
+    {
+        _begun = false;
+        linkDown();
+        return true;
+    }
+
+    bool isConnected() const { return _connected; }
+    IPAddress localIP() const { return _connected ? _ip : IPAddress(); }
+    int32_t channel() const { return radio().channel; }
+    int32_t RSSI() const { return _connected ? -60 : 31; }
+    String macAddress() const { return String("5C:CF:7F:00:00:01"); }
+    String softAPmacAddress() const { return String("5C:CF:7F:00:00:02"); }
+
+    WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f)
+    {
+        WiFiEventHandler handler = std::make_shared<WiFiEventHandlerOpaque>();
+        handler->on_event = [this, f]() { f(WiFiEventStationModeGotIP{_ip}); };
+        _got_ip.push_back(handler);
+        return handler;
+    }
+
+    WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> f)
+    {
+        WiFiEventHandler handler = std::make_shared<WiFiEventHandlerOpaque>();
+        handler->on_event = [f]() { f(WiFiEventStationModeDisconnected{201}); }; // NO_AP_FOUND
+        _disconnected.push_back(handler);
+        return handler;
+    }
+
+    /*
+     * blocks for the scan time of the simulated radio like the real one, returns the no of access points found
+     */
+    int8_t scanNetworks()
+    {
+        scans++;
+        delay(radio().scan_us / 1000);
+        return (int8_t)radio().access_points.size();
+    }
+
+    std::string SSID(uint8_t i) const { return radio().access_points[i].ssid; }
+    int32_t channel(uint8_t i) const { return radio().access_points[i].channel; }
+
+    // ************ the access point, set by the test *******************
+    void apDown()
+    {
+        _ap_up = false;
+        linkDown();
+    }
+
+    void apUp()
+    {
+        _ap_up = true;
+        if(_auto_reconnect)
+            scheduleConnect();
+    }
+
+    uint32_t connect_us = 500000; // association, DHCP
+    uint32_t scans = 0;
+    uint32_t drops = 0; // disconnected events raised
+
+    /*
+     * back to a station that has not begun, for setUp(). The event handlers stay registered
+     */
+    void reset()
+    {
+        _begun = _connected = false;
+        _ap_up = true;
+        _attempt++;
+        drops = scans = 0;
+    }
+
+    private:
+    void scheduleConnect()
+    {
+        uint32_t attempt = ++_attempt;
+        simSchedule(connect_us, [this, attempt]()
+        {
+            if(attempt != _attempt || !_begun || !_ap_up || _connected)
+                return;
+            _connected = true;
+            raise(_got_ip);
+        });
+    }
+
+    void linkDown()
+    {
+        _attempt++;
+        if(!_connected)
+            return;
+        _connected = false;
+        drops++;
+        raise(_disconnected);
+    }
+
+    static void raise(std::vector<std::weak_ptr<WiFiEventHandlerOpaque>> &handlers)
+    {
+        for(auto &h : handlers)
+            if(WiFiEventHandler handler = h.lock())
+                handler->on_event();
+    }
+
+    WiFiMode_t _mode = WIFI_OFF;
+    IPAddress _ip = IPAddress(192, 168, 1, 11);
+    bool _begun = false;
+    bool _connected = false;
+    bool _ap_up = true;
+    bool _auto_reconnect = false;
+    uint32_t _attempt = 0; // a scheduled connect is void once this moves on
+    std::vector<std::weak_ptr<WiFiEventHandlerOpaque>> _got_ip;
+    std::vector<std::weak_ptr<WiFiEventHandlerOpaque>> _disconnected;
+};
+
+inline simWiFi WiFi;
+
+inline uint8_t wifi_get_channel() { return radio().channel; }
+inline bool wifi_set_channel(uint8_t channel) { radio().channel = channel; return true; }
+inline bool wifi_set_macaddr(uint8_t, uint8_t*) { return true; }
+inline void wifi_promiscuous_enable(uint8_t) {}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * FS.h - stand-in for the ESP8266 core's fs::FS in the native tests, a filesystem on a host directory through fileStorage.h so power
+ * cuts and flash time work as in the spool tests. begin() makes a fresh temporary directory the first time, format() empties it, it is
+ * removed at exit
+ */
+
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "WString.h"
+#include "fileStorage.h"
+
+namespace fs
+{
+
+typedef fileStorage::file File;
+
+class Dir
+{
+    public:
+    bool next() { return ++_next < _entries.size(); }
+    String fileName() const { return String(_entries[_next].first); }
+    size_t fileSize() const { return _entries[_next].second; }
+
+    std::vector<std::pair<std::string, size_t>> _entries;
+    size_t _next = (size_t)-1;
+};
+
+class FS
+{
+    public:
+    ~FS()
+    {
+        _storage.reset();
+        if(!_root.empty())
+            system(("rm -rf " + _root).c_str());
+    }
+
+    bool begin()
+    {
+        if(_root.empty())
+        {
+            char root[] = "/tmp/littlefsXXXXXX";
+            if(mkdtemp(root) == nullptr)
+                return false;
+            _root = root;
+        }
+        if(!_storage)
+            _storage.reset(new fileStorage(_root));
+        return true;
+    }
+
+    bool format()
+    {
+        if(!begin())
+            return false;
+        std::string cmd = "rm -rf " + _root + "/*";
+        _storage.reset(new fileStorage(_root));
+        return system(cmd.c_str()) == 0;
+    }
+
+    void end() { _storage.reset(); }
+
+    File open(const char *path, const char *mode) { return _storage ? _storage->open(path, mode) : File(); }
+    bool remove(const char *path) { return _storage && _storage->remove(path); }
+    bool mkdir(const char *path) { return _storage && _storage->mkdir(path); }
+
+    Dir openDir(const char *path)
+    {
+        Dir dir;
+        if(_storage)
+            _storage->list(path, [&dir](const char *name, size_t size) { dir._entries.push_back(std::make_pair(std::string(name), size)); });
+        return dir;
+    }
+
+    // the flash behind it, for a test to cut the power or set the time an access takes. Valid after begin()
+    fileStorage& storage() { return *_storage; }
+
+    private:
+    std::string _root;
+    std::unique_ptr<fileStorage> _storage;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::Dir;
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * LittleFS.h - stand-in for the ESP8266 core's LittleFS in the native tests, see FS.h
+ */
+
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include "FS.h"
+
+inline fs::FS LittleFS;
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Pinger.h - stand-in for ESP8266-ping in the native tests, the gateway only declares one
+ */
+
+#ifndef SIM_PINGER_H
+#define SIM_PINGER_H
+
+class Pinger
+{
+    public:
+    bool Ping(const char*, unsigned int = 5, unsigned int = 1000) { return true; }
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * WString.h - stand-in for the Arduino String class in the native tests, on a std::string. Only what the gateway and ArduinoJson
+ * (with ARDUINOJSON_ENABLE_ARDUINO_STRING) use
+ */
+
+#ifndef SIM_WSTRING_H
+#define SIM_WSTRING_H
+
+#include <stdio.h>
+#include <string>
+
+class String
+{
+    public:
+    String(const char *s = "") : _s(s != nullptr ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned int v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+    String(unsigned char v) : _s(std::to_string(v)) {}
+    String(float v, unsigned char decimals = 2) : String((double)v, decimals) {}
+    String(double v, unsigned char decimals = 2)
+    {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        _s = buf;
+    }
+
+    // ArduinoJson assigns a null pointer to clear the string before writing to it
+    String& operator=(const char *s) { _s = s != nullptr ? s : ""; return *this; }
+
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return (unsigned int)_s.size(); }
+    bool reserve(unsigned int size) { _s.reserve(size); return true; }
+    char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : '\0'; }
+
+    bool concat(const String &s) { _s += s._s; return true; }
+    bool concat(const char *s) { if(s != nullptr) _s += s; return true; }
+    bool concat(const char *s, unsigned int len) { _s.append(s, len); return true; }
+    bool concat(char c) { _s += c; return true; }
+    String& operator+=(const String &s) { _s += s._s; return *this; }
+    String& operator+=(const char *s) { concat(s); return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+
+    void replace(const String &find, const String &with)
+    {
+        if(find._s.empty())
+            return;
+        for(size_t pos = _s.find(find._s); pos != std::string::npos; pos = _s.find(find._s, pos + with._s.size()))
+            _s.replace(pos, find._s.size(), with._s);
+    }
+
+    bool operator==(const String &s) const { return _s == s._s; }
+    bool operator==(const char *s) const { return s != nullptr && _s == s; }
+    bool operator!=(const String &s) const { return _s != s._s; }
+
+    friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+    friend String operator+(const String &a, const char *b) { return String(a._s + (b != nullptr ? b : "")); }
+    friend String operator+(const char *a, const String &b) { return String((a != nullptr ? a : "") + b._s); }
+
+    private:
+    std::string _s;
+};
+
+// what String + String yields in the core, ArduinoJson names it
+class StringSumHelper : public String
+{
+    public:
+    StringSumHelper(const String &s) : String(s) {}
+};
+
+#endif
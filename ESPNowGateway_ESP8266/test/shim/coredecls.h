@@ -0,0 +1,21 @@
+/*
+ * coredecls.h - stand-in for the ESP8266 core's esp_delay()/esp_schedule() in the native tests
+ * esp_delay() runs the simulated radio's events (the callbacks) on the virtual clock till blocked() turns false or the timeout passes,
+ * there is nothing for esp_schedule() to do as blocked() is checked after every event
+ */
+
+#ifndef SIM_COREDECLS_H
+#define SIM_COREDECLS_H
+
+#include "Arduino.h"
+
+template <typename T>
+void esp_delay(const uint32_t timeout_ms, T&& blocked)
+{
+    simWait((uint64_t)timeout_ms * 1000, [&](){ return !blocked(); });
+}
+
+inline void esp_delay(const uint32_t timeout_ms) { delay(timeout_ms); }
+inline void esp_schedule() {}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * espnow.h - stand-in for the ESP8266 SDK's ESP-NOW API in the native tests, backed by the simulated radio (simRadio.h)
+ */
+
+#ifndef SIM_ESPNOW_H
+#define SIM_ESPNOW_H
+
+#include <stdint.h>
+#include "simRadio.h"
+
+typedef uint8_t u8;
+
+enum esp_now_role
+{
+    ESP_NOW_ROLE_IDLE = 0,
+    ESP_NOW_ROLE_CONTROLLER,
+    ESP_NOW_ROLE_SLAVE,
+    ESP_NOW_ROLE_COMBO,
+    ESP_NOW_ROLE_MAX
+};
+
+typedef sim_send_cb_t esp_now_send_cb_t;
+typedef sim_recv_cb_t esp_now_recv_cb_t;
+
+inline int esp_now_init() { radio().ready = true; return 0; }
+inline int esp_now_deinit() { radio().ready = false; radio().peers.clear(); return 0; }
+inline int esp_now_set_self_role(u8) { return 0; }
+inline int esp_now_register_send_cb(esp_now_send_cb_t cb) { radio().send_cb = cb; return 0; }
+inline int esp_now_register_recv_cb(esp_now_recv_cb_t cb) { radio().recv_cb = cb; return 0; }
+inline int esp_now_unregister_send_cb() { radio().send_cb = nullptr; return 0; }
+inline int esp_now_unregister_recv_cb() { radio().recv_cb = nullptr; return 0; }
+
+inline int esp_now_add_peer(u8 *mac, u8, u8 channel, u8*, u8)
+{
+    if(radio().findPeer(mac) != nullptr)
+        return -1;
+    simRadio::peer p;
+    memcpy(p.mac, mac, 6);
+    p.channel = channel;
+    radio().peers.push_back(p);
+    return 0;
+}
+
+inline int esp_now_del_peer(u8 *mac)
+{
+    std::vector<simRadio::peer> &peers = radio().peers;
+    for(size_t i = 0; i < peers.size(); i++)
+    {
+        if(memcmp(peers[i].mac, mac, 6) == 0)
+        {
+            peers.erase(peers.begin() + i);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+inline int esp_now_is_peer_exist(u8 *mac) { return radio().findPeer(mac) != nullptr ? 1 : 0; }
+
+inline int esp_now_set_peer_channel(u8 *mac, u8 channel)
+{
+    simRadio::peer *p = radio().findPeer(mac);
+    if(p == nullptr)
+        return -1;
+    p->channel = channel;
+    return 0;
+}
+
+inline u8* esp_now_fetch_peer(bool restart)
+{
+    static size_t next = 0;
+    if(restart)
+        next = 0;
+    return next < radio().peers.size() ? radio().peers[next++].mac : nullptr;
+}
+
+inline int esp_now_send(u8 *mac, u8 *data, int len) { return radio().send(mac, data, len); }
+
+#endif
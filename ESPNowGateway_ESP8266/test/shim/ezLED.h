@@ -0,0 +1,37 @@
+/*
+ * ezLED.h - stand-in for ezLED (../lib/ezLED) in the native tests, keeps the state the gateway reads back and drives no pin
+ */
+
+#ifndef SIM_EZLED_H
+#define SIM_EZLED_H
+
+#define LED_OFF 0
+#define LED_ON  1
+
+#define LED_IDLE     0
+#define LED_DELAY    1
+#define LED_FADING   2
+#define LED_BLINKING 3
+
+#define CTRL_ANODE   0
+#define CTRL_CATHODE 1
+
+class ezLED
+{
+    public:
+    ezLED(int, int = CTRL_ANODE) {}
+    void turnON(unsigned long = 0) { _state = LED_IDLE; _on = LED_ON; }
+    void turnOFF(unsigned long = 0) { _state = LED_IDLE; _on = LED_OFF; }
+    void toggle(unsigned long = 0) { _on = !_on; }
+    void blink(unsigned long, unsigned long, unsigned long = 0) { _state = LED_BLINKING; }
+    void cancel(void) { _state = LED_IDLE; _on = LED_OFF; }
+    int getOnOff(void) { return _on; }
+    int getState(void) { return _state; }
+    void loop(void) {}
+
+    private:
+    int _state = LED_IDLE;
+    int _on = LED_OFF;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * fileStorage.h - file backed stand-in for the flash filesystem in the native tests, implements the storage interface of frameSpool.h
+ * on a directory of the host. Paths are relative to that directory, so "/spool/0" is <root>/spool/0
+ * cutPowerAfter(n) lets n more bytes reach the files, the write that crosses it is torn and from then on every call fails as on a dead
+ * ESP. A new fileStorage on the same root is the ESP coming back up and finds what made it to the files
+ * Each read or write call takes op_us of the virtual clock (simBusy()), 0 unless a test sets it
+ */
+
+#ifndef FILE_STORAGE_H
+#define FILE_STORAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "simClock.h"
+
+class fileStorage
+{
+    public:
+    class file
+    {
+        public:
+        file() {}
+        file(FILE *f, fileStorage *owner) : _f(f), _owner(owner) {}
+
+        size_t read(uint8_t *buf, size_t size)
+        {
+            if(_f == nullptr || !_owner->_powered)
+                return 0;
+            simBusy(_owner->op_us);
+            return fread(buf, 1, size, _f);
+        }
+
+        size_t write(const uint8_t *buf, size_t size)
+        {
+            if(_f == nullptr || !_owner->_powered)
+                return 0;
+            simBusy(_owner->op_us);
+            size_t allowed = _owner->allow(size);
+            size_t written = fwrite(buf, 1, allowed, _f);
+            fflush(_f);
+            return written;
+        }
+
+        bool seek(uint32_t pos) { return _f != nullptr && fseek(_f, pos, SEEK_SET) == 0; }
+
+        size_t size()
+        {
+            if(_f == nullptr)
+                return 0;
+            long pos = ftell(_f);
+            fseek(_f, 0, SEEK_END);
+            long end = ftell(_f);
+            fseek(_f, pos, SEEK_SET);
+            return end;
+        }
+
+        void close()
+        {
+            if(_f != nullptr)
+                fclose(_f);
+            _f = nullptr;
+        }
+
+        operator bool() const { return _f != nullptr; }
+
+        private:
+        FILE *_f = nullptr;
+        fileStorage *_owner = nullptr;
+    };
+
+    fileStorage(const std::string &root) : _root(root) {}
+
+    file open(const char *path, const char *mode)
+    {
+        if(!_powered)
+            return file();
+        const char *host_mode = mode[0] == 'w' ? "wb" : (mode[0] == 'a' ? "ab" : "rb");
+        return file(fopen((_root + path).c_str(), host_mode), this);
+    }
+
+    bool remove(const char *path) { return _powered && ::remove((_root + path).c_str()) == 0; }
+    bool mkdir(const char *path) { return _powered && ::mkdir((_root + path).c_str(), 0755) == 0; }
+
+    template <typename F>
+    void list(const char *path, F f)
+    {
+        DIR *dir = _powered ? opendir((_root + path).c_str()) : nullptr;
+        if(dir == nullptr)
+            return;
+        while(struct dirent *entry = readdir(dir))
+        {
+            if(entry->d_name[0] == '.')
+                continue;
+            struct stat st;
+            if(stat((_root + path + "/" + entry->d_name).c_str(), &st) == 0)
+                f(entry->d_name, (size_t)st.st_size);
+        }
+        closedir(dir);
+    }
+
+    void cutPowerAfter(size_t bytes) { _budget = bytes; _limited = true; }
+    bool powered() const { return _powered; }
+    uint32_t writes = 0; // write calls that reached a file, the flash wear
+    uint32_t op_us = 0; // time a read or write call takes
+
+    private:
+    // bytes of a write of size that make it before the power goes
+    size_t allow(size_t size)
+    {
+        writes++;
+        if(!_limited)
+            return size;
+        if(size >= _budget)
+        {
+            size = _budget;
+            _powered = false;
+        }
+        _budget -= size;
+        return size;
+    }
+
+    std::string _root;
+    bool _powered = true;
+    bool _limited = false;
+    size_t _budget = 0;
+};
+
+#endif
@@ -0,0 +1,3 @@
+/*
+ * lwip/icmp.h - empty stand-in for the lwIP header Pinger.h needs on the ESP8266, nothing of it is used in the native tests
+ */
@@ -0,0 +1,20 @@
+/*
+ * pir_sensor.h - stand-in for pir_sensor (../lib/pir_sensor) in the native tests, no motion is ever seen
+ */
+
+#ifndef SIM_PIR_SENSOR_H
+#define SIM_PIR_SENSOR_H
+
+#include "Arduino.h"
+
+class pir_sensor
+{
+    public:
+    pir_sensor(byte) {}
+    pir_sensor(byte, uint16_t) {}
+    bool begin(const char[25]) { return true; }
+    short update() { return 0; }
+    void setMotionDuration(uint16_t) {}
+};
+
+#endif
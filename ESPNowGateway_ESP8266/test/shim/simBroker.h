@@ -0,0 +1,161 @@
+/*
+ * simBroker.h - the MQTT broker in the native tests, with the publish() of AsyncMqttClient so the gateway's send path can be pointed at it
+ * - a QoS1 publish is acknowledged after puback_us on the virtual clock (simClock.h) by calling on_puback with its packet id
+ * - disconnect() drops the connection, PUBACKs still due are lost and publish() fails till connect()
+ * - max_inflight stands in for the TCP send buffer, publish() fails while that many QoS1 publishes wait for their PUBACK
+ * - online is the broker being reachable, the AsyncMqttClient stand-in (AsyncMqttClient.h) connects only while it is, outage() takes it
+ *   down along with the connection
+ * - deliver() sends a message to the client on a topic it subscribed to
+ * Every publish that got through is kept in received with the time it was sent, a test checks it for loss, duplicates, order and latency
+ */
+
+#ifndef SIM_BROKER_H
+#define SIM_BROKER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "simClock.h"
+
+struct simBroker
+{
+    struct message
+    {
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+        bool dup;
+        uint16_t packet_id;
+        uint64_t at_us; // virtual time of the publish
+    };
+
+    uint32_t puback_us = 20000;
+    uint32_t publish_us = 0; // time a publish call takes the client, see simBusy()
+    uint8_t max_inflight = 0; // 0 no limit
+    bool online = true;
+    std::function<void(uint16_t)> on_puback;
+    std::function<void(const char *topic, const char *payload, size_t len)> on_message;
+    std::vector<message> received;
+    std::vector<std::string> subscriptions;
+
+    /*
+     * returns the packet id, 1 for QoS0, or 0 if the publish could not be sent. A dup publish keeps its packet id
+     */
+    uint16_t publish(const char *topic, uint8_t qos, bool retain, const char *payload = nullptr, size_t length = 0, bool dup = false, uint16_t message_id = 0)
+    {
+        if(!_connected || (qos > 0 && max_inflight > 0 && _inflight >= max_inflight))
+            return 0;
+        if(payload != nullptr && length == 0)
+            length = strlen(payload);
+        uint16_t packet_id = 1;
+        if(qos > 0)
+        {
+            packet_id = dup && message_id != 0 ? message_id : nextPacketId();
+            _inflight++;
+            uint32_t session = _session;
+            simSchedule(puback_us, [this, packet_id, session]()
+            {
+                if(session != _session)
+                    return; // the connection it was sent on is gone
+                _inflight--;
+                if(on_puback)
+                    on_puback(packet_id);
+            });
+        }
+        received.push_back(message{topic, std::string(payload != nullptr ? payload : "", length), qos, retain, dup, packet_id, simTime().now_us});
+        return packet_id;
+    }
+
+    void connect() { _connected = true; }
+
+    void disconnect()
+    {
+        _connected = false;
+        _session++;
+        _inflight = 0;
+    }
+
+    void outage()
+    {
+        online = false;
+        disconnect();
+    }
+
+    void subscribe(const char *topic) { subscriptions.push_back(topic); }
+
+    /*
+     * passes a message on topic to the client if it is connected and subscribed to it, '+' matches one level
+     */
+    bool deliver(const char *topic, const char *payload)
+    {
+        if(!_connected || !on_message)
+            return false;
+        for(const std::string &filter : subscriptions)
+        {
+            if(matches(filter.c_str(), topic))
+            {
+                on_message(topic, payload, strlen(payload));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool connected() const { return _connected; }
+
+    /*
+     * drops the connection and what was received, keeps the client's callbacks. For setUp()
+     */
+    void reset()
+    {
+        disconnect();
+        online = true;
+        received.clear();
+        subscriptions.clear();
+        puback_us = 20000;
+        publish_us = 0;
+        max_inflight = 0;
+    }
+    uint32_t inflight() const { return _inflight; }
+
+    private:
+    static bool matches(const char *filter, const char *topic)
+    {
+        while(*filter != '\0' && *topic != '\0')
+        {
+            if(*filter == '+')
+            {
+                while(*topic != '\0' && *topic != '/')
+                    topic++;
+                filter++;
+            }
+            else if(*filter++ != *topic++)
+                return false;
+        }
+        return *filter == *topic;
+    }
+
+    uint16_t nextPacketId()
+    {
+        if(++_next_id == 0)
+            _next_id = 1;
+        return _next_id;
+    }
+
+    bool _connected = false; // connect() or the client's connect() brings it up
+    uint32_t _session = 0;
+    uint32_t _inflight = 0;
+    uint16_t _next_id = 0;
+};
+
+// the broker the gateway's MQTT client talks to
+inline simBroker& mqttBroker()
+{
+    static simBroker broker;
+    return broker;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * simClock.h - virtual time for the native tests, millis(), micros() and delay() of the Arduino.h stand-in run on it
+ * Time moves only when the code under test waits (delay(), esp_delay()) or a test calls simAdvance(), so a test runs in a fraction of the
+ * time it simulates and gives the same result every run. Events scheduled by the simulated radio and broker (a send callback, an incoming
+ * frame, a PUBACK) run in time order as it moves, the way the SDK runs the callbacks between passes of loop() and never in the middle of one
+ */
+
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+
+struct simClock
+{
+    uint64_t now_us = 0;
+    std::multimap<uint64_t, std::function<void()>> events; // by due time, events due at the same time run in the order they were scheduled
+};
+
+inline simClock& simTime()
+{
+    static simClock clock;
+    return clock;
+}
+
+/*
+ * runs event delay_us from now
+ */
+inline void simSchedule(uint32_t delay_us, std::function<void()> event)
+{
+    simClock &clock = simTime();
+    clock.events.emplace(clock.now_us + delay_us, std::move(event));
+}
+
+/*
+ * runs the earliest event due at or before until, moving the time to it. Returns false if there is none
+ */
+inline bool simRunNext(uint64_t until)
+{
+    simClock &clock = simTime();
+    auto next = clock.events.begin();
+    if(next == clock.events.end() || next->first > until)
+        return false;
+    if(next->first > clock.now_us)
+        clock.now_us = next->first;
+    std::function<void()> event = std::move(next->second);
+    clock.events.erase(next);
+    event();
+    return true;
+}
+
+/*
+ * moves the time on by us, running the events due meanwhile
+ */
+inline void simAdvance(uint64_t us)
+{
+    uint64_t until = simTime().now_us + us;
+    while(simRunNext(until))
+        ;
+    simTime().now_us = until;
+}
+
+/*
+ * moves the time on by us without running anything, the time the code under test spends working (a publish, a flash read). The callbacks
+ * that come due meanwhile run at its next wait, as on the ESP8266 where they wait for loop() to yield
+ */
+inline void simBusy(uint64_t us)
+{
+    simTime().now_us += us;
+}
+
+/*
+ * runs events till done() returns true or timeout_us passes, the time stops at the event which made done() true. Returns done()
+ */
+template <typename F>
+bool simWait(uint64_t timeout_us, F done)
+{
+    uint64_t until = simTime().now_us + timeout_us;
+    while(!done())
+    {
+        if(!simRunNext(until))
+        {
+            simTime().now_us = until;
+            break;
+        }
+    }
+    return done();
+}
+
+/*
+ * back to time 0 with nothing scheduled, for setUp()
+ */
+inline void simReset()
+{
+    simTime().events.clear();
+    simTime().now_us = 0;
+}
+
+#endif
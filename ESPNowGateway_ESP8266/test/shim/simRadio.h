@@ -0,0 +1,134 @@
+/*
+ * simRadio.h - the ESP-NOW air in the native tests, behind the espnow.h and ESP8266WiFi.h stand-ins
+ * The code under test is the local end, a test plays the far end :
+ * - a frame the local end sends reaches far_end after airtime_us unless it is lost (loss_pct) or the far end is on another channel,
+ *   either way the send callback follows with the MAC layer ack status (0 delivered, 1 not), as on the ESP8266
+ * - receive() puts a frame on the air for the local end, eg. the gateway's ack or a sensor's uplink, its receive callback gets it after delay_us
+ * Losses are drawn from a seeded xorshift so a test gives the same result every run
+ */
+
+#ifndef SIM_RADIO_H
+#define SIM_RADIO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "simClock.h"
+
+typedef void (*sim_send_cb_t)(uint8_t *mac, uint8_t status);
+typedef void (*sim_recv_cb_t)(uint8_t *mac, uint8_t *data, uint8_t len);
+
+struct simRadio
+{
+    struct peer
+    {
+        uint8_t mac[6];
+        uint8_t channel;
+    };
+
+    struct access_point
+    {
+        std::string ssid;
+        uint8_t channel;
+    };
+
+    // ************ the link, set by the test *******************
+    uint8_t far_channel = 1; // channel the far end listens on
+    uint32_t airtime_us = 1000; // from the send to the send callback
+    uint8_t loss_pct = 0; // frames lost on the air
+    uint32_t scan_us = 2000000; // time a WiFi.scanNetworks() takes
+    std::vector<access_point> access_points; // what a scan finds
+    std::function<void(const uint8_t *mac, const uint8_t *data, int len)> far_end; // gets the frames that make it
+
+    // ************ the local end, set through espnow.h/ESP8266WiFi.h *******************
+    uint8_t channel = 1;
+    bool ready = false; // esp_now_init() done
+    sim_send_cb_t send_cb = nullptr;
+    sim_recv_cb_t recv_cb = nullptr;
+    std::vector<peer> peers;
+
+    // ************ counts *******************
+    uint32_t sent = 0; // frames handed to the radio
+    uint32_t lost = 0; // of those, not acked at the MAC layer
+    uint32_t received = 0; // frames passed to the receive callback
+
+    /*
+     * esp_now_send(), returns 0 or non zero if the radio isnt ready or mac is not a peer
+     */
+    int send(const uint8_t *mac, const uint8_t *data, int len)
+    {
+        if(!ready || len <= 0 || len > 250 || (mac != nullptr && findPeer(mac) == nullptr))
+            return -1;
+        sent++;
+        bool heard = channel == far_channel && (loss_pct == 0 || nextRandom() % 100 >= loss_pct);
+        if(!heard)
+            lost++;
+        std::vector<uint8_t> frame(data, data + len);
+        std::vector<uint8_t> to(6, 0xFF);
+        if(mac != nullptr)
+            to.assign(mac, mac + 6);
+        simSchedule(airtime_us, [this, heard, frame, to]()
+        {
+            if(heard && far_end)
+                far_end(to.data(), frame.data(), (int)frame.size());
+            if(send_cb != nullptr)
+                send_cb(const_cast<uint8_t*>(to.data()), heard ? 0 : 1);
+        });
+        return 0;
+    }
+
+    /*
+     * a frame from mac reaches the local end after delay_us, if its radio is up and on the channel it was sent on (0 any) by then
+     */
+    void receive(const uint8_t mac[6], const uint8_t *data, int len, uint32_t delay_us = 0, uint8_t on_channel = 0)
+    {
+        std::vector<uint8_t> frame(data, data + len);
+        std::vector<uint8_t> from(mac, mac + 6);
+        simSchedule(delay_us, [this, frame, from, on_channel]()
+        {
+            if(!ready || recv_cb == nullptr || (on_channel != 0 && on_channel != channel))
+                return;
+            received++;
+            recv_cb(const_cast<uint8_t*>(from.data()), const_cast<uint8_t*>(frame.data()), (uint8_t)frame.size());
+        });
+    }
+
+    peer* findPeer(const uint8_t *mac)
+    {
+        for(peer &p : peers)
+            if(memcmp(p.mac, mac, 6) == 0)
+                return &p;
+        return nullptr;
+    }
+
+    uint32_t nextRandom()
+    {
+        _rng ^= _rng << 13;
+        _rng ^= _rng >> 17;
+        _rng ^= _rng << 5;
+        return _rng;
+    }
+
+    void seed(uint32_t seed) { _rng = seed | 1; }
+
+    private:
+    uint32_t _rng = 2463534242u;
+};
+
+inline simRadio& radio()
+{
+    static simRadio air;
+    return air;
+}
+
+/*
+ * fresh radio and link for setUp(), call after simReset()
+ */
+inline void simRadioReset()
+{
+    radio() = simRadio();
+}
+
+#endif
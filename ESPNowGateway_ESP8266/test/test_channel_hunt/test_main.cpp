@@ -0,0 +1,111 @@
+/*
+ * espnowSender::hunt() (espnowController.h, shared include) with CHANNEL_HUNT on the simulated radio : the probe order, the channel found
+ * being stored, going back when the gateway is nowhere and a send on a stale channel hunting and then being delivered
+ */
+
+#define CHANNEL_HUNT IN_USE
+#define RETRY_POLICY {"test", 2, 0, 0, 0, 1, 0, false} // hunt after the first no ack, one more attempt
+#include <unity.h>
+#include <vector>
+#include <Arduino.h>
+#include "macros.h"
+#define SERIAL_DEBUG NOT_IN_USE
+// the globals espnowController.h expects from the sketch
+const char *ssid = "test_ap"; // never scanned for with CHANNEL_HUNT
+uint8_t gatewayAddress[6] = {0x5C, 0xCF, 0x7F, 0x01, 0x02, 0x03};
+#include "espnowController.h"
+
+static espnowSender sender;
+static std::vector<uint8_t> channels; // channel of each frame sent, in order
+static uint32_t messages; // espnow_message frames the gateway heard
+
+// the send callback comes while the radio is still on the channel the frame went out on
+static void onSent(uint8_t *mac, uint8_t status)
+{
+  channels.push_back(radio().channel);
+  sender.onSent(status);
+}
+
+static void gatewayHears(const uint8_t *mac, const uint8_t *data, int len)
+{
+  if(len >= (int)ESPNOW_MESSAGE_MIN_LEN)
+    messages++;
+}
+
+void setUp(void)
+{
+  simReset();
+  simRadioReset();
+  ESP.powerCut();
+  EEPROM.erase();
+  ctrlStateLoaded = false;
+  slave_channel = 6; // where the gateway was last time
+  channelRefreshed = false;
+  sender = espnowSender();
+  channels.clear();
+  messages = 0;
+  radio().airtime_us = 1000;
+  radio().far_end = gatewayHears;
+  radio().channel = 6;
+  esp_now_init();
+  esp_now_register_send_cb(onSent);
+  esp_now_add_peer(gatewayAddress, ESP_NOW_ROLE_COMBO, 6, NULL, 0);
+}
+
+void tearDown(void) {}
+
+void test_hunt_probe_order(void)
+{
+  radio().far_channel = 13;
+  uint32_t start = millis();
+  TEST_ASSERT_EQUAL_UINT8(13, sender.hunt(gatewayAddress));
+  // the last known channel, its neighbours, KNOWN_CHANNELS and then the rest, each once
+  const uint8_t expected[] = {6, 5, 7, 1, 11, 2, 3, 4, 8, 9, 10, 12, 13};
+  TEST_ASSERT_EQUAL_UINT32(sizeof(expected), channels.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, channels.data(), sizeof(expected));
+  TEST_ASSERT_EQUAL_UINT8(13, radio().channel);
+  TEST_ASSERT_EQUAL_UINT8(13, slave_channel);
+  TEST_ASSERT_EQUAL_UINT8(13, EEPROM.read(0)); // for the next cold boot
+  TEST_ASSERT_EQUAL_UINT32(0, messages); // probes only, the gateway drops them
+  TEST_ASSERT_LESS_THAN(radio().scan_us / 1000 / 10, millis() - start); // well under a tenth of a scan
+}
+
+void test_hunt_neighbour_found_first(void)
+{
+  radio().far_channel = 7;
+  TEST_ASSERT_EQUAL_UINT8(7, sender.hunt(gatewayAddress));
+  TEST_ASSERT_EQUAL_UINT32(3, channels.size()); // 6, 5, 7
+}
+
+void test_hunt_gateway_nowhere(void)
+{
+  radio().far_channel = 14; // not a channel hunted
+  TEST_ASSERT_EQUAL_UINT8(0, sender.hunt(gatewayAddress));
+  TEST_ASSERT_EQUAL_UINT32(14, channels.size()); // 13 channels and the probe that goes back
+  TEST_ASSERT_EQUAL_UINT8(6, radio().channel);
+  TEST_ASSERT_EQUAL_UINT8(6, slave_channel);
+  TEST_ASSERT_EQUAL_UINT8(0xFF, EEPROM.read(0)); // nothing stored
+}
+
+void test_send_hunts_and_delivers(void)
+{
+  radio().far_channel = 11; // the gateway moved since the last wake
+  espnow_message msg;
+  strcpy(msg.device_name, "test_door");
+  msg.message_id = 1;
+  TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sender.send(&msg, gatewayAddress));
+  TEST_ASSERT_EQUAL_UINT32(1, messages);
+  TEST_ASSERT_EQUAL_UINT8(11, slave_channel);
+  TEST_ASSERT_EQUAL_UINT16(1, ctrlState.hunts);
+  TEST_ASSERT_EQUAL_UINT8(11, channels.back()); // the resend went out on the channel found
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_hunt_probe_order);
+  RUN_TEST(test_hunt_neighbour_found_first);
+  RUN_TEST(test_hunt_gateway_nowhere);
+  RUN_TEST(test_send_hunts_and_delivers);
+  return UNITY_END();
+}
@@ -0,0 +1,138 @@
+/*
+ * controllerState.h and the state handling of espnowController.h (shared include) on the shim : the state surviving deep sleep without
+ * touching the EEPROM, a cold boot after a power cut or a garbled RTC memory falling back to the EEPROM, sequence nos never used twice
+ * across power cuts and the message carried forward to the next wake
+ */
+
+#define SEQ_BLOCK 4
+#include <unity.h>
+#include <vector>
+#include <Arduino.h>
+#include "macros.h"
+#define SERIAL_DEBUG NOT_IN_USE
+// the globals espnowController.h expects from the sketch
+const char *ssid = "test_ap";
+uint8_t gatewayAddress[6] = {0x5C, 0xCF, 0x7F, 0x01, 0x02, 0x03};
+#include "espnowController.h"
+
+// what a wake starts with, RAM is gone and RTC memory and the EEPROM are as they were left
+static void wake(void)
+{
+  ctrlStateLoaded = false;
+  eepromReady = false;
+  memset(&ctrlState, 0, sizeof(ctrlState));
+}
+
+void setUp(void)
+{
+  simReset();
+  ESP.powerCut();
+  EEPROM.erase();
+  EEPROM.commits = 0;
+  wake();
+}
+
+void tearDown(void) {}
+
+void test_state_erased_eeprom(void)
+{
+  loadState();
+  TEST_ASSERT_EQUAL_UINT8(0, ctrlState.channel);
+  TEST_ASSERT_EQUAL_UINT32(0, ctrlState.seq);
+  TEST_ASSERT_EQUAL_UINT32(1, nextSeq());
+}
+
+// waking from deep sleep carries on from RTC memory, the EEPROM is written once per SEQ_BLOCK nos and not read at all
+void test_state_survives_deep_sleep(void)
+{
+  saveChannel(11);
+  uint32_t commits = EEPROM.commits;
+  for(uint32_t seq = 1; seq <= 3; seq++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(seq, nextSeq());
+    wake();
+  }
+  TEST_ASSERT_EQUAL_UINT32(commits + 1, EEPROM.commits);
+  EEPROM.write(0, 3); // a changed EEPROM must go unnoticed
+  loadState();
+  TEST_ASSERT_EQUAL_UINT8(11, ctrlState.channel);
+  TEST_ASSERT_EQUAL_UINT32(4, nextSeq());
+  TEST_ASSERT_EQUAL_UINT32(commits + 1, EEPROM.commits);
+}
+
+void test_cold_boot_reads_eeprom(void)
+{
+  saveChannel(11);
+  TEST_ASSERT_EQUAL_UINT32(1, nextSeq());
+  ESP.powerCut();
+  wake();
+  loadState();
+  TEST_ASSERT_EQUAL_UINT8(11, ctrlState.channel);
+  TEST_ASSERT_EQUAL_UINT32(SEQ_BLOCK + 1, nextSeq()); // what was left of the block is skipped
+}
+
+// a single byte changed in RTC memory fails the crc, the state is cleared and read again as on a cold boot
+void test_garbled_state_is_cold_boot(void)
+{
+  saveChannel(6);
+  nextSeq();
+  ESP.rtc[CONTROLLER_STATE_RTC_BLOCK * 4 + offsetof(controller_state, seq)] ^= 0x10;
+  controller_state state;
+  TEST_ASSERT_FALSE(loadControllerState(&state));
+  TEST_ASSERT_EQUAL_UINT32(CONTROLLER_STATE_MAGIC, state.magic);
+  TEST_ASSERT_EQUAL_UINT32(0, state.seq);
+  wake();
+  loadState();
+  TEST_ASSERT_EQUAL_UINT8(6, ctrlState.channel);
+  TEST_ASSERT_EQUAL_UINT32(SEQ_BLOCK, ctrlState.seq);
+}
+
+// power cuts at every point of a run of wakes, the nos handed out must only go up
+void test_seq_never_reused_across_power_cuts(void)
+{
+  std::vector<uint32_t> seqs;
+  for(int i = 0; i < 40; i++)
+  {
+    seqs.push_back(nextSeq());
+    if(i % 3 == 0 || i % 7 == 0)
+      ESP.powerCut();
+    wake();
+  }
+  for(size_t i = 1; i < seqs.size(); i++)
+    TEST_ASSERT_TRUE(seqs[i] > seqs[i - 1]);
+}
+
+void test_deferred_round_trip(void)
+{
+  deferred_message deferred = deferred_message();
+  TEST_ASSERT_FALSE(loadDeferred(&deferred));
+  deferred.magic = DEFERRED_MAGIC;
+  deferred.wakes = 2;
+  deferred.msg.seq = 77;
+  strcpy(deferred.msg.device_name, "door");
+  saveDeferred(&deferred);
+  deferred_message loaded = deferred_message();
+  TEST_ASSERT_TRUE(loadDeferred(&loaded));
+  TEST_ASSERT_EQUAL_UINT16(2, loaded.wakes);
+  TEST_ASSERT_EQUAL_UINT32(77, loaded.msg.seq);
+  TEST_ASSERT_EQUAL_STRING("door", loaded.msg.device_name);
+  deferred.magic = 0; // sent, nothing waiting any more
+  saveDeferred(&deferred);
+  TEST_ASSERT_FALSE(loadDeferred(&loaded));
+  deferred.magic = DEFERRED_MAGIC;
+  saveDeferred(&deferred);
+  ESP.powerCut();
+  TEST_ASSERT_FALSE(loadDeferred(&loaded));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_state_erased_eeprom);
+  RUN_TEST(test_state_survives_deep_sleep);
+  RUN_TEST(test_cold_boot_reads_eeprom);
+  RUN_TEST(test_garbled_state_is_cold_boot);
+  RUN_TEST(test_seq_never_reused_across_power_cuts);
+  RUN_TEST(test_deferred_round_trip);
+  return UNITY_END();
+}
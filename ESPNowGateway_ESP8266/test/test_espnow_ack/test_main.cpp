@@ -0,0 +1,62 @@
+/*
+ * espnowAck.h (shared include) : round trip of the ack, little endian layout, and frames of any other length or magic not taken for an ack
+ */
+
+#include <unity.h>
+#include "espnowAck.h"
+#include "espnowMessage.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_ack_round_trip(void)
+{
+  espnow_ack ack = {11, ESPNOW_ACK_PENDING, 30, 0xDEADBEEF, 1700000000};
+  uint8_t frame[ESPNOW_ACK_LEN];
+  encodeAck(ack, frame);
+  espnow_ack decoded;
+  TEST_ASSERT_TRUE(decodeAck(frame, sizeof(frame), &decoded));
+  TEST_ASSERT_EQUAL_UINT8(11, decoded.channel);
+  TEST_ASSERT_EQUAL_UINT8(ESPNOW_ACK_PENDING, decoded.flags);
+  TEST_ASSERT_EQUAL_UINT8(30, decoded.backoff);
+  TEST_ASSERT_EQUAL_UINT32(0xDEADBEEF, decoded.message_id);
+  TEST_ASSERT_EQUAL_UINT32(1700000000, decoded.time);
+}
+
+void test_ack_layout(void)
+{
+  espnow_ack ack = {6, 0, 0, 0x04030201, 0x08070605};
+  uint8_t frame[ESPNOW_ACK_LEN];
+  encodeAck(ack, frame);
+  const uint8_t expected[ESPNOW_ACK_LEN] = {ESPNOW_ACK_MAGIC, 6, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8}; // the same on either end whatever the CPU
+  TEST_ASSERT_EQUAL_MEMORY(expected, frame, sizeof(frame));
+}
+
+void test_ack_length_must_match(void)
+{
+  espnow_ack ack = {1, 0, 0, 42, 0};
+  uint8_t frame[sizeof(espnow_message)] = {0};
+  encodeAck(ack, frame);
+  espnow_ack decoded;
+  for(size_t len = 0; len <= sizeof(frame); len++)
+    TEST_ASSERT_EQUAL(len == ESPNOW_ACK_LEN, decodeAck(frame, len, &decoded)); // short, long and a whole message are not acks
+}
+
+void test_ack_magic_must_match(void)
+{
+  uint8_t frame[ESPNOW_ACK_LEN] = {0};
+  espnow_ack decoded;
+  TEST_ASSERT_FALSE(decodeAck(frame, sizeof(frame), &decoded));
+  frame[0] = ESPNOW_PROBE_MAGIC; // a probe padded to the ack's length
+  TEST_ASSERT_FALSE(decodeAck(frame, sizeof(frame), &decoded));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ack_round_trip);
+  RUN_TEST(test_ack_layout);
+  RUN_TEST(test_ack_length_must_match);
+  RUN_TEST(test_ack_magic_must_match);
+  return UNITY_END();
+}
@@ -0,0 +1,197 @@
+/*
+ * espnowBinary.h (shared include) : round trips of random messages, the worst case size against ESPNOW_BINARY_MAX_LEN, truncated and unknown
+ * version frames rejected and the bytes of a typical door sensor frame
+ * - a benchmark of encodeMessage() against the JSON of serializeMessage() (jsonWriter.h), time and bytes per frame, and of decodeMessage()
+ *   over a million frames. The times are of the host the test runs on, not of the ESP8266
+ */
+
+#include <unity.h>
+#include <limits.h>
+#include <chrono>
+#include <vector>
+#include "espnowBinary.h"
+#include "jsonWriter.h"
+
+#define BENCH_FRAMES 1000000
+#define BENCH_MESSAGES 1024 // distinct random messages the benchmark cycles through, a power of 2
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t nextRandom(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// a message with each field present or not, and of any size, at random
+static espnow_message randomMessage(void)
+{
+  espnow_message msg;
+  uint8_t name_len = nextRandom() % 17;
+  for(uint8_t i = 0; i < name_len; i++)
+    msg.device_name[i] = 'a' + nextRandom() % 26;
+  msg.message_id = nextRandom();
+  msg.msg_type = (msg_type_t)(nextRandom() % 3);
+  const int32_t ints[] = {0, 1, -1, 63, -64, 64, 300, -70000, INT_MAX, INT_MIN};
+  msg.intvalue1 = ints[nextRandom() % 10];
+  msg.intvalue2 = ints[nextRandom() % 10];
+  msg.intvalue3 = (int32_t)nextRandom();
+  msg.intvalue4 = nextRandom() % 2 ? 0 : (int32_t)nextRandom();
+  msg.floatvalue1 = nextRandom() % 2 ? 0 : 3.3f;
+  msg.floatvalue2 = (float)(int32_t)nextRandom() / 1000;
+  msg.floatvalue3 = 0;
+  msg.floatvalue4 = -0.1f;
+  uint8_t len1 = nextRandom() % 17, len2 = nextRandom() % 17;
+  for(uint8_t i = 0; i < len1; i++)
+    msg.chardata1[i] = '0' + nextRandom() % 10;
+  for(uint8_t i = 0; i < len2; i++)
+    msg.chardata2[i] = 'A' + nextRandom() % 26;
+  return msg;
+}
+
+static void assertSame(const espnow_message &msg, const espnow_message &decoded)
+{
+  TEST_ASSERT_EQUAL_MEMORY(msg.device_name, decoded.device_name, sizeof(msg.device_name));
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)msg.message_id, (uint32_t)decoded.message_id);
+  TEST_ASSERT_EQUAL_INT(msg.msg_type, decoded.msg_type);
+  TEST_ASSERT_EQUAL_INT(msg.intvalue1, decoded.intvalue1);
+  TEST_ASSERT_EQUAL_INT(msg.intvalue2, decoded.intvalue2);
+  TEST_ASSERT_EQUAL_INT(msg.intvalue3, decoded.intvalue3);
+  TEST_ASSERT_EQUAL_INT(msg.intvalue4, decoded.intvalue4);
+  TEST_ASSERT_EQUAL_FLOAT(msg.floatvalue1, decoded.floatvalue1);
+  TEST_ASSERT_EQUAL_FLOAT(msg.floatvalue2, decoded.floatvalue2);
+  TEST_ASSERT_EQUAL_FLOAT(msg.floatvalue3, decoded.floatvalue3);
+  TEST_ASSERT_EQUAL_FLOAT(msg.floatvalue4, decoded.floatvalue4);
+  TEST_ASSERT_EQUAL_MEMORY(msg.chardata1, decoded.chardata1, sizeof(msg.chardata1));
+  TEST_ASSERT_EQUAL_MEMORY(msg.chardata2, decoded.chardata2, sizeof(msg.chardata2));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_binary_round_trip(void)
+{
+  for(uint32_t n = 0; n < 10000; n++)
+  {
+    espnow_message msg = randomMessage(), decoded;
+    uint8_t buffer[ESPNOW_BINARY_MAX_LEN];
+    size_t len = encodeMessage(msg, buffer, sizeof(buffer));
+    TEST_ASSERT_GREATER_THAN(0, len);
+    TEST_ASSERT_TRUE(decodeMessage(buffer, len, &decoded));
+    assertSame(msg, decoded);
+  }
+}
+
+void test_binary_worst_case_fits(void)
+{
+  espnow_message msg;
+  memset(msg.device_name, 'x', sizeof(msg.device_name)); // no terminator
+  msg.message_id = 0xFFFFFFFF;
+  msg.msg_type = ESP_NOW_TIME_SYNC;
+  msg.intvalue1 = msg.intvalue2 = msg.intvalue3 = msg.intvalue4 = INT_MIN; // 5 byte varints
+  msg.floatvalue1 = msg.floatvalue2 = msg.floatvalue3 = msg.floatvalue4 = 1.5f;
+  memset(msg.chardata1, 'y', sizeof(msg.chardata1));
+  memset(msg.chardata2, 'z', sizeof(msg.chardata2));
+  uint8_t buffer[ESPNOW_BINARY_MAX_LEN];
+  TEST_ASSERT_EQUAL_size_t(ESPNOW_BINARY_MAX_LEN, encodeMessage(msg, buffer, sizeof(buffer)));
+  espnow_message decoded;
+  TEST_ASSERT_TRUE(decodeMessage(buffer, sizeof(buffer), &decoded));
+  assertSame(msg, decoded);
+  TEST_ASSERT_EQUAL_size_t(0, encodeMessage(msg, buffer, sizeof(buffer) - 1)); // a buffer short of the worst case is refused
+}
+
+void test_binary_door_frame(void)
+{
+  espnow_message msg = espnow_message(); // the fields not set are left out
+  strcpy(msg.device_name, "main_door");
+  msg.message_id = 0x01020304;
+  msg.intvalue1 = 1; // open
+  msg.intvalue2 = 3300; // Vcc in mV
+  uint8_t buffer[ESPNOW_BINARY_MAX_LEN];
+  const uint8_t expected[] = {ESPNOW_BINARY_VERSION, 0x03, 0x00, 0x04, 0x03, 0x02, 0x01, 9, 'm', 'a', 'i', 'n', '_', 'd', 'o', 'o', 'r',
+    0x02, 0xC8, 0x33}; // zigzag 1 = 2, zigzag 3300 = 6600 = 0xC8 0x33
+  TEST_ASSERT_EQUAL_size_t(sizeof(expected), encodeMessage(msg, buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, sizeof(expected));
+}
+
+void test_binary_truncated_rejected(void)
+{
+  for(uint32_t n = 0; n < 1000; n++)
+  {
+    espnow_message msg = randomMessage(), decoded;
+    uint8_t buffer[ESPNOW_BINARY_MAX_LEN];
+    size_t len = encodeMessage(msg, buffer, sizeof(buffer));
+    for(size_t cut = 0; cut < len; cut++)
+      TEST_ASSERT_FALSE(decodeMessage(buffer, cut, &decoded));
+  }
+}
+
+void test_binary_bad_frames_rejected(void)
+{
+  espnow_message msg = randomMessage(), decoded;
+  uint8_t buffer[ESPNOW_BINARY_MAX_LEN];
+  size_t len = encodeMessage(msg, buffer, sizeof(buffer));
+  buffer[0] = ESPNOW_BINARY_VERSION + 1; // a newer version
+  TEST_ASSERT_FALSE(decodeMessage(buffer, len, &decoded));
+  buffer[0] = ESPNOW_BINARY_VERSION;
+  buffer[7] = 17; // a name longer than device_name
+  TEST_ASSERT_FALSE(decodeMessage(buffer, len, &decoded));
+  const uint8_t runaway[] = {ESPNOW_BINARY_VERSION, 0x01, 0x00, 0, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; // a varint that never ends
+  TEST_ASSERT_FALSE(decodeMessage(runaway, sizeof(runaway), &decoded));
+}
+
+// encode time and size, JSON against binary, then decode rate of the binary frames
+void test_binary_benchmark(void)
+{
+  std::vector<espnow_message> msgs;
+  for(uint32_t i = 0; i < BENCH_MESSAGES; i++)
+    msgs.push_back(randomMessage());
+  char json[JSON_MSG_LEN];
+  uint8_t bin[ESPNOW_BINARY_MAX_LEN];
+  uint64_t json_bytes = 0, bin_bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t n = 0; n < BENCH_FRAMES; n++)
+    json_bytes += serializeMessage(msgs[n & (BENCH_MESSAGES - 1)], json, sizeof(json));
+  double json_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  for(uint32_t n = 0; n < BENCH_FRAMES; n++)
+    bin_bytes += encodeMessage(msgs[n & (BENCH_MESSAGES - 1)], bin, sizeof(bin));
+  double bin_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<std::vector<uint8_t>> frames;
+  for(const espnow_message &msg : msgs)
+    frames.push_back(std::vector<uint8_t>(bin, bin + encodeMessage(msg, bin, sizeof(bin))));
+  espnow_message decoded;
+  uint32_t ok = 0;
+  start = std::chrono::steady_clock::now();
+  for(uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    const std::vector<uint8_t> &frame = frames[n & (BENCH_MESSAGES - 1)];
+    ok += decodeMessage(frame.data(), frame.size(), &decoded);
+  }
+  double decode_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32(BENCH_FRAMES, ok);
+  TEST_ASSERT_LESS_THAN(json_bytes, bin_bytes);
+
+  char report[160];
+  snprintf(report, sizeof(report), "encode, %u frames : JSON %.3f us/frame %.1f bytes/frame, binary %.3f us/frame %.1f bytes/frame",
+    BENCH_FRAMES, json_secs * 1e6 / BENCH_FRAMES, (double)json_bytes / BENCH_FRAMES, bin_secs * 1e6 / BENCH_FRAMES, (double)bin_bytes / BENCH_FRAMES);
+  TEST_MESSAGE(report);
+  snprintf(report, sizeof(report), "decode, %u binary frames : %.0f frames/sec", BENCH_FRAMES, BENCH_FRAMES / decode_secs);
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_binary_round_trip);
+  RUN_TEST(test_binary_worst_case_fits);
+  RUN_TEST(test_binary_door_frame);
+  RUN_TEST(test_binary_truncated_rejected);
+  RUN_TEST(test_binary_bad_frames_rejected);
+  RUN_TEST(test_binary_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,173 @@
+/*
+ * espnowSender (espnowController.h, shared include) on the simulated radio, with APP_ACK : the adaptive timeout starting at ACK_WAIT_TIMEOUT and
+ * following the round trip to the gateway's ack, Karn's algorithm leaving out the samples of resent frames and the MAC layer ack taken once the
+ * gateway's ack does not come. The test plays the gateway, it acks every frame after ack_delay_us unless told not to
+ * The sensor is set up as the door sensors, which cut their own power and so have no sequence nos (SEQ_BLOCK 0). Built with -DSEQ_BLOCK=1
+ * it has the checkpoint per wake they had before, test_cold_boot_wake_to_send then reports the time that costs
+ */
+
+#ifndef SEQ_BLOCK
+  #define SEQ_BLOCK 0
+#endif
+#define EEPROM_COMMIT_US 50000 // assumed, not measured : a 4KB sector erase and write of the flash of an ESP-01 (datasheet typ. ~45 ms + ~10 ms)
+#define APP_ACK IN_USE
+#define RETRY_POLICY {"test", 3, 0, 0, 0, 0, 0, false} // 3 attempts back to back, no hunts, no budget
+#include <unity.h>
+#include <Arduino.h>
+#include "macros.h"
+#define SERIAL_DEBUG NOT_IN_USE
+// the globals espnowController.h expects from the sketch
+const char *ssid = "test_ap"; // rescanned for, never with this policy
+uint8_t gatewayAddress[6] = {0x5C, 0xCF, 0x7F, 0x01, 0x02, 0x03};
+#include "espnowController.h"
+
+static espnowSender sender;
+
+static struct
+{
+  uint32_t ack_delay_us; // from the frame reaching the gateway to its ack reaching the sensor
+  bool acks; // false as when the gateway's ack queue is full
+  uint32_t frames; // frames the gateway heard
+}gateway;
+
+static void onSent(uint8_t *mac, uint8_t status) { sender.onSent(status); }
+static void onRecv(uint8_t *mac, uint8_t *data, uint8_t len) { sender.onReceive(data, len); }
+
+static void gatewayHears(const uint8_t *mac, const uint8_t *data, int len)
+{
+  if(len < (int)ESPNOW_MESSAGE_MIN_LEN)
+    return;
+  gateway.frames++;
+  if(!gateway.acks)
+    return;
+  espnow_message msg;
+  memcpy(&msg, data, len < (int)sizeof(msg) ? len : sizeof(msg));
+  espnow_ack ack = {1, 0, 0, (uint32_t)msg.message_id, 0};
+  uint8_t frame[ESPNOW_ACK_LEN];
+  encodeAck(ack, frame);
+  radio().receive(gatewayAddress, frame, sizeof(frame), gateway.ack_delay_us);
+}
+
+// sends a new message and returns the outcome
+static uint8_t sendMessage(uint32_t id)
+{
+  espnow_message msg;
+  strcpy(msg.device_name, "test_door");
+  msg.message_id = id;
+  return sender.send(&msg, gatewayAddress);
+}
+
+void setUp(void)
+{
+  simReset();
+  simRadioReset();
+  ESP.powerCut(); // no srtt from an earlier test
+  EEPROM.erase();
+  ctrlStateLoaded = false;
+  sender = espnowSender();
+  radio().airtime_us = 1000;
+  radio().far_end = gatewayHears;
+  gateway.ack_delay_us = 500;
+  gateway.acks = true;
+  gateway.frames = 0;
+  esp_now_init();
+  esp_now_register_send_cb(onSent);
+  esp_now_register_recv_cb(onRecv);
+  esp_now_add_peer(gatewayAddress, ESP_NOW_ROLE_COMBO, 1, NULL, 0);
+}
+
+void tearDown(void) {}
+
+void test_rto_starts_at_ack_wait_timeout(void)
+{
+  TEST_ASSERT_EQUAL_UINT32(ACK_WAIT_TIMEOUT, sender.rto());
+}
+
+void test_rtt_sampled_to_gateway_ack(void)
+{
+  TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(1));
+  TEST_ASSERT_TRUE(sender.ackReceived());
+  TEST_ASSERT_EQUAL_UINT32(1500, ctrlState.srtt_us); // airtime + the gateway's ack, not the MAC layer ack at 1000
+  TEST_ASSERT_EQUAL_UINT32(750, ctrlState.rttvar_us);
+  TEST_ASSERT_EQUAL_UINT32(5, sender.rto()); // 1.5 + 4 x 0.75 ms rounded up
+}
+
+void test_rto_follows_the_link(void)
+{
+  for(uint32_t id = 1; id <= 40; id++)
+    TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(id));
+  TEST_ASSERT_EQUAL_UINT32(RTO_MIN, sender.rto()); // a steady 1.5 ms, the variation decays and the floor holds
+  gateway.ack_delay_us = 15000; // the gateway's loop() got slow
+  for(uint32_t id = 41; id <= 80; id++)
+    TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(id));
+  TEST_ASSERT_UINT32_WITHIN(500, 16000, ctrlState.srtt_us);
+  TEST_ASSERT_GREATER_OR_EQUAL(17, sender.rto());
+  TEST_ASSERT_LESS_OR_EQUAL(ACK_WAIT_TIMEOUT, sender.rto());
+  TEST_ASSERT_EQUAL_UINT32(80, gateway.frames); // all within the timeout, no resends
+}
+
+void test_karn_leaves_out_resent_frames(void)
+{
+  sendMessage(1);
+  uint32_t srtt = ctrlState.srtt_us, rttvar = ctrlState.rttvar_us;
+  uint16_t retries = ctrlState.retries;
+  radio().far_channel = 2; // the first attempt is lost on the air, no MAC layer ack and no gateway's ack
+  simSchedule(100, [](){ radio().far_channel = 1; });
+  TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(2));
+  TEST_ASSERT_EQUAL_UINT16(retries + 1, ctrlState.retries);
+  TEST_ASSERT_EQUAL_UINT32(srtt, ctrlState.srtt_us); // the ack of the resend could have been for either attempt
+  TEST_ASSERT_EQUAL_UINT32(rttvar, ctrlState.rttvar_us);
+}
+
+void test_mac_ack_taken_without_gateway_ack(void)
+{
+  sendMessage(1);
+  uint32_t rto = sender.rto();
+  gateway.acks = false; // the gateway heard it but sent no ack
+  gateway.frames = 0;
+  uint32_t start = millis();
+  TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(2));
+  TEST_ASSERT_FALSE(sender.ackReceived());
+  TEST_ASSERT_EQUAL_UINT32(1, gateway.frames); // not resent, the gateway already has it
+  TEST_ASSERT_EQUAL_UINT32(rto, millis() - start); // after the wait for the gateway's ack
+  TEST_ASSERT_GREATER_THAN(rto, sender.rto()); // the wait is sampled, the next one is longer
+}
+
+void test_no_ack_at_all_resends_on_mac_failure(void)
+{
+  radio().far_channel = 2; // the gateway is gone
+  uint32_t start = millis();
+  TEST_ASSERT_EQUAL_UINT8(SEND_NO_ACK, sendMessage(1));
+  TEST_ASSERT_EQUAL_UINT32(3, radio().sent);
+  TEST_ASSERT_LESS_THAN(ACK_WAIT_TIMEOUT, millis() - start); // each attempt ends at the failed MAC layer ack, not the ack timeout
+  TEST_ASSERT_EQUAL_UINT32(0, ctrlState.srtt_us);
+}
+
+// a door event from a cold boot : the time from send() till the message is delivered and the flash writes it took
+void test_cold_boot_wake_to_send(void)
+{
+  EEPROM.commit_us = EEPROM_COMMIT_US;
+  uint32_t commits = EEPROM.commits;
+  uint64_t start = simTime().now_us;
+  TEST_ASSERT_EQUAL_UINT8(SEND_DELIVERED, sendMessage(1));
+  uint32_t wake_to_send = (uint32_t)(simTime().now_us - start);
+  EEPROM.commit_us = 0;
+  TEST_ASSERT_EQUAL_UINT32(SEQ_BLOCK == 0 ? 0 : 1, EEPROM.commits - commits);
+  char report[128];
+  snprintf(report, sizeof(report), "SEQ_BLOCK %u, cold boot to delivered %u us, %u EEPROM commits of an assumed %u us",
+    (unsigned)SEQ_BLOCK, (unsigned)wake_to_send, (unsigned)(EEPROM.commits - commits), (unsigned)EEPROM_COMMIT_US);
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_rto_starts_at_ack_wait_timeout);
+  RUN_TEST(test_rtt_sampled_to_gateway_ack);
+  RUN_TEST(test_rto_follows_the_link);
+  RUN_TEST(test_karn_leaves_out_resent_frames);
+  RUN_TEST(test_mac_ack_taken_without_gateway_ack);
+  RUN_TEST(test_no_ack_at_all_resends_on_mac_failure);
+  RUN_TEST(test_cold_boot_wake_to_send);
+  return UNITY_END();
+}
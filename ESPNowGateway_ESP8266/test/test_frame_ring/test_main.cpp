@@ -0,0 +1,193 @@
+/*
+ * frameRing.h : the single threaded contract, then the receive callback and loop() played by two threads, a stress test for order,
+ * loss and the counters and a benchmark reporting frames/sec and lost frames
+ * The frames are the size of the gateway's (espnow_message + receive time + MAC)
+ */
+
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "espnowMessage.h"
+#include "frameRing.h"
+
+#define RING_SIZE 64
+#define STRESS_FRAMES 1000000UL
+
+typedef struct test_frame
+{
+  espnow_message msg;
+  uint32_t rx_time;
+  uint8_t mac[6];
+}test_frame;
+
+typedef frameRing<test_frame,RING_SIZE> test_ring;
+static test_ring *ring;
+
+static bool push(uint32_t seq)
+{
+  test_frame *frame = ring->reserve();
+  if(frame == nullptr)
+    return false;
+  frame->msg.seq = seq;
+  frame->msg.message_id = ~seq; // checked by the consumer, catches a slot read before it was written out
+  ring->commit();
+  return true;
+}
+
+void setUp(void)
+{
+  ring = new test_ring();
+}
+
+void tearDown(void)
+{
+  delete ring;
+}
+
+void test_ring_fifo_and_release(void)
+{
+  TEST_ASSERT_NULL(ring->front());
+  TEST_ASSERT_TRUE(push(1));
+  TEST_ASSERT_TRUE(push(2));
+  TEST_ASSERT_EQUAL_UINT32(1, ring->front()->msg.seq);
+  TEST_ASSERT_EQUAL_UINT32(1, ring->front()->msg.seq); // held till release(), eg. a failed publish
+  ring->release();
+  TEST_ASSERT_EQUAL_UINT32(2, ring->front()->msg.seq);
+  ring->release();
+  TEST_ASSERT_TRUE(ring->isEmpty());
+  ring->release(); // on an empty ring does nothing
+  TEST_ASSERT_EQUAL_UINT16(0, ring->count());
+  TEST_ASSERT_EQUAL_UINT16(2, ring->highWater());
+}
+
+void test_ring_full_counts_lost(void)
+{
+  for(uint32_t i = 1; i <= RING_SIZE; i++)
+    TEST_ASSERT_TRUE(push(i));
+  TEST_ASSERT_TRUE(ring->isFull());
+  TEST_ASSERT_FALSE(push(RING_SIZE + 1));
+  TEST_ASSERT_FALSE(push(RING_SIZE + 2));
+  TEST_ASSERT_EQUAL_UINT32(2, ring->lost());
+  TEST_ASSERT_EQUAL_UINT32(1, ring->front()->msg.seq); // nothing was overwritten
+  TEST_ASSERT_EQUAL_UINT16(RING_SIZE, ring->highWater());
+}
+
+void test_ring_pending(void)
+{
+  push(1);
+  uint32_t first = ring->position() - 1;
+  push(2);
+  uint32_t second = ring->position() - 1;
+  TEST_ASSERT_NULL(ring->pending(first)); // the front slot may be in use by the consumer
+  TEST_ASSERT_NOT_NULL(ring->pending(second));
+  TEST_ASSERT_EQUAL_UINT32(2, ring->pending(second)->msg.seq);
+  ring->release();
+  ring->release();
+  TEST_ASSERT_NULL(ring->pending(second)); // consumed
+}
+
+/*
+ * a producer which waits for room (the ring never goes over capacity) loses nothing and the consumer sees every frame in order
+ * reports the frames/sec the pair sustains without loss
+ */
+void test_ring_two_threads_no_loss_below_capacity(void)
+{
+  std::atomic<bool> order_ok(true);
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer([&]()
+  {
+    uint32_t expected = 1;
+    while(expected <= STRESS_FRAMES)
+    {
+      test_frame *frame = ring->front();
+      if(frame == nullptr)
+      {
+        std::this_thread::yield(); // lets the producer run on a single core host
+        continue;
+      }
+      if(frame->msg.seq != expected || frame->msg.message_id != ~expected)
+        order_ok = false;
+      ring->release();
+      expected++;
+    }
+  });
+  for(uint32_t seq = 1; seq <= STRESS_FRAMES; seq++)
+  {
+    while(ring->isFull())
+      std::this_thread::yield();
+    TEST_ASSERT_TRUE(push(seq)); // only the consumer can change isFull() meanwhile, and only to false
+  }
+  consumer.join();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_TRUE(order_ok);
+  TEST_ASSERT_EQUAL_UINT32(0, ring->lost());
+  TEST_ASSERT_LESS_OR_EQUAL(RING_SIZE, ring->highWater());
+  TEST_ASSERT_TRUE(ring->isEmpty());
+
+  char report[160];
+  snprintf(report, sizeof(report), "%lu frames in %.3f s without loss : %.0f frames/sec, high water %u of %u",
+    STRESS_FRAMES, secs, STRESS_FRAMES / secs, ring->highWater(), RING_SIZE);
+  TEST_MESSAGE(report);
+}
+
+/*
+ * a producer which never waits, like the receive callback : frames that find the ring full are lost, the rest arrive in order
+ * reports frames/sec and lost frames
+ */
+void test_ring_two_threads_benchmark(void)
+{
+  std::atomic<bool> done(false);
+  std::atomic<bool> order_ok(true);
+  std::atomic<uint32_t> received(0);
+  std::thread consumer([&]()
+  {
+    uint32_t last = 0;
+    uint32_t count = 0;
+    for(;;)
+    {
+      test_frame *frame = ring->front();
+      if(frame == nullptr)
+      {
+        if(done)
+          break;
+        std::this_thread::yield();
+        continue;
+      }
+      if(frame->msg.seq <= last || frame->msg.message_id != ~frame->msg.seq)
+        order_ok = false;
+      last = frame->msg.seq;
+      ring->release();
+      count++;
+    }
+    received = count;
+  });
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t seq = 1; seq <= STRESS_FRAMES; seq++)
+    push(seq);
+  done = true;
+  consumer.join();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  TEST_ASSERT_TRUE(order_ok);
+  TEST_ASSERT_EQUAL_UINT32(STRESS_FRAMES, received + ring->lost()); // every frame is either delivered or counted lost
+  TEST_ASSERT_LESS_OR_EQUAL(RING_SIZE, ring->highWater());
+  if(ring->lost() > 0)
+    TEST_ASSERT_EQUAL_UINT16(RING_SIZE, ring->highWater()); // frames are only lost when the ring is full
+
+  char report[160];
+  snprintf(report, sizeof(report), "%lu frames offered in %.3f s : %.0f frames/sec delivered, %lu lost, high water %u of %u",
+    STRESS_FRAMES, secs, received / secs, (unsigned long)ring->lost(), ring->highWater(), RING_SIZE);
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_fifo_and_release);
+  RUN_TEST(test_ring_full_counts_lost);
+  RUN_TEST(test_ring_pending);
+  RUN_TEST(test_ring_two_threads_no_loss_below_capacity);
+  RUN_TEST(test_ring_two_threads_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,235 @@
+/*
+ * frameSpool.h on the file backed stand-in (fileStorage.h) : order, batching, retention, the batch buffer's lifetime, begin()'s status
+ * and recovery after a power cut, including one in the middle of a write and one in the middle of a replay
+ * Every frame carries its seq and a pattern derived from it, so a frame read back from a wrong offset is caught
+ */
+
+#include <unity.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "fileStorage.h"
+#include "frameSpool.h"
+
+typedef struct test_frame
+{
+  uint32_t seq;
+  uint8_t pattern[92]; // the size of espnow_message
+}test_frame;
+
+typedef frameSpool<test_frame, fileStorage> test_spool;
+
+#define BATCH_FRAMES (SPOOL_BATCH_BYTES / sizeof(test_frame))
+#define SEGMENT_FRAMES (SPOOL_SEGMENT_BYTES / sizeof(test_frame))
+
+static char root[32];
+
+static test_frame makeFrame(uint32_t seq)
+{
+  test_frame frame;
+  frame.seq = seq;
+  for(size_t i = 0; i < sizeof(frame.pattern); i++)
+    frame.pattern[i] = (uint8_t)(seq * 31 + i);
+  return frame;
+}
+
+static bool intact(const test_frame &frame)
+{
+  return memcmp(makeFrame(frame.seq).pattern, frame.pattern, sizeof(frame.pattern)) == 0;
+}
+
+// appends seqs first..last a millisec apart, returns the time after the last
+static uint32_t appendFrames(test_spool &spool, uint32_t first, uint32_t last, uint32_t now)
+{
+  for(uint32_t seq = first; seq <= last; seq++)
+  {
+    spool.append(makeFrame(seq), now);
+    spool.update(now++);
+  }
+  return now;
+}
+
+// replays up to max frames, checking each is intact, returns their seqs
+static std::vector<uint32_t> replay(test_spool &spool, uint32_t max = 0xFFFFFFFF)
+{
+  std::vector<uint32_t> seqs;
+  test_frame *frame;
+  while(seqs.size() < max && (frame = spool.front()) != nullptr)
+  {
+    TEST_ASSERT_TRUE(intact(*frame));
+    seqs.push_back(frame->seq);
+    spool.release();
+  }
+  return seqs;
+}
+
+static void assertSeqs(const std::vector<uint32_t> &seqs, uint32_t first, uint32_t last)
+{
+  TEST_ASSERT_EQUAL_UINT32(last - first + 1, seqs.size());
+  for(uint32_t i = 0; i < seqs.size(); i++)
+    TEST_ASSERT_EQUAL_UINT32(first + i, seqs[i]);
+}
+
+void setUp(void)
+{
+  strcpy(root, "/tmp/spoolXXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+}
+
+void tearDown(void)
+{
+  std::string cmd = std::string("rm -rf ") + root;
+  (void)system(cmd.c_str());
+}
+
+void test_spool_replays_in_order(void)
+{
+  fileStorage flash(root);
+  test_spool spool(flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  uint32_t layout_writes = flash.writes;
+  uint32_t frames = 3 * BATCH_FRAMES + 5;
+  uint32_t now = appendFrames(spool, 1, frames, 1000);
+  TEST_ASSERT_EQUAL_UINT32(frames, spool.count());
+  TEST_ASSERT_EQUAL_UINT32(3, flash.writes - layout_writes); // whole batches only, the rest waits for SPOOL_FLUSH_INTERVAL
+  spool.update(now + SPOOL_FLUSH_INTERVAL + 1);
+  TEST_ASSERT_EQUAL_UINT32(4, flash.writes - layout_writes);
+  assertSeqs(replay(spool), 1, frames);
+  TEST_ASSERT_TRUE(spool.isEmpty());
+  TEST_ASSERT_EQUAL_UINT32(frames, spool.spooled());
+  TEST_ASSERT_EQUAL_UINT32(frames, spool.replayed());
+  TEST_ASSERT_EQUAL_UINT32(0, spool.discarded());
+}
+
+void test_spool_replays_batch_from_ram(void)
+{
+  fileStorage flash(root);
+  test_spool spool(flash);
+  spool.begin();
+  uint32_t layout_writes = flash.writes;
+  appendFrames(spool, 1, 10, 0);
+  assertSeqs(replay(spool), 1, 10);
+  TEST_ASSERT_EQUAL_UINT32(0, flash.writes - layout_writes); // replayed before it was due on flash
+}
+
+void test_spool_batch_buffer_only_while_spooling(void)
+{
+  fileStorage flash(root);
+  test_spool spool(flash);
+  spool.begin();
+  TEST_ASSERT_FALSE(spool.batchAllocated());
+  uint32_t now = appendFrames(spool, 1, 5, 0);
+  TEST_ASSERT_TRUE(spool.batchAllocated());
+  spool.update(now + SPOOL_FLUSH_INTERVAL + 1); // flushed and freed
+  TEST_ASSERT_FALSE(spool.batchAllocated());
+  assertSeqs(replay(spool), 1, 5);
+}
+
+void test_spool_begin_reports_failure(void)
+{
+  std::string missing = std::string(root) + "/no/such/dir";
+  fileStorage flash(missing);
+  test_spool spool(flash);
+  TEST_ASSERT_FALSE(spool.begin());
+  spool.append(makeFrame(1), 0);
+  TEST_ASSERT_EQUAL_UINT32(1, spool.discarded());
+  TEST_ASSERT_NULL(spool.front());
+}
+
+void test_spool_retention_drops_oldest(void)
+{
+  fileStorage flash(root);
+  test_spool spool(flash);
+  spool.begin();
+  uint32_t frames = (SPOOL_MAX_SEGMENTS + 2) * SEGMENT_FRAMES;
+  uint32_t now = appendFrames(spool, 1, frames, 0);
+  spool.update(now + SPOOL_FLUSH_INTERVAL + 1);
+  std::vector<uint32_t> seqs = replay(spool);
+  TEST_ASSERT_EQUAL_UINT32(frames, seqs.size() + spool.discarded());
+  TEST_ASSERT_GREATER_THAN(0, spool.discarded());
+  assertSeqs(seqs, frames - seqs.size() + 1, frames); // the newest are kept, in order
+}
+
+// the power goes in the middle of a batch write : the frames written whole before it are replayed after the restart, the torn one is
+// skipped and frames spooled after the restart follow them
+void test_spool_recovers_from_torn_write(void)
+{
+  uint32_t on_flash = BATCH_FRAMES;
+  {
+    fileStorage flash(root);
+    test_spool spool(flash);
+    spool.begin();
+    appendFrames(spool, 1, 2 * BATCH_FRAMES, 0); // the 1st batch on flash, the 2nd full in RAM
+    flash.cutPowerAfter(10 * sizeof(test_frame) + sizeof(test_frame) / 2);
+    appendFrames(spool, 2 * BATCH_FRAMES + 1, 2 * BATCH_FRAMES + 1, 0); // writes the 2nd batch, torn in its 11th frame
+    TEST_ASSERT_FALSE(flash.powered());
+  }
+  fileStorage flash(root); // back up
+  test_spool spool(flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  uint32_t recovered = on_flash + 10;
+  TEST_ASSERT_EQUAL_UINT32(recovered, spool.count());
+  uint32_t now = appendFrames(spool, 1000, 1000 + BATCH_FRAMES + 3, 0);
+  spool.update(now + SPOOL_FLUSH_INTERVAL + 1);
+  std::vector<uint32_t> seqs = replay(spool);
+  TEST_ASSERT_EQUAL_UINT32(recovered + BATCH_FRAMES + 4, seqs.size());
+  assertSeqs(std::vector<uint32_t>(seqs.begin(), seqs.begin() + recovered), 1, recovered);
+  assertSeqs(std::vector<uint32_t>(seqs.begin() + recovered, seqs.end()), 1000, 1000 + BATCH_FRAMES + 3);
+  TEST_ASSERT_TRUE(spool.isEmpty());
+}
+
+// the power goes during a replay : the segment being replayed comes again from its start, nothing is lost
+void test_spool_recovers_mid_replay(void)
+{
+  uint32_t frames = SEGMENT_FRAMES + BATCH_FRAMES; // 2 segments
+  {
+    fileStorage flash(root);
+    test_spool spool(flash);
+    spool.begin();
+    uint32_t now = appendFrames(spool, 1, frames, 0);
+    spool.update(now + SPOOL_FLUSH_INTERVAL + 1);
+    assertSeqs(replay(spool, 10), 1, 10);
+    flash.cutPowerAfter(0);
+  }
+  fileStorage flash(root);
+  test_spool spool(flash);
+  spool.begin();
+  std::vector<uint32_t> seqs = replay(spool);
+  TEST_ASSERT_EQUAL_UINT32(frames, seqs.size());
+  assertSeqs(seqs, 1, frames); // the 10 replayed before go again, at least once delivery
+  TEST_ASSERT_EQUAL_UINT32(0, spool.discarded());
+}
+
+// segments written with another frame size cant be read back, begin() deletes and counts them
+void test_spool_layout_change_discards(void)
+{
+  {
+    fileStorage flash(root);
+    frameSpool<uint32_t, fileStorage> old_spool(flash);
+    old_spool.begin();
+    for(uint32_t i = 0; i < 2000; i++)
+      old_spool.append(i, 0);
+    old_spool.update(SPOOL_FLUSH_INTERVAL + 1);
+  }
+  fileStorage flash(root);
+  test_spool spool(flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_EQUAL_UINT32(2000, spool.discarded());
+  TEST_ASSERT_TRUE(spool.isEmpty());
+  appendFrames(spool, 1, 3, 0);
+  assertSeqs(replay(spool), 1, 3);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_spool_replays_in_order);
+  RUN_TEST(test_spool_replays_batch_from_ram);
+  RUN_TEST(test_spool_batch_buffer_only_while_spooling);
+  RUN_TEST(test_spool_begin_reports_failure);
+  RUN_TEST(test_spool_retention_drops_oldest);
+  RUN_TEST(test_spool_recovers_from_torn_write);
+  RUN_TEST(test_spool_recovers_mid_replay);
+  RUN_TEST(test_spool_layout_change_discards);
+  return UNITY_END();
+}
@@ -0,0 +1,99 @@
+/*
+ * holdTable.h : frames held for the peer gateway, removed when it confirms them, released oldest first once held too long, or all at once
+ * when the peer goes offline, and kept when the release fails
+ */
+
+#include <unity.h>
+#include <vector>
+#include "holdTable.h"
+
+#define HOLD_TIME 300
+
+static std::vector<uint32_t> released;
+static bool accept;
+
+static bool releaseFrame(const uint32_t &frame)
+{
+  if(accept)
+    released.push_back(frame);
+  return accept;
+}
+
+void setUp(void)
+{
+  released.clear();
+  accept = true;
+}
+
+void tearDown(void) {}
+
+void test_hold_full_and_remove(void)
+{
+  holdTable<uint32_t, 3> table;
+  TEST_ASSERT_TRUE(table.add(1, 0));
+  TEST_ASSERT_TRUE(table.add(2, 0));
+  TEST_ASSERT_TRUE(table.add(3, 0));
+  TEST_ASSERT_TRUE(table.isFull());
+  TEST_ASSERT_FALSE(table.add(4, 0));
+  TEST_ASSERT_TRUE(table.remove([](const uint32_t &f) { return f == 2; })); // the peer published it
+  TEST_ASSERT_FALSE(table.remove([](const uint32_t &f) { return f == 2; }));
+  TEST_ASSERT_EQUAL_UINT8(2, table.count());
+  TEST_ASSERT_TRUE(table.add(4, 0)); // into the freed slot
+}
+
+void test_hold_expires_oldest_first(void)
+{
+  holdTable<uint32_t, 4> table;
+  table.add(30, 300); // slots in another order than the times
+  table.add(10, 100);
+  table.add(20, 200);
+  TEST_ASSERT_EQUAL_UINT8(0, table.expire(100 + HOLD_TIME - 1, HOLD_TIME, releaseFrame));
+  TEST_ASSERT_EQUAL_UINT8(2, table.expire(200 + HOLD_TIME, HOLD_TIME, releaseFrame));
+  TEST_ASSERT_EQUAL_UINT32(2, released.size());
+  TEST_ASSERT_EQUAL_UINT32(10, released[0]);
+  TEST_ASSERT_EQUAL_UINT32(20, released[1]);
+  TEST_ASSERT_EQUAL_UINT8(1, table.count());
+}
+
+void test_hold_all_when_peer_offline(void)
+{
+  holdTable<uint32_t, 4> table;
+  table.add(2, 1000);
+  table.add(1, 999);
+  TEST_ASSERT_EQUAL_UINT8(2, table.expire(1000, 0, releaseFrame)); // hold time 0, nothing is held
+  TEST_ASSERT_EQUAL_UINT32(1, released[0]);
+  TEST_ASSERT_EQUAL_UINT32(2, released[1]);
+}
+
+void test_hold_kept_when_release_fails(void)
+{
+  holdTable<uint32_t, 4> table;
+  table.add(1, 0);
+  table.add(2, 10);
+  accept = false; // eg. the ingest ring is full
+  TEST_ASSERT_EQUAL_UINT8(0, table.expire(10 + HOLD_TIME, HOLD_TIME, releaseFrame));
+  TEST_ASSERT_EQUAL_UINT8(2, table.count());
+  accept = true;
+  TEST_ASSERT_EQUAL_UINT8(2, table.expire(10 + HOLD_TIME, HOLD_TIME, releaseFrame));
+  TEST_ASSERT_EQUAL_UINT32(1, released[0]); // still in order
+}
+
+void test_hold_across_millis_wrap(void)
+{
+  holdTable<uint32_t, 4> table;
+  table.add(2, 0x00000010);
+  table.add(1, 0xFFFFFFF0); // older, before the wrap
+  TEST_ASSERT_EQUAL_UINT8(1, table.expire(0xFFFFFFF0 + HOLD_TIME, HOLD_TIME, releaseFrame));
+  TEST_ASSERT_EQUAL_UINT32(1, released[0]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_hold_full_and_remove);
+  RUN_TEST(test_hold_expires_oldest_first);
+  RUN_TEST(test_hold_all_when_peer_offline);
+  RUN_TEST(test_hold_kept_when_release_fails);
+  RUN_TEST(test_hold_across_millis_wrap);
+  return UNITY_END();
+}
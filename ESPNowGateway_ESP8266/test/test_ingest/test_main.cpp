@@ -0,0 +1,396 @@
+/*
+ * The gateway's ingest path off device, src/main.cpp itself (the native env builds it with DEVICE 3) on the shim : sensors on the simulated
+ * radio -> OnDataRecv() -> the ingest rings -> drainQueue()/drainRings() in loop() -> the publish window -> AsyncMqttClient -> the simulated
+ * broker, on the virtual clock. setup() runs once, the tests run one after the other on the same gateway, each with its own sensors, and check
+ * what it published and what it reports on its health and senders topics
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include "simBroker.h"
+#include "espnowMessage.h"
+#include "logHistogram.h"
+
+#define SENSORS 12
+#define DRAIN_BUDGET_MSGS_DEFAULT 16 // DRAIN_BUDGET_MSGS and DRAIN_BUDGET_US in main.cpp
+#define DRAIN_BUDGET_US_DEFAULT 20000
+#define LOOP_US 1000 // time a loop() pass takes besides the code under test (the WiFi stack, OTA, the MQTT client's TCP)
+#define HEALTH_TOPIC "home/espnow/gateway_gf/state"
+#define SENDERS_TOPIC "home/espnow/gateway_gf/senders"
+
+void setup();
+void loop();
+extern uint16_t drain_budget_msgs;
+extern unsigned long drain_budget_us;
+
+// runs loop() for us of virtual time
+static void runGateway(uint64_t us)
+{
+  uint64_t until = simTime().now_us + us;
+  while(simTime().now_us < until)
+  {
+    loop();
+    simAdvance(LOOP_US);
+  }
+}
+
+// frames sent so far per sensor, the message_id and seq of the next frame follow on across the tests
+static uint32_t sent[32];
+// virtual time each frame reaches the gateway, by topic and seq
+static std::map<std::pair<std::string,uint32_t>,uint64_t> arrivals;
+
+// name of sensor i, the door sensors are PRIORITY_DEVICES of Gateway_GF
+static std::string sensorName(uint8_t i)
+{
+  return i == 30 ? "test_door" : i == 31 ? "main_door" : "sensor" + std::to_string(i);
+}
+
+/*
+ * sensor i sends count frames every interval_ms starting interval_ms from now, frame n (1 based) is resent (same message_id and seq) 3 ms
+ * later if resend says so and dropped on the air if lose says so
+ */
+template <typename R, typename L>
+static void scheduleSensor(uint8_t i, uint32_t count, uint32_t interval_ms, R resend, L lose)
+{
+  uint8_t mac[6] = {0x5C, 0xCF, 0x7F, 0x00, 0x10, i};
+  std::string name = sensorName(i);
+  for(uint32_t n = 1; n <= count; n++)
+  {
+    espnow_message msg;
+    snprintf(msg.device_name, sizeof(msg.device_name), "%s", name.c_str());
+    msg.message_id = msg.seq = ++sent[i];
+    msg.msg_type = (msg_type_t)0;
+    msg.intvalue1 = msg.seq; msg.intvalue2 = 0; msg.intvalue3 = 0; msg.intvalue4 = 0;
+    msg.floatvalue1 = 21.5f + n / 10.0f; msg.floatvalue2 = 0; msg.floatvalue3 = 0; msg.floatvalue4 = 0;
+    uint32_t at_us = (n * interval_ms * 1000) + i * 1000; // sensors 1 ms apart
+    if(!lose(n))
+      radio().receive(mac, (const uint8_t*)&msg, sizeof(msg), at_us);
+    if(resend(n))
+      radio().receive(mac, (const uint8_t*)&msg, sizeof(msg), at_us + 3000);
+    arrivals[std::make_pair("home/espnow/" + name + "/state", msg.seq)] = simTime().now_us + at_us + (lose(n) ? 3000 : 0);
+  }
+}
+
+// values the broker got from sensor i in this test, in order, without the dup publishes
+static std::vector<int> publishedValues(uint8_t i)
+{
+  std::string topic = "home/espnow/" + sensorName(i) + "/state";
+  std::string key = "\"ival1\":";
+  std::vector<int> values;
+  for(const simBroker::message &m : mqttBroker().received)
+  {
+    if(m.topic != topic || m.dup)
+      continue;
+    size_t pos = m.payload.find(key);
+    values.push_back(atoi(m.payload.c_str() + pos + key.size()));
+  }
+  return values;
+}
+
+// the number after "key": in json, from pos on
+static uint32_t jsonValue(const std::string &json, const char *key, size_t pos = 0)
+{
+  std::string k = std::string("\"") + key + "\":";
+  pos = json.find(k, pos);
+  TEST_ASSERT_TRUE_MESSAGE(pos != std::string::npos, key);
+  return strtoul(json.c_str() + pos + k.size(), nullptr, 10);
+}
+
+// runs the gateway till it publishes its health message and the sender table, returns the health message
+static std::string nextHealth(std::string *senders_msg = nullptr)
+{
+  simBroker &broker = mqttBroker();
+  size_t from = broker.received.size();
+  std::string health, senders;
+  uint64_t until = simTime().now_us + 31000000;
+  while(simTime().now_us < until && senders.empty())
+  {
+    runGateway(LOOP_US);
+    for(size_t k = from; k < broker.received.size(); k++)
+    {
+      if(broker.received[k].topic == HEALTH_TOPIC)
+        health = broker.received[k].payload;
+      else if(broker.received[k].topic == SENDERS_TOPIC)
+        senders = broker.received[k].payload;
+    }
+  }
+  TEST_ASSERT_FALSE_MESSAGE(senders.empty(), "no health message");
+  if(senders_msg != nullptr)
+    *senders_msg = senders;
+  return health;
+}
+
+// a value of sensor i's entry in the sender table message
+static uint32_t senderValue(const std::string &senders, uint8_t i, const char *key)
+{
+  std::string device = "\"device\":\"" + sensorName(i) + "\"";
+  size_t pos = senders.find(device);
+  TEST_ASSERT_TRUE_MESSAGE(pos != std::string::npos, device.c_str());
+  return jsonValue(senders, key, pos);
+}
+
+void setUp(void)
+{
+  static bool started = false;
+  if(!started)
+  {
+    setup();
+    runGateway(2000000); // WiFi, then MQTT
+    started = true;
+  }
+  mqttBroker().received.clear();
+}
+
+void tearDown(void) {}
+
+// the gateway comes up on its own : WiFi, MQTT, the LWT, the init message and the command topic
+void test_ingest_gateway_starts(void)
+{
+  runGateway(LOOP_US);
+  simBroker &broker = mqttBroker();
+  TEST_ASSERT_TRUE(WiFi.isConnected());
+  TEST_ASSERT_TRUE(broker.connected());
+  TEST_ASSERT_EQUAL_UINT32(1, broker.subscriptions.size());
+  TEST_ASSERT_EQUAL_STRING("home/espnow/gateway_gf/cmd/+", broker.subscriptions[0].c_str());
+}
+
+// every frame heard is published once and in order, retransmissions and air losses are accounted per sender
+void test_ingest_accounts_every_frame(void)
+{
+  const uint32_t frames = 200;
+  for(uint8_t i = 0; i < SENSORS; i++)
+    scheduleSensor(i, frames, 50, [](uint32_t n){ return n % 10 == 0; }, [](uint32_t n){ return n % 25 == 0; });
+  auto start = std::chrono::steady_clock::now();
+  runGateway((frames + 20) * 50 * 1000ULL);
+  double host_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::string senders;
+  std::string health = nextHealth(&senders);
+
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "lost"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "drops"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "inflight"));
+  uint32_t heard = frames - frames / 25 + frames / 50; // every 50th frame is lost on the air but its resend gets through
+  uint32_t published = 0;
+  for(uint8_t i = 0; i < SENSORS; i++)
+  {
+    std::vector<int> values = publishedValues(i);
+    TEST_ASSERT_EQUAL_UINT32(heard, values.size());
+    for(size_t k = 1; k < values.size(); k++)
+      TEST_ASSERT_GREATER_THAN(values[k - 1], values[k]);
+    TEST_ASSERT_EQUAL_UINT32(frames - heard, senderValue(senders, i, "lost"));
+    // a resend of a frame lost on the air is the first copy heard, so only the others count as duplicates
+    TEST_ASSERT_EQUAL_UINT32(frames / 10 - frames / 50, senderValue(senders, i, "dups"));
+    published += values.size();
+  }
+
+  size_t pos = health.find("\"wait\":[");
+  TEST_ASSERT_TRUE(pos != std::string::npos);
+  unsigned p50 = 0, p90 = 0, p99 = 0, max = 0;
+  sscanf(health.c_str() + pos, "\"wait\":[%u,%u,%u,%u]", &p50, &p90, &p99, &max);
+  char report[192];
+  snprintf(report, sizeof(report), "%u frames, %.0f frames/sec of host time, OnDataRecv to PUBACK p50 %u us p99 %u us max %u us, ring high water %u",
+    (unsigned)published, published / host_secs, p50, p99, max, (unsigned)jsonValue(health, "queue_max"));
+  TEST_MESSAGE(report);
+}
+
+// a broker outage backs the frames up in the window, the ring and the spool, they go out once it is back and nothing is lost
+void test_ingest_survives_broker_outage(void)
+{
+  const uint32_t frames = 20;
+  const uint8_t first = SENSORS;
+  for(uint8_t i = first; i < first + 4; i++)
+    scheduleSensor(i, frames, 100, [](uint32_t){ return false; }, [](uint32_t){ return false; });
+  simSchedule(520000, [](){ mqttBroker().outage(); }); // with the frames of 500 ms waiting for their PUBACK
+  simSchedule(900000, [](){ mqttBroker().online = true; });
+  runGateway(10000000); // the retry after MQTT_RETRY_INTERVAL gets it back
+  std::string senders;
+  std::string health = nextHealth(&senders);
+
+  TEST_ASSERT_TRUE(mqttBroker().connected());
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "lost"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "spool_discarded"));
+  TEST_ASSERT_GREATER_THAN(0, jsonValue(health, "retx"));
+  TEST_ASSERT_GREATER_THAN(0, jsonValue(health, "spooled"));
+  for(uint8_t i = first; i < first + 4; i++)
+  {
+    std::vector<int> values = publishedValues(i);
+    std::set<int> unique(values.begin(), values.end());
+    TEST_ASSERT_EQUAL_UINT32(frames, unique.size());
+    TEST_ASSERT_EQUAL_UINT32(0, senderValue(senders, i, "lost"));
+  }
+}
+
+// a scripted outage through updateConnection() with the sensors sending all along : the access point goes away for 20 s (past SPOOL_AFTER, so
+// frames go to the spool), then the broker for 10 s. No frame is lost anywhere, the ring, the spool and every sender's sequence have no gap.
+// 6 sensors at 2 frames/sec keep the spool within its retention cap (SPOOL_MAX_SEGMENTS) over the 20 s. The simulated station comes back on
+// the same channel, a real one may have to find the access point on another channel first
+void test_ingest_survives_wifi_and_mqtt_outage(void)
+{
+  const uint32_t frames = 150;
+  const uint8_t first = SENSORS + 4;
+  std::string before = nextHealth();
+  uint32_t wifi_drops = WiFi.drops;
+  mqttBroker().received.clear();
+  for(uint8_t i = first; i < first + 6; i++)
+    scheduleSensor(i, frames, 500, [](uint32_t){ return false; }, [](uint32_t){ return false; });
+  simSchedule(5025000, [](){ WiFi.apDown(); }); // with frames waiting for their PUBACK
+  simSchedule(25000000, [](){ WiFi.apUp(); });
+  simSchedule(35025000, [](){ mqttBroker().outage(); });
+  simSchedule(45000000, [](){ mqttBroker().online = true; });
+  runGateway(75000000);
+  std::string senders;
+  std::string after = nextHealth(&senders);
+
+  TEST_ASSERT_EQUAL_UINT32(wifi_drops + 1, WiFi.drops);
+  TEST_ASSERT_EQUAL_UINT32(jsonValue(before, "wifi_drops") + 1, jsonValue(after, "wifi_drops"));
+  TEST_ASSERT_EQUAL_UINT32(jsonValue(before, "reconnects") + 2, jsonValue(after, "reconnects"));
+  TEST_ASSERT_GREATER_THAN(jsonValue(before, "spooled"), jsonValue(after, "spooled"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(after, "spool_len"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(after, "lost"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(after, "prio_lost"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(after, "spool_discarded"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(after, "drops"));
+  for(uint8_t i = first; i < first + 6; i++)
+  {
+    std::vector<int> values = publishedValues(i);
+    std::set<int> unique(values.begin(), values.end());
+    TEST_ASSERT_EQUAL_UINT32(frames, unique.size());
+    TEST_ASSERT_EQUAL_UINT32(0, senderValue(senders, i, "lost"));
+  }
+  char report[128];
+  snprintf(report, sizeof(report), "%u frames across the outages, %u spooled, %u sent again after a lost PUBACK",
+    (unsigned)(6 * frames), (unsigned)(jsonValue(after, "spooled") - jsonValue(before, "spooled")), (unsigned)(jsonValue(after, "retx") - jsonValue(before, "retx")));
+  TEST_MESSAGE(report);
+}
+
+/*
+ * publishes a backlog of 240 frames, spooled during a 13 s broker outage, with the drain budget of count frames / us microsecs a pass.
+ * Returns the frames/sec of virtual time from the reconnect till the last one is published, longest_pass is the longest pass of loop()
+ */
+static double backlogRate(uint16_t count, unsigned long us, uint64_t *longest_pass)
+{
+  const uint32_t frames = 120;
+  simBroker &broker = mqttBroker();
+  broker.outage();
+  for(uint8_t i = 28; i < 30; i++)
+    scheduleSensor(i, frames, 100, [](uint32_t){ return false; }, [](uint32_t){ return false; });
+  runGateway(frames * 100000ULL + 1000000);
+  drain_budget_msgs = count;
+  drain_budget_us = us;
+  broker.received.clear();
+  broker.online = true;
+  while(!broker.connected())
+    runGateway(LOOP_US);
+  uint64_t start = simTime().now_us;
+  uint32_t published = 0;
+  size_t seen = 0;
+  *longest_pass = 0;
+  while(published < 2 * frames && simTime().now_us - start < 60000000)
+  {
+    uint64_t pass_start = simTime().now_us;
+    loop();
+    if(simTime().now_us - pass_start > *longest_pass)
+      *longest_pass = simTime().now_us - pass_start;
+    for(; seen < broker.received.size(); seen++)
+      if(!broker.received[seen].dup && broker.received[seen].topic.compare(0, 18, "home/espnow/sensor") == 0)
+        published++;
+    simAdvance(LOOP_US);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2 * frames, published);
+  return published * 1e6 / (simTime().now_us - start);
+}
+
+// the drain budget swept over a backlog in the spool : frames/sec and the longest pass of loop() it costs
+// assumed ESP8266 costs, not measured : a publish call 250 us, a flash access 150 us, a PUBACK from a broker on the LAN after 2 ms
+void test_ingest_drain_budget_sweep(void)
+{
+  const uint16_t counts[] = {1, 4, 8, 16};
+  const unsigned long budgets_us[] = {500, 2000, 20000};
+  simBroker &broker = mqttBroker();
+  broker.publish_us = 250;
+  broker.puback_us = 2000;
+  LittleFS.storage().op_us = 150;
+  double slowest = 0, fastest = 0;
+  for(uint16_t count : counts)
+  {
+    for(unsigned long us : budgets_us)
+    {
+      uint64_t longest_pass;
+      double rate = backlogRate(count, us, &longest_pass);
+      char report[128];
+      snprintf(report, sizeof(report), "drain budget %2u frames / %5lu us : %4.0f frames/sec, longest loop() pass %5u us",
+        count, us, rate, (unsigned)longest_pass);
+      TEST_MESSAGE(report);
+      if(count == 1 && us == budgets_us[0])
+        slowest = rate;
+      if(count == DRAIN_BUDGET_MSGS_DEFAULT && us == DRAIN_BUDGET_US_DEFAULT)
+        fastest = rate;
+    }
+  }
+  drain_budget_msgs = DRAIN_BUDGET_MSGS_DEFAULT;
+  drain_budget_us = DRAIN_BUDGET_US_DEFAULT;
+  broker.publish_us = 0;
+  broker.puback_us = 20000;
+  LittleFS.storage().op_us = 0;
+  TEST_ASSERT_GREATER_THAN(slowest * 3 / 2, fastest); // past a few frames a pass the window and the PUBACK round trip set the rate
+  std::string health = nextHealth();
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "spool_discarded"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "lost"));
+}
+
+// mixed traffic near the gateway's limit : two doors (PRIORITY_DEVICES) at 10 frames/sec each among 12 sensors sending 340 frames/sec, so
+// frames queue in the rings. Latency from OnDataRecv() to the publish, a histogram per class
+// assumed ESP8266 cost, not measured : a publish call 250 us
+void test_ingest_latency_per_class(void)
+{
+  simBroker &broker = mqttBroker();
+  broker.publish_us = 250;
+  for(uint8_t i = 0; i < SENSORS; i++)
+    scheduleSensor(i, 285, 35, [](uint32_t){ return false; }, [](uint32_t){ return false; });
+  for(uint8_t i = 30; i < 32; i++)
+    scheduleSensor(i, 90, 100, [](uint32_t){ return false; }, [](uint32_t){ return false; });
+  runGateway(12000000);
+  broker.publish_us = 0;
+  std::string health = nextHealth();
+
+  logHistogram priority, normal;
+  for(const simBroker::message &m : broker.received)
+  {
+    if(m.dup || m.topic.compare(0, 12, "home/espnow/") != 0)
+      continue;
+    size_t pos = m.payload.find("\"ival1\":");
+    auto arrival = arrivals.find(std::make_pair(m.topic, (uint32_t)atoi(m.payload.c_str() + pos + 8)));
+    if(pos == std::string::npos || arrival == arrivals.end())
+      continue;
+    bool door = m.topic.find("_door/") != std::string::npos;
+    (door ? priority : normal).record((uint32_t)(m.at_us - arrival->second));
+  }
+  TEST_ASSERT_EQUAL_UINT32(2 * 90, priority.count());
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "prio_lost"));
+  TEST_ASSERT_EQUAL_UINT32(0, jsonValue(health, "lost"));
+  TEST_ASSERT_LESS_THAN(normal.percentile(99), priority.percentile(99));
+  char report[160];
+  snprintf(report, sizeof(report), "receive to publish, priority %u frames p50 %u us p99 %u us, normal %u frames p50 %u us p99 %u us",
+    (unsigned)priority.count(), (unsigned)priority.percentile(50), (unsigned)priority.percentile(99),
+    (unsigned)normal.count(), (unsigned)normal.percentile(50), (unsigned)normal.percentile(99));
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ingest_gateway_starts);
+  RUN_TEST(test_ingest_accounts_every_frame);
+  RUN_TEST(test_ingest_survives_broker_outage);
+  RUN_TEST(test_ingest_survives_wifi_and_mqtt_outage);
+  RUN_TEST(test_ingest_drain_budget_sweep);
+  RUN_TEST(test_ingest_latency_per_class);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+/*
+ * jsonWriter.h against ArduinoJson 6, the path publishToMQTT() had before : a StaticJsonDocument serialized into a String
+ * - byte for byte the same output for fixed and random messages (floats over the whole range, negative ints, escaped and unterminated chars)
+ * - a benchmark of both in messages/sec and bytes of heap allocated per message, counted with a replaced operator new
+ * std::string stands in for the Arduino String on the host, both grow on the heap as the JSON is appended. The document is larger than the
+ * StaticJsonDocument<MAX_MESSAGE_LEN> on the ESP8266 as the host's pointers, and so the document's slots, are twice the size
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <ArduinoJson.h>
+#include "espnowMessage.h"
+#include "jsonWriter.h"
+
+#define RANDOM_MESSAGES 20000
+#define BENCH_MESSAGES 200000
+
+static bool count_heap = false;
+static size_t heap_bytes = 0;
+static size_t heap_allocs = 0;
+
+void* operator new(size_t size)
+{
+  if(count_heap)
+  {
+    heap_bytes += size;
+    heap_allocs++;
+  }
+  void *p = malloc(size ? size : 1);
+  if(p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// the document publishToMQTT() built before jsonWriter.h
+static std::string arduinoJson(const espnow_message &msg)
+{
+  StaticJsonDocument<1024> msg_json;
+  msg_json["id"] = msg.message_id;
+  msg_json["device"] = msg.device_name;
+  msg_json["ival1"] = msg.intvalue1;
+  msg_json["ival2"] = msg.intvalue2;
+  msg_json["ival3"] = msg.intvalue3;
+  msg_json["ival4"] = msg.intvalue4;
+  msg_json["fval1"] = msg.floatvalue1;
+  msg_json["fval2"] = msg.floatvalue2;
+  msg_json["fval3"] = msg.floatvalue3;
+  msg_json["fval4"] = msg.floatvalue4;
+  msg_json["char1"] = msg.chardata1;
+  msg_json["char2"] = msg.chardata2;
+  std::string str_msg = "";
+  serializeJson(msg_json, str_msg);
+  return str_msg;
+}
+
+static std::string writer(const espnow_message &msg)
+{
+  char buffer[JSON_MSG_LEN];
+  size_t len = serializeMessage(msg, buffer, sizeof(buffer));
+  return std::string(buffer, len);
+}
+
+static uint32_t rng = 2463534242u;
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static float randomFloat()
+{
+  switch(nextRandom() % 6)
+  {
+    case 0 : return 0;
+    case 1 : return (float)(int32_t)(nextRandom() % 2000) - 1000; // whole numbers, the fast path
+    case 2 : return (int32_t)(nextRandom() % 100000) / 100.0f - 500; // sensor readings
+    case 3 : { float f; uint32_t bits = nextRandom(); memcpy(&f, &bits, sizeof(f)); return f; } // anything, NaN and inf included
+    case 4 : return (nextRandom() % 1000) * 1e-7f; // below 1e-5, printed with an exponent
+    default : return (nextRandom() % 1000) * 1e6f; // beyond 1e7, printed with an exponent
+  }
+}
+
+static void randomChars(char *s, size_t size)
+{
+  static const char chars[] = "abcXYZ019 _-\"\\\b\f\n\r\t/";
+  size_t len = nextRandom() % (size + 1);
+  for(size_t i = 0; i < size; i++)
+    s[i] = i < len ? chars[nextRandom() % (sizeof(chars) - 1)] : '\0';
+  if(len == size)
+    s[size - 1] = '\0'; // ArduinoJson would read past an unterminated one, see test_writer_bounds_unterminated_chars
+}
+
+static espnow_message randomMessage()
+{
+  espnow_message msg;
+  randomChars(msg.device_name, sizeof(msg.device_name));
+  msg.message_id = nextRandom();
+  msg.msg_type = (msg_type_t)0;
+  msg.intvalue1 = (int32_t)nextRandom();
+  msg.intvalue2 = (int32_t)(nextRandom() % 200) - 100;
+  msg.intvalue3 = 0;
+  msg.intvalue4 = nextRandom() % 2 ? INT32_MIN : INT32_MAX;
+  msg.floatvalue1 = randomFloat();
+  msg.floatvalue2 = randomFloat();
+  msg.floatvalue3 = randomFloat();
+  msg.floatvalue4 = randomFloat();
+  randomChars(msg.chardata1, sizeof(msg.chardata1));
+  randomChars(msg.chardata2, sizeof(msg.chardata2));
+  return msg;
+}
+
+static espnow_message doorMessage()
+{
+  espnow_message msg;
+  strcpy(msg.device_name, "frontdoor");
+  msg.message_id = 4021;
+  msg.msg_type = (msg_type_t)0;
+  msg.intvalue1 = 1; msg.intvalue2 = -3; msg.intvalue3 = 0; msg.intvalue4 = 0;
+  msg.floatvalue1 = 3.3f; msg.floatvalue2 = 21.5f; msg.floatvalue3 = 0; msg.floatvalue4 = 0.1f;
+  strcpy(msg.chardata1, "open");
+  strcpy(msg.chardata2, "tab\there");
+  return msg;
+}
+
+void setUp(void)
+{
+  count_heap = false;
+}
+
+void tearDown(void) {}
+
+void test_writer_matches_golden(void)
+{
+  TEST_ASSERT_EQUAL_STRING("{\"id\":4021,\"device\":\"frontdoor\",\"ival1\":1,\"ival2\":-3,\"ival3\":0,\"ival4\":0,"
+    "\"fval1\":3.299999952,\"fval2\":21.5,\"fval3\":0,\"fval4\":0.100000001,\"char1\":\"open\",\"char2\":\"tab\\there\"}",
+    writer(doorMessage()).c_str());
+}
+
+void test_writer_matches_arduinojson(void)
+{
+  TEST_ASSERT_EQUAL_STRING(arduinoJson(doorMessage()).c_str(), writer(doorMessage()).c_str());
+  for(uint32_t i = 0; i < RANDOM_MESSAGES; i++)
+  {
+    espnow_message msg = randomMessage();
+    std::string expected = arduinoJson(msg);
+    std::string actual = writer(msg);
+    if(expected != actual)
+      TEST_ASSERT_EQUAL_STRING(expected.c_str(), actual.c_str()); // shows the first message which differs
+  }
+}
+
+// a sender which does not terminate its char fields cannot make the writer read past them
+void test_writer_bounds_unterminated_chars(void)
+{
+  espnow_message msg = doorMessage();
+  memset(msg.chardata2, 'x', sizeof(msg.chardata2));
+  msg.seq = 0x41414141; // right after chardata2, "AAAA" if it were read
+  std::string json = writer(msg);
+  TEST_ASSERT_TRUE(json.find("\"char2\":\"xxxxxxxxxxxxxxxx\"}") != std::string::npos);
+}
+
+void test_writer_overflow_returns_zero(void)
+{
+  char buffer[64];
+  TEST_ASSERT_EQUAL_size_t(0, serializeMessage(doorMessage(), buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_UINT8('\0', buffer[sizeof(buffer) - 1]);
+}
+
+void test_writer_benchmark_against_arduinojson(void)
+{
+  espnow_message msgs[64];
+  for(uint8_t i = 0; i < 64; i++)
+    msgs[i] = i % 2 ? doorMessage() : randomMessage();
+  size_t sink = 0;
+
+  count_heap = true;
+  heap_bytes = heap_allocs = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t i = 0; i < BENCH_MESSAGES; i++)
+    sink += arduinoJson(msgs[i % 64]).size();
+  double arduinojson_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  size_t arduinojson_bytes = heap_bytes, arduinojson_allocs = heap_allocs;
+
+  heap_bytes = heap_allocs = 0;
+  char buffer[JSON_MSG_LEN];
+  start = std::chrono::steady_clock::now();
+  for(uint32_t i = 0; i < BENCH_MESSAGES; i++)
+    sink += serializeMessage(msgs[i % 64], buffer, sizeof(buffer));
+  double writer_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  size_t writer_bytes = heap_bytes;
+  count_heap = false;
+
+  TEST_ASSERT_EQUAL_size_t(0, writer_bytes);
+  TEST_ASSERT_GREATER_THAN(0, sink);
+  char report[200];
+  snprintf(report, sizeof(report), "ArduinoJson + String : %.0f msgs/sec, %.1f heap bytes in %.1f allocs per msg", BENCH_MESSAGES / arduinojson_secs,
+    (double)arduinojson_bytes / BENCH_MESSAGES, (double)arduinojson_allocs / BENCH_MESSAGES);
+  TEST_MESSAGE(report);
+  snprintf(report, sizeof(report), "jsonWriter           : %.0f msgs/sec, %.1f heap bytes per msg", BENCH_MESSAGES / writer_secs,
+    (double)writer_bytes / BENCH_MESSAGES);
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_writer_matches_golden);
+  RUN_TEST(test_writer_matches_arduinojson);
+  RUN_TEST(test_writer_bounds_unterminated_chars);
+  RUN_TEST(test_writer_overflow_returns_zero);
+  RUN_TEST(test_writer_benchmark_against_arduinojson);
+  return UNITY_END();
+}
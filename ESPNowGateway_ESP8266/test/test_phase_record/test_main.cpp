@@ -0,0 +1,88 @@
+/*
+ * phaseProfiler.h (shared include) : the phase record's round trip and layout, decodePhases() on short frames, records with fewer or more
+ * phases than this build and phaseUnits() saturating
+ */
+
+#include <unity.h>
+#include "phaseProfiler.h"
+
+static phase_record makeRecord(void)
+{
+  phase_record record;
+  for(uint8_t i = 0; i < PHASE_COUNT; i++)
+    record.units[i] = 100 * (i + 1);
+  record.units[PHASE_SLEEP] = PHASE_NOT_MEASURED;
+  return record;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_phases_round_trip(void)
+{
+  phase_record record = makeRecord(), decoded;
+  uint8_t buffer[PHASE_RECORD_LEN];
+  encodePhases(record, buffer);
+  TEST_ASSERT_EQUAL_UINT8(PHASE_RECORD_MAGIC, buffer[0]);
+  TEST_ASSERT_EQUAL_UINT8(PHASE_COUNT, buffer[1]);
+  TEST_ASSERT_EQUAL_UINT8(100, buffer[2]); // little endian
+  TEST_ASSERT_EQUAL_UINT8(0, buffer[3]);
+  TEST_ASSERT_TRUE(decodePhases(buffer, sizeof(buffer), &decoded));
+  TEST_ASSERT_EQUAL_MEMORY(record.units, decoded.units, sizeof(record.units));
+}
+
+void test_phases_short_frames_rejected(void)
+{
+  phase_record record = makeRecord(), decoded;
+  uint8_t buffer[PHASE_RECORD_LEN];
+  encodePhases(record, buffer);
+  for(size_t len = 0; len < sizeof(buffer); len++) // any truncation, down to the header alone
+    TEST_ASSERT_FALSE(decodePhases(buffer, len, &decoded));
+  buffer[0] = 0;
+  TEST_ASSERT_FALSE(decodePhases(buffer, sizeof(buffer), &decoded));
+}
+
+void test_phases_fewer_phases(void)
+{
+  phase_record record = makeRecord(), decoded;
+  uint8_t buffer[PHASE_RECORD_LEN];
+  encodePhases(record, buffer);
+  buffer[1] = 4; // an older sensor with 4 phases
+  TEST_ASSERT_FALSE(decodePhases(buffer, 2 + 2 * 4 - 1, &decoded));
+  TEST_ASSERT_TRUE(decodePhases(buffer, 2 + 2 * 4, &decoded));
+  for(uint8_t i = 0; i < 4; i++)
+    TEST_ASSERT_EQUAL_UINT16(record.units[i], decoded.units[i]);
+  for(uint8_t i = 4; i < PHASE_COUNT; i++)
+    TEST_ASSERT_EQUAL_UINT16(PHASE_NOT_MEASURED, decoded.units[i]);
+}
+
+void test_phases_more_phases(void)
+{
+  phase_record record = makeRecord(), decoded;
+  uint8_t buffer[PHASE_RECORD_LEN + 4];
+  encodePhases(record, buffer);
+  buffer[1] = PHASE_COUNT + 2; // a newer sensor, the phases this build knows are read, the rest skipped
+  buffer[PHASE_RECORD_LEN] = buffer[PHASE_RECORD_LEN + 1] = buffer[PHASE_RECORD_LEN + 2] = buffer[PHASE_RECORD_LEN + 3] = 0xEE;
+  TEST_ASSERT_FALSE(decodePhases(buffer, PHASE_RECORD_LEN, &decoded)); // its own count says it is longer
+  TEST_ASSERT_TRUE(decodePhases(buffer, sizeof(buffer), &decoded));
+  TEST_ASSERT_EQUAL_MEMORY(record.units, decoded.units, sizeof(record.units));
+}
+
+void test_phase_units_saturate(void)
+{
+  TEST_ASSERT_EQUAL_UINT16(0, phaseUnits(PHASE_UNIT_US - 1));
+  TEST_ASSERT_EQUAL_UINT16(12, phaseUnits(12 * PHASE_UNIT_US + 50));
+  TEST_ASSERT_EQUAL_UINT16(PHASE_NOT_MEASURED - 1, phaseUnits((uint32_t)PHASE_NOT_MEASURED * PHASE_UNIT_US)); // never reads as not measured
+  TEST_ASSERT_EQUAL_UINT16(PHASE_NOT_MEASURED - 1, phaseUnits(0xFFFFFFFF));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_phases_round_trip);
+  RUN_TEST(test_phases_short_frames_rejected);
+  RUN_TEST(test_phases_fewer_phases);
+  RUN_TEST(test_phases_more_phases);
+  RUN_TEST(test_phase_units_saturate);
+  return UNITY_END();
+}
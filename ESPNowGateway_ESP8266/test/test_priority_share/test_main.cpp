@@ -0,0 +1,98 @@
+/*
+ * priorityShare.h : priority frames first, the guaranteed share of the normal ring under a flood of priority frames and a mixed backlog
+ * drained through two frameRings as drainRings() in src/main.cpp does
+ */
+
+#include <unity.h>
+#include "priorityShare.h"
+#include "frameRing.h"
+
+#define SHARE 4 // LOW_PRIORITY_SHARE in main.cpp
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_share_priority_first(void)
+{
+  priorityShare share(SHARE);
+  TEST_ASSERT_TRUE(share.pickPriority(true, true));
+  TEST_ASSERT_TRUE(share.pickPriority(true, false));
+  TEST_ASSERT_FALSE(share.pickPriority(false, true));
+  TEST_ASSERT_FALSE(share.pickPriority(false, false));
+}
+
+// with both rings full one publish in every SHARE+1 is a normal frame
+void test_share_normal_never_starved(void)
+{
+  priorityShare share(SHARE);
+  uint32_t normal = 0;
+  for(uint32_t i = 0; i < 100; i++)
+  {
+    bool priority = share.pickPriority(true, true);
+    if(!priority)
+    {
+      TEST_ASSERT_EQUAL_UINT8(SHARE, share.streak());
+      normal++;
+    }
+    share.published(priority);
+  }
+  TEST_ASSERT_EQUAL_UINT32(100 / (SHARE + 1), normal);
+}
+
+// a long run of priority frames with nothing normal waiting does not wrap the streak, the next normal frame still gets its turn
+void test_share_streak_holds_while_normal_empty(void)
+{
+  priorityShare share(SHARE);
+  for(uint32_t i = 0; i < 1000; i++)
+    share.published(share.pickPriority(true, false));
+  TEST_ASSERT_FALSE(share.pickPriority(true, true));
+}
+
+// a backlog of 40 normal and 10 priority frames : the priority frames go out within the first 12 publishes, 4 + 1 normal + 4 + 1 normal + 2,
+// and each ring keeps its order
+void test_share_mixed_backlog(void)
+{
+  frameRing<uint32_t,64> normal_ring;
+  frameRing<uint32_t,16> priority_ring;
+  for(uint32_t i = 0; i < 40; i++)
+  {
+    *normal_ring.reserve() = i;
+    normal_ring.commit();
+  }
+  for(uint32_t i = 0; i < 10; i++)
+  {
+    *priority_ring.reserve() = 1000 + i;
+    priority_ring.commit();
+  }
+  priorityShare share(SHARE);
+  uint32_t next_normal = 0, next_priority = 1000, last_priority_at = 0;
+  for(uint32_t n = 1; !normal_ring.isEmpty() || !priority_ring.isEmpty(); n++)
+  {
+    bool priority = share.pickPriority(!priority_ring.isEmpty(), !normal_ring.isEmpty());
+    if(priority)
+    {
+      TEST_ASSERT_EQUAL_UINT32(next_priority++, *priority_ring.front());
+      priority_ring.release();
+      last_priority_at = n;
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL_UINT32(next_normal++, *normal_ring.front());
+      normal_ring.release();
+    }
+    share.published(priority);
+  }
+  TEST_ASSERT_EQUAL_UINT32(40, next_normal);
+  TEST_ASSERT_EQUAL_UINT32(1010, next_priority);
+  TEST_ASSERT_EQUAL_UINT32(12, last_priority_at);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_share_priority_first);
+  RUN_TEST(test_share_normal_never_starved);
+  RUN_TEST(test_share_streak_holds_while_normal_empty);
+  RUN_TEST(test_share_mixed_backlog);
+  return UNITY_END();
+}
@@ -0,0 +1,221 @@
+/*
+ * publishWindow.h : in order sends and releases, requeue() and timeouts resending with the dup flag and the original packet id, a full TCP
+ * buffer keeping the order and unpublishable frames dropped without stalling the window
+ * - a benchmark of window sizes 1, 2, 4 and 8 against the simulated broker with a PUBACK delay, msgs/sec and p99 latency for a backlog
+ *   and for bursts
+ */
+
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "publishWindow.h"
+#include "simBroker.h"
+
+#define BENCH_PUBACK_US 20000 // broker round trip, a broker on the LAN under load
+#define BENCH_LOOP_US 1000 // time between passes of loop()
+
+struct sent_frame
+{
+  uint32_t frame;
+  bool dup;
+  uint16_t packet_id; // the id passed in, 0 on a first send
+};
+
+static std::vector<sent_frame> sends;
+static std::vector<uint32_t> released;
+static uint16_t next_id;
+static int32_t refuse; // returned instead of a packet id while not 1
+
+static int32_t sendFrame(const uint32_t &frame, bool dup, uint16_t packet_id)
+{
+  if(refuse != 1)
+    return refuse;
+  sends.push_back(sent_frame{frame, dup, packet_id});
+  return dup ? packet_id : next_id++;
+}
+
+static void doneFrame(const uint32_t &frame)
+{
+  released.push_back(frame);
+}
+
+void setUp(void)
+{
+  sends.clear();
+  released.clear();
+  next_id = 1;
+  refuse = 1;
+}
+
+void tearDown(void) {}
+
+void test_window_sends_and_releases_in_order(void)
+{
+  publishWindow<uint32_t, 4> window;
+  for(uint32_t f = 10; f < 14; f++)
+    TEST_ASSERT_TRUE(window.add(f));
+  TEST_ASSERT_TRUE(window.isFull());
+  TEST_ASSERT_FALSE(window.add(99));
+  window.update(0, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(4, sends.size());
+  for(uint32_t i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(10 + i, sends[i].frame);
+    TEST_ASSERT_FALSE(sends[i].dup);
+  }
+  window.acked(2); // the 2nd frame, the oldest is still out
+  TEST_ASSERT_EQUAL_UINT8(0, window.update(1, sendFrame, doneFrame));
+  TEST_ASSERT_EQUAL_UINT8(4, window.count());
+  window.acked(1);
+  TEST_ASSERT_EQUAL_UINT8(2, window.update(2, sendFrame, doneFrame)); // released up to the first one not acked
+  TEST_ASSERT_EQUAL_UINT32(2, released.size());
+  TEST_ASSERT_EQUAL_UINT32(10, released[0]);
+  TEST_ASSERT_EQUAL_UINT32(11, released[1]);
+  TEST_ASSERT_TRUE(window.add(14)); // into a freed slot, sent after the ones before it
+  window.update(3, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(14, sends.back().frame);
+  TEST_ASSERT_EQUAL_UINT32(4, window.highWater());
+  TEST_ASSERT_EQUAL_UINT32(2, window.acknowledged());
+}
+
+void test_window_requeue_resends_with_dup(void)
+{
+  publishWindow<uint32_t, 4> window;
+  for(uint32_t f = 10; f < 13; f++)
+    window.add(f);
+  window.update(0, sendFrame, doneFrame);
+  window.acked(2);
+  sends.clear();
+  window.requeue(); // the connection dropped, PUBACKs for 1 and 3 never came
+  window.update(10, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(2, sends.size()); // the acked one is not sent again
+  TEST_ASSERT_EQUAL_UINT32(10, sends[0].frame);
+  TEST_ASSERT_TRUE(sends[0].dup);
+  TEST_ASSERT_EQUAL_UINT16(1, sends[0].packet_id); // same packet id, the broker drops it if it already has it
+  TEST_ASSERT_EQUAL_UINT32(12, sends[1].frame);
+  TEST_ASSERT_TRUE(sends[1].dup);
+  TEST_ASSERT_EQUAL_UINT16(3, sends[1].packet_id);
+  TEST_ASSERT_EQUAL_UINT32(2, window.retransmits());
+  window.acked(1);
+  window.acked(3);
+  TEST_ASSERT_EQUAL_UINT8(3, window.update(11, sendFrame, doneFrame));
+  TEST_ASSERT_TRUE(window.isEmpty());
+}
+
+void test_window_resends_after_ack_timeout(void)
+{
+  publishWindow<uint32_t, 2> window;
+  window.add(10);
+  window.update(1000, sendFrame, doneFrame);
+  window.update(1000 + MQTT_ACK_TIMEOUT, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(1, sends.size()); // not yet
+  window.update(1000 + MQTT_ACK_TIMEOUT + 1, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(2, sends.size());
+  TEST_ASSERT_TRUE(sends[1].dup);
+  TEST_ASSERT_EQUAL_UINT16(1, sends[1].packet_id);
+  window.update(1000 + MQTT_ACK_TIMEOUT + 2, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(2, sends.size()); // the timeout restarts from the resend
+}
+
+void test_window_full_buffer_keeps_order(void)
+{
+  publishWindow<uint32_t, 4> window;
+  for(uint32_t f = 10; f < 13; f++)
+    window.add(f);
+  refuse = 0; // not connected or TCP buffer full
+  window.update(0, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(0, sends.size());
+  refuse = 1;
+  window.update(1, sendFrame, doneFrame);
+  TEST_ASSERT_EQUAL_UINT32(3, sends.size());
+  for(uint32_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(10 + i, sends[i].frame);
+    TEST_ASSERT_FALSE(sends[i].dup); // never went out, not a resend
+  }
+}
+
+void test_window_drops_unpublishable(void)
+{
+  publishWindow<uint32_t, 2> window;
+  window.add(10);
+  refuse = -1; // eg. a topic too long
+  window.update(0, sendFrame, doneFrame);
+  refuse = 1;
+  window.add(11);
+  TEST_ASSERT_EQUAL_UINT8(0, window.update(1, sendFrame, doneFrame)); // the dropped one is freed, not counted as acked
+  TEST_ASSERT_EQUAL_UINT8(1, window.count());
+  TEST_ASSERT_EQUAL_UINT32(1, window.dropped());
+  TEST_ASSERT_EQUAL_UINT32(0, released.size());
+  window.acked(1);
+  TEST_ASSERT_EQUAL_UINT8(1, window.update(2, sendFrame, doneFrame));
+  TEST_ASSERT_EQUAL_UINT32(11, released[0]);
+}
+
+/*
+ * a window of N slots in a loop() every BENCH_LOOP_US publishing count frames to the simulated broker, they arrive in bursts of burst frames
+ * every period_us. Returns the msgs/sec from the first arrival to the last PUBACK, p99_us the 99th percentile from arrival to PUBACK
+ */
+template <uint8_t N>
+static double benchWindow(uint32_t count, uint32_t burst, uint32_t period_us, uint32_t *p99_us)
+{
+  simReset();
+  simBroker broker;
+  broker.connect();
+  broker.puback_us = BENCH_PUBACK_US;
+  publishWindow<uint32_t, N> window;
+  broker.on_puback = [&window](uint16_t packet_id) { window.acked(packet_id); };
+  auto arrival = [burst, period_us](uint32_t frame) { return (uint64_t)(frame / burst) * period_us; };
+  std::vector<uint32_t> latency;
+  uint32_t next = 0;
+  auto send = [&broker](const uint32_t &frame, bool dup, uint16_t packet_id) { return (int32_t)broker.publish("bench", 1, false, "{}", 2, dup, packet_id); };
+  auto done = [&latency, &arrival](const uint32_t &frame) { latency.push_back((uint32_t)(simTime().now_us - arrival(frame))); };
+  while(latency.size() < count)
+  {
+    while(next < count && arrival(next) <= simTime().now_us && window.add(next))
+      next++;
+    window.update(simTime().now_us / 1000, send, done);
+    simAdvance(BENCH_LOOP_US);
+  }
+  double rate = count * 1e6 / simTime().now_us;
+  std::sort(latency.begin(), latency.end());
+  *p99_us = latency[(latency.size() * 99 + 99) / 100 - 1];
+  return rate;
+}
+
+template <uint8_t N>
+static void reportWindow(double *saturated)
+{
+  uint32_t p99_backlog, p99_bursts;
+  *saturated = benchWindow<N>(2000, 2000, 0, &p99_backlog);
+  double bursts = benchWindow<N>(2000, 8, 200000, &p99_bursts); // 40 msgs/sec in bursts of 8, within what a window of 1 gets through
+  char report[160];
+  snprintf(report, sizeof(report), "window %u : backlog of 2000 %3.0f msgs/sec p99 %8u us, bursts of 8 every 200 ms %2.0f msgs/sec p99 %6u us",
+    N, *saturated, (unsigned)p99_backlog, bursts, (unsigned)p99_bursts);
+  TEST_MESSAGE(report);
+}
+
+// the window is what keeps the publish rate off the broker round trip, a window of N gets ~N frames through per PUBACK delay
+void test_window_size_benchmark(void)
+{
+  double rate1, rate2, rate4, rate8;
+  reportWindow<1>(&rate1);
+  reportWindow<2>(&rate2);
+  reportWindow<4>(&rate4);
+  reportWindow<8>(&rate8);
+  TEST_ASSERT_GREATER_THAN(rate1 * 3 / 2, rate2);
+  TEST_ASSERT_GREATER_THAN(rate2 * 3 / 2, rate4);
+  TEST_ASSERT_GREATER_THAN(rate4 * 3 / 2, rate8);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_window_sends_and_releases_in_order);
+  RUN_TEST(test_window_requeue_resends_with_dup);
+  RUN_TEST(test_window_resends_after_ack_timeout);
+  RUN_TEST(test_window_full_buffer_keeps_order);
+  RUN_TEST(test_window_drops_unpublishable);
+  RUN_TEST(test_window_size_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,133 @@
+/*
+ * retryPolicy.h (shared include) : the backoff schedule, its jitter bounds, channel hunts, the time budget and giving up or carrying forward
+ */
+
+#include <unity.h>
+#include "retryPolicy.h"
+
+static const retry_policy legacy = RETRY_POLICY_LEGACY;
+static const retry_policy battery = RETRY_POLICY_BATTERY;
+static const retry_policy noisy = RETRY_POLICY_NOISY;
+static const retry_policy steady = {"steady", 7, 10, 50, 0, 0, 0, false}; // no jitter, no hunts, no budget
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_retry_backoff_doubles_up_to_cap(void)
+{
+  retryEngine engine(steady, 1);
+  const uint16_t expected[] = {10, 20, 40, 50, 50, 50};
+  for(uint8_t i = 0; i < 6; i++)
+  {
+    retry_action action = engine.next(SEND_NO_ACK, 0, 0, false);
+    TEST_ASSERT_EQUAL_INT(RETRY_SEND, action.verb);
+    TEST_ASSERT_EQUAL_UINT16(expected[i], action.delay_ms);
+  }
+  TEST_ASSERT_EQUAL_INT(RETRY_GIVE_UP, engine.next(SEND_NO_ACK, 0, 0, false).verb); // the 7th attempt was the last
+  TEST_ASSERT_EQUAL_UINT8(7, engine.attempts());
+}
+
+void test_retry_jitter_within_bounds(void)
+{
+  // noisy : 10 ms doubling to 160, +-50%
+  const uint16_t base[] = {10, 20, 40, 80, 160};
+  uint16_t lowest[5], highest[5];
+  for(uint8_t i = 0; i < 5; i++)
+  {
+    lowest[i] = 0xFFFF;
+    highest[i] = 0;
+  }
+  for(uint32_t seed = 0; seed < 10000; seed++)
+  {
+    retryEngine engine(noisy, seed * 2654435761u);
+    for(uint8_t i = 0; i < 5; i++)
+    {
+      retry_action action = engine.next(SEND_ERROR, 0, 0, true);
+      TEST_ASSERT_EQUAL_INT(RETRY_SEND, action.verb);
+      TEST_ASSERT_GREATER_OR_EQUAL(base[i] - base[i] / 2, action.delay_ms);
+      TEST_ASSERT_LESS_OR_EQUAL(base[i] + base[i] / 2, action.delay_ms);
+      if(action.delay_ms < lowest[i]) lowest[i] = action.delay_ms;
+      if(action.delay_ms > highest[i]) highest[i] = action.delay_ms;
+    }
+  }
+  for(uint8_t i = 0; i < 5; i++) // the whole spread is used, sensors woken together dont retry in step
+  {
+    TEST_ASSERT_EQUAL_UINT16(base[i] - base[i] / 2, lowest[i]);
+    TEST_ASSERT_EQUAL_UINT16(base[i] + base[i] / 2, highest[i]);
+  }
+}
+
+void test_retry_same_seed_same_delays(void)
+{
+  retryEngine a(battery, 1234), b(battery, 1234);
+  uint16_t da = a.next(SEND_ERROR, 0, 0, true).delay_ms;
+  TEST_ASSERT_EQUAL_UINT16(da, b.next(SEND_ERROR, 0, 0, true).delay_ms);
+  bool differs = false;
+  for(uint32_t seed = 1; seed < 20 && !differs; seed++)
+  {
+    retryEngine d(battery, seed);
+    differs = d.next(SEND_ERROR, 0, 0, true).delay_ms != da;
+  }
+  TEST_ASSERT_TRUE(differs);
+}
+
+void test_retry_legacy_hunts_then_gives_up(void)
+{
+  retryEngine engine(legacy, 1);
+  retry_action action = engine.next(SEND_NO_ACK, 0, 0, false);
+  TEST_ASSERT_EQUAL_INT(RETRY_HUNT, action.verb);
+  TEST_ASSERT_EQUAL_UINT16(0, action.delay_ms); // straight away, as sendESPnowMessage() did
+  TEST_ASSERT_EQUAL_INT(RETRY_GIVE_UP, engine.next(SEND_NO_ACK, 0, 0, true).verb);
+
+  retryEngine hunted(legacy, 1);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, hunted.next(SEND_NO_ACK, 0, 0, true).verb); // once per wake
+}
+
+void test_retry_hunt_after_no_acks_in_a_row(void)
+{
+  retryEngine engine(noisy, 1); // hunt_after 3
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_NO_ACK, 0, 0, false).verb);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_NO_ACK, 0, 0, false).verb);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_ERROR, 0, 0, false).verb); // a local error breaks the run
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_NO_ACK, 0, 0, false).verb);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_NO_ACK, 0, 0, false).verb);
+  TEST_ASSERT_EQUAL_INT(RETRY_GIVE_UP, engine.next(SEND_NO_ACK, 0, 0, false).verb); // 6 attempts before the 3rd in a row
+  retryEngine second(noisy, 1);
+  second.next(SEND_NO_ACK, 0, 0, false);
+  second.next(SEND_NO_ACK, 0, 0, false);
+  TEST_ASSERT_EQUAL_INT(RETRY_HUNT, second.next(SEND_NO_ACK, 0, 0, false).verb);
+}
+
+void test_retry_no_peer_gives_up(void)
+{
+  retryEngine engine(noisy, 1);
+  TEST_ASSERT_EQUAL_INT(RETRY_GIVE_UP, engine.next(SEND_NO_PEER, 0, 0, false).verb);
+  retryEngine carry(battery, 1);
+  retry_action action = carry.next(SEND_NO_PEER, 0, 0, false);
+  TEST_ASSERT_EQUAL_INT(RETRY_CARRY_FORWARD, action.verb);
+  TEST_ASSERT_EQUAL_UINT16(0, action.delay_ms);
+}
+
+void test_retry_budget(void)
+{
+  // battery : 300 ms budget, first backoff 20 ms +-25%, so at most 25 ms
+  retryEngine engine(battery, 1);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, engine.next(SEND_ERROR, 200, 40, true).verb); // 200 + 25 + 40 fits
+  retryEngine over(battery, 1);
+  TEST_ASSERT_EQUAL_INT(RETRY_CARRY_FORWARD, over.next(SEND_ERROR, 250, 40, true).verb); // 250 + 15 + 40 does not
+  retryEngine unlimited(steady, 1);
+  TEST_ASSERT_EQUAL_INT(RETRY_SEND, unlimited.next(SEND_ERROR, 60000, 40, true).verb);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_retry_backoff_doubles_up_to_cap);
+  RUN_TEST(test_retry_jitter_within_bounds);
+  RUN_TEST(test_retry_same_seed_same_delays);
+  RUN_TEST(test_retry_legacy_hunts_then_gives_up);
+  RUN_TEST(test_retry_hunt_after_no_acks_in_a_row);
+  RUN_TEST(test_retry_no_peer_gives_up);
+  RUN_TEST(test_retry_budget);
+  return UNITY_END();
+}
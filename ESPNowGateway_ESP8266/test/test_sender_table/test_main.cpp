@@ -0,0 +1,170 @@
+/*
+ * senderTable.h : acceptSeq() in order, gaps, late frames within SEQ_WINDOW, stale replays, SEQ_RESYNC and wrap around, plus lookup and isDuplicate()
+ */
+
+#include <unity.h>
+#include "senderTable.h"
+
+static const uint8_t mac_a[6] = {0x4C, 0xF2, 0x32, 0xF0, 0x74, 0x2D};
+static const uint8_t mac_b[6] = {0x4C, 0xF2, 0x32, 0xF0, 0x74, 0x2E};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_seq_in_order(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  for(uint32_t seq = 100; seq < 110; seq++)
+    TEST_ASSERT_TRUE(table.acceptSeq(e, seq));
+  TEST_ASSERT_EQUAL_UINT32(109, e->last_seq);
+  TEST_ASSERT_EQUAL_UINT32(10, e->seq_frames);
+  TEST_ASSERT_EQUAL_UINT32(0, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(0, table.lossPermille(*e));
+}
+
+void test_seq_zero_always_accepted(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 0));
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, e->seq_frames); // a sender without sequence nos is not counted
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 5));
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 0));
+  TEST_ASSERT_EQUAL_UINT32(5, e->last_seq);
+}
+
+void test_seq_gap_counts_lost(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 1);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 5)); // 2, 3 and 4 missing
+  TEST_ASSERT_EQUAL_UINT32(3, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(2, e->seq_frames);
+  TEST_ASSERT_EQUAL_UINT32(600, table.lossPermille(*e)); // 3 of 5
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 5 + SEQ_WINDOW + 10)); // a gap wider than the window
+  TEST_ASSERT_EQUAL_UINT32(3 + SEQ_WINDOW + 9, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(1, e->seq_window); // nothing before the newest is known received
+}
+
+void test_seq_late_frame_takes_loss_back(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 10);
+  table.acceptSeq(e, 14);
+  TEST_ASSERT_EQUAL_UINT32(3, e->lost);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 12)); // late, not lost
+  TEST_ASSERT_EQUAL_UINT32(2, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(14, e->last_seq); // the newest stays
+  TEST_ASSERT_FALSE(table.acceptSeq(e, 12)); // the same late frame again is a replay
+  TEST_ASSERT_EQUAL_UINT32(2, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(1, e->replays);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 11));
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 13));
+  TEST_ASSERT_EQUAL_UINT32(0, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(5, e->seq_frames);
+}
+
+void test_seq_stale_replays_rejected(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 100);
+  TEST_ASSERT_FALSE(table.acceptSeq(e, 100)); // the newest again
+  TEST_ASSERT_FALSE(table.acceptSeq(e, 99)); // before the first no received, not ours to count
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 200)); // the window now holds only 200
+  TEST_ASSERT_EQUAL_UINT32(99, e->lost);
+  TEST_ASSERT_FALSE(table.acceptSeq(e, 200 - SEQ_WINDOW)); // too old to tell late from replayed
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 200 - SEQ_WINDOW + 1)); // the oldest no still in the window
+  TEST_ASSERT_EQUAL_UINT32(98, e->lost);
+  TEST_ASSERT_EQUAL_UINT32(3, e->replays);
+  TEST_ASSERT_EQUAL_UINT32(3, table.replays());
+  TEST_ASSERT_EQUAL_UINT32(0, e->stale_run); // the accepted frame ended the run
+}
+
+void test_seq_resync_after_restart(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 500);
+  uint32_t lost = e->lost;
+  for(uint32_t seq = 1; seq <= SEQ_RESYNC; seq++) // the sender lost its nos and counts from 1 again
+    TEST_ASSERT_FALSE(table.acceptSeq(e, seq));
+  TEST_ASSERT_TRUE(table.acceptSeq(e, SEQ_RESYNC + 1)); // taken afresh
+  TEST_ASSERT_EQUAL_UINT32(SEQ_RESYNC + 1, e->last_seq);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, SEQ_RESYNC + 2));
+  TEST_ASSERT_EQUAL_UINT32(lost, e->lost); // the restart is not counted as a loss
+  TEST_ASSERT_FALSE(table.acceptSeq(e, SEQ_RESYNC + 2)); // and replays are rejected again
+}
+
+void test_seq_resync_needs_stale_in_a_row(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 500);
+  uint32_t seq = 501;
+  for(uint8_t i = 0; i < 3 * SEQ_RESYNC; i++)
+  {
+    TEST_ASSERT_FALSE(table.acceptSeq(e, 1)); // a replayed old frame now and then
+    TEST_ASSERT_TRUE(table.acceptSeq(e, seq++));
+  }
+  TEST_ASSERT_EQUAL_UINT32(seq - 1, e->last_seq); // never resynced to the replay
+  TEST_ASSERT_EQUAL_UINT32(3 * SEQ_RESYNC, e->replays);
+}
+
+void test_seq_wraps_around(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  table.acceptSeq(e, 0xFFFFFFFE);
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 0xFFFFFFFF));
+  TEST_ASSERT_TRUE(table.acceptSeq(e, 1)); // newer, 0 is not a sequence no but counts in the gap
+  TEST_ASSERT_EQUAL_UINT32(1, e->last_seq);
+  TEST_ASSERT_FALSE(table.acceptSeq(e, 0xFFFFFFFF));
+}
+
+void test_lookup_same_and_evicted(void)
+{
+  senderTable<1> table; // one slot
+  sender_entry *a = table.lookup(mac_a, 1000);
+  table.acceptSeq(a, 7);
+  TEST_ASSERT_EQUAL_PTR(a, table.lookup(mac_a, 2000));
+  TEST_ASSERT_EQUAL_UINT32(7, a->last_seq);
+  sender_entry *b = table.lookup(mac_b, 3000); // replaces the least recently heard
+  TEST_ASSERT_EQUAL_MEMORY(mac_b, b->mac, 6);
+  TEST_ASSERT_EQUAL_UINT32(0, b->seq_frames);
+  TEST_ASSERT_EQUAL_UINT32(0, b->last_seq);
+}
+
+void test_duplicate_within_window(void)
+{
+  senderTable<8> table;
+  sender_entry *e = table.lookup(mac_a, 1000);
+  TEST_ASSERT_FALSE(table.isDuplicate(e, 42, 1000));
+  TEST_ASSERT_TRUE(table.isDuplicate(e, 42, 1000 + DEDUP_WINDOW - 1));
+  TEST_ASSERT_FALSE(table.isDuplicate(e, 42, 1000 + DEDUP_WINDOW)); // too long ago, a new message reusing the id
+  for(uint32_t id = 1; id <= DEDUP_DEPTH; id++)
+    TEST_ASSERT_FALSE(table.isDuplicate(e, id, 2000));
+  TEST_ASSERT_FALSE(table.isDuplicate(e, 42, 2000)); // pushed out by DEDUP_DEPTH newer ids
+  TEST_ASSERT_EQUAL_UINT32(1, e->duplicates);
+  TEST_ASSERT_EQUAL_UINT32(1, table.duplicates());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_seq_in_order);
+  RUN_TEST(test_seq_zero_always_accepted);
+  RUN_TEST(test_seq_gap_counts_lost);
+  RUN_TEST(test_seq_late_frame_takes_loss_back);
+  RUN_TEST(test_seq_stale_replays_rejected);
+  RUN_TEST(test_seq_resync_after_restart);
+  RUN_TEST(test_seq_resync_needs_stale_in_a_row);
+  RUN_TEST(test_seq_wraps_around);
+  RUN_TEST(test_lookup_same_and_evicted);
+  RUN_TEST(test_duplicate_within_window);
+  return UNITY_END();
+}
@@ -0,0 +1,64 @@
+/*
+ * stateTimer.h : the time and entries counted per state, staying in a state, states out of range and millis() wrapping
+ */
+
+#include <unity.h>
+#include "stateTimer.h"
+
+enum { WIFI_DOWN, MQTT_DOWN, UP, STATES };
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_timer_counts_time_per_state(void)
+{
+  stateTimer<STATES> timer(WIFI_DOWN);
+  timer.set(MQTT_DOWN, 3000);
+  timer.set(UP, 3500);
+  timer.set(MQTT_DOWN, 10000);
+  timer.set(UP, 10200);
+  TEST_ASSERT_EQUAL_UINT8(UP, timer.get());
+  TEST_ASSERT_EQUAL_UINT32(3000, timer.timeIn(WIFI_DOWN, 12000));
+  TEST_ASSERT_EQUAL_UINT32(700, timer.timeIn(MQTT_DOWN, 12000));
+  TEST_ASSERT_EQUAL_UINT32(6500 + 1800, timer.timeIn(UP, 12000)); // the ongoing stay included
+  TEST_ASSERT_EQUAL_UINT32(1800, timer.elapsed(12000));
+  TEST_ASSERT_EQUAL_UINT32(0, timer.entries(WIFI_DOWN)); // the initial state is not entered
+  TEST_ASSERT_EQUAL_UINT32(2, timer.entries(MQTT_DOWN));
+  TEST_ASSERT_EQUAL_UINT32(2, timer.entries(UP));
+}
+
+void test_timer_same_state_is_no_op(void)
+{
+  stateTimer<STATES> timer(WIFI_DOWN);
+  timer.set(UP, 1000);
+  timer.set(UP, 5000); // called on every loop() while up
+  TEST_ASSERT_EQUAL_UINT32(1, timer.entries(UP));
+  TEST_ASSERT_EQUAL_UINT32(6000, timer.elapsed(7000)); // since it was first entered
+}
+
+void test_timer_ignores_unknown_state(void)
+{
+  stateTimer<STATES> timer(WIFI_DOWN);
+  timer.set(STATES, 1000);
+  TEST_ASSERT_EQUAL_UINT8(WIFI_DOWN, timer.get());
+  TEST_ASSERT_EQUAL_UINT32(2000, timer.timeIn(WIFI_DOWN, 2000));
+}
+
+void test_timer_across_millis_wrap(void)
+{
+  stateTimer<STATES> timer(WIFI_DOWN);
+  timer.set(UP, 0xFFFFFF00);
+  timer.set(MQTT_DOWN, 0x00000100); // millis() wrapped meanwhile
+  TEST_ASSERT_EQUAL_UINT32(0x200, timer.timeIn(UP, 0x00000200));
+  TEST_ASSERT_EQUAL_UINT32(0x100, timer.timeIn(MQTT_DOWN, 0x00000200));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_timer_counts_time_per_state);
+  RUN_TEST(test_timer_same_state_is_no_op);
+  RUN_TEST(test_timer_ignores_unknown_state);
+  RUN_TEST(test_timer_across_millis_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,79 @@
+/*
+ * topicCache.h : hits, misses, LRU eviction within the probe sequence, names without a terminator and topics too long for TOPIC_LEN
+ */
+
+#include <unity.h>
+#include "topicCache.h"
+
+#define BASE "home/espnow"
+#define LONG_BASE "home/espnow/a/topic/long/enough/for/thirteen/c" // 46 chars, with "/" and "/state" a name of 13 or more chars does not fit
+
+static const char* names[] = {"door", "garage", "kitchen", "porch"};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_cache_builds_topic_once(void)
+{
+  topicCache<8> cache(BASE, "/state");
+  TEST_ASSERT_EQUAL_STRING("home/espnow/door/state", cache.get("door"));
+  const char *topic = cache.get("door");
+  TEST_ASSERT_EQUAL_STRING("home/espnow/door/state", topic);
+  TEST_ASSERT_EQUAL_UINT32(1, cache.hits());
+  TEST_ASSERT_EQUAL_UINT32(1, cache.misses());
+}
+
+void test_cache_name_without_terminator(void)
+{
+  topicCache<8> cache(BASE, "/state");
+  char name[TOPIC_NAME_LEN];
+  memcpy(name, "sixteen_chars_ab", TOPIC_NAME_LEN); // no room for the terminator, as espnow_message::device_name may come
+  TEST_ASSERT_EQUAL_STRING("home/espnow/sixteen_chars_ab/state", cache.get(name));
+}
+
+void test_cache_evicts_least_recently_used(void)
+{
+  topicCache<1> cache(BASE, "/state"); // one slot, every new name evicts
+  cache.get("door");
+  TEST_ASSERT_EQUAL_STRING("home/espnow/garage/state", cache.get("garage"));
+  TEST_ASSERT_EQUAL_UINT32(1, cache.evictions());
+  TEST_ASSERT_EQUAL_STRING("home/espnow/door/state", cache.get("door"));
+  TEST_ASSERT_EQUAL_UINT32(3, cache.misses());
+}
+
+void test_cache_every_slot_reachable(void)
+{
+  topicCache<4> cache(BASE, "/state"); // 4 names in 4 slots, whatever their hashes they share probe sequences
+  for(const char *name : names)
+    cache.get(name);
+  for(const char *name : names)
+    TEST_ASSERT_NOT_NULL(cache.get(name));
+  TEST_ASSERT_EQUAL_UINT32(4, cache.hits());
+  TEST_ASSERT_EQUAL_UINT32(0, cache.evictions());
+}
+
+// a name whose topic does not fit must leave the cached names alone, freeing a slot would cut the probe sequence of the names after it
+void test_cache_too_long_topic_keeps_entries(void)
+{
+  topicCache<4> cache(LONG_BASE, "/state");
+  for(const char *name : names)
+    TEST_ASSERT_NOT_NULL(cache.get(name));
+  TEST_ASSERT_NULL(cache.get("a_very_long_name"));
+  TEST_ASSERT_NULL(cache.get("a_very_long_name"));
+  for(const char *name : names)
+    TEST_ASSERT_NOT_NULL(cache.get(name));
+  TEST_ASSERT_EQUAL_UINT32(4, cache.hits());
+  TEST_ASSERT_EQUAL_UINT32(4, cache.misses());
+  TEST_ASSERT_EQUAL_UINT32(0, cache.evictions());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_cache_builds_topic_once);
+  RUN_TEST(test_cache_name_without_terminator);
+  RUN_TEST(test_cache_evicts_least_recently_used);
+  RUN_TEST(test_cache_every_slot_reachable);
+  RUN_TEST(test_cache_too_long_topic_keeps_entries);
+  return UNITY_END();
+}
@@ -16,6 +16,13 @@
   #pragma message "Compiling the program for the device: MAIN_DOOR"
   #define SERIAL_DEBUG            IN_USE 
   #define SECURITY                NOT_IN_USE // using security or not to encrypt messages
+  #define SECONDARY_GATEWAY       NOT_IN_USE // also send every message to secondaryGatewayAddress, for a pair of gateways (GATEWAY_PAIR in the gateway)
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (APP_ACK in the gateway), a frame it acked is not resent even if the MAC layer ack was lost
+  #define CHANNEL_HUNT            IN_USE // find the gateway's channel by probing it instead of a ~2 sec WiFi scan, see espnowSender::hunt()
+  #define KNOWN_CHANNELS          {1, 6, 11} // channels the router (or the nodes of a mesh router) use, probed after the last known channel and its neighbours
+  #define SEQ_BLOCK               0 // no sequence nos : power is cut after every wake, so each one would cost an EEPROM write (a flash sector erase) per door event
+  #define RETRY_POLICY            RETRY_POLICY_NOISY // a door event cant be carried to the next wake (no RTC memory across the power cut), so try harder now
+  #define PHASE_PROFILER          NOT_IN_USE // time the phases of the wake and send them to the gateway, see phaseProfiler.h (send/ack/sleep never reported, no RTC memory)
   #define DEVICE_NAME             "main_door"
   #define HOLD_PIN 0  // defines hold pin (will hold power to the ESP).
   #define SIGNAL_PIN 3 //indicates the message type
@@ -23,6 +30,7 @@
   #define MY_ROLE         ESP_NOW_ROLE_COMBO              // set the role of this device: CONTROLLER, SLAVE, COMBO
   #define RECEIVER_ROLE   ESP_NOW_ROLE_COMBO              // set the role of the receiver
   uint8_t gatewayAddress[] = GATEWAY_FF_AP_MAC; //comes from secrets.h
+  uint8_t secondaryGatewayAddress[] = GATEWAY_GF_AP_MAC; //comes from secrets.h, must be on the same channel as gatewayAddress
   constexpr char WIFI_SSID[] = primary_ssid;// from secrets.h
   #define HOLDING_LOGIC LOGIC_NORMAL
 
@@ -30,6 +38,13 @@
   #pragma message "Compiling the program for the device: TERRACE_DOOR"
   #define SERIAL_DEBUG            IN_USE 
   #define SECURITY                NOT_IN_USE // using security or not to encrypt messages
+  #define SECONDARY_GATEWAY       NOT_IN_USE // also send every message to secondaryGatewayAddress, for a pair of gateways (GATEWAY_PAIR in the gateway)
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (APP_ACK in the gateway), a frame it acked is not resent even if the MAC layer ack was lost
+  #define CHANNEL_HUNT            IN_USE // find the gateway's channel by probing it instead of a ~2 sec WiFi scan, see espnowSender::hunt()
+  #define KNOWN_CHANNELS          {1, 6, 11} // channels the router (or the nodes of a mesh router) use, probed after the last known channel and its neighbours
+  #define SEQ_BLOCK               0 // no sequence nos : power is cut after every wake, so each one would cost an EEPROM write (a flash sector erase) per door event
+  #define RETRY_POLICY            RETRY_POLICY_NOISY // a door event cant be carried to the next wake (no RTC memory across the power cut), so try harder now
+  #define PHASE_PROFILER          NOT_IN_USE // time the phases of the wake and send them to the gateway, see phaseProfiler.h (send/ack/sleep never reported, no RTC memory)
   #define DEVICE_NAME             "terrace_door" // This becomes the postfix of the final MQTT topic under which messages are published
   #define HOLD_PIN 0  // defines hold pin (will hold power to the ESP).
   #define SIGNAL_PIN 3 //indicates the message type
@@ -40,6 +55,7 @@
   // You can get the address via the command WiFi.softAPmacAddress() , usually it is one decimal no after WiFi MAC address
   // As a best practice you should define your own custom Soft MAC address so that you dont have to update all your sensors if you change the gateway device
   uint8_t gatewayAddress[] = GATEWAY_FF_AP_MAC; //comes from secrets.h
+  uint8_t secondaryGatewayAddress[] = GATEWAY_GF_AP_MAC; //comes from secrets.h, must be on the same channel as gatewayAddress
   constexpr char WIFI_SSID[] = primary_ssid;// from secrets.h
   #define HOLDING_LOGIC LOGIC_NORMAL
 
@@ -47,12 +63,20 @@
   #pragma message "Compiling the program for the device: BALCONY_DOOR"
   #define SERIAL_DEBUG            IN_USE 
   #define SECURITY                NOT_IN_USE // using security or not to encrypt messages
+  #define SECONDARY_GATEWAY       NOT_IN_USE // also send every message to secondaryGatewayAddress, for a pair of gateways (GATEWAY_PAIR in the gateway)
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (APP_ACK in the gateway), a frame it acked is not resent even if the MAC layer ack was lost
+  #define CHANNEL_HUNT            IN_USE // find the gateway's channel by probing it instead of a ~2 sec WiFi scan, see espnowSender::hunt()
+  #define KNOWN_CHANNELS          {1, 6, 11} // channels the router (or the nodes of a mesh router) use, probed after the last known channel and its neighbours
+  #define SEQ_BLOCK               0 // no sequence nos : power is cut after every wake, so each one would cost an EEPROM write (a flash sector erase) per door event
+  #define RETRY_POLICY            RETRY_POLICY_NOISY // a door event cant be carried to the next wake (no RTC memory across the power cut), so try harder now
+  #define PHASE_PROFILER          NOT_IN_USE // time the phases of the wake and send them to the gateway, see phaseProfiler.h (send/ack/sleep never reported, no RTC memory)
   #define DEVICE_NAME             "balcony_door"
   #define HOLD_PIN 5  // defines hold pin (will hold power to the ESP).
   #define SIGNAL_PIN 4 //indicates the message type
   #define MY_ROLE         ESP_NOW_ROLE_COMBO              // set the role of this device: CONTROLLER, SLAVE, COMBO
   #define RECEIVER_ROLE   ESP_NOW_ROLE_COMBO              // set the role of the receiver
   uint8_t gatewayAddress[] = GATEWAY_FF_AP_MAC; //comes from secrets.h
+  uint8_t secondaryGatewayAddress[] = GATEWAY_GF_AP_MAC; //comes from secrets.h, must be on the same channel as gatewayAddress
   constexpr char WIFI_SSID[] = primary_ssid;// from secrets.h
   #define BOUNCE_DELAY 1 // bounce delay in seconds, this is used for a bumby door which bounces a few times before settling on either open or closed
   #define HOLDING_LOGIC LOGIC_INVERTED
@@ -61,12 +85,20 @@
   #pragma message "Compiling the program for the device: TEST_DOOR" 
   #define SERIAL_DEBUG            IN_USE 
   #define SECURITY                NOT_IN_USE // using security or not to encrypt messages
+  #define SECONDARY_GATEWAY       NOT_IN_USE // also send every message to secondaryGatewayAddress, for a pair of gateways (GATEWAY_PAIR in the gateway)
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (APP_ACK in the gateway), a frame it acked is not resent even if the MAC layer ack was lost
+  #define CHANNEL_HUNT            IN_USE // find the gateway's channel by probing it instead of a ~2 sec WiFi scan, see espnowSender::hunt()
+  #define KNOWN_CHANNELS          {1, 6, 11} // channels the router (or the nodes of a mesh router) use, probed after the last known channel and its neighbours
+  #define SEQ_BLOCK               0 // no sequence nos : power is cut after every wake, so each one would cost an EEPROM write (a flash sector erase) per door event
+  #define RETRY_POLICY            RETRY_POLICY_NOISY // a door event cant be carried to the next wake (no RTC memory across the power cut), so try harder now
+  #define PHASE_PROFILER          NOT_IN_USE // time the phases of the wake and send them to the gateway, see phaseProfiler.h (send/ack/sleep never reported, no RTC memory)
   #define DEVICE_NAME             "test_door"
   #define HOLD_PIN 5  // defines hold pin (will hold power to the ESP).
   #define SIGNAL_PIN 4 //indicates the message type
   #define MY_ROLE         ESP_NOW_ROLE_CONTROLLER              // set the role of this device: CONTROLLER, SLAVE, COMBO
   #define RECEIVER_ROLE   ESP_NOW_ROLE_SLAVE              // set the role of the receiver
   uint8_t gatewayAddress[] = GATEWAY_FF_AP_MAC; //comes from secrets.h
+  uint8_t secondaryGatewayAddress[] = GATEWAY_GF_AP_MAC; //comes from secrets.h, must be on the same channel as gatewayAddress
   constexpr char WIFI_SSID[] = primary_ssid;// from secrets.h
   #define BOUNCE_DELAY 1 // bounce delay in seconds, this is used for a bumby door which bounces a few times before settling on either open or closed
   #define HOLDING_LOGIC LOGIC_NORMAL
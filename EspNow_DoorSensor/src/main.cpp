@@ -7,6 +7,8 @@
  * espnow takes ~ 2 sec to obtain the current channel of the SSID, so I store the same in the EEPROM memory and read it every time, saves a lot of time
  * As it rarely changes, the EEPROM isnt worn out. 
  * The entire sketch from start to finish takes less than 90ms to execute and power down
+ * With SECONDARY_GATEWAY the message is also sent to a second gateway, see GATEWAY_PAIR in the gateway
+ * With PHASE_PROFILER the time spent in each phase of setup() is sent with the message, see phaseProfiler.h
  * TO DO :
  * - have multiple slaves to which a message can be tranmitted in the order of preference
  */
@@ -49,6 +51,7 @@ short CURR_MSG = SENSOR_NONE;//This stores the message type deciphered from the
 ADC_MODE(ADC_VCC);//connects the internal ADC to VCC pin and enables measuring Vcc
 const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3 strings adjacent to each other become pasted together as one long string
 espnow_message myData;
+espnowSender sender; // sends myData and waits for its delivery, fed by the callbacks below
 #if USING(SECURITY)
 uint8_t kok[16]= PMK_KEY_STR;//comes from secrets.h
 uint8_t key[16] = LMK_KEY_STR;// comes from secrets.h
@@ -56,26 +59,27 @@ uint8_t key[16] = LMK_KEY_STR;// comes from secrets.h
 // ************ GLOBAL OBJECTS/VARIABLES *******************
 
 /*
- * Callback when data is sent , It sets the bResultReady flag to true on successful delivery of message
- * The flag is set to false in the main loop where data is sent and then the code waits to see if it gets set to true, if not it retires to send
+ * Callback when data is sent , it hands the delivery status to the sender which is waiting for it in send(), if it failed it retries to send
  */
 esp_now_send_cb_t OnDataSent([](uint8_t *mac_addr, uint8_t status) {
-  deliverySuccess = status;
   DPRINT("OnDataSent:Last Packet delivery status:\t");
   DPRINTLN(status == 0 ? "Success" : "Fail");
-  bResultReady = true;
+  sender.onSent(status);
 });
 
 /*
- * Callback called on receiving a message. Nothing to do here for now , I am not using this in the flow
+ * Callback called on receiving a message. Only the gateway's ack is used, see espnowSender::send()
  */
 void OnDataRecv(uint8_t * mac, uint8_t *incomingData, uint8_t len) {
+  if(sender.onReceive(incomingData,len) || len < ESPNOW_MESSAGE_MIN_LEN)
+    return;
   espnow_message msg;
-  memcpy(&msg, incomingData, sizeof(msg));
+  memcpy(&msg, incomingData, len < sizeof(msg) ? len : sizeof(msg));
   DPRINTF("OnDataRecv:%lu,%d,%d,%d,%d,%f,%f,%f,%f,%s,%s\n",msg.message_id,msg.intvalue1,msg.intvalue2,msg.intvalue3,msg.intvalue4,msg.floatvalue1,msg.floatvalue2,msg.floatvalue3,msg.floatvalue4,msg.chardata1,msg.chardata2);
 };
 
 void setup() {
+  PROFILE_START();
   //Set the HOLD pin HIGH so that the ESP maintains power to itself. We will set it to low once we're done with the job, terminating power to ESP
   DBEGIN(115200);
   DPRINTLN("HOLD HIGH START");
@@ -85,9 +89,10 @@ void setup() {
     digitalWrite(HOLD_PIN, HIGH);  // sets HOLD_PIN to high
   else // LOGIC_INVERTED
     digitalWrite(HOLD_PIN, LOW);  // sets HOLD_PIN to high
+  PROFILE_MARK(PHASE_HOLD);
 
-  //Initialize EEPROM , this is used to store the channel no for espnow in the memory, only stored when it changes which is rare
-  EEPROM.begin(16);// 16 is the size of the EEPROM to be allocated, 16 is the minimum
+  // the EEPROM with the espnow channel is initialized by espnowController.h when needed. This ESP cuts its own power so the RTC memory
+  // state of espnowController.h is always lost and the channel always comes from the EEPROM
   // For us to use Rx as input we have to define the pins as below else it would continue to be Serial pins
   if(SIGNAL_PIN == 1)
   {
@@ -111,6 +116,7 @@ void setup() {
     CURR_MSG = SENSOR_CLOSE;
   //else nothing to do, invalid mode
   DPRINTLN(digitalRead(SIGNAL_PIN));
+  PROFILE_MARK(PHASE_BOUNCE);
 
   DPRINTLN("initializing espnow");
   initilizeESP(WIFI_SSID,MY_ROLE);
@@ -123,6 +129,12 @@ void setup() {
   #else
     refreshPeer(gatewayAddress,NULL,RECEIVER_ROLE);
   #endif
+  #if USING(SECONDARY_GATEWAY)
+  // added directly as refreshPeer() always deletes gatewayAddress first
+  if(esp_now_add_peer(secondaryGatewayAddress, RECEIVER_ROLE, slave_channel, NULL, 0) != 0)
+    DPRINTLN("Failed to add the secondary gateway");
+  #endif
+  PROFILE_MARK(PHASE_PEER);
 
   // populate the values for the message
   // If devicename is not given then generate one from MAC address stripping off the colon
@@ -148,12 +160,19 @@ void setup() {
   // and that for a ESP is always constant. Hence I am trying to get a combination of the following 4 things, micros creates an almost true random number
   myData.message_id = myData.intvalue1 + myData.intvalue2 + WiFi.RSSI() + micros();
   myData.intvalue3 = millis();// for debug purpuses, send the millis till this instant in intvalue3
-  int result = sendESPnowMessage(&myData,gatewayAddress);
+  int result = sender.send(&myData,gatewayAddress);
+  #if USING(SECONDARY_GATEWAY)
+  // same message (same message_id) to the other gateway of the pair, it publishes it if the primary doesnt. Delivered if either got it
+  int secondary_result = sender.send(&myData,secondaryGatewayAddress);
+  DPRINTFLN("Secondary gateway result:%d",secondary_result);
+  if(secondary_result == 0)
+    result = 0;
+  #endif
   if (result == 0) {
     DPRINTLN("Delivered with success");}
   else {DPRINTFLN("Error sending/receipting the message, error code:%d",result);}
 
-  // Now you can kill power
+  // Now you can kill power, no PROFILE_END() as nothing survives it
   DPRINTLN("powering down");
   DFLUSH();
   if(HOLDING_LOGIC == LOGIC_NORMAL)
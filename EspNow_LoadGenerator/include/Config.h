@@ -0,0 +1,42 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "macros.h"
+
+// Define all your devices here and then pass the DEVICE in the build flags in platform.ini file
+#define LOAD_GENERATOR 1
+
+// arrival patterns
+#define ARRIVAL_POISSON 1 // frames of a sender are independent, exponentially distributed gaps
+#define ARRIVAL_BURSTY 2 // frames come in bursts of BURST_LEN, BURST_GAP millisecs apart, bursts themselves are poisson
+
+#if (DEVICE == LOAD_GENERATOR)
+  //Turn features ON and OFF below start
+  #define SERIAL_DEBUG            NOT_IN_USE // keep it off, the report goes out on Serial and debug lines would mix with it
+  #define VIRTUAL_MACS            IN_USE // each virtual sender sends from its own station MAC so the gateway sees them as separate controllers
+  #define APP_ACK                 IN_USE // wait for the gateway's ack (see espnowAck.h) and time to it, turn off for a gateway built without APP_ACK
+  //Turn features ON and OFF below end
+
+  #define MY_ROLE                 ESP_NOW_ROLE_COMBO              // set the role of this device: CONTROLLER, SLAVE, COMBO
+  #define RECEIVER_ROLE           ESP_NOW_ROLE_COMBO              // set the role of the receiver
+  #define WiFi_SSID               primary_ssid // from secrets.h, only used to find the channel of the gateway
+  uint8_t gatewayAddress[] = GATEWAY_FF_AP_MAC; //comes from secrets.h
+
+  #ifndef FLEET_SIZE
+    #define FLEET_SIZE            50 // no of virtual senders, can be passed from platformio.ini
+  #endif
+  #define TOUCH_SHARE             20 // percent of the senders sending touch module frames, the rest send door sensor frames
+  #define RATE_PER_MIN            6 // average frames per minute of a sender
+  #define RATE_PROFILE            {1, 1, 1, 2, 5} // per sender multiplier of RATE_PER_MIN, sender i uses entry i % size
+  #define ARRIVAL                 ARRIVAL_POISSON
+  #define BURST_LEN               5
+  #define BURST_GAP               20
+  #define MAX_RETRIES             1 // resends of a frame which is not acked, same as the default of espnowSender::send()
+  #define RETRY_STORM_PCT         5 // percent of frames which are resent even though acked, as espnowSender::send() does when the ack is lost on the way back
+  #define RETRY_STORM_COUNT       3 // no of such resends
+  #define REPORT_INTERVAL         10000 // millisecs between reports on Serial
+#else
+  #error "Device type not found. Have you passed DEVICE id in platform.ini as build flag. See Config.h for all DEVICES"
+#endif
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Load generator for the ESPNow gateway. One ESP8266 plays FLEET_SIZE virtual sensors, each sending espnow messages to the gateway at its own rate
+ * Features:
+ * - virtual senders send either door sensor frames (open/closed, Vcc, version) or touch module frames (gpio pin), see Config.h for the mix
+ * - each sender has a rate (RATE_PER_MIN x its entry in RATE_PROFILE) and the gaps between its frames are poisson or bursty
+ * - a frame which is not acked is resent up to MAX_RETRIES times like espnowSender::send() does, RETRY_STORM_PCT of the frames are also resent
+ *   RETRY_STORM_COUNT times after the ack, which is what the gateway sees when a sensor misses the ack and retries
+ * - each sender numbers its frames with its own seq from 1 up, resends keep it, so the gateway's sender table counts them lost, late or duplicate
+ *   as it does for real sensors
+ * - with VIRTUAL_MACS each sender sends from its own locally administered station MAC (02:4C:47:00:<n>), so the gateway tracks them separately
+ * - with APP_ACK a frame counts as acked when the gateway's ack (see espnowAck.h) for it comes back, which it sends once loop() has taken the frame,
+ *   so the latency includes the gateway's ingest and not only its radio. A frame whose send callback reports success but whose gateway's ack does not
+ *   come within ACK_WAIT_TIMEOUT counts as mac_only, espnowSender::send() takes those as delivered too. Without APP_ACK the send callback is the ack
+ * - only one frame is in flight at a time, the next due sender goes once the previous frame is acked or the wait (WAIT_TIMEOUT, ACK_WAIT_TIMEOUT) runs out
+ * - every REPORT_INTERVAL a single line of JSON is printed on Serial :
+ *   {"t_ms":..,"fleet":50,"sent":..,"acked":..,"mac_only":..,"failed":..,"retries":..,"tx_fps":..,"drop_pct":..,"devices":[{"device":"lg_door_000","sent":..,"acked":..,"mac_only":..,"failed":..,"seq":..,"lat_avg_us":..,"lat_max_us":..},..]}
+ *   sent/acked/mac_only/failed count frames (a frame counts by the best outcome of its sends), retries counts the resends, tx_fps is the send rate over
+ *   the last interval, seq is the sender's last sequence no and lat is the time from esp_now_send() to the ack (the gateway's ack with APP_ACK)
+ *   The gateway's health and senders messages have its side of the same run (queue wait, drops, lost and duplicate seqs per device)
+ */
+
+#include <Arduino.h>
+#include "macros.h"
+#include "secrets.h"
+#include "Config.h"
+#include "Debugutils.h"
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+#include "espnowMessage.h" // for struct of espnow message
+const char* ssid = WiFi_SSID; // espnowController.h uses ssid to rescan the channel
+#include "espnowController.h" //defines all utility functions for espnow functionality
+#include <EEPROM.h> // espnowController.h keeps the wifi channel in eeprom
+
+// ************ HASH DEFINES *******************
+#define VERSION "1.0"
+#define STORM_SCALE 100 // RETRY_STORM_PCT is a percentage
+// ************ HASH DEFINES *******************
+
+// ************ GLOBAL OBJECTS/VARIABLES *******************
+const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3 strings adjacent to each other become pasted together as one long string
+const uint8_t rate_profile[] = RATE_PROFILE;
+const uint8_t touch_pins[] = {4, 12, 13, 14, 15, 27, 32, 33}; // touch capable gpios of the ESP32 on the touch module
+
+typedef struct virtual_sender
+{
+  char device_name[16];
+  uint8_t mac[6];
+  bool touch; // sends touch module frames, else door sensor frames
+  uint8_t door_state; // last door state sent, toggles on every frame
+  uint8_t burst_left; // frames left in the current burst
+  uint32_t mean_interval; // average time between frames in millisecs
+  uint32_t next_send; // millis() when the next frame is due
+  uint32_t sent;
+  uint32_t acked;
+  uint32_t mac_only; // frames only the send callback acked, the gateway's ack never came (APP_ACK)
+  uint32_t failed;
+  uint32_t seq; // sequence no of the last frame, resends keep it
+  uint32_t lat_sum; // sum of the ack latencies in microsecs, for the average
+  uint32_t lat_count;
+  uint32_t lat_max;
+}virtual_sender;
+
+virtual_sender fleet[FLEET_SIZE];
+espnow_message frame; // frame in flight, kept for resends
+virtual_sender *current = nullptr; // sender of the frame in flight, nullptr if none
+uint8_t retries_left = 0; // resends left if the frame isnt acked
+uint8_t storm_left = 0; // resends left after the frame is acked
+bool delivered = false; // the frame in flight was acked at least once
+uint32_t send_us = 0; // micros() of the last esp_now_send()
+uint32_t send_ms = 0; // millis() of the same, for the timeout
+volatile bool result_ready = false;
+volatile uint8_t result_status = 0;
+volatile uint32_t result_us = 0;
+volatile bool app_acked = false; // the gateway's ack for the frame in flight came (APP_ACK)
+volatile uint32_t app_ack_us = 0; // micros() when it came
+uint32_t total_retries = 0;
+uint32_t last_report = 0;
+uint32_t last_sends = 0; // total sends (frames + retries) at the last report
+// ************ GLOBAL OBJECTS/VARIABLES *******************
+
+/*
+ * Callback when data is sent, picked up in loop()
+ */
+void OnDataSent(uint8_t *mac_addr, uint8_t status) {
+  result_us = micros();
+  result_status = status;
+  result_ready = true;
+}
+
+/*
+ * Callback when data is received, only the gateway's acks are expected, picked up in loop()
+ */
+void OnDataRecv(uint8_t * mac, uint8_t *incomingData, uint8_t len) {
+  #if USING(APP_ACK)
+  espnow_ack ack;
+  if(current != nullptr && decodeAck(incomingData, len, &ack) && ack.message_id == frame.message_id)
+  {
+    app_ack_us = micros();
+    app_acked = true;
+  }
+  #endif
+}
+
+/*
+ * returns an exponentially distributed time in millisecs with the given mean
+ */
+uint32_t expInterval(uint32_t mean)
+{
+  double u = random(1, 1000001) / 1000000.0;
+  return (uint32_t)(-log(u) * mean);
+}
+
+/*
+ * returns the time till the next frame of the sender as per ARRIVAL
+ */
+uint32_t nextInterval(virtual_sender &sender)
+{
+  #if (ARRIVAL == ARRIVAL_BURSTY)
+  if(sender.burst_left > 0)
+  {
+    sender.burst_left--;
+    return BURST_GAP;
+  }
+  sender.burst_left = BURST_LEN - 1;
+  return expInterval(sender.mean_interval * BURST_LEN); // same average rate as poisson
+  #else
+  return expInterval(sender.mean_interval);
+  #endif
+}
+
+/*
+ * fills frame with the payload the sender's real counterpart sends, see EspNow_DoorSensor and ESP touch Module
+ */
+void buildFrame(virtual_sender &sender)
+{
+  memset(&frame, 0, sizeof(frame));
+  memcpy(frame.device_name, sender.device_name, sizeof(frame.device_name));
+  frame.seq = ++sender.seq;
+  if(sender.touch)
+  {
+    frame.intvalue1 = touch_pins[random(sizeof(touch_pins))];
+    frame.message_id = millis();
+  }
+  else
+  {
+    sender.door_state = !sender.door_state;
+    frame.intvalue1 = sender.door_state;
+    frame.intvalue2 = 3300 + random(-50, 50); // Vcc in mV
+    frame.intvalue3 = millis();
+    strncpy(frame.chardata2, compile_version, 15);
+    frame.message_id = frame.intvalue1 + frame.intvalue2 + micros();
+  }
+}
+
+/*
+ * sends the frame in flight from the current sender, a failure to even queue it is handled as a failed delivery
+ */
+void sendFrame()
+{
+  #if USING(VIRTUAL_MACS)
+  wifi_set_macaddr(STATION_IF, current->mac);
+  #endif
+  result_ready = false;
+  app_acked = false;
+  send_us = micros();
+  send_ms = millis();
+  if(esp_now_send(gatewayAddress, (uint8_t *) &frame, sizeof(frame)) != 0)
+  {
+    result_status = 1;
+    result_us = send_us;
+    result_ready = true;
+  }
+}
+
+/*
+ * handles the outcome of a send, once it is acked or the wait ran out : resends on failure (MAX_RETRIES) and after success (retry storm),
+ * else finishes the frame
+ */
+void handleResult()
+{
+  #if USING(APP_ACK)
+  bool acked = app_acked;
+  bool mac_only = !acked && result_ready && result_status == 0; // the gateway's radio has it, the ack didnt come
+  uint32_t acked_us = app_ack_us;
+  #else
+  bool acked = result_ready && result_status == 0;
+  bool mac_only = false;
+  uint32_t acked_us = result_us;
+  #endif
+  if(acked || mac_only)
+  {
+    if(acked)
+    {
+      uint32_t latency = acked_us - send_us;
+      current->lat_sum += latency;
+      current->lat_count++;
+      if(latency > current->lat_max)
+        current->lat_max = latency;
+    }
+    if(!delivered)
+    {
+      delivered = true;
+      if(acked)
+        current->acked++;
+      else
+        current->mac_only++;
+    }
+    if(storm_left > 0)
+    {
+      storm_left--;
+      total_retries++;
+      sendFrame();
+      return;
+    }
+  }
+  else if(retries_left > 0)
+  {
+    retries_left--;
+    total_retries++;
+    sendFrame();
+    return;
+  }
+  if(!delivered)
+    current->failed++;
+  current = nullptr;
+}
+
+/*
+ * prints the report line described at the top on Serial
+ */
+void printReport(uint32_t now)
+{
+  uint32_t sent = 0, acked = 0, mac_only = 0, failed = 0;
+  for(uint16_t i = 0; i < FLEET_SIZE; i++)
+  {
+    sent += fleet[i].sent;
+    acked += fleet[i].acked;
+    mac_only += fleet[i].mac_only;
+    failed += fleet[i].failed;
+  }
+  uint32_t sends = sent + total_retries;
+  float tx_fps = (sends - last_sends) * 1000.0 / (now - last_report);
+  float drop_pct = sent > 0 ? failed * 100.0 / sent : 0;
+  last_sends = sends;
+  Serial.printf("{\"t_ms\":%lu,\"fleet\":%u,\"sent\":%lu,\"acked\":%lu,\"mac_only\":%lu,\"failed\":%lu,\"retries\":%lu,\"tx_fps\":%.1f,\"drop_pct\":%.2f,\"devices\":[",
+    (unsigned long)now, FLEET_SIZE, (unsigned long)sent, (unsigned long)acked, (unsigned long)mac_only, (unsigned long)failed, (unsigned long)total_retries, tx_fps, drop_pct);
+  for(uint16_t i = 0; i < FLEET_SIZE; i++)
+  {
+    virtual_sender &s = fleet[i];
+    Serial.printf("%s{\"device\":\"%s\",\"sent\":%lu,\"acked\":%lu,\"mac_only\":%lu,\"failed\":%lu,\"seq\":%lu,\"lat_avg_us\":%lu,\"lat_max_us\":%lu}", i == 0 ? "" : ",",
+      s.device_name, (unsigned long)s.sent, (unsigned long)s.acked, (unsigned long)s.mac_only, (unsigned long)s.failed, (unsigned long)s.seq,
+      (unsigned long)(s.lat_count > 0 ? s.lat_sum / s.lat_count : 0), (unsigned long)s.lat_max);
+  }
+  Serial.println("]}");
+}
+
+void setup() {
+  Serial.begin(115200); // the report goes out irrespective of SERIAL_DEBUG
+  EEPROM.begin(16);
+  DPRINTLN("Starting up as a ESPNow load generator");
+
+  initilizeESP(ssid,MY_ROLE);
+  esp_now_register_send_cb(OnDataSent);
+  esp_now_register_recv_cb(OnDataRecv);
+  refreshPeer(gatewayAddress,NULL,RECEIVER_ROLE);
+
+  uint32_t now = millis();
+  for(uint16_t i = 0; i < FLEET_SIZE; i++)
+  {
+    virtual_sender &s = fleet[i];
+    memset(&s, 0, sizeof(s));
+    s.touch = (i % 100) < TOUCH_SHARE;
+    snprintf(s.device_name, sizeof(s.device_name), s.touch ? "lg_touch_%03u" : "lg_door_%03u", i);
+    uint8_t mac[6] = {0x02, 0x4C, 0x47, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(s.mac, mac, sizeof(mac));
+    s.mean_interval = 60000UL / (RATE_PER_MIN * rate_profile[i % sizeof(rate_profile)]);
+    s.next_send = now + random(s.mean_interval); // spread the first frames out
+  }
+  last_report = now;
+  Serial.printf("{\"start\":\"%s\",\"fleet\":%u,\"channel\":%u}\n", compile_version, FLEET_SIZE, getWiFiChannel());
+}
+
+void loop() {
+  uint32_t now = millis();
+  if(current != nullptr)
+  {
+    #if USING(APP_ACK)
+    // the gateway's ack follows the send callback, a failed send has nothing to wait for
+    if(app_acked || (result_ready && result_status != 0) || now - send_ms > ACK_WAIT_TIMEOUT)
+      handleResult();
+    #else
+    if(result_ready || now - send_ms > WAIT_TIMEOUT)
+      handleResult();
+    #endif
+  }
+  if(current == nullptr)
+  {
+    // the sender most overdue goes next
+    virtual_sender *due = nullptr;
+    for(uint16_t i = 0; i < FLEET_SIZE; i++)
+      if((int32_t)(now - fleet[i].next_send) >= 0 && (due == nullptr || (int32_t)(fleet[i].next_send - due->next_send) < 0))
+        due = &fleet[i];
+    if(due != nullptr)
+    {
+      current = due;
+      buildFrame(*due);
+      due->sent++;
+      due->next_send = now + nextInterval(*due);
+      retries_left = MAX_RETRIES;
+      storm_left = (uint32_t)random(STORM_SCALE) < RETRY_STORM_PCT ? RETRY_STORM_COUNT : 0;
+      delivered = false;
+      sendFrame();
+    }
+  }
+  if(now - last_report >= REPORT_INTERVAL)
+  {
+    printReport(now);
+    last_report = now;
+  }
+}
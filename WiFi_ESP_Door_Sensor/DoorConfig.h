@@ -15,6 +15,7 @@ const short mqtt_port_no = mqtt_port;//from secrets.h
 #if defined(MAIN_DOOR)
   #warning "Compiling the program for the device: MAIN_DOOR"
   #define SERIAL_DEBUG            IN_USE 
+  #define FAST_CONNECT            IN_USE // join the access point of the last wake by its BSSID and channel, no scan, see setupWiFi()
   #define DEVICE_NAME             "main_door"
   #define MQTT_TOPIC              "home/main_door"
   #define ESP_IP_ADDRESS          IPAddress(192,168,1,50)
@@ -26,6 +27,7 @@ const short mqtt_port_no = mqtt_port;//from secrets.h
 #elif defined(TERRACE_DOOR)
   #warning "Compiling the program for the device: TERRACE_DOOR"
   #define SERIAL_DEBUG            IN_USE 
+  #define FAST_CONNECT            IN_USE // join the access point of the last wake by its BSSID and channel, no scan, see setupWiFi()
   #define DEVICE_NAME             "terrace_door"
   #define MQTT_TOPIC              "home/terrace_door"
   #define ESP_IP_ADDRESS          IPAddress(192,168,1,51)
@@ -37,6 +39,7 @@ const short mqtt_port_no = mqtt_port;//from secrets.h
 #elif defined(BALCONY_DOOR)
   #warning "Compiling the program for the device: BALCONY_DOOR"
   #define SERIAL_DEBUG            IN_USE 
+  #define FAST_CONNECT            IN_USE // join the access point of the last wake by its BSSID and channel, no scan, see setupWiFi()
   #define DEVICE_NAME             "balcony_door"
   #define MQTT_TOPIC              "home/balcony_door"
   #define ESP_IP_ADDRESS          IPAddress(192,168,1,52)
@@ -1,5 +1,10 @@
 /*
  * NOTE IMPORTANT : BUILD SETTINGS : File Size: 512K no SPIFFS and no OTA for ESP01 or choose similar size for ESP12
+ * 2.2.0 - fast reconnect (FAST_CONNECT) : the BSSID and channel of the access point are kept in the EEPROM and the next wake joins it directly
+ *         with the static IP, without a scan. A full connect is done only if that fails, and the EEPROM is written only when the AP changes
+ *         (this ESP cuts its own power so the RTC memory does not survive). The fixed delay(1000) after publishing is replaced by waiting
+ *         till the broker's TCP stack acks the data. The state message carries wifiMs (time to join), fastConnect and onlineMs (WiFi connected to
+ *         the state message, which is the last one, so all of the time online but its own send)
  * 2.1.1 - moved wifi info to a separate topic , moved other params like ESP type, ssid etc into DoorConfig.h , included compile version
  * 2.0.0 - removed usage of SPIFFS, instead moved to hardcoded values from header file. removed usage of WiFimanager
  * 1.4.1 - removed config of individual topics , rather only take main topic and hard code subsequent paths. Also included more messages to be logged on MQ Broker , like TESTING mode etc
@@ -26,9 +31,10 @@
 #include "secrets.h"
 #include "DoorConfig.h"
 #include "Debugutils.h"
+#include <EEPROM.h> // BSSID and channel of the access point for FAST_CONNECT
 
 // ************ HASH DEFINES *******************
-#define VERSION "2.1.1"
+#define VERSION "2.2.0"
 const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3 strings adjacent to each other become pasted together as one long string
 //For some reason I get an error that compile_version is not defined in this scope if I use version.h where the above statement is written, so writing it inline instead.
 
@@ -38,6 +44,10 @@ const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3
 #define SENSOR_OPEN 2
 #define SENSOR_CLOSED 3
 #define MAX_MQTT_CONNECT_RETRY 4 //max no of retries to connect to MQTT server
+#define WIFI_CONNECT_TIMEOUT 30000 // time in ms to wait for a full WiFi connect (scan, auth, assoc)
+#define FAST_CONNECT_TIMEOUT 2000 // time in ms to wait for a connect to the cached BSSID and channel before falling back to a full connect
+#define PUBLISH_DRAIN_TIMEOUT 2000 // max time in ms to wait for the broker to ack the published data before powering down
+#define WIFI_CACHE_MAGIC 0x57430001 // "WC" + version of wifi_cache
 #define MSG_ON "on" //payload for ON
 #define MSG_OFF "off"//payload for OFF
 // ************ HASH DEFINES *******************
@@ -46,6 +56,19 @@ const char compile_version[] = VERSION " " __DATE__ " " __TIME__; //note, the 3
 ADC_MODE(ADC_VCC);//connects the internal ADC to VCC pin and enables measuring Vcc
 WiFiClient espClient;
 PubSubClient client(espClient);
+unsigned long wifi_ms = 0; // time taken to connect to WiFi
+unsigned long connected_at = 0; // millis() when WiFi got connected
+bool fast_connect = false; // connected with the cached BSSID and channel
+
+// the access point we connected to last, kept in the EEPROM as the RTC memory is lost when the power is cut
+typedef struct wifi_cache
+{
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t check; // checksum of the SSID and the above, a cache written for another SSID is not used
+}wifi_cache;
 // ************ GLOBAL OBJECTS/VARIABLES *******************
 
 void setup() 
@@ -92,9 +115,7 @@ void setup()
     {
       if(CURR_MSG != SENSOR_NONE)
       {
-        publishMessage(CURR_MSG);
-        //Allow a delay to let MQTT publish the message as the publish method is asyncronous, If I dont put this, the ESP powers down before the msg is published
-        delay(1000);
+        publishMessage(CURR_MSG); // returns once the broker has acked the data, no need to wait before powering down
       }
       
       //Read the sensor again to see if it has changed from last time, if yes then repeat the loop to publish this message
@@ -115,27 +136,115 @@ void setup()
   digitalWrite(HOLD_PIN, HIGH);  // set HOLD PIN HIGH to cutt off power
 }
 
+/*
+* checksum of the cache for the SSID, FNV-1a
+*/
+uint32_t wifiCacheCheck(const wifi_cache &cache)
+{
+  uint32_t hash = 2166136261u;
+  for(const char *c = WiFi_SSID; *c; c++)
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  const uint8_t *p = (const uint8_t *)&cache;
+  for(size_t i = 0; i < offsetof(wifi_cache, check); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+/*
+* reads the BSSID and channel of the last connect from the EEPROM, returns false if there are none for this SSID
+*/
+bool loadWiFiCache(wifi_cache *cache)
+{
+  EEPROM.begin(sizeof(wifi_cache));
+  EEPROM.get(0, *cache);
+  return cache->magic == WIFI_CACHE_MAGIC && cache->channel >= 1 && cache->channel <= 14 && cache->check == wifiCacheCheck(*cache);
+}
+
+/*
+* stores the BSSID and channel we are connected to, the EEPROM is written only if they differ from what it has, to avoid wearing it
+*/
+void saveWiFiCache()
+{
+  wifi_cache cache;
+  bool valid = loadWiFiCache(&cache);
+  if(valid && cache.channel == WiFi.channel() && memcmp(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid)) == 0)
+    return;
+  cache.magic = WIFI_CACHE_MAGIC;
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.reserved = 0;
+  cache.check = wifiCacheCheck(cache);
+  EEPROM.put(0, cache);
+  EEPROM.commit();
+  DPRINTLN("Access point saved for a fast connect:" + WiFi.BSSIDstr() + " channel:" + String(cache.channel));
+}
+
+/*
+* waits till the connect started by WiFi.begin() succeeds or fails, at most timeout ms, and returns WiFi.status(). Same as
+* WiFi.waitForConnectResult() but it polls every 10 ms instead of every 100 ms, so the wake is not stretched by up to 100 ms after the connect is done
+*/
+wl_status_t waitConnect(unsigned long timeout)
+{
+  unsigned long start = millis();
+  while(WiFi.status() == WL_DISCONNECTED && millis() - start < timeout)
+    delay(10);
+  return WiFi.status();
+}
+
 void setupWiFi() 
 {
-  WiFi.config(ESP_IP_ADDRESS, default_gateway, subnet_mask);//from secrets.h
+  unsigned long start = millis();
+  WiFi.persistent(false); // the SDK would otherwise write the WiFi config to flash on every connect, the cache above is written only on a change
+  WiFi.config(ESP_IP_ADDRESS, default_gateway, subnet_mask);//from secrets.h , no DHCP
   WiFi.hostname(DEVICE_NAME);// Set Hostname.
   DPRINTLN(".....");
   
   WiFi.mode(WIFI_STA); // Force to station mode because if device was switched off while in access point mode it will start up next time in access point mode.
-  WiFi.begin(WiFi_SSID,WiFi_SSID_PSWD);
-  for(short i=0;i<3000;i++) //break after 30 sec 3000*10 msec
+  #if USING(FAST_CONNECT)
+  wifi_cache cache;
+  if(loadWiFiCache(&cache))
   {
-    if(WiFi.status() != WL_CONNECTED)
+    // join the AP we used last time directly, no scan for the SSID
+    WiFi.begin(WiFi_SSID,WiFi_SSID_PSWD,cache.channel,cache.bssid,true);
+    fast_connect = waitConnect(FAST_CONNECT_TIMEOUT) == WL_CONNECTED;
+    if(!fast_connect)
     {
-      delay(10);//Dont increase this delay, I set it to 500 and it takes a very long time to connect, I think this blocks the execution
-    }
-    else
-    {
-      DPRINT("WiFi connected, IP Address:");
-      DPRINTLN(WiFi.localIP());
-      break;
+      DPRINTLN("Fast connect failed, the AP may have moved, connecting afresh");
+      WiFi.disconnect();
     }
   }
+  #endif
+  // waitConnect() returns as soon as the connect succeeds or fails, the timeout only bounds a connect which hangs
+  if(!fast_connect)
+  {
+    WiFi.begin(WiFi_SSID,WiFi_SSID_PSWD);
+    waitConnect(WIFI_CONNECT_TIMEOUT);
+  }
+  wifi_ms = millis() - start;
+  if(WiFi.status() == WL_CONNECTED)
+  {
+    connected_at = millis();
+    DPRINT("WiFi connected, IP Address:");
+    DPRINTLN(WiFi.localIP());
+    DPRINTLN(String(fast_connect?"Fast":"Full") + " connect took " + String(wifi_ms) + " ms");
+    #if USING(FAST_CONNECT)
+    if(!fast_connect)
+      saveWiFiCache();
+    #endif
+  }
+}
+
+/*
+* waits till the broker's TCP stack has acked all the data published so far, at most PUBLISH_DRAIN_TIMEOUT ms. PubSubClient publishes with QoS 0,
+* there is no PUBACK to wait for, so the TCP ack is the point from which the broker has the message and the power can be cut
+*/
+void drainPublish()
+{
+  unsigned long start = millis();
+  if(espClient.flush(PUBLISH_DRAIN_TIMEOUT))
+    {DPRINTLN("Published data acked in " + String(millis() - start) + " ms");}
+  else
+    {DPRINTLN("Timed out waiting for the broker to ack the published data");}
 }
 
 void publishMessage(short msg_type) {
@@ -151,6 +260,7 @@ void publishMessage(short msg_type) {
     // Attempt to connect
     if (client.connect(DEVICE_NAME,mqtt_user,mqtt_password,publish_topic,0,true,"offline")) {
       DPRINTLN("connected");
+      espClient.setNoDelay(true); // send each publish straight away instead of holding it till the previous one is acked. Only once connected, before that there is no TCP connection to set it on
       strcpy(publish_topic,MQTT_TOPIC);
       strcat(publish_topic,"/status");
       int msgLen = String(MSG_ON).length();
@@ -180,12 +290,15 @@ void publishMessage(short msg_type) {
       strcpy(publish_topic,MQTT_TOPIC);
       strcat(publish_topic,"/wifi"); 
       client.publish(publish_topic, state_json.c_str(),true);
-      
+      drainPublish(); // all but the state message are on the broker now, so onlineMs below covers nearly all of the time we are online
+
       //publish the state message
-      state_json = String("{\"upTime\":") + millis() + String(",\"vcc\":") + batt_volt + String(",\"version\":\"") + compile_version + String("\",\"testingMode\":") + testing_mode + String("}");
+      state_json = String("{\"upTime\":") + millis() + String(",\"vcc\":") + batt_volt + String(",\"version\":\"") + compile_version + String("\",\"testingMode\":") + testing_mode
+                  + String(",\"wifiMs\":") + wifi_ms + String(",\"fastConnect\":") + (fast_connect ? 1 : 0) + String(",\"onlineMs\":") + (millis() - connected_at) + String("}");
       strcpy(publish_topic,MQTT_TOPIC);
       strcat(publish_topic,"/state"); 
       client.publish(publish_topic, state_json.c_str(),true);
+      drainPublish();
 
       DPRINTLN("published messages");
     } 
@@ -0,0 +1,149 @@
+/*
+ * controllerState.h - state a controller (sensor) keeps between wake ups in RTC memory, checksummed so a cold boot (power on, garbage in RTC memory) is detected
+ * - ESP8266 : RTC user memory from block CONTROLLER_STATE_RTC_BLOCK, survives deep sleep and reset but not a power cut
+ *   (so a sensor which cuts its own power, like the door sensor, always has a cold boot)
+ * - ESP32 : a RTC_NOINIT_ATTR variable, survives deep sleep and a software restart
+ * espnowController.h loads it in initilizeESP() and falls back to the EEPROM copy of the channel and the sequence no checkpoint on a cold boot,
+ * the EEPROM is written only when the channel changes or a new block of sequence nos is reserved
+ * A message the retry policy carries forward to the next wake (see retryPolicy.h) is kept here too, in its own checksummed block
+ */
+
+#ifndef CONTROLLER_STATE_H
+#define CONTROLLER_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "espnowMessage.h"
+#if defined(ESP32)
+#include <esp_attr.h> // RTC_NOINIT_ATTR
+#endif
+
+#define CONTROLLER_STATE_MAGIC 0x43530003 // "CS" + version, a new layout must change it
+#define CONTROLLER_STATE_RTC_BLOCK 32 // first 4 byte block of RTC user memory used on the ESP8266, 0-31 are left for writeRtcMem() in myutils.h
+#define DEFERRED_MAGIC 0x444D0001 // "DM" + version
+#define DEFERRED_RTC_BLOCK 48 // first 4 byte block of the carried forward message, after the controller state
+
+typedef struct controller_state
+{
+  uint32_t magic;
+  uint8_t channel; // WiFi channel of the gateway, 0 if not known
+  uint8_t peer_mac[6]; // gateway the channel belongs to
+  uint8_t reserved;
+  uint32_t seq; // sequence no of the last message sent, see nextSeq() in espnowController.h
+  uint32_t seq_limit; // seq checkpointed to flash, seq may go up to it before the next checkpoint
+  uint32_t srtt_us; // smoothed time from sending to the ack, 0 until the first sample, see espnowSender::rto()
+  uint32_t rttvar_us; // its mean deviation
+  uint16_t sends; // messages sent since the cold boot
+  uint16_t retries; // resends of those
+  uint16_t failures; // messages which were not delivered
+  uint16_t hunts; // channel refreshes (scans or hunts)
+  uint32_t crc; // crc32 of everything above, must be the last member
+}controller_state;
+
+typedef struct deferred_message
+{
+  uint32_t magic; // DEFERRED_MAGIC while a message is waiting, anything else if not
+  uint16_t wakes; // no of wakes it has been carried over
+  uint16_t replaced; // messages carried forward which a newer one replaced before they went out
+  espnow_message msg;
+  uint32_t crc; // crc32 of everything above, must be the last member
+}deferred_message;
+
+static_assert(sizeof(controller_state) % 4 == 0, "RTC user memory is read and written in 4 byte blocks");
+static_assert(sizeof(deferred_message) % 4 == 0, "RTC user memory is read and written in 4 byte blocks");
+static_assert(CONTROLLER_STATE_RTC_BLOCK + sizeof(controller_state) / 4 <= DEFERRED_RTC_BLOCK, "controller state runs into the deferred message");
+static_assert(DEFERRED_RTC_BLOCK + sizeof(deferred_message) / 4 <= 128, "ESP8266 RTC user memory is 128 blocks");
+
+/*
+ * crc32 (IEEE) of len bytes
+ */
+inline uint32_t rtcCrc(const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t*)data;
+  uint32_t crc = 0xFFFFFFFF;
+  for(size_t i = 0; i < len; i++)
+  {
+    crc ^= p[i];
+    for(uint8_t b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+/*
+ * crc32 of the state without its crc member
+ */
+inline uint32_t stateCrc(const controller_state &state)
+{
+  return rtcCrc(&state, offsetof(controller_state, crc));
+}
+
+#if defined(ESP32)
+RTC_NOINIT_ATTR controller_state rtc_controller_state;
+RTC_NOINIT_ATTR deferred_message rtc_deferred_message;
+#endif
+
+/*
+ * reads the state from RTC memory, returns false on a cold boot (or a changed layout), state is then cleared
+ */
+inline bool loadControllerState(controller_state *state)
+{
+  #if defined(ESP8266)
+  bool read = ESP.rtcUserMemoryRead(CONTROLLER_STATE_RTC_BLOCK, (uint32_t*)state, sizeof(*state));
+  #elif defined(ESP32)
+  *state = rtc_controller_state;
+  bool read = true;
+  #else
+  bool read = false;
+  #endif
+  if(read && state->magic == CONTROLLER_STATE_MAGIC && state->crc == stateCrc(*state))
+    return true;
+  memset(state, 0, sizeof(*state));
+  state->magic = CONTROLLER_STATE_MAGIC;
+  return false;
+}
+
+/*
+ * writes the state to RTC memory, this does not touch the flash
+ */
+inline void saveControllerState(controller_state *state)
+{
+  state->crc = stateCrc(*state);
+  #if defined(ESP8266)
+  ESP.rtcUserMemoryWrite(CONTROLLER_STATE_RTC_BLOCK, (uint32_t*)state, sizeof(*state));
+  #elif defined(ESP32)
+  rtc_controller_state = *state;
+  #endif
+}
+
+/*
+ * reads the message carried forward from an earlier wake, returns false if there is none
+ */
+inline bool loadDeferred(deferred_message *deferred)
+{
+  #if defined(ESP8266)
+  bool read = ESP.rtcUserMemoryRead(DEFERRED_RTC_BLOCK, (uint32_t*)deferred, sizeof(*deferred));
+  #elif defined(ESP32)
+  *deferred = rtc_deferred_message;
+  bool read = true;
+  #else
+  bool read = false;
+  #endif
+  return read && deferred->magic == DEFERRED_MAGIC && deferred->crc == rtcCrc(deferred, offsetof(deferred_message, crc));
+}
+
+/*
+ * keeps the message for the next wake, or with magic other than DEFERRED_MAGIC marks that there is none
+ */
+inline void saveDeferred(deferred_message *deferred)
+{
+  deferred->crc = rtcCrc(deferred, offsetof(deferred_message, crc));
+  #if defined(ESP8266)
+  ESP.rtcUserMemoryWrite(DEFERRED_RTC_BLOCK, (uint32_t*)deferred, sizeof(*deferred));
+  #elif defined(ESP32)
+  rtc_deferred_message = *deferred;
+  #endif
+}
+
+#endif
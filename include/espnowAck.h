@@ -0,0 +1,78 @@
+/*
+ * espnowAck.h - application level ack the gateway (APP_ACK) sends back to the sender of every frame it receives
+ * The MAC layer ack only says the frame reached the radio of the gateway, this one also tells the sender what it would otherwise guess or wait for :
+ * the channel to use, the time, if a command follows and if it should back off. A sender can sleep as soon as it has the ack
+ * The ack is told apart from an espnow_message by its length, ESPNOW_ACK_LEN. It is sent for a retransmitted frame too as the sender missed the last one
+ * The probe frame a sender hunts for the gateway's channel with is defined here too
+ * No Arduino dependencies, same as espnowBinary.h
+ *
+ * Layout, all multi byte values little endian:
+ *   offset 0  : u8  ESPNOW_ACK_MAGIC
+ *   offset 1  : u8  WiFi channel the gateway is on
+ *   offset 2  : u8  flags, bit 0 (ESPNOW_ACK_PENDING) a command for the sender follows, keep listening (see MAILBOX in the gateway)
+ *   offset 3  : u8  backoff, secs the sender should wait before its next non urgent frame, 0 if the gateway is keeping up
+ *   offset 4  : u32 message_id of the frame acked
+ *   offset 8  : u32 unix time in secs at the gateway, 0 if it doesnt know the time yet
+ */
+
+#ifndef ESPNOW_ACK_H
+#define ESPNOW_ACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ESPNOW_ACK_LEN 12
+#define ESPNOW_ACK_MAGIC 0xA5
+#define ESPNOW_ACK_PENDING (1 << 0)
+
+// probe frame a sender sends to find the channel the gateway is on (see espnowSender::hunt() in espnowController.h), only its MAC layer ack matters
+// the gateway drops it, it is told apart by its length too
+#define ESPNOW_PROBE_LEN 2
+#define ESPNOW_PROBE_MAGIC 0x5A
+
+typedef struct espnow_ack
+{
+  uint8_t channel;
+  uint8_t flags;
+  uint8_t backoff;
+  uint32_t message_id;
+  uint32_t time;
+}espnow_ack;
+
+/*
+ * writes the ack into buffer, which must hold ESPNOW_ACK_LEN bytes
+ */
+inline void encodeAck(const espnow_ack &ack, uint8_t *buffer)
+{
+  buffer[0] = ESPNOW_ACK_MAGIC;
+  buffer[1] = ack.channel;
+  buffer[2] = ack.flags;
+  buffer[3] = ack.backoff;
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    buffer[4 + i] = (uint8_t)(ack.message_id >> (8 * i));
+    buffer[8 + i] = (uint8_t)(ack.time >> (8 * i));
+  }
+}
+
+/*
+ * decodes a received frame into ack, returns false if it is not an ack (eg. it is an espnow_message)
+ */
+inline bool decodeAck(const uint8_t *buffer, size_t len, espnow_ack *ack)
+{
+  if(len != ESPNOW_ACK_LEN || buffer[0] != ESPNOW_ACK_MAGIC)
+    return false;
+  ack->channel = buffer[1];
+  ack->flags = buffer[2];
+  ack->backoff = buffer[3];
+  ack->message_id = 0;
+  ack->time = 0;
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    ack->message_id |= (uint32_t)buffer[4 + i] << (8 * i);
+    ack->time |= (uint32_t)buffer[8 + i] << (8 * i);
+  }
+  return true;
+}
+
+#endif
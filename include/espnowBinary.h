@@ -0,0 +1,204 @@
+/*
+ * espnowBinary.h - compact binary encoding of espnow_message, used by the gateway to publish frames to MQTT instead of JSON
+ * This file has no Arduino dependencies so the same code is the encoder on the gateway and the decoder on the Linux side,
+ * a consumer only needs this file and espnowMessage.h on its include path
+ *
+ * Layout (version 1), all multi byte values little endian:
+ *   offset 0 : u8  version, ESPNOW_BINARY_VERSION
+ *   offset 1 : u16 presence bitmap, a field which is zero/empty is left out and its bit is 0
+ *                  bit 0-3 intvalue1-4 , bit 4-7 floatvalue1-4 , bit 8 chardata1 , bit 9 chardata2 , bit 10 msg_type
+ *   offset 3 : u32 message_id
+ *   offset 7 : u8  length of device_name (0-16) followed by that many chars, no terminator
+ *   then, in this order and only if present:
+ *     msg_type                     u8
+ *     intvalue1..4                 zigzag varint (1-5 bytes each)
+ *     floatvalue1..4               IEEE 754 single, 4 bytes each
+ *     chardata1, chardata2         u8 length (0-16) followed by that many chars
+ * A frame is at most ESPNOW_BINARY_MAX_LEN bytes, a typical door sensor frame is ~25 bytes against ~230 bytes of JSON
+ * A decoder must reject a version it does not know, new versions will only add fields after the ones above
+ */
+
+#ifndef ESPNOW_BINARY_H
+#define ESPNOW_BINARY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "espnowMessage.h"
+
+#define ESPNOW_BINARY_VERSION 1
+#define ESPNOW_BINARY_MAX_LEN 95 // 3 + 4 + 17 + 1 + 4*5 + 4*4 + 2*17
+
+#define ESPNOW_BIN_INT1   (1 << 0)
+#define ESPNOW_BIN_FLOAT1 (1 << 4)
+#define ESPNOW_BIN_CHAR1  (1 << 8)
+#define ESPNOW_BIN_CHAR2  (1 << 9)
+#define ESPNOW_BIN_TYPE   (1 << 10)
+
+namespace espnow_binary
+{
+  inline uint8_t boundedLength(const char *s, uint8_t max_len)
+  {
+    uint8_t len = 0;
+    while(len < max_len && s[len] != '\0')
+      len++;
+    return len;
+  }
+
+  inline uint8_t* putVarint(uint8_t *p, int32_t value)
+  {
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); // zigzag so small negative values stay short
+    while(v >= 0x80)
+    {
+      *p++ = (uint8_t)(v | 0x80);
+      v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+  }
+
+  inline const uint8_t* getVarint(const uint8_t *p, const uint8_t *end, int32_t *value)
+  {
+    uint32_t v = 0;
+    for(uint8_t shift = 0; shift < 35; shift += 7)
+    {
+      if(p >= end)
+        return nullptr;
+      uint8_t b = *p++;
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if(!(b & 0x80))
+      {
+        *value = (int32_t)((v >> 1) ^ (0u - (v & 1)));
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  inline uint8_t* putU32(uint8_t *p, uint32_t v)
+  {
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+  }
+
+  inline uint32_t getU32(const uint8_t *p)
+  {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  inline uint8_t* putChars(uint8_t *p, const char *s, uint8_t max_len)
+  {
+    uint8_t len = boundedLength(s, max_len);
+    *p++ = len;
+    memcpy(p, s, len);
+    return p + len;
+  }
+
+  inline const uint8_t* getChars(const uint8_t *p, const uint8_t *end, char *s, uint8_t max_len)
+  {
+    if(p >= end || *p > max_len || end - (p + 1) < *p)
+      return nullptr;
+    uint8_t len = *p++;
+    memset(s, 0, max_len);
+    memcpy(s, p, len);
+    return p + len;
+  }
+}
+
+/*
+ * encodes msg into buffer, returns the no of bytes written or 0 if the buffer is smaller than ESPNOW_BINARY_MAX_LEN
+ */
+inline size_t encodeMessage(const espnow_message &msg, uint8_t *buffer, size_t size)
+{
+  using namespace espnow_binary;
+  if(size < ESPNOW_BINARY_MAX_LEN)
+    return 0;
+  const int32_t ints[4] = {msg.intvalue1, msg.intvalue2, msg.intvalue3, msg.intvalue4};
+  const float floats[4] = {msg.floatvalue1, msg.floatvalue2, msg.floatvalue3, msg.floatvalue4};
+  uint16_t present = 0;
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    if(ints[i] != 0) present |= ESPNOW_BIN_INT1 << i;
+    if(floats[i] != 0) present |= ESPNOW_BIN_FLOAT1 << i; // -0.0 is sent as 0
+  }
+  if(msg.chardata1[0] != '\0') present |= ESPNOW_BIN_CHAR1;
+  if(msg.chardata2[0] != '\0') present |= ESPNOW_BIN_CHAR2;
+  if(msg.msg_type != 0) present |= ESPNOW_BIN_TYPE;
+
+  uint8_t *p = buffer;
+  *p++ = ESPNOW_BINARY_VERSION;
+  *p++ = (uint8_t)present;
+  *p++ = (uint8_t)(present >> 8);
+  p = putU32(p, (uint32_t)msg.message_id);
+  p = putChars(p, msg.device_name, sizeof(msg.device_name));
+  if(present & ESPNOW_BIN_TYPE)
+    *p++ = (uint8_t)msg.msg_type;
+  for(uint8_t i = 0; i < 4; i++)
+    if(present & (ESPNOW_BIN_INT1 << i))
+      p = putVarint(p, ints[i]);
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    if(present & (ESPNOW_BIN_FLOAT1 << i))
+    {
+      uint32_t bits;
+      memcpy(&bits, &floats[i], sizeof(bits));
+      p = putU32(p, bits);
+    }
+  }
+  if(present & ESPNOW_BIN_CHAR1)
+    p = putChars(p, msg.chardata1, sizeof(msg.chardata1));
+  if(present & ESPNOW_BIN_CHAR2)
+    p = putChars(p, msg.chardata2, sizeof(msg.chardata2));
+  return p - buffer;
+}
+
+/*
+ * decodes a frame produced by encodeMessage() into msg, fields which were left out are set to zero/empty
+ * returns false if the frame is truncated, malformed or of an unknown version, msg is then undefined
+ */
+inline bool decodeMessage(const uint8_t *buffer, size_t len, espnow_message *msg)
+{
+  using namespace espnow_binary;
+  const uint8_t *end = buffer + len;
+  if(len < 8 || buffer[0] != ESPNOW_BINARY_VERSION)
+    return false;
+  uint16_t present = buffer[1] | (buffer[2] << 8);
+  const uint8_t *p = buffer + 3;
+  msg->message_id = getU32(p);
+  p += 4;
+  if(!(p = getChars(p, end, msg->device_name, sizeof(msg->device_name))))
+    return false;
+  msg->msg_type = (msg_type_t)0;
+  if(present & ESPNOW_BIN_TYPE)
+  {
+    if(p >= end)
+      return false;
+    msg->msg_type = (msg_type_t)*p++;
+  }
+  int32_t ints[4] = {0, 0, 0, 0};
+  for(uint8_t i = 0; i < 4; i++)
+    if((present & (ESPNOW_BIN_INT1 << i)) && !(p = getVarint(p, end, &ints[i])))
+      return false;
+  float floats[4] = {0, 0, 0, 0};
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    if(present & (ESPNOW_BIN_FLOAT1 << i))
+    {
+      if(end - p < 4)
+        return false;
+      uint32_t bits = getU32(p);
+      memcpy(&floats[i], &bits, sizeof(bits));
+      p += 4;
+    }
+  }
+  memset(msg->chardata1, 0, sizeof(msg->chardata1));
+  memset(msg->chardata2, 0, sizeof(msg->chardata2));
+  if((present & ESPNOW_BIN_CHAR1) && !(p = getChars(p, end, msg->chardata1, sizeof(msg->chardata1))))
+    return false;
+  if((present & ESPNOW_BIN_CHAR2) && !(p = getChars(p, end, msg->chardata2, sizeof(msg->chardata2))))
+    return false;
+  msg->intvalue1 = ints[0]; msg->intvalue2 = ints[1]; msg->intvalue3 = ints[2]; msg->intvalue4 = ints[3];
+  msg->floatvalue1 = floats[0]; msg->floatvalue2 = floats[1]; msg->floatvalue3 = floats[2]; msg->floatvalue4 = floats[3];
+  return true;
+}
+
+#endif
@@ -3,26 +3,39 @@ Utility file which encapsulates the functionality of initializing espnow on a co
 * - Single code base works with both ESP8266 and ESP32
 * - Scans the WiFi channel number for the peer using provided SSID and stores it in EEPROM for later use. 
 *  This saves ~2 sec time. The ESP controller is required to be on the same channel as the Slave else messages wont be received
-* - Retries the sending of a failed message a certain no of times (passed as parameter)
-* - Retries refreshing of WiFi channel no, if sending fails only once, if its required to scan the channel again, set channelRefreshed=false
-*   from the calling code
+* - Keeps the channel, the gateway MAC, the message sequence no, the last ack RTT and send/retry stats in RTC memory (controllerState.h), the EEPROM
+*   is read only on a cold boot and written only when the channel changes or a block of sequence nos is reserved
+* - Stamps every new message with a sequence no (espnow_message.seq) that increases by 1 per message and survives deep sleep and power cuts,
+*   the gateway uses it to count lost frames and drop replays. SEQ_BLOCK 0 turns it off, see nextSeq()
+* - Retries a failed message as the retry policy selected in Config.h (RETRY_POLICY) says : per outcome (no ack, send error, peer missing),
+*   with exponential backoff and jitter, within a per wake time budget and optionally carrying the message forward to the next wake. See retryPolicy.h
+* - Refreshes the WiFi channel no at most once per wake when the policy asks for it, if its required to scan the channel again, set
+*   channelRefreshed=false from the calling code
+* - With CHANNEL_HUNT defined as IN_USE in the calling code the channel is found by sending a probe frame to the gateway on each candidate channel
+*   (last known, its neighbours, KNOWN_CHANNELS, then the rest) till one is acked, instead of the ~2 sec WiFi.scanNetworks()
 * - Initilizes the espnow for espnow functions , sets role etc
+* - With PHASE_PROFILER defined as IN_USE in the calling code, times the phases of the wake (EEPROM, init, channel, send, ack) and appends them
+*   to the first message delivered, see phaseProfiler.h
 * - refreshes the peer. This deletes an existing peer and adds it. This is to be called initially to add a peer
 *   but can be called later too when the channel no changes in between and so the peer needs to be refreshed
-  - Monitors the delivery success of the message subject to a timeout - WAIT_TIMEOUT
+  - Monitors the delivery success of the message subject to a timeout that adapts to the ack round trip time, at most WAIT_TIMEOUT. The wait
+*   sleeps till the send callback instead of polling, see espnowSender
+* - With APP_ACK defined as IN_USE in the calling code, waits for the gateway's ack (see espnowAck.h) which counts as the delivery. A send callback
+*   reporting that the MAC layer gave up ends the wait early and the message is resent. If the gateway's ack does not come in time the MAC layer ack counts, as the gateway sends no ack when its ack queue is full. The channel in it is stored for the next start, espnowSender::lastAck() keeps the rest (time, command pending, backoff)
 * Usage Steps :
-  - Define the following variables in the calling code : 
-    bool deliverySuccess , bool bResultReady , #define WIFI_SSID
-  - Call EEPROM.begin(size) , to initialize the EEPROM. IT is used to store the channel no for future use
+  - Define the following in the calling code : 
+    espnowSender object , #define WIFI_SSID
+  - The EEPROM is initialized here when needed (cold boot or a new channel), the calling code need not call EEPROM.begin() for the channel
   - call initilizeESP - to initialize the ESP , aps in the SSID the Slave connects to and the role in case of ESP8266
     For ESP32 role is ignored
-  - register the OnDatasent & onDatareceive callbacks in the calling code
+  - register the OnDatasent & onDatareceive callbacks in the calling code, OnDataSent calls espnowSender::onSent() with the status
   - Call refreshPeer() - passing in ther gateway address of Slave and ROLE of Slave. This concludes the setup process
-  - Call sendESPnowMessage() to send a message of type espnow_message 
-    monitor the delivery success of the message send via the flag deliverySuccess until bResultReady is not set
+  - With APP_ACK call espnowSender::onReceive() first thing in the OnDataRecv callback
+  - Call espnowSender::send() to send a message of type espnow_message, it returns 0 once the message is delivered
+    A message with seq 0 is given the next sequence no, set seq back to 0 when a espnow_message is reused for a new message
 
 TO DO list:
-  - refreshPeer() function when called from within sendESPnowMessage needs access to a variable WIFI_SSID in order to rescan the 
+  - refreshPeer() function when called from within espnowSender::send() needs access to a variable WIFI_SSID in order to rescan the 
     SSID channel number, I have to remove this and paramterize this later
   - Security is still not tested fully although code for that is present
 
@@ -41,21 +54,45 @@ TO DO list:
 #include <esp_now.h>
 #endif
 #include "espnowMessage.h" // for struct of espnow message
+#include "espnowAck.h" // for the ack from the gateway
+#include "controllerState.h" // state kept in RTC memory between wake ups
+#include "retryPolicy.h" // what to do when a send fails
+#include "phaseProfiler.h" // wake phase timings sent with the message, empty unless PHASE_PROFILER is IN_USE
 #include "Debugutils.h" //This file is located in the Sketches\libraries\DebugUtils folder
 #include <EEPROM.h> // to store WiFi channel number to EEPROM
+#if defined(ESP8266)
+#include <coredecls.h> // esp_delay(), esp_schedule()
+#endif
 
 // ************ GLOBAL OBJECTS/VARIABLES *******************
 uint8_t slave_channel = 0;//stores the channel of the slave by scanning the SSID the slave is on.
 bool channelRefreshed = false;//tracks the status of the change in wifi channel , true -> wifi channel has been refreshed
-volatile uint8_t deliverySuccess = 9; //0 means success , non zero are error codes
-volatile bool bResultReady = false;
-// it is set to false every time the ESP boots
+controller_state ctrlState; // see controllerState.h, loaded by loadState()
+bool ctrlStateLoaded = false;
+bool eepromReady = false; // EEPROM.begin() done
 // ************ GLOBAL OBJECTS/VARIABLES *******************
 
 
 // ************ HASH DEFINES *******************
 #define KEY_LEN  16 // lenght of PMK & LMK key (fixed at 16 for ESP)
-#define WAIT_TIMEOUT 25 // time in millis to wait for acknowledgement of the message sent
+#define CONTROLLER_EEPROM_SIZE 16 // EEPROM allocated for the channel, 16 is the minimum
+#define WAIT_TIMEOUT 25 // max time in millis to wait for acknowledgement of the message sent, see espnowSender::rto()
+#define SEQ_EEPROM_ADDR 8 // EEPROM address of the sequence no checkpoint (4 bytes), 0 holds the channel and 4-7 are left to the calling code
+#ifndef SEQ_BLOCK
+  #define SEQ_BLOCK 64 // sequence nos reserved per EEPROM write, a cold boot skips what is left of the block and the gateway counts those as lost. 0 no sequence nos
+#endif
+#define ACK_WAIT_TIMEOUT 40 // max time in millis from sending to wait for the gateway's ack (APP_ACK), it follows the MAC layer ack
+#define RTO_MIN 4 // shortest wait in millis for an ack however fast the link has been
+#ifndef APP_ACK
+  #define APP_ACK NOT_IN_USE // the calling code's Config.h turns it on
+#endif
+#ifndef CHANNEL_HUNT
+  #define CHANNEL_HUNT NOT_IN_USE // the calling code's Config.h turns it on
+#endif
+#ifndef KNOWN_CHANNELS
+  #define KNOWN_CHANNELS {1, 6, 11} // channels the AP (or the nodes of a mesh router) are likely on, tried after the last known channel and its neighbours
+#endif
+#define PROBE_TIMEOUT 5 // time in millis to wait for the MAC layer ack of a probe, the ack comes within ~1ms if the gateway is on the channel
 #define CONNECTION_RETRY_INTERVAL 30 // time is secs to wait before refreshing the connection in case of failure
 #define MAX_SSID 50
 //Define the esp_now_peer_info if we're working with esp8266, for ESP32 its already defined
@@ -112,6 +149,106 @@ uint8_t getWiFiChannel()
   #endif
 }
 
+/*
+* EEPROM.begin() copies a flash sector into RAM, so it is done only when the EEPROM is actually needed
+*/
+void beginEEPROM()
+{
+  if(eepromReady)
+    return;
+  EEPROM.begin(CONTROLLER_EEPROM_SIZE);
+  eepromReady = true;
+}
+
+/*
+* Loads the state kept in RTC memory, on a cold boot the channel is read from the EEPROM instead
+*/
+void loadState()
+{
+  if(ctrlStateLoaded)
+    return;
+  ctrlStateLoaded = true;
+  if(loadControllerState(&ctrlState))
+  {
+    DPRINTFLN("State from RTC memory, channel:%u seq:%lu",ctrlState.channel,(unsigned long)ctrlState.seq);
+    return;
+  }
+  beginEEPROM();
+  uint8_t channel = EEPROM.read(0);
+  ctrlState.channel = (channel >= 1 && channel <= 14) ? channel : 0;
+  uint32_t checkpoint;
+  EEPROM.get(SEQ_EEPROM_ADDR, checkpoint);
+  if(checkpoint == 0xFFFFFFFF) // erased EEPROM
+    checkpoint = 0;
+  ctrlState.seq = ctrlState.seq_limit = checkpoint; // nos up to the checkpoint may have been used before the power went
+  DPRINTFLN("Cold boot, wifi channel read from memory = %d, seq from %lu",ctrlState.channel,(unsigned long)checkpoint);
+  saveControllerState(&ctrlState);
+}
+
+/*
+* Stores the channel in RTC memory and in EEPROM if it differs from the one there, to avoid wearing the EEPROM
+*/
+void saveChannel(uint8_t channel)
+{
+  loadState();
+  if(ctrlState.channel == channel)
+    return;
+  ctrlState.channel = channel;
+  saveControllerState(&ctrlState);
+  beginEEPROM();
+  EEPROM.write(0,(int)channel);
+  EEPROM.commit();
+  // read back the channel to see if it was written properly
+  if(EEPROM.read(0) == channel)
+    {DPRINTFLN("New wifi channel: %d successfully written to memory",channel);}
+  else
+    {DPRINTFLN("Failed to write wifi channel %d to memory",channel);}
+}
+
+/*
+* Returns the sequence no for a new message. The nos are reserved in blocks of SEQ_BLOCK, the end of a block is written to the EEPROM before
+* its first no is used, so after a power cut counting resumes from there and a no is never used twice
+* A sensor waking from deep sleep carries on from RTC memory without touching the flash. One which cuts its own power (door sensor) has a cold
+* boot on every wake and has to reserve a new block every time, ie. an EEPROM write (a flash sector erase) per wake whatever the block size.
+* It sets SEQ_BLOCK to 0 : every message goes out with seq 0, which the gateway takes as no sequence no (duplicates are still dropped by
+* message_id, but losses are not counted) and the flash is left alone
+*/
+uint32_t nextSeq()
+{
+  #if SEQ_BLOCK == 0
+  return 0;
+  #else
+  loadState();
+  if(ctrlState.seq >= ctrlState.seq_limit)
+  {
+    ctrlState.seq_limit = ctrlState.seq + SEQ_BLOCK;
+    beginEEPROM();
+    EEPROM.put(SEQ_EEPROM_ADDR, ctrlState.seq_limit);
+    EEPROM.commit();
+    DPRINTFLN("Sequence nos reserved up to %lu",(unsigned long)ctrlState.seq_limit);
+  }
+  ctrlState.seq++;
+  saveControllerState(&ctrlState);
+  return ctrlState.seq;
+  #endif
+}
+
+/*
+* Moves the radio to channel
+*/
+void setWiFiChannel(uint8_t channel)
+{
+  #if defined(ESP8266)
+    wifi_promiscuous_enable(true);
+    wifi_set_channel(channel);
+    wifi_promiscuous_enable(false);
+  #elif defined(ESP32)
+    esp_wifi_set_promiscuous(true);
+    esp_wifi_set_channel(channel,WIFI_SECOND_CHAN_NONE);
+    esp_wifi_set_promiscuous(false);
+  #endif
+}
+
 /*
 * Sets the right channel for WiFi on the ESP. It finds the channel of the SSID passed to it and then changes the channel of the ESP to match the same
 * It also stores it in the EEPROM memory if different from the one already on for later use
@@ -123,51 +260,45 @@ uint8_t getWiFiChannel()
 void setSSIDChannel(const char ssid[MAX_SSID], bool forceChannelRefresh = false, bool restartOnError= false)
 {
   DPRINTFLN("Current channel:%d",getWiFiChannel());
-  if(slave_channel == 0) // we're starting up , get the channel from the EEPROM
+  if(slave_channel == 0) // we're starting up , get the channel from RTC memory (or the EEPROM on a cold boot)
   {
-    slave_channel = EEPROM.read(0);
+    loadState();
+    PROFILE_MARK(PHASE_EEPROM);
+    slave_channel = ctrlState.channel;
     if(slave_channel > 0)
     {DPRINTFLN("wifi channel read from memory = %d",slave_channel);}
     else
     {DPRINTFLN("Failed to read wifi channel from memory:%d",slave_channel);}
   }
   
+  #if USING(CHANNEL_HUNT)
+  // no scan, if the channel is wrong the first send fails and espnowSender::send() hunts for the gateway, see espnowSender::hunt()
+  #else
   if((slave_channel <= 0 || slave_channel > 14) || forceChannelRefresh )//we have an invalid channel, it can only range between 1-14 , scan for a valid channel
   {
       DPRINTFLN("Scanning channel for SSID = %s",ssid);
+      #if USING(SERIAL_DEBUG)
+      unsigned long scan_start = millis();
+      #endif
       uint8_t new_channel = getSSIDChannel(ssid);
-      DPRINTFLN("new wifi channel scanned = %d",new_channel);
+      DPRINTFLN("new wifi channel scanned = %d in %lu ms",new_channel,millis() - scan_start);
       if(new_channel != 0)
       {
         if(new_channel != slave_channel)//only write the new channel if it's different from the one we already have to avoid wearing the EEPROM
         {
           slave_channel = new_channel;
-          EEPROM.write(0,(int)slave_channel);
-          EEPROM.commit();
-          // read back the channel to see if it was written properly
-          new_channel = EEPROM.read(0);
-          if(new_channel == slave_channel)
-            {DPRINTFLN("New wifi channel: %d successfully written to memory",new_channel);}
-          else
-            {DPRINTFLN("Failed to write wifi channel %d to memory",new_channel);}
+          saveChannel(slave_channel);
         }
       }
       else
         DPRINTLN("Failed to get a valid channel for " && ssid);
   }
+  #endif
   
   if((getWiFiChannel() != slave_channel) && slave_channel !=0)// no use changing channel if we got 0, it can happen if you dont find the SSID
   {
-    #if defined(ESP8266)
-      wifi_promiscuous_enable(true);
-      wifi_set_channel(slave_channel);
-      wifi_promiscuous_enable(false);
-    #elif defined(ESP32)
-      //DPRINTLN("Going to set the new channel");
-      esp_wifi_set_promiscuous(true);
-      wifi_second_chan_t second;
-      esp_wifi_set_channel(slave_channel,second);
-      esp_wifi_set_promiscuous(false);
+    setWiFiChannel(slave_channel);
+    #if defined(ESP32)
       WiFi.disconnect();
     #endif
 
@@ -182,6 +313,7 @@ void setSSIDChannel(const char ssid[MAX_SSID], bool forceChannelRefresh = false,
     DPRINTLN("Could not set WiFi Channel properly, restarting");
     ESP.restart();
   }
+  PROFILE_MARK(PHASE_CHANNEL);
   //  WiFi.printDiag(Serial);
 }
 
@@ -197,6 +329,7 @@ void initilizeESP(const char ssid[MAX_SSID],esp_now_role role, bool forceChannel
 {
   // Set device as a Wi-Fi Station and set channel
   WiFi.mode(WIFI_STA); 
+  PROFILE_MARK(PHASE_INIT);
   setSSIDChannel(ssid,forceChannelRefresh,restartOnError);
   
   // if we're forcing an init again, deinit first
@@ -209,6 +342,7 @@ void initilizeESP(const char ssid[MAX_SSID],esp_now_role role, bool forceChannel
   #if defined(ESP8266)
   esp_now_set_self_role(role);
   #endif
+  PROFILE_MARK(PHASE_INIT);
 }
 
 #if defined(ESP8266)
@@ -263,56 +397,429 @@ bool refreshPeer(esp_now_peer_info_t *peer)
 #endif
 
 /*
-* Sends a espnow_message to the slave. It retries to send the message a certain no of times if it fails and then gives up
-* Relies on the variable bResultReady & deliverySuccess which is set to true in the call back function of the OnDataSent to determine if the
-   message sending was successful. You must set these in the OnDataSent function in your code
+* Sends espnow messages and waits for their delivery. It keeps the state of the message in flight (send status, the gateway's ack)
+* which the calling code feeds from its callbacks : onSent() from OnDataSent and onReceive() from OnDataRecv
+* The wait is driven by those callbacks, there is no polling meanwhile :
+* - ESP8266 : esp_delay() suspends loop() and the SDK idles the CPU, the callback resumes it with esp_schedule()
+* - ESP32 : the task blocks on a task notification which the callback gives, the idle task runs (and light sleeps if power management is on)
+* The timeout adapts to the round trip time to the ack, smoothed like TCP does (RFC 6298) and kept in RTC memory, so a sensor close to the
+* gateway does not wait out WAIT_TIMEOUT (ACK_WAIT_TIMEOUT with APP_ACK) before it retries. That is also where it starts and its ceiling
 */
-int sendESPnowMessage(espnow_message *myData,uint8_t peerAddress[], short retries=1,bool ack= true)
+class espnowSender
 {
-  bResultReady = false;
-  // retries should at least be 1 so that a message is tried twice in the loop, this is so that if channel number needs refreshed,
-  // message sending is tried again.
-  if(retries<1)
-    retries = 1;
-  // try to send the message MAX_MESSAGE_RETRIES times if it fails
-  for(short i = 0;i<=retries;i++)
+  public:
+  /*
+  * Call from the OnDataSent callback with its status, 0 is success
+  */
+  void onSent(uint8_t status)
   {
-    int result = esp_now_send(peerAddress, (uint8_t *) myData, sizeof(*myData));
-    // If devicename is not given then generate one from MAC address stripping off the colon
-    long waitTimeStart = millis();
-    if (result == 0) DPRINTLN("Sent message, waiting for delivery...");
-    else DPRINTLN("Error sending the message");
-    
-    if(ack)
+    #if USING(PHASE_PROFILER)
+    _sent_at = micros();
+    #endif
+    _status = status;
+    _sent = true;
+    wake();
+  }
+
+  /*
+  * Call first thing from the OnDataRecv callback, returns true if the frame was an ack from the gateway (APP_ACK) and keeps it, see lastAck()
+  */
+  bool onReceive(const uint8_t *data, int len)
+  {
+    espnow_ack ack;
+    if(len < 0 || !decodeAck(data, len, &ack))
+      return false;
+    _ack = ack;
+    _ack_received = true;
+    wake();
+    return true;
+  }
+
+  /*
+  * Sends a espnow_message to the peer, retrying as the retry policy (RETRY_POLICY, see retryPolicy.h) says when it fails
+  * A message carried forward from an earlier wake is sent first, it keeps its sequence no so the gateway counts it late and not lost
+  * A message with seq 0 is given the next sequence no, set seq back to 0 when a espnow_message is reused for a new message
+  * ack - false to return as soon as the message is handed to the radio
+  * Returns SEND_DELIVERED (0) or how the last attempt failed, see send_outcome_t
+  */
+  uint8_t send(espnow_message *myData, uint8_t peerAddress[], bool ack= true)
+  {
+    _send_start = micros();
+    PROFILE_MARK(PHASE_APP);
+    loadState();
+    if(myData->seq == 0) // a new message, sending the same message again (eg. to a second gateway) keeps its no
+      myData->seq = nextSeq();
+    PROFILE_MARK(PHASE_EEPROM);
+    if(_policy.carry_forward && ack && !_deferred_checked)
     {
-      //get a confirmation of successful delivery , else try again. This flag is set in the callback OnDataSent from the calling code
-      while(!bResultReady && ((millis() - waitTimeStart) < WAIT_TIMEOUT))
+      _deferred_checked = true;
+      if(loadDeferred(&_deferred) && _deferred.msg.seq != myData->seq)
       {
-        delay(1);
+        DPRINTFLN("Sending the message carried over %u wakes, seq:%lu",_deferred.wakes,(unsigned long)_deferred.msg.seq);
+        bool carry = false;
+        if(deliver(&_deferred.msg, peerAddress, true, &carry) == SEND_DELIVERED)
+          _deferred.magic = 0;
+        else
+          _deferred.wakes++;
+        saveDeferred(&_deferred);
       }
-      //DPRINTFLN("wait:%u",(millis() - waitTimeStart));
-      if(result == 0  && deliverySuccess == 0)
+    }
+    bool carry = false;
+    uint8_t status = deliver(myData, peerAddress, ack, &carry);
+    if(carry)
+    {
+      if(!loadDeferred(&_deferred))
+        _deferred.replaced = 0;
+      else if(_deferred.msg.seq != myData->seq)
+        _deferred.replaced++; // there is one slot, the newer message matters more
+      _deferred.magic = DEFERRED_MAGIC;
+      _deferred.wakes = 0;
+      _deferred.msg = *myData;
+      saveDeferred(&_deferred);
+      DPRINTFLN("Message seq:%lu carried forward to the next wake",(unsigned long)myData->seq);
+    }
+    saveControllerState(&ctrlState);
+    _send_us = micros() - _send_start;
+    _wake_us += _send_us;
+    DPRINTFLN("Send took %lu us",(unsigned long)_send_us);
+    return status;
+  }
+
+  /*
+  * Moves the radio and the peer to channel and sends a probe frame (see espnowAck.h) to the peer, the gateway drops it but its radio acks it
+  * Returns true if the probe was acked ie. the peer is on the channel
+  */
+  bool probe(uint8_t peerAddress[], uint8_t channel)
+  {
+    setWiFiChannel(channel);
+    #if defined(ESP8266)
+      esp_now_set_peer_channel(peerAddress, channel);
+    #elif defined(ESP32)
+      esp_now_peer_info_t peer;
+      if(esp_now_get_peer(peerAddress, &peer) == ESP_OK)
       {
-        break;
+        peer.channel = channel;
+        esp_now_mod_peer(&peer);
+      }
+    #endif
+    uint8_t frame[ESPNOW_PROBE_LEN] = {ESPNOW_PROBE_MAGIC, 0};
+    _sent = false;
+    clearWake();
+    if(esp_now_send(peerAddress, frame, sizeof(frame)) != 0)
+      return false;
+    return wait(PROBE_TIMEOUT, [&](){ return (bool)_sent; }) && _status == 0;
+  }
+
+  /*
+  * Finds the channel of the peer by probing, in this order : the current channel (slave_channel), its neighbours, KNOWN_CHANNELS and then the rest of 1-13
+  * A probe takes ~1ms on the right channel and PROBE_TIMEOUT on a wrong one, against ~2 sec for a WiFi.scanNetworks()
+  * The channel found is set and stored in EEPROM, if none answers the radio goes back to the channel it was on
+  * Returns the channel found or 0
+  */
+  uint8_t hunt(uint8_t peerAddress[])
+  {
+    const uint8_t known[] = KNOWN_CHANNELS;
+    uint8_t candidates[3 + sizeof(known) + 13];
+    uint8_t count = 0;
+    uint8_t last = slave_channel;
+    if(last >= 1 && last <= 13)
+    {
+      candidates[count++] = last;
+      if(last > 1)
+        candidates[count++] = last - 1;
+      if(last < 13)
+        candidates[count++] = last + 1;
+    }
+    for(uint8_t i = 0; i < sizeof(known); i++)
+      candidates[count++] = known[i];
+    for(uint8_t ch = 1; ch <= 13; ch++)
+      candidates[count++] = ch;
+
+    #if USING(SERIAL_DEBUG)
+    unsigned long start = millis();
+    #endif
+    uint16_t tried = 0; // bit per channel
+    for(uint8_t i = 0; i < count; i++)
+    {
+      uint8_t ch = candidates[i];
+      if(ch < 1 || ch > 13 || (tried & (1 << ch)))
+        continue;
+      tried |= 1 << ch;
+      if(probe(peerAddress, ch))
+      {
+        DPRINTFLN("Gateway found on channel %u in %lu ms",ch,millis() - start);
+        slave_channel = ch;
+        saveChannel(ch);
+        return ch;
+      }
+    }
+    DPRINTFLN("Gateway not found on any channel in %lu ms",millis() - start);
+    if(last >= 1 && last <= 13)
+      probe(peerAddress, last); // back to where we were, result doesnt matter
+    return 0;
+  }
+
+  /*
+  * returns true if the gateway acked the message
+  */
+  bool isAcked(uint32_t message_id) const
+  {
+    return _ack_received && _ack.message_id == message_id;
+  }
+
+  /*
+  * returns the time in millis to wait for the ack of a first attempt : srtt + 4 x rttvar, at least RTO_MIN and at most WAIT_TIMEOUT/ACK_WAIT_TIMEOUT
+  */
+  uint32_t rto()
+  {
+    loadState();
+    if(ctrlState.srtt_us == 0) // no sample yet
+      return maxTimeout();
+    uint32_t rto = (ctrlState.srtt_us + 4 * ctrlState.rttvar_us + 999) / 1000;
+    if(rto < RTO_MIN)
+      rto = RTO_MIN;
+    return rto < maxTimeout() ? rto : maxTimeout();
+  }
+
+  bool ackReceived() const { return _ack_received; }
+  const espnow_ack& lastAck() const { return _ack; } // valid if ackReceived() : the gateway's time, if a command follows, backoff
+  uint32_t sendTime() const { return _send_us; } // micros the last send() took, retries and channel hunts included
+  const char* policy() const { return _policy.name; }
+
+  private:
+  /*
+  * Sends the message till it is delivered or the retry policy gives up, carry is set if the policy wants it kept for the next wake
+  */
+  uint8_t deliver(espnow_message *myData, uint8_t peerAddress[], bool ack, bool *carry)
+  {
+    _ack_received = false;
+    ctrlState.sends++;
+    retryEngine engine(_policy, micros() ^ myData->seq);
+    uint32_t timeout = rto();
+    const uint8_t *frame = (const uint8_t *) myData;
+    size_t frame_len = sizeof(*myData);
+    #if USING(PHASE_PROFILER)
+    // the phases ride on the first message delivered in the wake, the gateway tells them apart by the length of the frame
+    uint8_t profiled[sizeof(*myData) + PHASE_RECORD_LEN];
+    if(!_profiled)
+    {
+      memcpy(profiled, myData, sizeof(*myData));
+      profiler.record(profiled + sizeof(*myData));
+      frame = profiled;
+      frame_len = sizeof(profiled);
+    }
+    #endif
+    for(uint8_t attempt = 0;; attempt++)
+    {
+      if(attempt > 0)
+        ctrlState.retries++;
+      _sent = false;
+      clearWake();
+      unsigned long sendStart = micros();
+      int result = esp_now_send(peerAddress, (uint8_t *) frame, frame_len);
+      if (result == 0)
+      {
+        DPRINTFLN("Sent message, waiting up to %lu ms for delivery...",(unsigned long)timeout);
       }
       else
       {
-          bResultReady = false; // message sending failed , prepare for next iteration
-          // See if we are on the right channel, it might have changed since last time we wrote the same in EEPROM memory
-          // Do it only once in the cycle to send a message else it consumes battery every time the ESP tries to send in case
-          // there is permanent error in sending a message - eg. in case the Slave isnt available
-          if(!channelRefreshed)
-          {
-              DPRINTLN("Refresh wifi channel...");
-              setSSIDChannel(ssid,true);//force the channel refresh
-              channelRefreshed = true;// this will enable refreshing of channel only once in a cycle, unless the flag is again reset by the calling code
-          }
+        DPRINTFLN("Error %d sending the message",result);
+      }
+      if(!ack)
+      {
+        PROFILE_MARK(PHASE_SEND);
+        return result == 0 ? SEND_DELIVERED : SEND_ERROR;
+      }
+      send_outcome_t outcome;
+      if(result != 0)
+        outcome = peerMissing(peerAddress, result) ? SEND_NO_PEER : SEND_ERROR;
+      else
+      {
+        #if USING(APP_ACK)
+        // the gateway's ack comes after the MAC layer ack, so wait for it unless the send callback reports the MAC layer gave up on the frame,
+        // then resend straight away rather than wait out the timeout for an ack that is unlikely to come
+        uint32_t message_id = myData->message_id;
+        bool delivered = wait(timeout, [&](){ return isAcked(message_id) || (_sent && _status != 0); }) && isAcked(message_id);
+        if(delivered)
+        {
+          DPRINTFLN("Acked by gateway, wait:%lu us",(unsigned long)(micros() - sendStart));
+          applyAck();
+        }
+        else if(_sent && _status == 0)
+        {
+          // no ack from the gateway (its ack queue was full, the ack was lost or it came late) but the MAC layer ack says the frame reached
+          // its radio, resending would only make a duplicate. The time waited is sampled below so the next wake waits longer for the ack
+          DPRINTLN("No ack from gateway, delivered by the MAC layer ack");
+          delivered = true;
+        }
+        #else
+        bool delivered = wait(timeout, [&](){ return (bool)_sent; }) && _status == 0;
+        #endif
+        if(delivered)
+        {
+          if(attempt == 0) // the ack of a resend could be for an earlier attempt, such samples are left out (Karn's algorithm)
+            sampleRtt(micros() - sendStart);
+          memcpy(ctrlState.peer_mac, peerAddress, sizeof(ctrlState.peer_mac));
+          #if USING(PHASE_PROFILER)
+          if(_sent && (int32_t)(_sent_at - sendStart) >= 0)
+            PROFILE_MARK_AT(PHASE_SEND, _sent_at); // the MAC layer ack, the rest is the wait for the gateway's ack
+          #if USING(APP_ACK)
+          PROFILE_MARK(PHASE_ACK);
+          #else
+          PROFILE_MARK(PHASE_SEND);
+          #endif
+          _profiled = true;
+          #endif
+          return SEND_DELIVERED;
+        }
+        outcome = SEND_NO_ACK;
+      }
+      timeout = timeout * 2 < maxTimeout() ? timeout * 2 : maxTimeout(); // back off, the ack may just be slow this time
+      uint32_t spent_ms = (_wake_us + (micros() - _send_start)) / 1000;
+      retry_action action = engine.next(outcome, spent_ms, timeout, channelRefreshed);
+      if(action.verb == RETRY_GIVE_UP || action.verb == RETRY_CARRY_FORWARD)
+      {
+        DPRINTFLN("Giving up after %u attempts, outcome:%u",engine.attempts(),outcome);
+        PROFILE_MARK(PHASE_SEND);
+        ctrlState.failures++;
+        *carry = action.verb == RETRY_CARRY_FORWARD;
+        return outcome;
+      }
+      if(action.verb == RETRY_HUNT)
+      {
+        // See if we are on the right channel, it might have changed since last time we wrote the same in EEPROM memory
+        // Done only once per wake else it consumes battery every time the ESP tries to send in case
+        // there is permanent error in sending a message - eg. in case the Slave isnt available
+        DPRINTLN("Refresh wifi channel...");
+        PROFILE_MARK(PHASE_SEND);
+        ctrlState.hunts++;
+        #if USING(CHANNEL_HUNT)
+        hunt(peerAddress);
+        #else
+        setSSIDChannel(ssid,true);//force the channel refresh
+        #endif
+        channelRefreshed = true;// this will enable refreshing of channel only once in a cycle, unless the flag is again reset by the calling code
+        PROFILE_MARK(PHASE_CHANNEL);
+      }
+      if(action.delay_ms > 0)
+      {
+        DPRINTFLN("Retrying in %u ms",action.delay_ms);
+        delay(action.delay_ms); // the CPU idles, the radio stays on the channel
       }
     }
-    else
-      return result==0?true:false;
   }
-  return deliverySuccess;
-}
 
-#endif
\ No newline at end of file
+  /*
+  * returns true if esp_now_send() failed because the peer is not registered
+  */
+  static bool peerMissing(uint8_t peerAddress[], int result)
+  {
+    #if defined(ESP8266)
+    return result != 0 && esp_now_is_peer_exist(peerAddress) == 0; // the SDK returns the same error for every failure, ask it about the peer
+    #elif defined(ESP32)
+    return result == ESP_ERR_ESPNOW_NOT_FOUND;
+    #endif
+  }
+
+  static uint32_t maxTimeout()
+  {
+    #if USING(APP_ACK)
+    return ACK_WAIT_TIMEOUT;
+    #else
+    return WAIT_TIMEOUT;
+    #endif
+  }
+
+  /*
+  * folds a round trip time into the smoothed rtt and its variation kept in RTC memory, gains of 1/8 and 1/4 as in RFC 6298
+  */
+  void sampleRtt(uint32_t rtt_us)
+  {
+    if(ctrlState.srtt_us == 0)
+    {
+      ctrlState.srtt_us = rtt_us;
+      ctrlState.rttvar_us = rtt_us / 2;
+      return;
+    }
+    uint32_t err = rtt_us > ctrlState.srtt_us ? rtt_us - ctrlState.srtt_us : ctrlState.srtt_us - rtt_us;
+    ctrlState.rttvar_us = ctrlState.rttvar_us - ctrlState.rttvar_us / 4 + err / 4;
+    ctrlState.srtt_us = ctrlState.srtt_us - ctrlState.srtt_us / 8 + rtt_us / 8;
+  }
+
+  /*
+  * Stores the channel the gateway says it is on if it differs from ours, eg. after a rescan, so the next start uses it straight away
+  */
+  void applyAck()
+  {
+    if(_ack.channel >= 1 && _ack.channel <= 14 && _ack.channel != slave_channel)
+    {
+      DPRINTFLN("Gateway is on channel:%u",_ack.channel);
+      slave_channel = _ack.channel;
+      saveChannel(slave_channel);
+    }
+  }
+
+  /*
+  * sleeps till done() returns true or timeout_ms passes, each callback wakes it to check done(). Returns done()
+  */
+  template <typename F>
+  bool wait(uint32_t timeout_ms, F done)
+  {
+    #if defined(ESP8266)
+    esp_delay(timeout_ms, [&](){ return !done(); });
+    #elif defined(ESP32)
+    unsigned long start = millis();
+    _waiter = xTaskGetCurrentTaskHandle();
+    while(!done())
+    {
+      unsigned long elapsed = millis() - start;
+      if(elapsed >= timeout_ms)
+        break;
+      TickType_t ticks = pdMS_TO_TICKS(timeout_ms - elapsed);
+      ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+    }
+    _waiter = nullptr;
+    #endif
+    return done();
+  }
+
+  // called from the callbacks, resumes wait()
+  void wake()
+  {
+    #if defined(ESP8266)
+    esp_schedule();
+    #elif defined(ESP32)
+    TaskHandle_t waiter = _waiter;
+    if(waiter != nullptr)
+      xTaskNotifyGive(waiter);
+    #endif
+  }
+
+  // drops a wake up left over from the callback of an earlier frame
+  void clearWake()
+  {
+    #if defined(ESP32)
+    ulTaskNotifyTake(pdTRUE, 0);
+    #endif
+  }
+
+  volatile bool _sent = false; // the send callback came for the frame in flight
+  volatile uint8_t _status = SEND_NO_ACK; // and its status
+  volatile bool _ack_received = false; // _ack is valid
+  espnow_ack _ack = {0, 0, 0, 0, 0}; // last ack received from the gateway
+  uint32_t _send_us = 0;
+  unsigned long _send_start = 0; // micros() when the send() in progress started
+  uint32_t _wake_us = 0; // time spent in send() since the ESP woke up, counted against the policy's budget
+  retry_policy _policy = RETRY_POLICY;
+  deferred_message _deferred;
+  bool _deferred_checked = false; // the message carried forward has been looked for in this wake
+  #if USING(PHASE_PROFILER)
+  volatile uint32_t _sent_at = 0; // micros() of the last send callback
+  bool _profiled = false; // the phase record has been delivered in this wake
+  #endif
+  #if defined(ESP32)
+  TaskHandle_t volatile _waiter = nullptr; // task blocked in wait()
+  #endif
+};
+
+#endif
@@ -1,11 +1,26 @@
 
 #ifndef ESPNOW_MESSAGE_H
 #define ESPNOW_MESSAGE_H
+#include <stdint.h>
+#include <stddef.h> // offsetof
+#if defined(ARDUINO)
 #include "myutils.h"
+#else
+// host side builds (eg. decoders on Linux using espnowBinary.h) dont have myutils.h, provide the one function used here
+#include <string.h>
+#ifndef HAVE_XSTRCMP
+#define HAVE_XSTRCMP // the gateway's native build includes myutils.h as well
+static bool xstrcmp(const char *s1, const char *s2) { return strcmp(s1,s2) == 0; }
+#endif
+#endif
 
 #define OTA_MSG "OTA" // ota message , if received triggers an OTA mode
+// Commands sent by the gateway to a sensor (see mailbox.h in the gateway) carry the command id in message_id, the sensor's name in device_name
+// and the no of commands still waiting for the sensor after this one in intvalue4, so the sensor can stop listening once it is 0
 typedef enum {
-    ESP_NOW_OTA        = 0
+    ESP_NOW_OTA        = 0,
+    ESP_NOW_CONFIG     = 1, // command : set the setting named in chardata1 to intvalue1
+    ESP_NOW_TIME_SYNC  = 2  // command : intvalue1 is the unix time in secs
 } msg_type_t;
 
 // Datatypes in Arduino : https://www.tutorialspoint.com/arduino/arduino_data_types.htm
@@ -26,12 +41,16 @@ typedef struct espnow_message{
   float floatvalue4;// float data
   char chardata1[16]="";// any char data
   char chardata2[16]="";// any char data
+  uint32_t seq = 0; // per device sequence no, increases by 1 for every new message and survives deep sleep and power cuts (see espnowController.h), 0 if not known
 }espnow_message;
 
+// frames from senders built before seq was added end before it, receivers accept frames of at least this length and treat seq as 0
+#define ESPNOW_MESSAGE_MIN_LEN offsetof(espnow_message, seq)
+
 /*
 * equal to operator for espnow_message struct
 */
-bool operator==(const espnow_message& lhs, const espnow_message& rhs)
+inline bool operator==(const espnow_message& lhs, const espnow_message& rhs)
 {
   return (xstrcmp(lhs.device_name,rhs.device_name) && lhs.message_id==rhs.message_id && \
   lhs.intvalue1==rhs.intvalue2 && lhs.intvalue1==rhs.intvalue2 && lhs.intvalue3==rhs.intvalue3 && \
@@ -43,7 +62,7 @@ bool operator==(const espnow_message& lhs, const espnow_message& rhs)
 /*
 * not equal to operator for espnow_message struct
 */
-bool operator!=(const espnow_message& lhs, const espnow_message& rhs)
+inline bool operator!=(const espnow_message& lhs, const espnow_message& rhs)
 {
   return !(lhs==rhs);
 }
@@ -118,11 +118,14 @@ This short article presents trivial but fast and memory efficient function to co
 Function returns true on success (strings are the same), else false
 Source: https://blog.podkalicki.com/fast-string-comparison-for-microcontrollers/
 */
+#ifndef HAVE_XSTRCMP
+#define HAVE_XSTRCMP // espnowMessage.h has its own on host builds
 static bool xstrcmp(const char *s1, const char *s2)
 {
     while(*s1 != '\0' && *s1 == *s2) {s1++; s2++;}
     return((*s1 - *s2) == 0);
 }
+#endif
 
 
 #endif
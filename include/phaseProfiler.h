@@ -0,0 +1,204 @@
+/*
+ * phaseProfiler.h - times the phases of a battery sensor's wake, from power on to sleep (or power off), and sends them to the gateway
+ * - the sketch (and espnowController.h) calls PROFILE_MARK(phase) at the end of each phase, the time since the previous mark is added to that
+ *   phase, so a phase marked more than once (eg. PHASE_INIT around the channel set) adds up. The first mark counts from boot
+ * - espnowSender::send() appends the record (PHASE_RECORD_LEN bytes) to the espnow_message it sends. The gateway tells it apart by the frame length
+ *   and keeps per device, per phase histograms (phaseTable.h in the gateway)
+ * - PHASE_SEND, PHASE_ACK and PHASE_SLEEP are only known after the frame has gone out, so the record carries the ones of the previous wake,
+ *   kept in RTC memory by PROFILE_END(). A sensor which cuts its own power (door sensor) has none and sends them as not measured
+ * With PHASE_PROFILER not IN_USE the macros are empty and nothing is appended to the frame, there is no code, RAM or airtime cost
+ * The record layout and encode/decode have no Arduino dependencies, same as espnowAck.h :
+ *   offset 0  : u8  PHASE_RECORD_MAGIC
+ *   offset 1  : u8  PHASE_COUNT
+ *   offset 2  : u16 per phase, little endian, in units of PHASE_UNIT_US, PHASE_NOT_MEASURED if not measured, saturates below it
+ */
+
+#ifndef PHASE_PROFILER_H
+#define PHASE_PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "macros.h"
+
+#ifndef PHASE_PROFILER
+  #define PHASE_PROFILER NOT_IN_USE // the calling code's Config.h turns it on
+#endif
+
+typedef enum {
+  PHASE_HOLD,     // boot till the power is held (door sensor's hold pin) or setup() is under way
+  PHASE_EEPROM,   // EEPROM reads and writes (channel, sequence no checkpoint)
+  PHASE_BOUNCE,   // waiting for the contact to settle, reading the sensor (or the touch pad)
+  PHASE_INIT,     // WiFi and ESP-NOW init
+  PHASE_CHANNEL,  // setting (or scanning/hunting) the channel
+  PHASE_PEER,     // adding the gateway as a peer, registering the callbacks
+  PHASE_APP,      // building the message
+  PHASE_SEND,     // from the send till the MAC layer ack, retries included
+  PHASE_ACK,      // from the MAC layer ack till the gateway's ack (APP_ACK)
+  PHASE_SLEEP,    // from the delivery till power off or deep sleep
+  PHASE_COUNT
+} phase_t;
+
+#define PHASE_RECORD_MAGIC 0x50
+#define PHASE_RECORD_LEN (2 + 2 * PHASE_COUNT)
+#define PHASE_UNIT_US 100 // resolution of a phase on the air, 0.1 ms up to 6.5 sec
+#define PHASE_NOT_MEASURED 0xFFFF
+
+static const char* const phase_names[PHASE_COUNT] = {"hold", "eeprom", "bounce", "init", "channel", "peer", "app", "send", "ack", "sleep"};
+
+typedef struct phase_record
+{
+  uint16_t units[PHASE_COUNT]; // duration of each phase in PHASE_UNIT_US, PHASE_NOT_MEASURED if not measured
+}phase_record;
+
+/*
+ * micro secs to PHASE_UNIT_US, saturating
+ */
+inline uint16_t phaseUnits(uint32_t us)
+{
+  uint32_t units = us / PHASE_UNIT_US;
+  return units < PHASE_NOT_MEASURED ? (uint16_t)units : PHASE_NOT_MEASURED - 1;
+}
+
+/*
+ * writes the record into buffer, which must hold PHASE_RECORD_LEN bytes
+ */
+inline void encodePhases(const phase_record &record, uint8_t *buffer)
+{
+  buffer[0] = PHASE_RECORD_MAGIC;
+  buffer[1] = PHASE_COUNT;
+  for(uint8_t i = 0; i < PHASE_COUNT; i++)
+  {
+    buffer[2 + 2 * i] = (uint8_t)record.units[i];
+    buffer[3 + 2 * i] = (uint8_t)(record.units[i] >> 8);
+  }
+}
+
+/*
+ * decodes a record of len bytes, returns false if it is not one. A record with fewer phases (older sensor) leaves the rest not measured
+ */
+inline bool decodePhases(const uint8_t *buffer, size_t len, phase_record *record)
+{
+  if(len < 2 || buffer[0] != PHASE_RECORD_MAGIC || len < (size_t)(2 + 2 * buffer[1]))
+    return false;
+  for(uint8_t i = 0; i < PHASE_COUNT; i++)
+    record->units[i] = i < buffer[1] ? (uint16_t)(buffer[2 + 2 * i] | (buffer[3 + 2 * i] << 8)) : PHASE_NOT_MEASURED;
+  return true;
+}
+
+#if USING(PHASE_PROFILER)
+#include <Arduino.h>
+#include "controllerState.h" // rtcCrc()
+
+#define PHASE_TAIL_MAGIC 0x50500001 // "PP" + version
+#define PHASE_TAIL_RTC_BLOCK 80 // first 4 byte block of RTC user memory used on the ESP8266, after the deferred message of controllerState.h
+
+// phases from PHASE_SEND on, kept for the next wake
+typedef struct phase_tail
+{
+  uint32_t magic;
+  uint16_t units[PHASE_COUNT - PHASE_SEND];
+  uint32_t crc; // crc32 of everything above, must be the last member
+}phase_tail;
+
+#if defined(ESP32)
+RTC_NOINIT_ATTR phase_tail rtc_phase_tail;
+#endif
+
+class phaseProfiler
+{
+  public:
+  /*
+  * clears this wake's phases and loads the tail of the previous wake
+  */
+  void start()
+  {
+    for(uint8_t i = 0; i < PHASE_COUNT; i++)
+      _us[i] = 0;
+    _measured = 0;
+    _last = 0; // the first phase counts from boot
+    #if defined(ESP8266)
+    bool read = ESP.rtcUserMemoryRead(PHASE_TAIL_RTC_BLOCK, (uint32_t*)&_tail, sizeof(_tail));
+    #elif defined(ESP32)
+    _tail = rtc_phase_tail;
+    bool read = true;
+    #endif
+    if(!read || _tail.magic != PHASE_TAIL_MAGIC || _tail.crc != rtcCrc(&_tail, offsetof(phase_tail, crc)))
+    {
+      for(uint8_t i = 0; i < PHASE_COUNT - PHASE_SEND; i++)
+        _tail.units[i] = PHASE_NOT_MEASURED;
+    }
+    _tail.magic = 0; // sent once
+  }
+
+  /*
+  * adds the time since the last mark to phase
+  */
+  void mark(uint8_t phase) { markAt(phase, micros()); }
+
+  /*
+  * same as mark() for an instant already taken, eg. in a callback
+  */
+  void markAt(uint8_t phase, uint32_t at)
+  {
+    if((int32_t)(at - _last) < 0)
+      at = _last;
+    _us[phase] += at - _last;
+    _last = at;
+    _measured |= 1 << phase;
+  }
+
+  /*
+  * marks PHASE_SLEEP and keeps the phases from PHASE_SEND on in RTC memory for the next wake's record, call just before sleeping
+  */
+  void end()
+  {
+    mark(PHASE_SLEEP);
+    phase_tail tail;
+    tail.magic = PHASE_TAIL_MAGIC;
+    for(uint8_t i = PHASE_SEND; i < PHASE_COUNT; i++)
+      tail.units[i - PHASE_SEND] = (_measured & (1 << i)) ? phaseUnits(_us[i]) : PHASE_NOT_MEASURED;
+    tail.crc = rtcCrc(&tail, offsetof(phase_tail, crc));
+    #if defined(ESP8266)
+    ESP.rtcUserMemoryWrite(PHASE_TAIL_RTC_BLOCK, (uint32_t*)&tail, sizeof(tail));
+    #elif defined(ESP32)
+    rtc_phase_tail = tail;
+    #endif
+  }
+
+  /*
+  * the record sent with the uplink : this wake's phases before PHASE_SEND and the previous wake's from PHASE_SEND on
+  */
+  void record(uint8_t *buffer) const
+  {
+    phase_record record;
+    for(uint8_t i = 0; i < PHASE_SEND; i++)
+      record.units[i] = (_measured & (1 << i)) ? phaseUnits(_us[i]) : PHASE_NOT_MEASURED;
+    for(uint8_t i = PHASE_SEND; i < PHASE_COUNT; i++)
+      record.units[i] = _tail.units[i - PHASE_SEND];
+    encodePhases(record, buffer);
+  }
+
+  private:
+  uint32_t _us[PHASE_COUNT];
+  uint16_t _measured = 0; // bit per phase marked in this wake
+  uint32_t _last = 0; // micros() of the last mark
+  phase_tail _tail;
+};
+
+static_assert(PHASE_TAIL_RTC_BLOCK >= DEFERRED_RTC_BLOCK + sizeof(deferred_message) / 4, "phase tail runs into the deferred message");
+static_assert(PHASE_TAIL_RTC_BLOCK + sizeof(phase_tail) / 4 <= 128, "ESP8266 RTC user memory is 128 blocks");
+
+phaseProfiler profiler;
+
+#define PROFILE_START() profiler.start()
+#define PROFILE_MARK(phase) profiler.mark(phase)
+#define PROFILE_MARK_AT(phase, at) profiler.markAt(phase, at)
+#define PROFILE_END() profiler.end()
+#else
+#define PROFILE_START()
+#define PROFILE_MARK(phase)
+#define PROFILE_MARK_AT(phase, at)
+#define PROFILE_END()
+#endif
+
+#endif
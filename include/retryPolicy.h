@@ -0,0 +1,141 @@
+/*
+ * retryPolicy.h - decides what a controller (sensor) does after an attempt to send a message fails, used by espnowSender::send()
+ * The outcome of the attempt picks the behaviour :
+ * - SEND_NO_ACK : the gateway did not ack, it may be busy, out of range or on another channel. Retried after a backoff, after hunt_after of
+ *   these in a row the channel is refreshed (once per wake, see channelRefreshed in espnowController.h)
+ * - SEND_ERROR : esp_now_send() failed locally (eg. out of buffers), retried after a backoff without touching the channel
+ * - SEND_NO_PEER : the gateway is not a peer, retrying cant help so it gives up straight away
+ * The backoff doubles for every retry from backoff_ms up to max_backoff_ms, randomised by +-jitter_pct so sensors woken by the same event
+ * (eg. a power cut) dont retry in step. A wake spends at most budget_ms on sending, a retry that would go over it is not made
+ * On giving up, a policy with carry_forward keeps the message in RTC memory to send first on the next wake (see controllerState.h)
+ * The policy of a device is selected in its Config.h, eg. #define RETRY_POLICY RETRY_POLICY_BATTERY
+ * No Arduino dependencies, the time spent and the seed are passed in, so a host program can run the policies against a simulated link
+ */
+
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <stdint.h>
+
+typedef enum {
+  SEND_DELIVERED = 0,
+  SEND_NO_ACK    = 1, // same value as a failed status in the send callback
+  SEND_ERROR     = 2,
+  SEND_NO_PEER   = 3
+} send_outcome_t;
+
+typedef enum {
+  RETRY_SEND,          // send again after delay_ms
+  RETRY_HUNT,          // refresh the channel, then send again after delay_ms
+  RETRY_GIVE_UP,       // the message is lost
+  RETRY_CARRY_FORWARD  // keep the message for the next wake
+} retry_verb_t;
+
+typedef struct retry_action
+{
+  retry_verb_t verb;
+  uint16_t delay_ms;
+}retry_action;
+
+typedef struct retry_policy
+{
+  const char *name;
+  uint8_t max_attempts; // sends of a message in one wake, the first one included
+  uint16_t backoff_ms; // wait before the first retry, doubled for every further retry
+  uint16_t max_backoff_ms;
+  uint8_t jitter_pct; // backoff randomised by +- this percent
+  uint8_t hunt_after; // no acks in a row after which the channel is refreshed, 0 never
+  uint16_t budget_ms; // time a wake may spend on sending, waits, backoffs and channel hunts included, 0 no limit
+  bool carry_forward; // a message not delivered is kept for the next wake, needs RTC memory that survives the sleep
+}retry_policy;
+
+// the loop sendESPnowMessage() had : one immediate retry after refreshing the channel
+#define RETRY_POLICY_LEGACY  {"legacy", 2, 0, 0, 0, 1, 0, false}
+// a battery sensor that sleeps between wakes : few tries, a tight budget, what isnt delivered goes with the next wake
+#define RETRY_POLICY_BATTERY {"battery", 3, 20, 80, 25, 1, 300, true}
+// a noisy RF environment : more tries spread out by backoff, the channel is refreshed only after repeated no acks
+#define RETRY_POLICY_NOISY   {"noisy", 6, 10, 160, 50, 3, 1500, false}
+
+#ifndef RETRY_POLICY
+  #define RETRY_POLICY RETRY_POLICY_LEGACY
+#endif
+
+class retryEngine
+{
+  public:
+  /*
+   * one engine per message, seed varies the jitter between sensors and messages
+   */
+  retryEngine(const retry_policy &policy, uint32_t seed) : _policy(policy), _rng(seed | 1) {}
+
+  /*
+   * returns what to do after an attempt which ended in outcome (not SEND_DELIVERED)
+   * spent_ms - time the wake has spent on sending so far
+   * attempt_ms - time another attempt may take (the ack timeout)
+   * hunted - the channel was already refreshed in this wake
+   */
+  retry_action next(send_outcome_t outcome, uint32_t spent_ms, uint32_t attempt_ms, bool hunted)
+  {
+    _attempts++;
+    if(outcome == SEND_NO_PEER || _attempts >= _policy.max_attempts)
+      return giveUp();
+    uint16_t delay_ms = backoff();
+    if(_policy.budget_ms > 0 && spent_ms + delay_ms + attempt_ms > _policy.budget_ms)
+      return giveUp();
+    retry_action action = {RETRY_SEND, delay_ms};
+    if(outcome == SEND_NO_ACK)
+    {
+      _no_acks++;
+      if(_policy.hunt_after > 0 && _no_acks >= _policy.hunt_after && !hunted)
+      {
+        action.verb = RETRY_HUNT;
+        _no_acks = 0;
+      }
+    }
+    else
+      _no_acks = 0;
+    return action;
+  }
+
+  uint8_t attempts() const { return _attempts; }
+
+  private:
+  retry_action giveUp() const
+  {
+    retry_action action = {_policy.carry_forward ? RETRY_CARRY_FORWARD : RETRY_GIVE_UP, 0};
+    return action;
+  }
+
+  // backoff_ms << (retry - 1) capped at max_backoff_ms, then jittered
+  uint16_t backoff()
+  {
+    if(_policy.backoff_ms == 0)
+      return 0;
+    uint8_t shift = _attempts - 1 < 15 ? _attempts - 1 : 15;
+    uint32_t delay_ms = (uint32_t)_policy.backoff_ms << shift;
+    if(delay_ms > _policy.max_backoff_ms)
+      delay_ms = _policy.max_backoff_ms;
+    if(_policy.jitter_pct > 0)
+    {
+      uint32_t spread = delay_ms * _policy.jitter_pct / 100;
+      delay_ms = delay_ms - spread + nextRandom() % (2 * spread + 1);
+    }
+    return (uint16_t)delay_ms;
+  }
+
+  // xorshift32, good enough to spread retries
+  uint32_t nextRandom()
+  {
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+  }
+
+  retry_policy _policy;
+  uint32_t _rng;
+  uint8_t _attempts = 0; // failed attempts so far
+  uint8_t _no_acks = 0; // SEND_NO_ACK in a row since the last channel refresh
+};
+
+#endif